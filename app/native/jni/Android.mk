@@ -102,6 +102,7 @@ LOCAL_CLANG := true
 LOCAL_SDK_VERSION := 14
 LOCAL_NDK_STL_VARIANT := c++_static
 LOCAL_LDFLAGS += -ldl
+LOCAL_LDFLAGS += -lz
 
 include $(BUILD_SHARED_LIBRARY)
 #################### Clean up the tmp vars
@@ -14,8 +14,13 @@
 
 JNI_SRC_FILES := \
     $(SRC_DIR)/beam_search.cc \
+    $(SRC_DIR)/decoder_binding.cc \
+    $(SRC_DIR)/mapped_model.cc \
     $(SRC_DIR)/sentence_piece.cc \
+    $(SRC_DIR)/shortlist.cc \
+    $(SRC_DIR)/tarball.cc \
     $(SRC_DIR)/tensor_utils.cc \
+    $(SRC_DIR)/translation_memory.cc \
     $(SRC_DIR)/vocabulary.cc
 
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/src/sentencepiece/builtin_pb
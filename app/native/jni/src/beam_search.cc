@@ -6,91 +6,603 @@
 #include <utility>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
-#include <unordered_set>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <memory>
 #include <cstdint>
-#include <numeric>
+#include <cstring>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__F16C__)
+#include <immintrin.h>
+#endif
 
 #include "OrtJniUtil.h"
 
+// Rounds to the nearest half precision value, ties to even, the same as the hardware conversions.
+static uint16_t convertFloatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    uint32_t exponent = (bits >> 23) & 0xffu;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (exponent == 0xffu) {
+        return (uint16_t) (sign | 0x7c00u | (mantissa != 0 ? 0x200u : 0u));
+    }
+
+    int32_t halfExponent = (int32_t) exponent - 127 + 15;
+    if (halfExponent >= 0x1f) {
+        return (uint16_t) (sign | 0x7c00u);
+    }
+
+    uint32_t shift = 13;
+    uint32_t half = ((uint32_t) std::max(halfExponent, 0) << 10) | (mantissa >> 13);
+
+    if (halfExponent <= 0) {
+        if (halfExponent < -10) {
+            return (uint16_t) sign;
+        }
+
+        mantissa |= 0x800000u;
+        shift = 14 - halfExponent;
+        half = mantissa >> shift;
+    }
+
+    // Rounding up carries into the exponent when the mantissa overflows, which is correct.
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1u))) {
+        half++;
+    }
+
+    return (uint16_t) (sign | half);
+}
+
+static void convertFloatToHalf(const float *source, uint16_t *destination, size_t count) {
+    size_t i = 0;
+#if defined(__aarch64__)
+    for (; i + 4 <= count; i += 4) {
+        float16x4_t half = vcvt_f16_f32(vld1q_f32(source + i));
+        vst1_u16(destination + i, vreinterpret_u16_f16(half));
+    }
+#elif defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *) (destination + i), half);
+    }
+#endif
+    for (; i < count; ++i) {
+        destination[i] = convertFloatToHalf(source[i]);
+    }
+}
+
+/**
+ * Persistent worker threads that run the tasks of a parallel loop together with the calling
+ * thread, so a decoding step does not pay for creating threads.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t workers) {
+        for (size_t i = 0; i < workers; ++i) {
+            threads.emplace_back([this, i] { work(i + 1); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (std::thread &thread: threads) {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    [[nodiscard]] size_t size() const {
+        return threads.size() + 1;
+    }
+
+    /**
+     * Runs task(i, worker) for every i in [0, count) on at most [concurrency] threads, including
+     * the calling one. The worker index is below [concurrency] and unique among the running tasks.
+     */
+    void run(size_t count, size_t concurrency, const std::function<void(size_t, size_t)> &task) {
+        size_t helpers = count == 0 ? 0 : std::min({concurrency, size(), count}) - 1;
+        if (helpers == 0) {
+            for (size_t i = 0; i < count; ++i) task(i, 0);
+            return;
+        }
+
+        std::lock_guard<std::mutex> running(runMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentTask = &task;
+            taskCount = count;
+            nextTask.store(0);
+            activeHelpers = helpers;
+            pendingHelpers = helpers;
+            generation++;
+        }
+        wake.notify_all();
+
+        drain(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pendingHelpers == 0; });
+        currentTask = nullptr;
+    }
+
+private:
+    void drain(size_t worker) {
+        for (size_t i = nextTask.fetch_add(1); i < taskCount; i = nextTask.fetch_add(1)) {
+            (*currentTask)(i, worker);
+        }
+    }
+
+    void work(size_t worker) {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping) return;
+
+            seen = generation;
+            if (worker > activeHelpers) continue;
+
+            lock.unlock();
+            drain(worker);
+            lock.lock();
+
+            if (--pendingHelpers == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex runMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t, size_t)> *currentTask = nullptr;
+    size_t taskCount = 0;
+    std::atomic<size_t> nextTask{0};
+    size_t activeHelpers = 0;
+    size_t pendingHelpers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+// Searches use at most this many threads, the decoder sessions already keep the big cores busy.
+constexpr size_t kMaxSearchThreads = 4;
+
+// Below this many beams × vocabulary logits, waking the workers costs more than it saves.
+constexpr size_t kParallelSearchSize = 1 << 16;
+
+// Number of logits of a beam every task of a parallel search covers.
+constexpr size_t kSearchChunkSize = 4096;
+
+static WorkerPool &searchPool() {
+    static WorkerPool pool(std::max<size_t>(
+            std::min<size_t>(std::thread::hardware_concurrency(), kMaxSearchThreads), 1) - 1);
+    return pool;
+}
+
+/**
+ * N-grams of the sequences of a search, indexed by the hash of their first n - 1 tokens, so the
+ * tokens that would repeat one of them are found in constant time at every step. Every token of a
+ * sequence gets a node, and the n-gram it ends is recorded once with that node. Sequences share
+ * the n-grams of their common prefix: an n-gram belongs to a sequence when the sequence has its
+ * node at the same position, so extending a sequence never copies the n-grams before it. An n of
+ * zero blocks nothing.
+ */
+class NgramTable {
+public:
+    explicit NgramTable(size_t n) : n(n) {}
+
+    // Preallocates the table for [count] tokens, so recording them never reallocates.
+    void reserve(size_t count) {
+        if (n == 0) return;
+
+        entries.reserve(count);
+        if (buckets.size() < 2 * count) rehash(2 * count);
+    }
+
+    // Records the last token of [sequence], and appends its node to [nodes], the nodes of the
+    // tokens before it.
+    void add(const std::vector<int64_t> &sequence, std::vector<uint32_t> &nodes) {
+        if (n == 0) return;
+
+        uint32_t node = nextNode++;
+        nodes.push_back(node);
+        if (sequence.size() < n) return;
+
+        if (2 * (entries.size() + 1) > buckets.size()) rehash(2 * (entries.size() + 1));
+
+        auto end = sequence.end() - 1;
+        uint64_t key = hash(end - (std::ptrdiff_t) (n - 1), end);
+        int32_t &bucket = buckets[key & (buckets.size() - 1)];
+
+        entries.push_back(Entry{key, sequence.back(), sequence.size() - 1, node, bucket});
+        bucket = (int32_t) (entries.size() - 1);
+    }
+
+    // Masks the logits of the tokens that would repeat an n-gram when appended to [sequence].
+    void mask(const std::vector<int64_t> &sequence, const std::vector<uint32_t> &nodes,
+              float *logits, size_t size) const {
+        if (n == 0 || sequence.size() < n - 1 || buckets.empty()) return;
+
+        uint64_t key = hash(sequence.end() - (std::ptrdiff_t) (n - 1), sequence.end());
+        for (int32_t i = buckets[key & (buckets.size() - 1)]; i >= 0; i = entries[i].next) {
+            const Entry &entry = entries[i];
+            if (entry.key != key || entry.position >= nodes.size() ||
+                nodes[entry.position] != entry.node) {
+                continue;
+            }
+
+            if (entry.token >= 0 && (size_t) entry.token < size) logits[entry.token] = -INFINITY;
+        }
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        int64_t token;
+        // Position of the token in its sequence, and its node there.
+        size_t position;
+        uint32_t node;
+        // Previous entry of the same bucket, or -1.
+        int32_t next;
+    };
+
+    static uint64_t hash(std::vector<int64_t>::const_iterator begin,
+                         std::vector<int64_t>::const_iterator end) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (auto it = begin; it != end; ++it) {
+            hash = (hash ^ (uint64_t) *it) * 0x100000001b3ULL;
+            hash ^= hash >> 29;
+        }
+        return hash;
+    }
+
+    // Relinks the entries into a power of two of at least [count] buckets.
+    void rehash(size_t count) {
+        size_t size = 16;
+        while (size < count) size <<= 1;
+
+        buckets.assign(size, -1);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            int32_t &bucket = buckets[entries[i].key & (size - 1)];
+            entries[i].next = bucket;
+            bucket = (int32_t) i;
+        }
+    }
+
+    size_t n;
+    uint32_t nextNode = 0;
+    std::vector<Entry> entries;
+    std::vector<int32_t> buckets;
+};
+
 struct Beam {
     int id{};
     std::vector<int64_t> sequence;
     float score{};
+    // Nodes of the tokens of the sequence in the n-gram table of the search.
+    std::vector<uint32_t> nodes;
 
-    Beam(int id, std::vector<int64_t> sequence, float score)
-            : id(id), sequence(std::move(sequence)), score(score) {}
+    Beam(int id, std::vector<int64_t> sequence, float score, std::vector<uint32_t> nodes)
+            : id(id), sequence(std::move(sequence)), score(score), nodes(std::move(nodes)) {}
+};
 
-    struct HashFunction {
-        std::size_t operator()(const Beam &beam) const {
-            std::size_t hash = std::accumulate(beam.sequence.begin(), beam.sequence.end(),
-                                               std::size_t(0),
-                                               [](std::size_t acc, int64_t val) {
-                                                   return acc * 31 + std::hash<int64_t>()(val);
-                                               });
-            hash = hash * 31 + std::hash<float>()(beam.score);
-            return hash;
-        }
-    };
+// Token ids a search runs over, either every id below [count] or the first [count] of [ids].
+struct TokenRange {
+    const int32_t *ids;
+    size_t count;
 
-    bool operator==(const Beam &other) const {
-        return sequence == other.sequence && score == other.score;
+    size_t operator[](size_t i) const {
+        return ids == nullptr ? i : (size_t) ids[i];
     }
 };
 
-class BeamSearch {
+/**
+ * Picks the next tokens from the logits of a decoding step. The JNI functions only use this
+ * interface, so every decoding strategy is driven the same way by the decoder.
+ */
+class Search {
 public:
-    BeamSearch(int beamSize, float minP, float repetitionPenalty, int64_t padId, int64_t eosId)
+    virtual ~Search() = default;
+
+    // Consumes the logits of every sequence, laid out as [sequences, size].
+    virtual void search(jfloat *tensorLogits, int size) = 0;
+
+    [[nodiscard]] virtual std::vector<std::vector<int64_t>> getLastTokens() const = 0;
+
+    [[nodiscard]] virtual bool complete() const = 0;
+
+    [[nodiscard]] virtual std::vector<int64_t> best() const = 0;
+
+    // Index of the sequence every current sequence was extended from in the last search.
+    [[nodiscard]] virtual std::vector<int> getTopBeamIds() const = 0;
+
+    /**
+     * Proposes up to [length] tokens to continue the best sequence with, which [verify] accepts
+     * or rejects in one go. Searches that cannot verify drafts exactly propose none.
+     */
+    [[nodiscard]] virtual std::vector<int64_t> draft(const std::vector<int64_t> &source,
+                                                     size_t length) const {
+        return {};
+    }
+
+    /**
+     * Consumes the logits of the last token and every [draft] token, laid out as
+     * [draft + 1, size], as consecutive searches. Stops at the first search that picks another
+     * token than the draft or completes the sequence, and returns the number of rows consumed.
+     */
+    virtual size_t verify(jfloat *tensorLogits, int size, const std::vector<int64_t> &draft) {
+        search(tensorLogits, size);
+        return 1;
+    }
+
+    // Restricts the next searches to the sorted token [ids], all tokens are searched without any.
+    void restrict(std::vector<int32_t> ids) {
+        candidates = std::move(ids);
+    }
+
+    /**
+     * Bounds the sequences to [steps] generated tokens, after which the search is complete, and
+     * preallocates what a step keeps per token for that many, so no step has to reallocate.
+     */
+    virtual void reserve(size_t steps) {
+        budget = steps;
+    }
+
+    [[nodiscard]] size_t maxLength() const {
+        return budget;
+    }
+
+    // Stops the search before its next step, may be called from any thread.
+    void cancel() {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    // Stops the search before the first step that starts after [timeout].
+    void setDeadline(std::chrono::milliseconds timeout) {
+        deadline = std::chrono::steady_clock::now() + timeout;
+        hasDeadline = true;
+    }
+
+    /**
+     * Whether the search takes no more steps, as its sequences are complete or it was cancelled
+     * or ran past its deadline before they were.
+     */
+    bool stop() {
+        if (complete()) return true;
+
+        stopped = stopped || cancelled.load(std::memory_order_relaxed) ||
+                  (hasDeadline && std::chrono::steady_clock::now() >= deadline);
+        return stopped;
+    }
+
+    // Whether the search stopped before its sequences were complete, they are the best so far.
+    [[nodiscard]] bool truncated() const {
+        return stopped;
+    }
+
+protected:
+    // Whether [sequence], which starts with the decoder start token, used up the budget.
+    [[nodiscard]] bool exhausted(const std::vector<int64_t> &sequence) const {
+        return sequence.size() > budget;
+    }
+
+    // Tokens of [size] logits to search, every token when none of the candidates is below [size].
+    [[nodiscard]] TokenRange tokens(size_t size) const {
+        auto end = std::lower_bound(candidates.begin(), candidates.end(), (int32_t) size);
+        if (end == candidates.begin()) return TokenRange{nullptr, size};
+
+        return TokenRange{candidates.data(), (size_t) (end - candidates.begin())};
+    }
+
+private:
+    std::vector<int32_t> candidates;
+    size_t budget = std::numeric_limits<size_t>::max();
+    std::atomic<bool> cancelled{false};
+    std::chrono::steady_clock::time_point deadline;
+    bool hasDeadline = false;
+    bool stopped = false;
+};
+
+// Extension of a beam by a token, the beams of the next step are picked from these.
+struct Candidate {
+    float score;
+    int beam;
+    int64_t token;
+
+    // Orders by score, ties are broken by beam and token so the result does not depend on the
+    // order the candidates were found in.
+    bool operator<(const Candidate &other) const {
+        if (score > other.score) return true;
+        if (score < other.score) return false;
+        if (beam != other.beam) return beam < other.beam;
+        return token < other.token;
+    }
+};
+
+class BeamSearch : public Search {
+public:
+    BeamSearch(int beamSize, float minP, float repetitionPenalty, int64_t padId, int64_t eosId,
+               int threads, size_t noRepeatNgramSize)
             : beamSize(beamSize),
               minP(minP),
               repetitionPenalty(repetitionPenalty),
-              eosId(eosId) {
+              eosId(eosId),
+              threads(std::clamp<size_t>(threads, 1, kMaxSearchThreads)),
+              ngrams(noRepeatNgramSize),
+              heaps(kMaxSearchThreads) {
         beams.reserve(beamSize);
 
+        // Every beam starts at the same node, the n-grams of the prefix are shared from there.
+        std::vector<uint32_t> nodes;
+        ngrams.add({padId}, nodes);
+
         for (int i = 0; i < beamSize; ++i) {
-            beams.emplace_back(i, std::vector<int64_t>{padId}, -1e-9f);
+            beams.emplace_back(i, std::vector<int64_t>{padId}, -1e-9f, nodes);
         }
+        nextBeams = beams;
+
+        states.resize(beamSize);
+        for (auto &heap: heaps) heap.reserve(beamSize + 1);
+        ranked.reserve(kMaxSearchThreads * beamSize);
     }
 
-    void search(jfloat *tensorLogits, int size) {
-        std::vector<Beam> newBeams;
+    void reserve(size_t steps) override {
+        Search::reserve(steps);
 
+        for (auto *generation: {&beams, &nextBeams}) {
+            for (auto &beam: *generation) {
+                beam.sequence.reserve(steps + 1);
+                beam.nodes.reserve(steps + 1);
+            }
+        }
+        ngrams.reserve(beamSize * steps + 1);
+        for (auto &state: states) state.tokens.reserve(steps + 1);
+    }
+
+    /**
+     * Extends every beam by the tokens above the min-p threshold and keeps the best [beamSize] of
+     * them. Large searches are split in chunks of the vocabulary across the search pool, every
+     * worker keeps its own top candidates and these are merged at the end. With a shortlist, the
+     * softmax and selection only cover its tokens.
+     */
+    void search(jfloat *tensorLogits, int size) override {
+        auto vocabSize = (size_t) size;
         for (size_t i = 0; i < beams.size(); ++i) {
-            std::vector<float> beamLogits(tensorLogits + i * size, tensorLogits + (i + 1) * size);
+            ngrams.mask(beams[i].sequence, beams[i].nodes, tensorLogits + i * vocabSize, vocabSize);
+        }
 
-            std::vector<float> probabilities = softmax(beamLogits);
-            std::vector<int> indices = minPIndices(probabilities, minP);
+        prepareBeams();
+        TokenRange range = tokens(vocabSize);
+        size_t chunks = (range.count + kSearchChunkSize - 1) / kSearchChunkSize;
+        size_t concurrency = states.size() * range.count >= kParallelSearchSize ? threads : 1;
+
+        WorkerPool &pool = searchPool();
+        concurrency = std::min(concurrency, pool.size());
+
+        // The softmax of every chunk is relative to its own maximum, and rescaled once the
+        // maximum of the beam is known. Both only grow at the first step.
+        chunkMax.resize(states.size() * chunks);
+        chunkSum.resize(states.size() * chunks);
+        pool.run(states.size() * chunks, concurrency, [&](size_t task, size_t) {
+            const float *logits = tensorLogits + states[task / chunks].beam * vocabSize;
+            size_t begin = (task % chunks) * kSearchChunkSize;
+            size_t end = std::min(begin + kSearchChunkSize, range.count);
+
+            float max = logits[range[begin]];
+            for (size_t i = begin + 1; i < end; ++i) {
+                max = std::max(max, logits[range[i]]);
+            }
 
-#pragma omp parallel for
-            for (int token: indices) {
-                std::vector<int64_t> sequence = beams[i].sequence;
-                sequence.push_back(token);
+            float sum = 0.0f;
+            for (size_t i = begin; i < end; ++i) {
+                sum += std::exp(logits[range[i]] - max);
+            }
 
-                float logit = std::max(probabilities[token], -1e-9f);
-                float score = beams[i].score + std::log(logit);
-                score = penalizeRepetition(sequence, score, repetitionPenalty);
+            chunkMax[task] = max;
+            chunkSum[task] = sum;
+        });
 
-                newBeams.emplace_back(i, sequence, score);
+        for (size_t b = 0; b < states.size(); ++b) {
+            float max = *std::max_element(chunkMax.begin() + b * chunks,
+                                          chunkMax.begin() + (b + 1) * chunks);
+            float sum = 0.0f;
+            for (size_t c = b * chunks; c < (b + 1) * chunks; ++c) {
+                sum += chunkSum[c] * std::exp(chunkMax[c] - max);
             }
+
+            states[b].max = max;
+            states[b].sum = sum;
         }
 
-        // Use unordered_set to remove duplicates
-        std::unordered_set < Beam, Beam::HashFunction >
-                                   uniqueBeams(newBeams.begin(), newBeams.end());
+        for (size_t worker = 0; worker < concurrency; ++worker) heaps[worker].clear();
+
+        pool.run(states.size() * chunks, concurrency, [&](size_t task, size_t worker) {
+            const BeamState &state = states[task / chunks];
+            const float *logits = tensorLogits + state.beam * vocabSize;
+            size_t begin = (task % chunks) * kSearchChunkSize;
+            size_t end = std::min(begin + kSearchChunkSize, range.count);
+
+            std::vector<Candidate> &heap = heaps[worker];
+            for (size_t i = begin; i < end; ++i) {
+                size_t token = range[i];
+                float score;
+                if (!scoreCandidate(state, logits, token, &score)) continue;
+
+                // A beam equal to an earlier one only adds the candidates that score differently.
+                if (state.duplicateOf >= 0) {
+                    const BeamState &original = states[state.duplicateOf];
+                    float originalScore;
+                    if (scoreCandidate(original, tensorLogits + original.beam * vocabSize, token,
+                                       &originalScore) &&
+                        !(originalScore < score) && !(score < originalScore)) {
+                        continue;
+                    }
+                }
 
-        // Sort beams by score
-        std::vector<Beam> sortedBeams(uniqueBeams.begin(), uniqueBeams.end());
-        std::sort(sortedBeams.begin(), sortedBeams.end(), [](const Beam &a, const Beam &b) {
-            return a.score > b.score;
+                pushCandidate(heap, Candidate{score, state.beam, (int64_t) token});
+            }
         });
 
-        // Keep only the top N beams
-        beams.assign(sortedBeams.begin(),
-                     sortedBeams.begin() + std::min(sortedBeams.size(), beamSize));
+        ranked.clear();
+        for (size_t worker = 0; worker < concurrency; ++worker) {
+            ranked.insert(ranked.end(), heaps[worker].begin(), heaps[worker].end());
+        }
+
+        size_t count = std::min(ranked.size(), beamSize);
+        std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end());
+
+        // Only min-p can leave fewer candidates than beams, after which more may return.
+        while (nextBeams.size() < count) {
+            nextBeams.push_back(beams.front());
+        }
+
+        // The next beams are written over the ones of the step before, so their sequences keep
+        // the capacity reserved for the budget.
+        for (size_t i = 0; i < count; ++i) {
+            const Candidate &candidate = ranked[i];
+            Beam &parent = beams[candidate.beam];
+            Beam &beam = nextBeams[i];
+
+            beam.id = candidate.beam;
+            beam.score = candidate.score;
+            beam.sequence.assign(parent.sequence.begin(), parent.sequence.end());
+            beam.sequence.push_back(candidate.token);
+            beam.nodes.assign(parent.nodes.begin(), parent.nodes.end());
+            ngrams.add(beam.sequence, beam.nodes);
+        }
+        nextBeams.erase(nextBeams.begin() + (std::ptrdiff_t) count, nextBeams.end());
+
+        std::swap(beams, nextBeams);
     }
 
-    [[nodiscard]] std::vector<std::vector<int64_t>> getLastTokens() const {
+    [[nodiscard]] std::vector<std::vector<int64_t>> getLastTokens() const override {
         std::vector<std::vector<int64_t>> tokens;
         for (const auto &beam: beams) {
             tokens.push_back({beam.sequence.back()});
@@ -98,11 +610,15 @@ public:
         return tokens;
     }
 
-    [[nodiscard]] bool complete(bool completeOnRepeat) const {
+    [[nodiscard]] bool complete() const override {
         if (beams.empty()) {
             return false;
         }
 
+        if (exhausted(beams.front().sequence)) {
+            return true;
+        }
+
         if (std::find(beams.front().sequence.begin(), beams.front().sequence.end(), eosId) != beams.front().sequence.end()) {
             return true;
         }
@@ -114,32 +630,18 @@ public:
 
             if (std::find(sequence.begin(), sequence.end(), eosId) != sequence.end()) {
                 completedBeams++;
-                continue;
-            }
-
-            if (completeOnRepeat) {
-                std::unordered_set<int64_t> tokens;
-
-                for (auto it = sequence.rbegin(); it != sequence.rend(); ++it) {
-                    if (tokens.find(*it) != tokens.end()) {
-                        completedBeams++;
-                        break;
-                    }
-
-                    tokens.insert(*it);
-                }
             }
         }
 
         return completedBeams >= topN;
     }
 
-    [[nodiscard]] std::vector<int64_t> best() const {
+    [[nodiscard]] std::vector<int64_t> best() const override {
         if (beams.empty()) return {};
         return beams.front().sequence;
     }
 
-    [[nodiscard]] std::vector<int> getTopBeamIds() const {
+    [[nodiscard]] std::vector<int> getTopBeamIds() const override {
         std::vector<int> ids;
         for (size_t i = 0; i < std::min(beams.size(), static_cast<size_t>(beamSize)); ++i) {
             ids.push_back(beams[i].id);
@@ -147,66 +649,390 @@ public:
         return ids;
     }
 
-    static std::vector<float> softmax(const std::vector<float> &logits) {
-        std::vector<float> output(logits.size());
-        float max = *std::max_element(logits.begin(), logits.end());
+private:
+    // What the candidates of a beam are scored with, computed once per search.
+    struct BeamState {
+        int beam;
+        float score;
+        // Number of repeated tokens in the sequence, which the penalty is applied for.
+        float repeats;
+        std::vector<int64_t> tokens;
+        // Index of the earlier equal beam, or -1.
+        int duplicateOf;
+        float max;
+        float sum;
+
+        [[nodiscard]] bool contains(int64_t token) const {
+            return std::binary_search(tokens.begin(), tokens.end(), token);
+        }
+    };
+
+    /**
+     * Updates the state of every beam. Beams that equal an earlier one, like all beams at the
+     * first step, refer to it so their duplicate candidates can be skipped.
+     */
+    void prepareBeams() {
+        states.resize(beams.size());
+
+        for (size_t i = 0; i < beams.size(); ++i) {
+            auto duplicate = std::find_if(beams.begin(), beams.begin() + i, [&](const Beam &beam) {
+                return beam.sequence == beams[i].sequence &&
+                       !(beam.score < beams[i].score) && !(beams[i].score < beam.score);
+            });
+
+            BeamState &state = states[i];
+            state.tokens.assign(beams[i].sequence.begin(), beams[i].sequence.end());
+            std::sort(state.tokens.begin(), state.tokens.end());
+            state.tokens.erase(std::unique(state.tokens.begin(), state.tokens.end()),
+                               state.tokens.end());
+
+            state.beam = (int) i;
+            state.score = beams[i].score;
+            state.repeats = (float) (beams[i].sequence.size() - state.tokens.size());
+            state.duplicateOf = duplicate != beams.begin() + i ? (int) (duplicate - beams.begin()) : -1;
+            state.max = 0;
+            state.sum = 0;
+        }
+    }
+
+    /**
+     * Scores extending the beam of [state] by [token], returns false when the token is not above
+     * the min-p threshold.
+     */
+    bool scoreCandidate(const BeamState &state, const float *logits, size_t token,
+                        float *score) const {
+        float probability = std::exp(logits[token] - state.max) / state.sum;
+        if (probability <= minP) return false;
+
+        float repeats = state.repeats + (state.contains((int64_t) token) ? 1.0f : 0.0f);
+        *score = state.score + std::log(probability) - repetitionPenalty * repeats;
+        return true;
+    }
+
+    void pushCandidate(std::vector<Candidate> &heap, const Candidate &candidate) const {
+        if (heap.size() < beamSize) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end());
+            return;
+        }
+
+        // The front of the heap is the worst of the best candidates found so far.
+        if (!(candidate < heap.front())) return;
+
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = candidate;
+        std::push_heap(heap.begin(), heap.end());
+    }
+
+    std::vector<Beam> beams;
+    size_t beamSize;
+    float minP;
+    float repetitionPenalty;
+    uint64_t eosId;
+    size_t threads;
+
+    // N-grams of every beam of the search, shared by the beams that extend the same prefix.
+    NgramTable ngrams;
+
+    // Buffers of a search, kept across steps so they are only allocated once.
+    std::vector<Beam> nextBeams;
+    std::vector<BeamState> states;
+    std::vector<float> chunkMax;
+    std::vector<float> chunkSum;
+    std::vector<std::vector<Candidate>> heaps;
+    std::vector<Candidate> ranked;
+};
+
+// Longest suffix of a sequence that is looked up in the source to draft its continuation.
+constexpr size_t kMaxDraftNgram = 3;
+
+/**
+ * Drafts the continuation of [sequence] from [source] by prompt lookup: the longest suffix of at
+ * most kMaxDraftNgram tokens that occurs in the source is assumed to continue like it does there.
+ * Copied numbers, names and untranslated spans are drafted in full this way.
+ */
+static std::vector<int64_t> lookupDraft(const std::vector<int64_t> &sequence,
+                                        const std::vector<int64_t> &source, size_t length) {
+    // The first token is the decoder start token, which never occurs in the source.
+    size_t generated = sequence.empty() ? 0 : sequence.size() - 1;
+
+    for (size_t n = std::min(kMaxDraftNgram, generated); n > 0 && length > 0; --n) {
+        auto suffix = sequence.end() - (std::ptrdiff_t) n;
+        auto match = std::search(source.begin(), source.end(), suffix, sequence.end());
+
+        // Takes the first occurrence that is followed by anything.
+        while (match != source.end() && match + (std::ptrdiff_t) n == source.end()) {
+            match = std::search(match + 1, source.end(), suffix, sequence.end());
+        }
+        if (match == source.end()) continue;
+
+        auto begin = match + (std::ptrdiff_t) n;
+        auto end = begin + (std::ptrdiff_t) std::min<size_t>(length, source.end() - begin);
+        return {begin, end};
+    }
+
+    return {};
+}
+
+// Returns a uniformly distributed value in [0, 1) that is the same on every platform for a seed,
+// unlike the standard distributions.
+static double uniform(std::mt19937_64 &random) {
+    return (double) (random() >> 11) * 0x1.0p-53;
+}
+
+// Picks the index of [weights] with a probability proportional to its weight.
+static size_t sampleIndex(const std::vector<float> &weights, std::mt19937_64 &random) {
+    double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+    double target = uniform(random) * total;
+
+    for (size_t i = 0; i < weights.size(); ++i) {
+        target -= weights[i];
+        if (target < 0) return i;
+    }
 
-        std::vector<float> exps(logits.size());
-        for (size_t i = 0; i < logits.size(); i++) {
-            exps[i] = std::exp(logits[i] - max);
+    return weights.size() - 1;
+}
+
+/**
+ * Picks the most likely token, a single pass over the logits.
+ */
+struct GreedyPolicy {
+    int64_t pick(const float *logits, TokenRange tokens, const uint8_t *seen, float penalty) {
+        size_t best = tokens[0];
+        float bestValue = logits[best] - penalty * seen[best];
+
+        for (size_t i = 1; i < tokens.count; ++i) {
+            size_t token = tokens[i];
+            float value = logits[token] - penalty * seen[token];
+            if (value > bestValue) {
+                best = token;
+                bestValue = value;
+            }
+        }
+
+        return (int64_t) best;
+    }
+};
+
+/**
+ * Samples from the [k] most likely tokens.
+ */
+struct TopKPolicy {
+    size_t k;
+    std::mt19937_64 random;
+    // Reused by every pick.
+    std::vector<std::pair<float, int64_t>> heap;
+    std::vector<float> weights;
+
+    TopKPolicy(size_t k, std::mt19937_64 random) : k(k), random(random), heap(), weights() {}
+
+    int64_t pick(const float *logits, TokenRange tokens, const uint8_t *seen, float penalty) {
+        // Min-heap of the best tokens, ties are broken by token so the pick is reproducible.
+        auto worse = [](const std::pair<float, int64_t> &a, const std::pair<float, int64_t> &b) {
+            return a.first > b.first || (!(a.first < b.first) && a.second < b.second);
+        };
+
+        heap.clear();
+        for (size_t i = 0; i < tokens.count; ++i) {
+            size_t token = tokens[i];
+            std::pair<float, int64_t> entry{logits[token] - penalty * seen[token], (int64_t) token};
+            if (heap.size() == k && !worse(entry, heap.front())) continue;
+
+            heap.push_back(entry);
+            std::push_heap(heap.begin(), heap.end(), worse);
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end(), worse);
+                heap.pop_back();
+            }
+        }
+
+        std::sort_heap(heap.begin(), heap.end(), worse);
+
+        weights.resize(heap.size());
+        for (size_t i = 0; i < heap.size(); ++i) {
+            weights[i] = std::exp(heap[i].first - heap.front().first);
+        }
+
+        return heap[sampleIndex(weights, random)].second;
+    }
+};
+
+/**
+ * Samples from the smallest set of most likely tokens whose probability adds up to [p]. Tokens
+ * below [minP] are never part of the set.
+ */
+struct TopPPolicy {
+    float p;
+    float minP;
+    std::mt19937_64 random;
+    // Reused by every pick.
+    std::vector<std::pair<float, int64_t>> likely;
+    std::vector<float> weights;
+
+    TopPPolicy(float p, float minP, std::mt19937_64 random)
+            : p(p), minP(minP), random(random), likely(), weights() {}
+
+    int64_t pick(const float *logits, TokenRange tokens, const uint8_t *seen, float penalty) {
+        float max = logits[tokens[0]] - penalty * seen[tokens[0]];
+        for (size_t i = 1; i < tokens.count; ++i) {
+            max = std::max(max, logits[tokens[i]] - penalty * seen[tokens[i]]);
         }
 
         float sum = 0.0f;
-        for (float exp: exps) {
-            sum += exp;
+        for (size_t i = 0; i < tokens.count; ++i) {
+            sum += std::exp(logits[tokens[i]] - penalty * seen[tokens[i]] - max);
+        }
+
+        likely.clear();
+        for (size_t i = 0; i < tokens.count; ++i) {
+            size_t token = tokens[i];
+            float probability = std::exp(logits[token] - penalty * seen[token] - max) / sum;
+            if (probability > minP) likely.emplace_back(probability, (int64_t) token);
         }
 
-        for (float &exp: exps) {
-            exp /= sum;
+        if (likely.empty()) {
+            return GreedyPolicy().pick(logits, tokens, seen, penalty);
         }
 
-        return exps;
+        std::sort(likely.begin(), likely.end(), [](const auto &a, const auto &b) {
+            return a.first > b.first || (!(a.first < b.first) && a.second < b.second);
+        });
+
+        weights.clear();
+        float cumulative = 0.0f;
+        for (const auto &token: likely) {
+            weights.push_back(token.first);
+            cumulative += token.first;
+            if (cumulative >= p) break;
+        }
+
+        return likely[sampleIndex(weights, random)].second;
     }
+};
 
-    static std::vector<int> minPIndices(const std::vector<float> &values, float threshold) {
-        std::vector<int> indices;
-        indices.reserve(values.size());
+/**
+ * Decodes a single sequence, extending it by the token [Policy] picks at every step. The policy
+ * is called directly, so every strategy gets its own specialized loop over the logits.
+ */
+template<typename Policy>
+class SequenceSearch : public Search {
+public:
+    SequenceSearch(Policy policy, float repetitionPenalty, int64_t padId, int64_t eosId,
+                   size_t noRepeatNgramSize)
+            : policy(std::move(policy)),
+              repetitionPenalty(repetitionPenalty),
+              eosId(eosId),
+              sequence{padId},
+              ngrams(noRepeatNgramSize) {
+        ngrams.add(sequence, nodes);
+    }
 
-        for (size_t i = 0; i < values.size(); i++) {
-            if (values[i] > threshold) {
-                indices.push_back(static_cast<int>(i));
+    void reserve(size_t steps) override {
+        Search::reserve(steps);
+        sequence.reserve(steps + 1);
+        nodes.reserve(steps + 1);
+        ngrams.reserve(steps + 1);
+    }
+
+    void search(jfloat *tensorLogits, int size) override {
+        // Tokens already in the sequence, which get the repetition penalty.
+        if (seen.size() != (size_t) size) {
+            seen.assign(size, 0);
+            for (int64_t token: sequence) {
+                if (token >= 0 && token < size) seen[token] = 1;
             }
         }
 
-        return indices;
+        ngrams.mask(sequence, nodes, tensorLogits, size);
+        int64_t token = policy.pick(tensorLogits, tokens(size), seen.data(), repetitionPenalty);
+
+        sequence.push_back(token);
+        seen[token] = 1;
+        ngrams.add(sequence, nodes);
     }
 
-    static float
-    penalizeRepetition(const std::vector<int64_t> &sequence, float score, float penalty) {
-        std::unordered_map<int64_t, int> wordFreq;
-        for (int64_t token: sequence) {
-            wordFreq[token]++;
+    // Only greedy picks can be verified in one go, a sampled pick depends on the random state.
+    [[nodiscard]] std::vector<int64_t> draft(const std::vector<int64_t> &source,
+                                             size_t length) const override {
+        if constexpr (std::is_same_v<Policy, GreedyPolicy>) {
+            return lookupDraft(sequence, source, length);
         }
+        return {};
+    }
+
+    size_t verify(jfloat *tensorLogits, int size, const std::vector<int64_t> &draft) override {
+        for (size_t row = 0; row < draft.size(); ++row) {
+            search(tensorLogits + row * size, size);
 
-        for (const auto &pair: wordFreq) {
-            if (pair.second > 1) {
-                score -= penalty * static_cast<float>(pair.second - 1);
+            if (sequence.back() != draft[row] || complete()) {
+                return row + 1;
             }
         }
 
-        return score;
+        search(tensorLogits + draft.size() * size, size);
+        return draft.size() + 1;
+    }
+
+    [[nodiscard]] std::vector<std::vector<int64_t>> getLastTokens() const override {
+        return {{sequence.back()}};
+    }
+
+    [[nodiscard]] bool complete() const override {
+        return exhausted(sequence) ||
+               std::find(sequence.begin(), sequence.end(), eosId) != sequence.end();
+    }
+
+    [[nodiscard]] std::vector<int64_t> best() const override {
+        return sequence;
+    }
+
+    [[nodiscard]] std::vector<int> getTopBeamIds() const override {
+        return {0};
     }
 
 private:
-    std::vector<Beam> beams;
-    size_t beamSize;
-    float minP;
+    Policy policy;
     float repetitionPenalty;
-    uint64_t eosId;
+    int64_t eosId;
+    std::vector<int64_t> sequence;
+    std::vector<uint8_t> seen;
+    std::vector<uint32_t> nodes;
+    NgramTable ngrams;
+};
+
+// Values of the strategy passed to construct, matching DecodingStrategy in Kotlin.
+enum SearchStrategy {
+    kGreedySearch = 0,
+    kTopKSearch = 1,
+    kTopPSearch = 2,
+    kBeamSearch = 3,
 };
 
-std::unordered_map<jlong, std::unique_ptr<BeamSearch>> beamSearchInstances;
+// Tokens any translation may take, so the budget of a short source still fits a sentence.
+constexpr size_t kMinDecodingBudget = 16;
+
+/**
+ * Number of tokens the translation of [sourceLength] tokens may take: [ratio] tokens per source
+ * token, but never more than [cap]. Without a source length or ratio, only the cap applies.
+ */
+static size_t decodingBudget(jint sourceLength, jfloat ratio, jint cap) {
+    auto limit = (size_t) std::max(cap, 1);
+    if (sourceLength <= 0 || !(ratio > 0.0f)) return limit;
+
+    auto budget = (size_t) std::ceil((double) sourceLength * ratio);
+    return std::min(std::max(budget, kMinDecodingBudget), limit);
+}
+
+std::unordered_map<jlong, std::unique_ptr<Search>> beamSearchInstances;
 jlong instanceCounter = 0;
+// Guards the instances, as concurrent translations and cancel run on different threads.
+std::mutex beamSearchInstancesMutex;
+
+static Search *findSearch(jlong handle) {
+    std::lock_guard<std::mutex> lock(beamSearchInstancesMutex);
+    auto instance = beamSearchInstances.find(handle);
+    return instance != beamSearchInstances.end() ? instance->second.get() : nullptr;
+}
 
 #ifdef __cplusplus
 extern "C" {
@@ -215,15 +1041,56 @@ JNIEXPORT jlong JNICALL
 Java_app_versta_translate_bridge_inference_BeamSearch_construct(
         JNIEnv *env,
         jobject,
+        jint strategy,
         jint beamSize,
         jfloat minP,
         jfloat repetitionPenalty,
         jlong padId,
-        jlong eosId
+        jlong eosId,
+        jint threads,
+        jint topK,
+        jfloat topP,
+        jlong seed,
+        jint noRepeatNgramSize,
+        jint sourceLength,
+        jfloat maxLengthRatio,
+        jint maxSequenceLength,
+        jlong timeoutMillis
 ) {
-    auto beamSearch = std::make_unique<BeamSearch>(beamSize, minP, repetitionPenalty, padId, eosId);
+    std::unique_ptr<Search> search;
+    std::mt19937_64 random((uint64_t) seed);
+    auto ngramSize = (size_t) std::max(noRepeatNgramSize, 0);
+
+    switch (strategy) {
+        case kGreedySearch:
+            search = std::make_unique<SequenceSearch<GreedyPolicy>>(
+                    GreedyPolicy(), repetitionPenalty, padId, eosId, ngramSize);
+            break;
+        case kTopKSearch:
+            search = std::make_unique<SequenceSearch<TopKPolicy>>(
+                    TopKPolicy((size_t) std::max(topK, 1), random), repetitionPenalty, padId,
+                    eosId, ngramSize);
+            break;
+        case kTopPSearch:
+            search = std::make_unique<SequenceSearch<TopPPolicy>>(
+                    TopPPolicy(topP, minP, random), repetitionPenalty, padId, eosId, ngramSize);
+            break;
+        case kBeamSearch:
+            search = std::make_unique<BeamSearch>(beamSize, minP, repetitionPenalty, padId, eosId,
+                                                  threads, ngramSize);
+            break;
+        default:
+            return 0;
+    }
+
+    search->reserve(decodingBudget(sourceLength, maxLengthRatio, maxSequenceLength));
+    if (timeoutMillis > 0) {
+        search->setDeadline(std::chrono::milliseconds(timeoutMillis));
+    }
+
+    std::lock_guard<std::mutex> lock(beamSearchInstancesMutex);
     jlong handle = ++instanceCounter;
-    beamSearchInstances[handle] = std::move(beamSearch);
+    beamSearchInstances[handle] = std::move(search);
     return handle;
 }
 
@@ -245,7 +1112,7 @@ JNIEXPORT void JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_sea
         return;
     }
 
-    auto beamSearch = beamSearchInstances[handle].get();
+    auto beamSearch = findSearch(handle);
     if (!beamSearch) {
         return;
     }
@@ -253,12 +1120,81 @@ JNIEXPORT void JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_sea
     beamSearch->search(logits, size);
 }
 
+JNIEXPORT jlongArray JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_draft(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jlongArray sourceIds,
+        jint length
+) {
+    auto beamSearch = findSearch(handle);
+    if (!beamSearch) {
+        return nullptr;
+    }
+
+    std::vector<int64_t> source(env->GetArrayLength(sourceIds));
+    env->GetLongArrayRegion(sourceIds, 0, (jsize) source.size(), (jlong *) source.data());
+
+    std::vector<int64_t> draft = beamSearch->draft(source, (size_t) std::max(length, 0));
+    jlongArray result = env->NewLongArray((jsize) draft.size());
+    env->SetLongArrayRegion(result, 0, (jsize) draft.size(), (const jlong *) draft.data());
+
+    return result;
+}
+
+JNIEXPORT jint JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_verify(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jlong apiHandle,
+        jlong tensorHandle,
+        jlongArray draftIds,
+        jint size
+) {
+    const auto *api = (const OrtApi *) apiHandle;
+    auto *ortValue = (OrtValue *) tensorHandle;
+
+    jfloat *logits = nullptr;
+    OrtErrorCode code = checkOrtStatus(env, api,
+                                       api->GetTensorMutableData(ortValue, (void **) &logits));
+    if (code != ORT_OK) {
+        return 0;
+    }
+
+    auto beamSearch = findSearch(handle);
+    if (!beamSearch) {
+        return 0;
+    }
+
+    std::vector<int64_t> draft(env->GetArrayLength(draftIds));
+    env->GetLongArrayRegion(draftIds, 0, (jsize) draft.size(), (jlong *) draft.data());
+
+    return (jint) beamSearch->verify(logits, size, draft);
+}
+
+JNIEXPORT jintArray JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_topBeamIds(
+        JNIEnv *env,
+        jobject,
+        jlong handle
+) {
+    auto beamSearch = findSearch(handle);
+    if (!beamSearch) {
+        return nullptr;
+    }
+
+    std::vector<int> ids = beamSearch->getTopBeamIds();
+    jintArray result = env->NewIntArray(ids.size());
+    env->SetIntArrayRegion(result, 0, ids.size(), ids.data());
+
+    return result;
+}
+
 JNIEXPORT jobjectArray JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_lastTokens(
         JNIEnv *env,
         jobject,
         jlong handle
 ) {
-    auto beamSearch = beamSearchInstances[handle].get();
+    auto beamSearch = findSearch(handle);
     if (!beamSearch) {
         return nullptr;
     }
@@ -276,17 +1212,51 @@ JNIEXPORT jobjectArray JNICALL Java_app_versta_translate_bridge_inference_BeamSe
     return result;
 }
 
+JNIEXPORT jint JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_maxLength(
+        JNIEnv *env,
+        jobject,
+        jlong handle
+) {
+    auto beamSearch = findSearch(handle);
+    if (!beamSearch) {
+        return 0;
+    }
+    return (jint) beamSearch->maxLength();
+}
+
 JNIEXPORT jboolean JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_complete(
         JNIEnv *env,
         jobject,
-        jlong handle,
-        jboolean completeOnRepeat
+        jlong handle
+) {
+    auto beamSearch = findSearch(handle);
+    if (!beamSearch) {
+        return JNI_FALSE;
+    }
+    return beamSearch->stop() ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_truncated(
+        JNIEnv *env,
+        jobject,
+        jlong handle
 ) {
-    auto beamSearch = beamSearchInstances[handle].get();
+    auto beamSearch = findSearch(handle);
     if (!beamSearch) {
         return JNI_FALSE;
     }
-    return beamSearch->complete(completeOnRepeat) ? JNI_TRUE : JNI_FALSE;
+    return beamSearch->truncated() ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_cancel(
+        JNIEnv *env,
+        jobject,
+        jlong handle
+) {
+    auto beamSearch = findSearch(handle);
+    if (beamSearch) {
+        beamSearch->cancel();
+    }
 }
 
 JNIEXPORT jlongArray JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_best(
@@ -294,7 +1264,7 @@ JNIEXPORT jlongArray JNICALL Java_app_versta_translate_bridge_inference_BeamSear
         jobject,
         jlong handle
 ) {
-    auto beamSearch = beamSearchInstances[handle].get();
+    auto beamSearch = findSearch(handle);
     if (!beamSearch) {
         return nullptr;
     }
@@ -306,28 +1276,51 @@ JNIEXPORT jlongArray JNICALL Java_app_versta_translate_bridge_inference_BeamSear
     return result;
 }
 
+JNIEXPORT void JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_restrict(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jintArray candidates
+) {
+    auto beamSearch = findSearch(handle);
+    if (!beamSearch) {
+        return;
+    }
+
+    std::vector<int32_t> ids(env->GetArrayLength(candidates));
+    env->GetIntArrayRegion(candidates, 0, (jsize) ids.size(), ids.data());
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    ids.erase(ids.begin(), std::lower_bound(ids.begin(), ids.end(), 0));
+
+    beamSearch->restrict(std::move(ids));
+}
+
 JNIEXPORT jboolean JNICALL Java_app_versta_translate_bridge_inference_BeamSearch_close(
         JNIEnv *env,
         jobject,
         jlong handle
 ) {
+    std::lock_guard<std::mutex> lock(beamSearchInstancesMutex);
     if (beamSearchInstances.erase(handle) > 0) {
         return JNI_TRUE;
     }
     return JNI_FALSE;
 }
 
-JNIEXPORT jobject JNICALL
+JNIEXPORT jint JNICALL
 Java_app_versta_translate_bridge_inference_BeamSearch_transposeBuffer(
         JNIEnv *env,
         jobject,
         jlong handle,
         jlong apiHandle,
-        jlong tensorHandle
+        jlong tensorHandle,
+        jobject destination,
+        jboolean half
 ) {
-    auto beamSearch = beamSearchInstances[handle].get();
+    auto beamSearch = findSearch(handle);
     if (!beamSearch) {
-        return nullptr;
+        return -1;
     }
 
     const auto *api = (const OrtApi *) apiHandle;
@@ -336,33 +1329,50 @@ Java_app_versta_translate_bridge_inference_BeamSearch_transposeBuffer(
     OrtErrorCode code = getTensorTypeShape(env, &typeShape, api, ortValue);
 
     if (code != ORT_OK) {
-        return nullptr;
+        return -1;
     }
+
+    // Only fp32 tensors are converted, the rest are already stored as compact as they get.
+    bool convert = half && typeShape.onnxTypeEnum == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+
     size_t typeSize = onnxTypeSize(typeShape.onnxTypeEnum);
     size_t sizeBytes = typeShape.elementCount * typeSize;
+    size_t transposedSizeBytes = convert ? typeShape.elementCount * sizeof(uint16_t) : sizeBytes;
 
     uint8_t *arr = nullptr;
     code = checkOrtStatus(env, api, api->GetTensorMutableData(ortValue, (void **) &arr));
 
     if (code != ORT_OK) {
-        return nullptr;
+        return -1;
     }
 
     std::vector<int> indices = beamSearch->getTopBeamIds();
     auto indicesLength = indices.size();
 
-    auto *transposed = new uint8_t[sizeBytes];
+    // The destination is allocated once for the whole translation, and reused every step.
+    auto *transposed = (uint8_t *) env->GetDirectBufferAddress(destination);
+    if (transposed == nullptr || env->GetDirectBufferCapacity(destination) < (jlong) transposedSizeBytes) {
+        return -1;
+    }
 
     size_t elementSize = sizeBytes / indicesLength;
+    size_t transposedElementSize = transposedSizeBytes / indicesLength;
 
-#pragma omp parallel for
     for (size_t i = 0; i < indicesLength; ++i) {
         auto oldIndex = indices[i];
         auto newIndex = i;
+
+        if (convert) {
+            convertFloatToHalf((const float *) (arr + oldIndex * elementSize),
+                               (uint16_t *) (transposed + newIndex * transposedElementSize),
+                               elementSize / sizeof(float));
+            continue;
+        }
+
         std::memcpy(transposed + newIndex * elementSize, arr + oldIndex * elementSize, elementSize);
     }
 
-    return env->NewDirectByteBuffer(transposed, (jlong) sizeBytes);
+    return (jint) transposedSizeBytes;
 }
 #ifdef __cplusplus
 }
@@ -0,0 +1,636 @@
+//
+// Created by Ricardo Snoek on 16/12/2024.
+//
+
+#include <jni.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OrtJniUtil.h"
+
+// Past and present key/value tensors of one attention layer, shaped
+// [beams, heads, sequence, headDim].
+struct KeyValueCache {
+    std::string pastName;
+    std::string presentName;
+    bool encoder;
+
+    // Two buffers sized for the maximum sequence length. The present output of a step is written
+    // into one while the other holds the past input, and they swap roles every step. Their pages
+    // are only committed once a step writes into them.
+    std::unique_ptr<uint8_t[]> buffers[2];
+    int past = 0;
+};
+
+class DecoderBinding {
+public:
+    DecoderBinding(const OrtApi *api, OrtSession *session, int beams, int maxSequenceLength,
+                   int maxTokens)
+            : api(api), session(session), beams(beams), maxSequenceLength(maxSequenceLength),
+              maxTokens(std::max(maxTokens, 1)) {}
+
+    ~DecoderBinding() {
+        if (binding != nullptr) api->ReleaseIoBinding(binding);
+        if (logits != nullptr) api->ReleaseValue(logits);
+        if (inputIds != nullptr) api->ReleaseValue(inputIds);
+        if (useCacheBranch != nullptr) api->ReleaseValue(useCacheBranch);
+        if (tokensLogits != nullptr) api->ReleaseValue(tokensLogits);
+        if (tokensInputIds != nullptr) api->ReleaseValue(tokensInputIds);
+        if (memoryInfo != nullptr) api->ReleaseMemoryInfo(memoryInfo);
+    }
+
+    // Reads the attention shapes from the session. Leaves supported unset when they are not static,
+    // as the buffers cannot be sized up front then, or when the past and present key/values differ
+    // in type and need a conversion.
+    OrtErrorCode initialize(JNIEnv *env, bool *supported, const OrtValue *encoderHiddenStates,
+                            const OrtValue *encoderAttentionMask) {
+        *supported = false;
+
+        OrtErrorCode code = checkOrtStatus(env, api, api->CreateCpuMemoryInfo(
+                OrtDeviceAllocator, OrtMemTypeDefault, &memoryInfo));
+        if (code != ORT_OK) return code;
+
+        OrtAllocator *allocator = nullptr;
+        code = checkOrtStatus(env, api, api->GetAllocatorWithDefaultOptions(&allocator));
+        if (code != ORT_OK) return code;
+
+        std::vector<int64_t> encoderShape;
+        code = valueShape(env, encoderHiddenStates, &encoderShape);
+        if (code != ORT_OK) return code;
+        if (encoderShape.size() != 3) return ORT_OK;
+        encoderSequenceLength = encoderShape[1];
+
+        size_t inputCount = 0;
+        code = checkOrtStatus(env, api, api->SessionGetInputCount(session, &inputCount));
+        if (code != ORT_OK) return code;
+
+        for (size_t i = 0; i < inputCount; ++i) {
+            std::string name;
+            code = inputName(env, allocator, i, &name);
+            if (code != ORT_OK) return code;
+
+            if (name == "use_cache_branch") {
+                hasUseCacheBranch = true;
+                continue;
+            }
+
+            if (name.rfind("past_key_values.", 0) != 0) {
+                continue;
+            }
+
+            std::vector<int64_t> shape;
+            ONNXTensorElementDataType type;
+            code = typeShape(env, true, i, &shape, &type);
+            if (code != ORT_OK) return code;
+
+            if (shape.size() != 4 || shape[1] <= 0 || shape[3] <= 0) {
+                return ORT_OK;
+            }
+            if (type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT &&
+                type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) {
+                return ORT_OK;
+            }
+            if (heads == 0) {
+                heads = shape[1];
+                headDim = shape[3];
+                cacheType = type;
+            } else if (heads != shape[1] || headDim != shape[3] || cacheType != type) {
+                return ORT_OK;
+            }
+
+            KeyValueCache cache;
+            cache.pastName = name;
+            cache.presentName = "present" + name.substr(std::strlen("past_key_values"));
+            cache.encoder = name.find(".encoder.") != std::string::npos;
+            caches.push_back(std::move(cache));
+        }
+
+        size_t outputCount = 0;
+        code = checkOrtStatus(env, api, api->SessionGetOutputCount(session, &outputCount));
+        if (code != ORT_OK) return code;
+
+        for (size_t i = 0; i < outputCount; ++i) {
+            std::string name;
+            code = outputName(env, allocator, i, &name);
+            if (code != ORT_OK) return code;
+
+            bool present = name.rfind("present.", 0) == 0;
+            if (name != "logits" && !present) {
+                continue;
+            }
+
+            std::vector<int64_t> shape;
+            ONNXTensorElementDataType type;
+            code = typeShape(env, false, i, &shape, &type);
+            if (code != ORT_OK) return code;
+
+            if (present) {
+                presentType = type;
+                continue;
+            }
+
+            if (shape.size() != 3 || shape[2] <= 0 || type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+                return ORT_OK;
+            }
+            vocabularySize = shape[2];
+        }
+
+        if (presentType != cacheType) {
+            return ORT_OK;
+        }
+        cacheElementSize = onnxTypeSize(cacheType);
+
+        if (caches.empty() || vocabularySize == 0) {
+            return ORT_OK;
+        }
+
+        for (auto &cache: caches) {
+            size_t size = byteCount(cache.encoder ? encoderSequenceLength : maxSequenceLength);
+            cache.buffers[0].reset(new uint8_t[size]);
+            if (!cache.encoder) {
+                cache.buffers[1].reset(new uint8_t[size]);
+            }
+        }
+
+        logitsBuffer.resize((size_t) beams * maxTokens * vocabularySize);
+        inputIdsBuffer.resize((size_t) beams * maxTokens);
+
+        code = createTokenTensors(env, 1, &inputIds, &logits);
+        if (code != ORT_OK) return code;
+
+        int64_t useCacheBranchShape[] = {1};
+        code = createTensor(env, &useCacheBranchValue, sizeof(useCacheBranchValue),
+                            useCacheBranchShape, 1, ONNX_TENSOR_ELEMENT_DATA_TYPE_BOOL,
+                            &useCacheBranch);
+        if (code != ORT_OK) return code;
+
+        code = checkOrtStatus(env, api, api->CreateIoBinding(session, &binding));
+        if (code != ORT_OK) return code;
+
+        code = bindInput(env, "encoder_hidden_states", encoderHiddenStates);
+        if (code != ORT_OK) return code;
+        code = bindInput(env, "encoder_attention_mask", encoderAttentionMask);
+        if (code != ORT_OK) return code;
+        code = bindInput(env, "input_ids", inputIds);
+        if (code != ORT_OK) return code;
+        if (hasUseCacheBranch) {
+            code = bindInput(env, "use_cache_branch", useCacheBranch);
+            if (code != ORT_OK) return code;
+        }
+        code = checkOrtStatus(env, api, api->BindOutput(binding, "logits", logits));
+        if (code != ORT_OK) return code;
+
+        *supported = true;
+        return ORT_OK;
+    }
+
+    // Runs one decoder step for [count] consecutive tokens of every beam, laid out as
+    // [rows, count] in [tokens]. The first step runs without past key/values, every later step
+    // reads them from the buffers the previous step wrote into.
+    OrtErrorCode run(JNIEnv *env, const std::vector<int64_t> &tokens, int count) {
+        if (count < 1 || count > maxTokens) {
+            throwOrtException(env, convertErrorCode(ORT_INVALID_ARGUMENT),
+                              "Decoder step exceeds the maximum number of tokens");
+            return ORT_INVALID_ARGUMENT;
+        }
+        if (length + count > maxSequenceLength) {
+            throwOrtException(env, convertErrorCode(ORT_INVALID_ARGUMENT),
+                              "Decoder step exceeds the maximum sequence length");
+            return ORT_INVALID_ARGUMENT;
+        }
+
+        size_t rows = tokens.size() / count;
+        for (int i = 0; i < beams; ++i) {
+            size_t row = std::min<size_t>(i, rows - 1);
+            std::copy_n(tokens.begin() + row * count, count, inputIdsBuffer.begin() + i * count);
+        }
+        useCacheBranchValue = step > 0;
+
+        OrtErrorCode code = bindTokens(env, count);
+        if (code != ORT_OK) return code;
+
+        for (auto &cache: caches) {
+            code = bindCache(env, cache, count);
+            if (code != ORT_OK) return code;
+        }
+
+        code = checkOrtStatus(env, api, api->RunWithBinding(session, nullptr, binding));
+        if (code != ORT_OK) return code;
+
+        step++;
+        length += count;
+        lastCount = count;
+        return ORT_OK;
+    }
+
+    // Keeps the self attention key/values of the first [count] tokens of the last step, dropping
+    // those of the rejected draft tokens after them. The kept positions of every beam and head are
+    // moved together, so the buffer is laid out for the shorter length.
+    void accept(int count) {
+        count = std::clamp(count, 1, lastCount);
+        if (count == lastCount) return;
+
+        int kept = length - lastCount + count;
+        size_t rowSize = (size_t) headDim * cacheElementSize;
+
+        for (auto &cache: caches) {
+            if (cache.encoder) {
+                continue;
+            }
+
+            uint8_t *data = cache.buffers[step == 1 ? cache.past : 1 - cache.past].get();
+            for (int64_t row = 0; row < beams * heads; ++row) {
+                std::memmove(data + row * kept * rowSize, data + row * length * rowSize,
+                             kept * rowSize);
+            }
+        }
+
+        length = kept;
+        lastCount = count;
+    }
+
+    // Moves the self attention key/values of the selected beams into place for the next step. When
+    // the beams keep their order the buffers only swap roles, otherwise the selected beams are
+    // gathered into the buffer that held the past of this step.
+    void reorder(const std::vector<int> &beamIds) {
+        bool identity = true;
+        for (int i = 0; i < beams; ++i) {
+            if (beamId(beamIds, i) != i) {
+                identity = false;
+                break;
+            }
+        }
+
+        size_t beamSize = byteCount(length) / beams;
+
+        for (auto &cache: caches) {
+            if (cache.encoder) {
+                continue;
+            }
+
+            int present = step == 1 ? cache.past : 1 - cache.past;
+            if (identity) {
+                cache.past = present;
+                continue;
+            }
+
+            int target = 1 - present;
+            const uint8_t *source = cache.buffers[present].get();
+            uint8_t *destination = cache.buffers[target].get();
+
+            for (int i = 0; i < beams; ++i) {
+                std::memcpy(destination + i * beamSize, source + beamId(beamIds, i) * beamSize,
+                            beamSize);
+            }
+
+            cache.past = target;
+        }
+    }
+
+    [[nodiscard]] OrtValue *getLogits() const {
+        return boundTokens == 1 ? logits : tokensLogits;
+    }
+
+    [[nodiscard]] int64_t getVocabularySize() const {
+        return vocabularySize;
+    }
+
+private:
+    [[nodiscard]] size_t byteCount(int64_t sequenceLength) const {
+        return (size_t) beams * heads * sequenceLength * headDim * cacheElementSize;
+    }
+
+    [[nodiscard]] int beamId(const std::vector<int> &beamIds, int i) const {
+        if (beamIds.empty()) return i;
+        return beamIds[std::min<size_t>(i, beamIds.size() - 1)];
+    }
+
+    // Creates the input ids and logits tensors for steps of [count] tokens per beam, as views of
+    // the buffers sized for the maximum number of tokens.
+    OrtErrorCode createTokenTensors(JNIEnv *env, int count, OrtValue **ids, OrtValue **output) {
+        int64_t logitsShape[] = {beams, count, vocabularySize};
+        OrtErrorCode code = createTensor(env, logitsBuffer.data(),
+                                         (size_t) beams * count * vocabularySize * sizeof(float),
+                                         logitsShape, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT,
+                                         output);
+        if (code != ORT_OK) return code;
+
+        int64_t inputIdsShape[] = {beams, count};
+        return createTensor(env, inputIdsBuffer.data(), (size_t) beams * count * sizeof(int64_t),
+                            inputIdsShape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, ids);
+    }
+
+    // Binds the input ids and logits for steps of [count] tokens, single token steps keep using
+    // the tensors bound at initialization.
+    OrtErrorCode bindTokens(JNIEnv *env, int count) {
+        if (count == boundTokens) return ORT_OK;
+
+        if (tokensLogits != nullptr) api->ReleaseValue(tokensLogits);
+        if (tokensInputIds != nullptr) api->ReleaseValue(tokensInputIds);
+        tokensLogits = nullptr;
+        tokensInputIds = nullptr;
+
+        if (count != 1) {
+            OrtErrorCode code = createTokenTensors(env, count, &tokensInputIds, &tokensLogits);
+            if (code != ORT_OK) return code;
+        }
+
+        OrtErrorCode code = bindInput(env, "input_ids", count == 1 ? inputIds : tokensInputIds);
+        if (code != ORT_OK) return code;
+        code = checkOrtStatus(env, api, api->BindOutput(
+                binding, "logits", count == 1 ? logits : tokensLogits));
+        if (code != ORT_OK) return code;
+
+        boundTokens = count;
+        return ORT_OK;
+    }
+
+    OrtErrorCode bindCache(JNIEnv *env, KeyValueCache &cache, int count) {
+        if (cache.encoder) {
+            // The encoder key/values are computed once by the first step, later steps output
+            // empty placeholders for them that are left to the runtime.
+            int64_t shape[] = {beams, heads, encoderSequenceLength, headDim};
+            size_t size = byteCount(encoderSequenceLength);
+
+            if (step == 0) {
+                return bindBuffer(env, cache.presentName, cache.buffers[0].get(), size, shape,
+                                  false);
+            }
+            if (step == 1) {
+                OrtErrorCode code = bindBuffer(env, cache.pastName, cache.buffers[0].get(), size,
+                                               shape, true);
+                if (code != ORT_OK) return code;
+            }
+            return checkOrtStatus(env, api, api->BindOutputToDevice(
+                    binding, cache.presentName.c_str(), memoryInfo));
+        }
+
+        // Past holds the tokens of the previous steps, present [count] more.
+        if (step > 0) {
+            int64_t pastShape[] = {beams, heads, length, headDim};
+            OrtErrorCode code = bindBuffer(env, cache.pastName, cache.buffers[cache.past].get(),
+                                           byteCount(length), pastShape, true);
+            if (code != ORT_OK) return code;
+        }
+
+        int present = step == 0 ? cache.past : 1 - cache.past;
+        int64_t presentShape[] = {beams, heads, length + count, headDim};
+        return bindBuffer(env, cache.presentName, cache.buffers[present].get(),
+                          byteCount(length + count), presentShape, false);
+    }
+
+    // Binds a view of a buffer. The binding keeps its own reference to the tensor, which only
+    // wraps the buffer and does not own it.
+    OrtErrorCode bindBuffer(JNIEnv *env, const std::string &name, uint8_t *data, size_t size,
+                            const int64_t *shape, bool input) {
+        OrtValue *value = nullptr;
+        OrtErrorCode code = createTensor(env, data, size, shape, 4, cacheType, &value);
+        if (code != ORT_OK) return code;
+
+        if (input) {
+            code = bindInput(env, name.c_str(), value);
+        } else {
+            code = checkOrtStatus(env, api, api->BindOutput(binding, name.c_str(), value));
+        }
+
+        api->ReleaseValue(value);
+        return code;
+    }
+
+    OrtErrorCode bindInput(JNIEnv *env, const char *name, const OrtValue *value) {
+        return checkOrtStatus(env, api, api->BindInput(binding, name, value));
+    }
+
+    OrtErrorCode createTensor(JNIEnv *env, void *data, size_t size, const int64_t *shape,
+                              size_t dimensions, ONNXTensorElementDataType type,
+                              OrtValue **value) {
+        return checkOrtStatus(env, api, api->CreateTensorWithDataAsOrtValue(
+                memoryInfo, data, size, shape, dimensions, type, value));
+    }
+
+    OrtErrorCode valueShape(JNIEnv *env, const OrtValue *value, std::vector<int64_t> *shape) {
+        OrtTensorTypeAndShapeInfo *info = nullptr;
+        OrtErrorCode code = checkOrtStatus(env, api, api->GetTensorTypeAndShape(value, &info));
+        if (code != ORT_OK) return code;
+
+        code = dimensions(env, info, shape);
+        api->ReleaseTensorTypeAndShapeInfo(info);
+        return code;
+    }
+
+    OrtErrorCode typeShape(JNIEnv *env, bool input, size_t index, std::vector<int64_t> *shape,
+                           ONNXTensorElementDataType *type) {
+        OrtTypeInfo *typeInfo = nullptr;
+        OrtErrorCode code = checkOrtStatus(env, api, input
+                ? api->SessionGetInputTypeInfo(session, index, &typeInfo)
+                : api->SessionGetOutputTypeInfo(session, index, &typeInfo));
+        if (code != ORT_OK) return code;
+
+        const OrtTensorTypeAndShapeInfo *info = nullptr;
+        code = checkOrtStatus(env, api, api->CastTypeInfoToTensorInfo(typeInfo, &info));
+        if (code == ORT_OK && info != nullptr) {
+            code = checkOrtStatus(env, api, api->GetTensorElementType(info, type));
+        }
+        if (code == ORT_OK && info != nullptr) {
+            code = dimensions(env, info, shape);
+        }
+
+        api->ReleaseTypeInfo(typeInfo);
+        return code;
+    }
+
+    OrtErrorCode dimensions(JNIEnv *env, const OrtTensorTypeAndShapeInfo *info,
+                            std::vector<int64_t> *shape) {
+        size_t count = 0;
+        OrtErrorCode code = checkOrtStatus(env, api, api->GetDimensionsCount(info, &count));
+        if (code != ORT_OK) return code;
+
+        shape->resize(count);
+        return checkOrtStatus(env, api, api->GetDimensions(info, shape->data(), count));
+    }
+
+    OrtErrorCode inputName(JNIEnv *env, OrtAllocator *allocator, size_t index,
+                           std::string *name) {
+        char *value = nullptr;
+        OrtErrorCode code = checkOrtStatus(env, api, api->SessionGetInputName(
+                session, index, allocator, &value));
+        if (code != ORT_OK) return code;
+
+        *name = value;
+        return checkOrtStatus(env, api, api->AllocatorFree(allocator, value));
+    }
+
+    OrtErrorCode outputName(JNIEnv *env, OrtAllocator *allocator, size_t index,
+                            std::string *name) {
+        char *value = nullptr;
+        OrtErrorCode code = checkOrtStatus(env, api, api->SessionGetOutputName(
+                session, index, allocator, &value));
+        if (code != ORT_OK) return code;
+
+        *name = value;
+        return checkOrtStatus(env, api, api->AllocatorFree(allocator, value));
+    }
+
+    const OrtApi *api;
+    OrtSession *session;
+    int beams;
+    int maxSequenceLength;
+    // Most tokens per beam a single step runs for, the last token and a draft after it.
+    int maxTokens;
+    int step = 0;
+    // Number of tokens in the self attention key/values, and added by the last step.
+    int length = 0;
+    int lastCount = 0;
+    int boundTokens = 1;
+
+    int64_t heads = 0;
+    int64_t headDim = 0;
+    int64_t encoderSequenceLength = 0;
+    int64_t vocabularySize = 0;
+    bool hasUseCacheBranch = false;
+
+    // Key/values are kept in the type the model declares for them, fp16 models use half the memory.
+    ONNXTensorElementDataType cacheType = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+    ONNXTensorElementDataType presentType = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+    size_t cacheElementSize = 0;
+
+    std::vector<KeyValueCache> caches;
+    std::vector<float> logitsBuffer;
+    std::vector<int64_t> inputIdsBuffer;
+    bool useCacheBranchValue = false;
+
+    OrtMemoryInfo *memoryInfo = nullptr;
+    OrtIoBinding *binding = nullptr;
+    OrtValue *logits = nullptr;
+    OrtValue *inputIds = nullptr;
+    OrtValue *useCacheBranch = nullptr;
+    OrtValue *tokensInputIds = nullptr;
+    OrtValue *tokensLogits = nullptr;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_construct(
+        JNIEnv *env,
+        jobject,
+        jlong apiHandle,
+        jlong sessionHandle,
+        jlong encoderHiddenStatesHandle,
+        jlong encoderAttentionMaskHandle,
+        jint beams,
+        jint maxSequenceLength,
+        jint maxTokens
+) {
+    const auto *api = (const OrtApi *) apiHandle;
+    auto *session = (OrtSession *) sessionHandle;
+
+    auto binding = std::make_unique<DecoderBinding>(api, session, beams, maxSequenceLength,
+                                                    maxTokens);
+
+    bool supported = false;
+    OrtErrorCode code = binding->initialize(env, &supported,
+                                            (const OrtValue *) encoderHiddenStatesHandle,
+                                            (const OrtValue *) encoderAttentionMaskHandle);
+    if (code != ORT_OK || !supported) {
+        return 0;
+    }
+
+    return (jlong) binding.release();
+}
+
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_run(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jobjectArray inputIds
+) {
+    auto *binding = (DecoderBinding *) handle;
+
+    jsize rows = env->GetArrayLength(inputIds);
+    std::vector<int64_t> tokens(rows);
+    for (jsize i = 0; i < rows; ++i) {
+        auto row = (jlongArray) env->GetObjectArrayElement(inputIds, i);
+        env->GetLongArrayRegion(row, env->GetArrayLength(row) - 1, 1, (jlong *) &tokens[i]);
+        env->DeleteLocalRef(row);
+    }
+
+    if (tokens.empty() || binding->run(env, tokens, 1) != ORT_OK) {
+        return 0;
+    }
+
+    return (jlong) binding->getLogits();
+}
+
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_runTokens(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jlongArray inputIds
+) {
+    auto *binding = (DecoderBinding *) handle;
+
+    std::vector<int64_t> tokens(env->GetArrayLength(inputIds));
+    env->GetLongArrayRegion(inputIds, 0, (jsize) tokens.size(), (jlong *) tokens.data());
+
+    if (tokens.empty() || binding->run(env, tokens, (int) tokens.size()) != ORT_OK) {
+        return 0;
+    }
+
+    return (jlong) binding->getLogits();
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_accept(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jint count
+) {
+    auto *binding = (DecoderBinding *) handle;
+    binding->accept(count);
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_reorder(
+        JNIEnv *env,
+        jobject,
+        jlong handle,
+        jintArray beamIds
+) {
+    auto *binding = (DecoderBinding *) handle;
+
+    std::vector<int> ids(env->GetArrayLength(beamIds));
+    env->GetIntArrayRegion(beamIds, 0, (jsize) ids.size(), (jint *) ids.data());
+
+    binding->reorder(ids);
+}
+
+JNIEXPORT jint JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_vocabularySize(
+        JNIEnv *env,
+        jobject,
+        jlong handle
+) {
+    auto *binding = (DecoderBinding *) handle;
+    return (jint) binding->getVocabularySize();
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_DecoderBinding_close(
+        JNIEnv *env,
+        jobject,
+        jlong handle
+) {
+    delete (DecoderBinding *) handle;
+}
+#ifdef __cplusplus
+}
+#endif
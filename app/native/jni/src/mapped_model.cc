@@ -0,0 +1,148 @@
+//
+// Created by Ricardo Snoek on 16/12/2024.
+//
+
+#include <jni.h>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "onnxruntime_c_api.h"
+
+struct MappedModel {
+    void *data;
+    size_t size;
+};
+
+static void throwIOException(JNIEnv *env, const std::string &message) {
+    env->ThrowNew(env->FindClass("java/io/IOException"), message.c_str());
+}
+
+static uint64_t hashBytes(uint64_t hash, const uint8_t *data, size_t size) {
+    constexpr uint64_t prime = 0x100000001b3ULL;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * prime;
+    }
+
+    return hash;
+}
+
+// Version of the runtime that is loaded by the Java bindings, the optimized graphs it writes are
+// not guaranteed to load in other versions.
+static std::string runtimeVersion() {
+    void *library = dlopen("libonnxruntime.so", RTLD_NOW | RTLD_NOLOAD);
+    if (library != nullptr) {
+        auto getApiBase = (const OrtApiBase *(*)()) dlsym(library, "OrtGetApiBase");
+        dlclose(library);
+
+        if (getApiBase != nullptr) {
+            return getApiBase()->GetVersionString();
+        }
+    }
+
+    return "api" + std::to_string(ORT_API_VERSION);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_inference_MappedModel_open(JNIEnv *env, jobject,
+                                                             jstring filePath) {
+    const char *nativeFilePath = env->GetStringUTFChars(filePath, nullptr);
+    std::string path(nativeFilePath);
+    env->ReleaseStringUTFChars(filePath, nativeFilePath);
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throwIOException(env, "Failed to open " + path + ": " + strerror(errno));
+        return 0;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        throwIOException(env, "Failed to read the size of " + path);
+        return 0;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        throwIOException(env, "Failed to map " + path + ": " + strerror(errno));
+        return 0;
+    }
+
+    // The session parses the model front to back, let the kernel read ahead.
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    auto *model = new MappedModel{data, size};
+    return (jlong) model;
+}
+
+JNIEXPORT jobject JNICALL
+Java_app_versta_translate_bridge_inference_MappedModel_buffer(JNIEnv *env, jobject,
+                                                               jlong handle) {
+    auto *model = (MappedModel *) handle;
+    return env->NewDirectByteBuffer(model->data, (jlong) model->size);
+}
+
+JNIEXPORT jstring JNICALL
+Java_app_versta_translate_bridge_inference_MappedModel_hash(JNIEnv *env, jobject,
+                                                             jlong handle) {
+    auto *model = (MappedModel *) handle;
+    const auto *data = (const uint8_t *) model->data;
+
+    // Every byte is hashed, so any change to the contents changes the hash.
+    uint64_t hash = hashBytes(0xcbf29ce484222325ULL, (const uint8_t *) &model->size,
+                              sizeof(model->size));
+    hash = hashBytes(hash, data, model->size);
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016" PRIx64, hash);
+    return env->NewStringUTF(hex);
+}
+
+JNIEXPORT jstring JNICALL
+Java_app_versta_translate_bridge_inference_MappedModel_runtimeVersion(JNIEnv *env, jobject) {
+    return env->NewStringUTF(runtimeVersion().c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_MappedModel_trim(JNIEnv *env, jobject,
+                                                             jlong handle) {
+    auto *model = (MappedModel *) handle;
+
+    // Once the session holds its own copy of the weights, the mapped pages are only needed
+    // again if the runtime reads the model bytes directly, in which case they are paged back in
+    // from the file.
+    madvise(model->data, model->size, MADV_DONTNEED);
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_MappedModel_close(JNIEnv *env, jobject,
+                                                              jlong handle) {
+    auto *model = (MappedModel *) handle;
+    munmap(model->data, model->size);
+    delete model;
+}
+#ifdef __cplusplus
+}
+#endif
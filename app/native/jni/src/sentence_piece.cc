@@ -3,6 +3,12 @@
 //
 
 #include <jni.h>
+#include <cstdio>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sentencepiece/sentencepiece_processor.h>
 
 using sentencepiece::SentencePieceProcessor;
@@ -50,6 +56,67 @@ Java_app_versta_translate_bridge_tokenize_SentencePiece_loadFromSerializedProto(
     env->ReleasePrimitiveArrayCritical(serialized, str, JNI_ABORT);
 }
 
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_tokenize_SentencePiece_loadFromSerializedProtoWithIndex(
+        JNIEnv *env, jobject, jlong handle, jbyteArray serialized, jstring indexPath) {
+    auto *instance = (SentencePieceProcessor *) handle;
+
+    // The index is mapped rather than read, the processor keeps its own copy.
+    const char *path = env->GetStringUTFChars(indexPath, nullptr);
+    int fd = open(path, O_RDONLY);
+    env->ReleaseStringUTFChars(indexPath, path);
+
+    struct stat st{};
+    void *index = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        index = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (fd >= 0) close(fd);
+
+    string_view precompiledIndex;
+    if (index != MAP_FAILED) {
+        precompiledIndex = string_view(static_cast<const char *>(index), st.st_size);
+    }
+
+    jsize len = env->GetArrayLength(serialized);
+
+    void *str = env->GetPrimitiveArrayCritical(serialized, nullptr);
+    Status status = instance->LoadFromSerializedProto(
+            string_view(static_cast<const char *>(str), len), precompiledIndex);
+    env->ReleasePrimitiveArrayCritical(serialized, str, JNI_ABORT);
+
+    if (index != MAP_FAILED) munmap(index, st.st_size);
+
+    if (!status.ok()) {
+        env->ThrowNew(env->FindClass("java/lang/RuntimeException"), status.ToString().c_str());
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_tokenize_SentencePiece_serializeIndex(JNIEnv *env, jobject,
+                                                                       jlong handle,
+                                                                       jstring indexPath) {
+    auto *instance = (SentencePieceProcessor *) handle;
+
+    std::string index;
+    Status status = instance->SerializeIndex(&index);
+    if (!status.ok()) {
+        env->ThrowNew(env->FindClass("java/lang/RuntimeException"), status.ToString().c_str());
+        return;
+    }
+
+    const char *path = env->GetStringUTFChars(indexPath, nullptr);
+    FILE *file = fopen(path, "wb");
+    bool written = file != nullptr && fwrite(index.data(), 1, index.size(), file) == index.size();
+    if (file != nullptr && fclose(file) != 0) written = false;
+
+    if (!written) {
+        env->ThrowNew(env->FindClass("java/io/IOException"),
+                      (std::string("Failed to write ") + path).c_str());
+    }
+    env->ReleaseStringUTFChars(indexPath, path);
+}
+
 JNIEXPORT jobjectArray JNICALL
 Java_app_versta_translate_bridge_tokenize_SentencePiece_encodeAsPieces(JNIEnv *env, jobject,
                                                                        jlong handle, jstring input) {
@@ -73,6 +140,42 @@ Java_app_versta_translate_bridge_tokenize_SentencePiece_encodeAsPieces(JNIEnv *e
     }
     return array;
 }
+
+JNIEXPORT jint JNICALL
+Java_app_versta_translate_bridge_tokenize_SentencePiece_pieceToId(JNIEnv *env, jobject,
+                                                                  jlong handle, jstring piece) {
+    auto *instance = (SentencePieceProcessor *) handle;
+
+    jsize len = env->GetStringUTFLength(piece);
+
+    const char *str = env->GetStringUTFChars(piece, nullptr);
+    int id = instance->PieceToId(string_view(str, len));
+    env->ReleaseStringUTFChars(piece, str);
+
+    return id;
+}
+
+JNIEXPORT jstring JNICALL
+Java_app_versta_translate_bridge_tokenize_SentencePiece_decode(JNIEnv *env, jobject,
+                                                               jlong handle, jintArray ids) {
+    auto *instance = (SentencePieceProcessor *) handle;
+
+    // Reused across calls, decoding writes straight into it.
+    thread_local std::string detokenized;
+
+    jsize len = env->GetArrayLength(ids);
+
+    void *elements = env->GetPrimitiveArrayCritical(ids, nullptr);
+    Status status = instance->Decode(static_cast<const int *>(elements), len, &detokenized);
+    env->ReleasePrimitiveArrayCritical(ids, elements, JNI_ABORT);
+
+    if (!status.ok()) {
+        env->ThrowNew(env->FindClass("java/lang/RuntimeException"), status.ToString().c_str());
+        return nullptr;
+    }
+
+    return env->NewStringUTF(detokenized.c_str());
+}
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -14,6 +14,8 @@
 
 #include "bpe_model.h"
 
+#include <algorithm>
+#include <climits>
 #include <functional>
 #include <memory>
 #include <queue>
@@ -28,13 +30,234 @@
 namespace sentencepiece {
 namespace bpe {
 
+namespace {
+
+// Space symbol (U+2581)
+const absl::string_view kSpaceSymbol = "\xe2\x96\x81";
+
+// The merge table encoder rescans the word for the best pair after every
+// merge, which is quadratic in the word length. Longer words are handed to
+// the priority queue based SampleEncode.
+constexpr int kMaxMergeTableSymbols = 64;
+
+}  // namespace
+
 Model::Model(const ModelProto &model_proto) {
   model_proto_ = &model_proto;
   InitializePieces();
+  if (status().ok()) InitializeMergeTable();
 }
 
 Model::~Model() {}
 
+void Model::InitializeMergeTable() {
+  merge_table_.clear();
+  merge_table_available_ = false;
+
+  // Output ids are taken from `pieces_` directly, which is only correct if no
+  // normal piece is shadowed by a reserved one in PieceToId().
+  for (const auto &it : pieces_) {
+    if (reserved_id_map_.find(it.first) != reserved_id_map_.end()) return;
+  }
+
+  // Pieces with equal scores get equal ranks, as SampleEncode breaks such
+  // ties by position only.
+  std::vector<float> scores;
+  scores.reserve(pieces_.size());
+  for (const auto &it : pieces_) scores.push_back(GetScoreInlined(it.second));
+  std::sort(scores.begin(), scores.end(), std::greater<float>());
+  scores.erase(std::unique(scores.begin(), scores.end()), scores.end());
+
+  bool ws_only_at_begin = true;
+  bool ws_only_at_end = true;
+
+  for (const auto &it : pieces_) {
+    const absl::string_view piece = it.first;
+
+    for (size_t pos = piece.find(kSpaceSymbol);
+         pos != absl::string_view::npos;
+         pos = piece.find(kSpaceSymbol, pos + 1)) {
+      if (pos != 0) ws_only_at_begin = false;
+      if (pos + kSpaceSymbol.size() != piece.size()) ws_only_at_end = false;
+    }
+
+    const int rank = std::lower_bound(scores.begin(), scores.end(),
+                                      GetScoreInlined(it.second),
+                                      std::greater<float>()) -
+                     scores.begin();
+
+    // Every split into two known pieces is a merge producing this piece.
+    for (size_t split = string_util::OneCharLen(piece.data());
+         split < piece.size();
+         split += string_util::OneCharLen(piece.data() + split)) {
+      const auto left = pieces_.find(piece.substr(0, split));
+      const auto right = pieces_.find(piece.substr(split));
+      if (left == pieces_.end() || right == pieces_.end()) continue;
+      merge_table_[MergeKey(left->second, right->second)] = {rank, it.second};
+    }
+  }
+
+  if (ws_only_at_begin) {
+    word_boundary_ = kBeforeWhitespace;
+  } else if (ws_only_at_end) {
+    word_boundary_ = kAfterWhitespace;
+  } else {
+    word_boundary_ = kNoWordBoundary;
+  }
+
+  merge_table_available_ = true;
+}
+
+EncodeResult Model::Encode(absl::string_view normalized) const {
+  if (!merge_table_available_) {
+    return SampleEncode(normalized, 0.0);
+  }
+
+  if (!status().ok() || normalized.empty()) {
+    return {};
+  }
+
+  EncodeResult output;
+
+  if (word_boundary_ == kNoWordBoundary) {
+    EncodeWord(normalized, &output);
+    return output;
+  }
+
+  // No piece crosses a whitespace boundary, so every word can be merged on
+  // its own.
+  size_t begin = 0;
+  size_t pos = 0;
+  while (pos < normalized.size()) {
+    const size_t mblen = std::min<size_t>(
+        string_util::OneCharLen(normalized.data() + pos),
+        normalized.size() - pos);
+    const bool is_ws = normalized.substr(pos, mblen) == kSpaceSymbol;
+    if (is_ws && word_boundary_ == kBeforeWhitespace && pos > begin) {
+      EncodeWord(normalized.substr(begin, pos - begin), &output);
+      begin = pos;
+    }
+    pos += mblen;
+    if (is_ws && word_boundary_ == kAfterWhitespace) {
+      EncodeWord(normalized.substr(begin, pos - begin), &output);
+      begin = pos;
+    }
+  }
+  if (begin < normalized.size()) {
+    EncodeWord(normalized.substr(begin), &output);
+  }
+
+  return output;
+}
+
+void Model::EncodeWord(absl::string_view word, EncodeResult *output) const {
+  constexpr int kNoMerge = INT_MAX;
+
+  struct Symbol {
+    int prev;     // prev index of this symbol. -1 for BOS.
+    int next;     // next index of this symbol. -1 for EOS.
+    int begin;    // byte offset in `word`.
+    int node;     // index in `nodes`.
+    int rank;     // rank of the merge with `next`. kNoMerge if none.
+    int merged;   // piece id of the merge with `next`.
+    bool freeze;  // this symbol is never be merged.
+  };
+
+  // Merge history, used to resegment unused pieces.
+  struct Node {
+    int id;
+    int size;
+    int left;   // -1 for characters.
+    int right;  // -1 for characters.
+  };
+
+  Symbol symbols[kMaxMergeTableSymbols];
+  Node nodes[2 * kMaxMergeTableSymbols];
+  int num_symbols = 0;
+  int num_nodes = 0;
+
+  // Words with unknown characters may still merge into known pieces, which
+  // the table does not cover.
+  auto fallback = [&]() {
+    const EncodeResult result = SampleEncode(word, 0.0);
+    output->insert(output->end(), result.begin(), result.end());
+  };
+
+  // Splits the input into character sequence
+  for (absl::string_view rest = word; !rest.empty();) {
+    if (num_symbols == kMaxMergeTableSymbols) return fallback();
+    Symbol &s = symbols[num_symbols];
+    const int mblen = matcher_->PrefixMatch(rest, &s.freeze);
+    const auto it = pieces_.find(rest.substr(0, mblen));
+    if (it == pieces_.end()) return fallback();
+    s.prev = num_symbols - 1;
+    s.next = static_cast<size_t>(mblen) == rest.size() ? -1 : num_symbols + 1;
+    s.begin = rest.data() - word.data();
+    s.node = num_nodes;
+    nodes[num_nodes++] = {it->second, mblen, -1, -1};
+    rest.remove_prefix(mblen);
+    ++num_symbols;
+  }
+
+  // Lookup the merge of [index, next] in the table.
+  auto UpdateRank = [&](int index) {
+    if (index == -1) return;
+    Symbol &s = symbols[index];
+    s.rank = kNoMerge;
+    if (s.next == -1 || s.freeze || symbols[s.next].freeze) return;
+    const auto it = merge_table_.find(
+        MergeKey(nodes[s.node].id, nodes[symbols[s.next].node].id));
+    if (it == merge_table_.end()) return;
+    s.rank = it->second.rank;
+    s.merged = it->second.id;
+  };
+
+  for (int i = 0; i < num_symbols; ++i) UpdateRank(i);
+
+  // Main loop. Symbol 0 is always the head, as merges keep the left symbol.
+  while (true) {
+    int best = -1;
+    int best_rank = kNoMerge;
+    for (int i = 0; i != -1; i = symbols[i].next) {
+      if (symbols[i].rank < best_rank) {
+        best = i;
+        best_rank = symbols[i].rank;
+      }
+    }
+    if (best == -1) break;
+
+    Symbol &left = symbols[best];
+    const Symbol &right = symbols[left.next];
+    nodes[num_nodes] = {left.merged,
+                        nodes[left.node].size + nodes[right.node].size,
+                        left.node, right.node};
+    left.node = num_nodes++;
+    left.next = right.next;
+    if (left.next != -1) symbols[left.next].prev = best;
+
+    UpdateRank(left.prev);
+    UpdateRank(best);
+  }
+
+  // Unused pieces are replaced by the two pieces they were merged from.
+  int stack[2 * kMaxMergeTableSymbols];
+  for (int i = 0; i != -1; i = symbols[i].next) {
+    int begin = symbols[i].begin;
+    int top = 0;
+    stack[top++] = symbols[i].node;
+    while (top > 0) {
+      const Node &node = nodes[stack[--top]];
+      if (node.left != -1 && IsUnusedInlined(node.id)) {
+        stack[top++] = node.right;
+        stack[top++] = node.left;
+        continue;
+      }
+      output->emplace_back(word.substr(begin, node.size), node.id);
+      begin += node.size;
+    }
+  }
+}
+
 std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     absl::string_view normalized, float alpha) const {
   if (!status().ok() || normalized.empty()) {
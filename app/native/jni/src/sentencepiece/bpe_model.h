@@ -15,8 +15,12 @@
 #ifndef BPE_MODEL_H_
 #define BPE_MODEL_H_
 
+#include <cstdint>
+#include <vector>
+
 #include "model_interface.h"
 #include "sentencepiece_model.pb.h"
+#include "third_party/absl/container/flat_hash_map.h"
 
 namespace sentencepiece {
 namespace bpe {
@@ -32,9 +36,9 @@ class Model : public ModelInterface {
   explicit Model(const ModelProto &model_proto);
   ~Model() override;
 
-  EncodeResult Encode(absl::string_view normalized) const override {
-    return SampleEncode(normalized, 0.0);
-  }
+  // Deterministic segmentation. Uses the precomputed merge table when the
+  // model allows it, and falls back to SampleEncode(normalized, 0.0).
+  EncodeResult Encode(absl::string_view normalized) const override;
 
   // Sampling with BPE-dropout: https://arxiv.org/pdf/1910.13267.pdf
   // `alpha` is dropout probability in BPE-dropout paper.
@@ -46,6 +50,36 @@ class Model : public ModelInterface {
   bool IsSampleEncodeAvailable() const override { return true; }
 
   bool IsNBestEncodeAvailable() const override { return false; }
+
+ private:
+  // Result of merging two adjacent pieces. Smaller rank is merged first.
+  struct MergeRule {
+    int rank;
+    int id;
+  };
+
+  // Where words can be split without any piece crossing the boundary.
+  enum WordBoundary {
+    kNoWordBoundary,    // the whole input is one word.
+    kBeforeWhitespace,  // "▁" only appears at the start of pieces.
+    kAfterWhitespace,   // "▁" only appears at the end of pieces.
+  };
+
+  static uint64_t MergeKey(int left, int right) {
+    return (static_cast<uint64_t>(left) << 32) | static_cast<uint32_t>(right);
+  }
+
+  // Builds `merge_table_` from the vocabulary.
+  void InitializeMergeTable();
+
+  // Segments one word with the merge table and appends the pieces to
+  // `output`. Words are independent of each other.
+  void EncodeWord(absl::string_view word, EncodeResult *output) const;
+
+  // (left id, right id) -> merged piece. Ids are the ids in `pieces_`.
+  absl::flat_hash_map<uint64_t, MergeRule> merge_table_;
+  bool merge_table_available_ = false;
+  WordBoundary word_boundary_ = kNoWordBoundary;
 };
 }  // namespace bpe
 }  // namespace sentencepiece
@@ -13,7 +13,10 @@
 // limitations under the License.!
 
 #include <cstdio>
+#include <random>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "bpe_model.h"
 #include "model_interface.h"
@@ -249,6 +252,57 @@ TEST(BPEModelTest, EncodeWithUnusedTest) {
   }
 }
 
+TEST(BPEModelTest, MergeTableMatchesSampleEncodeTest) {
+  const std::vector<std::string> kChars = {"a", "b", "c", "\xe2\x96\x81"};
+  std::mt19937 gen(0);
+
+  auto random_string = [&](int length, bool ws_only_at_begin) {
+    std::string s;
+    for (int i = 0; i < length; ++i) {
+      const int c = gen() % (ws_only_at_begin && i > 0 ? 3 : 4);
+      s += kChars[c];
+    }
+    return s;
+  };
+
+  // Pieces with ws only at the beginning allow the per-word encoder, the
+  // others make the whole input one word.
+  for (const bool ws_only_at_begin : {true, false}) {
+    for (int trial = 0; trial < 20; ++trial) {
+      ModelProto model_proto = MakeBaseModelProto();
+      std::set<std::string> pieces;
+      // Leaves out "c" in some models, which makes it an unknown character.
+      for (const auto &c : kChars) {
+        if (c != "c" || trial % 3 != 0) pieces.insert(c);
+      }
+      while (pieces.size() < 40) {
+        pieces.insert(random_string(2 + gen() % 4, ws_only_at_begin));
+      }
+      for (const auto &piece : pieces) {
+        // Coarse scores to exercise ties.
+        AddPiece(&model_proto, piece, -static_cast<float>(gen() % 8));
+        if (piece.size() > 1 && gen() % 10 == 0) {
+          model_proto.mutable_pieces(model_proto.pieces_size() - 1)
+              ->set_type(ModelProto::SentencePiece::UNUSED);
+        }
+      }
+
+      const Model model(model_proto);
+      for (int n = 0; n < 50; ++n) {
+        // Long inputs are handed to SampleEncode when they are one word.
+        const std::string input = random_string(1 + gen() % 100, false);
+        const auto expected = model.SampleEncode(input, 0.0);
+        const auto actual = model.Encode(input);
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+          EXPECT_EQ(expected[i].first, actual[i].first);
+          EXPECT_EQ(expected[i].second, actual[i].second);
+        }
+      }
+    }
+  }
+}
+
 TEST(SampleModelTest, EncodeTest) {
   ModelProto model_proto = MakeBaseModelProto();
 
@@ -47,4 +47,13 @@ std::unique_ptr<ModelInterface> ModelFactory::Create(
 
   return absl::make_unique<unigram::Model>(model_proto);
 }
+
+std::unique_ptr<ModelInterface> ModelFactory::Create(
+    const ModelProto& model_proto, absl::string_view precompiled_index) {
+  if (model_proto.trainer_spec().model_type() == TrainerSpec::UNIGRAM) {
+    return absl::make_unique<unigram::Model>(model_proto, precompiled_index);
+  }
+
+  return Create(model_proto);
+}
 }  // namespace sentencepiece
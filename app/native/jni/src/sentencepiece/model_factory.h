@@ -26,6 +26,12 @@ class ModelFactory {
  public:
   // Creates Model instance from |model_proto|.
   static std::unique_ptr<ModelInterface> Create(const ModelProto &model_proto);
+
+  // Creates Model instance from |model_proto|, loading its index from
+  // |precompiled_index| when the model type supports one.
+  // |precompiled_index| must outlive the model.
+  static std::unique_ptr<ModelInterface> Create(
+      const ModelProto &model_proto, absl::string_view precompiled_index);
 };
 }  // namespace sentencepiece
 #endif  // MODEL_FACTORY_H_
@@ -196,6 +196,13 @@ class ModelInterface {
     return expected == actual;
   }
 
+  // Serializes the index built for looking up pieces, so that a model created
+  // from the same model_proto can load it instead of building it again.
+  virtual util::Status SerializeIndex(std::string *output) const {
+    return util::UnimplementedError(
+        "The model does not support a precompiled index.");
+  }
+
  protected:
   void InitializePieces();
 
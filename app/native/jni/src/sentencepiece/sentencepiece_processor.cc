@@ -234,10 +234,32 @@ util::Status SentencePieceProcessor::LoadFromSerializedProto(
   return Load(std::move(model_proto));
 }
 
+util::Status SentencePieceProcessor::LoadFromSerializedProto(
+    absl::string_view serialized, absl::string_view precompiled_index) {
+  auto model_proto = absl::make_unique<ModelProto>();
+  CHECK_OR_RETURN(
+      model_proto->ParseFromArray(serialized.data(), serialized.size()));
+  return Load(std::move(model_proto), std::string(precompiled_index));
+}
+
+util::Status SentencePieceProcessor::SerializeIndex(std::string *output) const {
+  RETURN_IF_ERROR(status());
+  return model_->SerializeIndex(output);
+}
+
 util::Status SentencePieceProcessor::Load(
     std::unique_ptr<ModelProto> model_proto) {
+  return Load(std::move(model_proto), std::string());
+}
+
+util::Status SentencePieceProcessor::Load(
+    std::unique_ptr<ModelProto> model_proto, std::string precompiled_index) {
   model_proto_ = std::move(model_proto);
-  model_ = ModelFactory::Create(*model_proto_);
+  model_.reset();
+  precompiled_index_ = std::move(precompiled_index);
+  model_ = precompiled_index_.empty()
+               ? ModelFactory::Create(*model_proto_)
+               : ModelFactory::Create(*model_proto_, precompiled_index_);
   normalizer_ = absl::make_unique<normalizer::Normalizer>(
       model_proto_->normalizer_spec(), model_proto_->trainer_spec());
   if (model_proto_->has_denormalizer_spec() &&
@@ -416,11 +438,129 @@ util::Status SentencePieceProcessor::Decode(
 
 util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
                                             std::string *detokenized) const {
+  return Decode(ids.data(), ids.size(), detokenized);
+}
+
+namespace {
+// Parses a byte piece "<0xXX>" without the allocation of PieceToByte().
+int ParseBytePiece(absl::string_view piece) {
+  auto hex = [](char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  if (piece.size() != 6 || piece.substr(0, 3) != "<0x" || piece[5] != '>') {
+    return -1;
+  }
+  const int high = hex(piece[3]);
+  const int low = hex(piece[4]);
+  if (high < 0 || low < 0) return -1;
+  return high * 16 + low;
+}
+}  // namespace
+
+util::Status SentencePieceProcessor::Decode(const int *ids, size_t num_ids,
+                                            std::string *detokenized) const {
   CHECK_OR_RETURN_STATUS_STL(detokenized);
 
-  SentencePieceText spt;
-  RETURN_IF_ERROR(Decode(ids, &spt));
-  *detokenized = std::move(spt.text());
+  const int num_pieces = GetPieceSize();
+  for (size_t i = 0; i < num_ids; ++i) {
+    if (ids[i] < 0 || ids[i] >= num_pieces) {
+      return util::Status(util::StatusCode::kOutOfRange,
+                          absl::StrCat("Invalid id: ", ids[i]));
+    }
+  }
+
+  // Extra options rewrite the piece sequence, which needs the proto path.
+  if (!decode_extra_options_.empty()) {
+    SentencePieceText spt;
+    RETURN_IF_ERROR(Decode(std::vector<int>(ids, ids + num_ids), &spt));
+    *detokenized = std::move(spt.text());
+    return util::OkStatus();
+  }
+
+  const char *unk_surface = kDefaultUnknownSymbol;
+  if (model_proto_ && model_proto_->trainer_spec().has_unk_surface())
+    unk_surface = model_proto_->trainer_spec().unk_surface().c_str();
+
+  const bool consume_bos_ws =
+      !model_proto_ || model_proto_->normalizer_spec().add_dummy_prefix() ||
+      model_proto_->normalizer_spec().remove_extra_whitespaces();
+  const bool remove_extra_whitespaces =
+      model_proto_ &&
+      model_proto_->normalizer_spec().remove_extra_whitespaces();
+
+  std::string *text = detokenized;
+
+  // Appends the Unicode characters of the byte pieces in [begin, end). Each
+  // character is at most 4 bytes, so a small window replaces the byte string
+  // that Decode(pieces, spt) builds.
+  auto AppendBytePieces = [&](size_t begin, size_t end) -> util::Status {
+    size_t offset = begin;
+    while (offset < end) {
+      char window[4];
+      const size_t window_size = std::min<size_t>(4, end - offset);
+      for (size_t j = 0; j < window_size; ++j) {
+        const int byte = ParseBytePiece(IdToPiece(ids[offset + j]));
+        CHECK_LE_OR_RETURN(0, byte);
+        window[j] = static_cast<char>(byte);
+      }
+
+      size_t consumed;
+      const absl::string_view utf8(window, window_size);
+      if (!string_util::IsValidDecodeUTF8(utf8, &consumed)) {
+        CHECK_EQ_OR_RETURN(consumed, 1);
+        text->append(kReplacementCharacter);
+      } else {
+        text->append(utf8.data(), consumed);
+      }
+      offset += consumed;
+    }
+    return util::OkStatus();
+  };
+
+  size_t byte_start = 0;
+  bool is_bos_ws = true;  // whether we expect a bos ws token to consume.
+  bool bos_ws_seen = false;
+
+  for (size_t i = 0; i < num_ids; ++i) {
+    const int id = ids[i];
+    if (IsByte(id)) continue;
+
+    RETURN_IF_ERROR(AppendBytePieces(byte_start, i));
+    byte_start = i + 1;
+
+    // if we have seen a bos_ws token or any non-empty token
+    if (bos_ws_seen || !text->empty()) is_bos_ws = false;
+    bos_ws_seen = false;
+
+    if (IsControl(id)) continue;  // invisible symbol.
+    if (IsUnknown(id)) {
+      text->append(unk_surface);
+      continue;
+    }
+
+    absl::string_view piece = IdToPiece(id);
+    if (is_bos_ws && consume_bos_ws) {
+      bos_ws_seen = absl::ConsumePrefix(&piece, kSpaceSymbol);
+      // if we are removing extra whitespace, we remove all leading whitespace
+      if (remove_extra_whitespaces) bos_ws_seen = false;
+    }
+
+    // Replaces kSpaceSymbol with " " while appending.
+    for (size_t pos = piece.find(kSpaceSymbol); pos != absl::string_view::npos;
+         pos = piece.find(kSpaceSymbol)) {
+      text->append(piece.data(), pos);
+      text->append(1, ' ');
+      piece.remove_prefix(pos + sizeof(kSpaceSymbol) - 1);
+    }
+    text->append(piece.data(), piece.size());
+  }
+  RETURN_IF_ERROR(AppendBytePieces(byte_start, num_ids));
+
+  if (denormalizer_) {
+    *text = denormalizer_->Normalize(*text);
+  }
 
   return util::OkStatus();
 }
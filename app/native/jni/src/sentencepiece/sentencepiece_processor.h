@@ -259,6 +259,17 @@ class SentencePieceProcessor {
   // Useful to load the model from a platform independent blob object.
   virtual util::Status LoadFromSerializedProto(absl::string_view serialized);
 
+  // Loads model from `serialized` like above, loading the index used for
+  // looking up pieces from `precompiled_index` instead of building it.
+  // Returns an error if the index does not match the model.
+  // `precompiled_index` is copied.
+  virtual util::Status LoadFromSerializedProto(
+      absl::string_view serialized, absl::string_view precompiled_index);
+
+  // Serializes the index of the loaded model, to be passed to
+  // LoadFromSerializedProto() along with the same model.
+  virtual util::Status SerializeIndex(std::string *output) const;
+
   // Returns the status. Encode/Decode methods are valid when status is OK.
   virtual util::Status status() const;
 
@@ -310,6 +321,11 @@ class SentencePieceProcessor {
   virtual util::Status Decode(const std::vector<int> &ids,
                               std::string *detokenized) const;
 
+  // Given `num_ids` ids, decodes them into `detokenized` without building a
+  // SentencePieceText. `detokenized` is overwritten, its capacity is reused.
+  virtual util::Status Decode(const int *ids, size_t num_ids,
+                              std::string *detokenized) const;
+
   //////////////////////////////////////////////////////////////
   // NBest API.
   //
@@ -692,6 +708,9 @@ class SentencePieceProcessor {
       const std::vector<std::pair<absl::string_view, int>> &result,
       SentencePieceText *spt) const;
 
+  util::Status Load(std::unique_ptr<ModelProto> model_proto,
+                    std::string precompiled_index);
+
   std::unique_ptr<ModelInterface> model_;
   std::unique_ptr<normalizer::Normalizer> normalizer_;
   std::unique_ptr<normalizer::Normalizer> denormalizer_;
@@ -699,6 +718,9 @@ class SentencePieceProcessor {
   // Underlying model protocol buffer. The same lifetime as model_.
   std::unique_ptr<ModelProto> model_proto_;
 
+  // Index the model was loaded with, if any. The same lifetime as model_.
+  std::string precompiled_index_;
+
   std::vector<ExtraOption> encode_extra_options_;
   std::vector<ExtraOption> decode_extra_options_;
 };
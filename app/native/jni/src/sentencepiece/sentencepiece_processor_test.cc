@@ -1425,6 +1425,72 @@ TEST(SentencePieceProcessorTest, ExtraOptionsUndefinedTest) {
   EXPECT_FALSE(sp.SetDecodeExtraOptions("eos").ok());
 }
 
+TEST(SentencePieceProcessorTest, DecodeToStringTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, "A");         // 3
+  AddPiece(&model_proto, "B");         // 4
+  AddPiece(&model_proto, WS);          // 5
+  AddPiece(&model_proto, WS "A");      // 6
+  AddPiece(&model_proto, "A" WS "B");  // 7
+  AddPiece(&model_proto, WS WS);       // 8
+  for (int i = 0; i < 256; ++i) {      // 9..264
+    auto *sp = model_proto.add_pieces();
+    sp->set_type(ModelProto::SentencePiece::BYTE);
+    sp->set_piece(ByteToPiece(i));
+  }
+  model_proto.mutable_trainer_spec()->set_byte_fallback(true);
+
+  auto byte_id = [](unsigned char c) { return 9 + c; };
+  const std::vector<std::vector<int>> kInputs = {
+      {},
+      {1, 2},
+      {1, 6, 4, 2},
+      {5, 5, 3, 0, 4},
+      {8, 6, 7, 5},
+      // "あ", "Z", invalid bytes, "い"
+      {6, byte_id(0xE3), byte_id(0x81), byte_id(0x82), byte_id('Z'),
+       byte_id(0xE0), byte_id(0x80), 6, byte_id(0xE3), byte_id(0x81),
+       byte_id(0x84)},
+      // Truncated character at the end.
+      {byte_id(0xE3), byte_id(0x81)},
+      // Whitespace as a byte piece.
+      {byte_id(0xE2), byte_id(0x96), byte_id(0x81), 6},
+  };
+
+  for (const bool add_dummy_prefix : {true, false}) {
+    for (const bool remove_extra_whitespaces : {true, false}) {
+      auto *normalizer_spec = model_proto.mutable_normalizer_spec();
+      normalizer_spec->set_add_dummy_prefix(add_dummy_prefix);
+      normalizer_spec->set_remove_extra_whitespaces(remove_extra_whitespaces);
+
+      SentencePieceProcessor sp;
+      ASSERT_TRUE(sp.Load(model_proto).ok());
+
+      std::string detokenized = "previous content";
+      for (const auto &ids : kInputs) {
+        SentencePieceText spt;
+        EXPECT_TRUE(sp.Decode(ids, &spt).ok());
+        EXPECT_TRUE(sp.Decode(ids.data(), ids.size(), &detokenized).ok());
+        EXPECT_EQ(spt.text(), detokenized);
+      }
+
+      EXPECT_FALSE(sp.Decode(std::vector<int>({3, 265}), &detokenized).ok());
+      EXPECT_FALSE(sp.Decode(std::vector<int>({-1}), &detokenized).ok());
+    }
+  }
+}
+
 TEST(SentencePieceProcessorTest, OverrideSpecialPieceTest) {
   ModelProto model_proto;
   auto *sp1 = model_proto.add_pieces();
@@ -415,45 +415,6 @@ END:
   if (self_test_samples_.size() > 0)
     LOG(INFO) << "Loaded " << self_test_samples_.size() << " test sentences";
 
-  // Normalize and removes empty string.
-  {
-    const normalizer::Normalizer normalizer(normalizer_spec_, trainer_spec_);
-    std::set<absl::string_view> meta_pieces_set;
-    for (const auto &it : meta_pieces_) {
-      LOG(INFO) << "Adding meta_piece: " << it.second.first;
-      meta_pieces_set.insert(it.second.first);
-    }
-    const normalizer::PrefixMatcher meta_pieces_matcher(meta_pieces_set);
-
-    LOG(INFO) << "Normalizing sentences...";
-    CHECK_OR_RETURN(!sentences_.empty());
-    {
-      auto pool = absl::make_unique<ThreadPool>(trainer_spec_.num_threads());
-      pool->StartWorkers();
-      for (int n = 0; n < trainer_spec_.num_threads(); ++n) {
-        pool->Schedule([&, n]() {
-          for (size_t i = n; i < sentences_.size();
-               i += trainer_spec_.num_threads()) {
-            auto *s = &sentences_[i].first;
-            *s = meta_pieces_matcher.GlobalReplace(normalizer.Normalize(*s),
-                                                   kUPPBoundaryStr);
-          }
-        });
-      }
-    }
-
-    for (size_t i = 0; i < sentences_.size(); ++i) {
-      auto *s = &sentences_[i].first;
-      CHECK_OR_RETURN(s->find(" ") == std::string::npos)
-          << "Normalized string must not include spaces";
-      if (s->empty()) {
-        std::swap(sentences_[i], sentences_[sentences_.size() - 1]);
-        sentences_.resize(sentences_.size() - 1);
-      }
-    }
-  }
-
-  // If DP is required, add the noise/clip the input.
   if (trainer_spec_.enable_differential_privacy()) {
     if (trainer_spec_.input_format() != "tsv") {
       LOG(ERROR)
@@ -467,38 +428,94 @@ END:
       LOG(WARNING) << "Private version with <=0 clipping threshold will give "
                       "infinity epsilon guarantees.";
     }
+  }
 
-    // Add noise to all the sentences via threadpool.
+  // Normalizes, validates, adds DP noise and counts the characters of all
+  // sentences in a single parallel pass. Every worker owns a contiguous chunk
+  // of |sentences_|, compacts the surviving sentences to the front of its
+  // chunk and keeps a thread-local character histogram. Chunks and histograms
+  // are merged afterwards, so the relative order of the sentences is kept.
+  struct LoadChunk {
+    size_t begin = 0;
+    size_t end = 0;  // Surviving sentences are in [begin, end).
+    int64 num_sentences = 0;
+    int64 num_dp_removed = 0;
+    int64 num_null_chars = 0;
+    int64 all_chars_count = 0;
+    absl::flat_hash_map<char32, int64> chars_count;
+    util::Status status;
+  };
 
-    // This line is mainly for tests with small num of sentences.
-    const auto num_workers =
-        std::min<uint64>(trainer_spec_.num_threads(), sentences_.size() - 1);
+  std::vector<LoadChunk> chunks;
+  {
+    const normalizer::Normalizer normalizer(normalizer_spec_, trainer_spec_);
+    std::set<absl::string_view> meta_pieces_set;
+    for (const auto &it : meta_pieces_) {
+      LOG(INFO) << "Adding meta_piece: " << it.second.first;
+      meta_pieces_set.insert(it.second.first);
+    }
+    const normalizer::PrefixMatcher meta_pieces_matcher(meta_pieces_set);
 
-    {
-      auto pool = absl::make_unique<ThreadPool>(num_workers);
-      pool->StartWorkers();
-      for (int n = 0; n < num_workers; ++n) {
-        pool->Schedule([&, n]() {
+    LOG(INFO) << "Normalizing sentences...";
+    CHECK_OR_RETURN(!sentences_.empty());
+
+    const bool enable_dp = trainer_spec_.enable_differential_privacy();
+    const size_t num_workers = std::min<size_t>(trainer_spec_.num_threads(),
+                                                sentences_.size());
+    const size_t chunk_size =
+        (sentences_.size() + num_workers - 1) / num_workers;
+    chunks.resize(num_workers);
+
+    auto pool = absl::make_unique<ThreadPool>(num_workers);
+    pool->StartWorkers();
+    for (size_t n = 0; n < num_workers; ++n) {
+      pool->Schedule([&, n]() {
+        auto *chunk = &chunks[n];
+        chunk->begin = std::min(n * chunk_size, sentences_.size());
+        chunk->end = chunk->begin;
+        const size_t end = std::min(chunk->begin + chunk_size,
+                                    sentences_.size());
+        chunk->status = [&]() -> util::Status {
           // One per thread generator.
           absl::SharedBitGen generator;
-          for (size_t i = n; i < sentences_.size(); i += num_workers) {
-            AddDPNoise<int64>(trainer_spec_, generator,
-                              &(sentences_[i].second));
+          for (size_t i = chunk->begin; i < end; ++i) {
+            auto *s = &sentences_[i];
+            s->first = meta_pieces_matcher.GlobalReplace(
+                normalizer.Normalize(s->first), kUPPBoundaryStr);
+            CHECK_OR_RETURN(s->first.find(" ") == std::string::npos)
+                << "Normalized string must not include spaces";
+            if (s->first.empty()) continue;
+
+            ++chunk->num_sentences;
+            if (enable_dp) {
+              AddDPNoise<int64>(trainer_spec_, generator, &s->second);
+              if (s->second <= 0) {
+                ++chunk->num_dp_removed;
+                continue;
+              }
+            }
+
+            for (const char32 c : string_util::UTF8ToUnicodeText(s->first)) {
+              if (!string_util::IsValidCodepoint(c)) continue;
+              if (c == 0x0000) {
+                ++chunk->num_null_chars;
+                continue;
+              }
+              // UTF8ToUnicodeText returns a white space if the text
+              // contains an interchange-invalid character. The normalized
+              // string is already verified to have no spaces.
+              if (c == 0x0020) continue;
+              chunk->chars_count[c] += s->second;
+              chunk->all_chars_count += s->second;
+            }
+
+            if (chunk->end != i) sentences_[chunk->end] = std::move(*s);
+            ++chunk->end;
           }
-        });
-      }
+          return util::OkStatus();
+        }();
+      });
     }
-
-    // Remove zero freq elements.
-    const auto before_size = sentences_.size();
-    auto it = std::remove_if(sentences_.begin(), sentences_.end(),
-                             [](const Sentence &s) { return s.second <= 0; });
-    const auto new_size = std::distance(sentences_.begin(), it);
-    const int num_erased = before_size - new_size;
-    sentences_.erase(it, sentences_.end());
-
-    LOG(INFO) << "DP noise resulted in " << 1.0 * num_erased / before_size
-              << " fraction of sentences removed.";
   }
 
   // Count character frequencies.
@@ -515,23 +532,42 @@ END:
     }
     chars_count[c].first = true;  // is_required_character.
   }
-  for (const auto &w : sentences_) {
-    for (const char32 c : string_util::UTF8ToUnicodeText(w.first)) {
-      if (!string_util::IsValidCodepoint(c)) continue;
-      if (c == 0x0000) {
-        LOG(INFO)
-            << "Found null character. The corpus must be encoded in utf-8.";
-        continue;
+
+  // Merges the chunks. Sentences are moved only if an earlier chunk dropped
+  // some of its sentences.
+  {
+    size_t num_sentences = 0;
+    int64 num_non_empty = 0;
+    int64 num_dp_removed = 0;
+    int64 num_null_chars = 0;
+    for (auto &chunk : chunks) {
+      RETURN_IF_ERROR(chunk.status);
+      if (num_sentences != chunk.begin) {
+        std::move(sentences_.begin() + chunk.begin,
+                  sentences_.begin() + chunk.end,
+                  sentences_.begin() + num_sentences);
       }
-      if (c == 0x0020) {
-        // UTF8ToUnicodeText returns a white space if the text
-        // contains an interchange-invalid character.
-        CHECK_OR_RETURN(w.first.find(" ") == std::string::npos)
-            << "space must not be included in normalized string.";
-        continue;
+      num_sentences += chunk.end - chunk.begin;
+      num_non_empty += chunk.num_sentences;
+      num_dp_removed += chunk.num_dp_removed;
+      num_null_chars += chunk.num_null_chars;
+      all_chars_count += chunk.all_chars_count;
+      for (const auto &it : chunk.chars_count) {
+        chars_count[it.first].second += it.second;
       }
-      chars_count[c].second += w.second;
-      all_chars_count += w.second;
+    }
+    sentences_.resize(num_sentences);
+    chunks.clear();
+
+    if (num_null_chars > 0) {
+      LOG(INFO) << "Found " << num_null_chars
+                << " null characters. The corpus must be encoded in utf-8.";
+    }
+
+    if (trainer_spec_.enable_differential_privacy() && num_non_empty > 0) {
+      LOG(INFO) << "DP noise resulted in "
+                << 1.0 * num_dp_removed / num_non_empty
+                << " fraction of sentences removed.";
     }
   }
   LOG(INFO) << "all chars count=" << all_chars_count;
@@ -555,6 +555,55 @@ TEST(TrainerInterfaceTest, CharactersTest) {
   }
 }
 
+TEST(TrainerInterfaceTest, LoadSentencesTest) {
+  const std::string input_file =
+      util::JoinPath(absl::GetFlag(FLAGS_test_tmpdir), "input");
+  std::vector<std::string> expected;
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    // Lines consisting only of spaces are normalized to empty strings and
+    // must be removed from every chunk without reordering the others.
+    for (int i = 0; i < 100; ++i) {
+      if (i % 7 == 3) {
+        output->WriteLine("   ");
+        continue;
+      }
+      const std::string line = "a" + std::to_string(i) + "b";
+      output->WriteLine(line);
+      expected.emplace_back(absl::StrCat(WS, line));
+    }
+  }
+
+  TrainerSpec trainer_spec;
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  normalizer_spec.set_name("identity");
+  trainer_spec.add_input(input_file);
+  trainer_spec.set_model_prefix("model");
+  trainer_spec.set_character_coverage(1.0);
+
+  for (const int num_threads : {1, 3, 8, 200}) {
+    trainer_spec.set_num_threads(num_threads);
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+
+    std::vector<std::string> sentences;
+    for (const auto &it : trainer.sentences_) sentences.emplace_back(it.first);
+    EXPECT_EQ(expected, sentences);
+
+    int64 num_digits = 0;
+    for (const auto &s : expected) num_digits += s.size() - 3 - 2;
+    EXPECT_EQ(expected.size(), trainer.required_chars_[ToChar32("a")]);
+    EXPECT_EQ(expected.size(), trainer.required_chars_[ToChar32("b")]);
+    EXPECT_EQ(expected.size(), trainer.required_chars_[ToChar32(WS)]);
+    int64 all_digits = 0;
+    for (char c = '0'; c <= '9'; ++c) {
+      all_digits += trainer.required_chars_[static_cast<char32>(c)];
+    }
+    EXPECT_EQ(num_digits, all_digits);
+  }
+}
+
 TEST(TrainerInterfaceTest, MultiFileSentenceIteratorTest) {
   std::vector<std::string> files;
   std::vector<std::string> expected;
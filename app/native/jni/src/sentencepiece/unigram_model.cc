@@ -18,8 +18,9 @@
 #include <cfloat>
 #include <cmath>
 #include <complex>
+#include <cstdint>
+#include <cstring>
 #include <map>
-#include <queue>
 #include <string>
 #include <utility>
 #include <vector>
@@ -40,23 +41,62 @@ constexpr size_t kPreallocateLatticeNodeSize = 1024;
 constexpr float kUnkPenalty = 10.0;
 constexpr float kEpsilon = 1e-7;
 
-// Returns log(exp(x) + exp(y)).
-// if init_mode is true, returns log(exp(y)) == y.
-// log(\sum_i exp(a[i])) can be computed as
-// for (int i = 0; i < a.size(); ++i)
-//   x = LogSumExp(x, a[i], i == 0);
-inline float LogSumExp(float x, float y, bool init_mode) {
-  if (init_mode) {
-    return y;
-  }
-  const float vmin = std::min(x, y);
-  const float vmax = std::max(x, y);
-  constexpr float kMinusLogEpsilon = 50;
-  if (vmax > vmin + kMinusLogEpsilon) {
-    return vmax;
-  } else {
-    return vmax + log(std::exp(static_cast<double>(vmin - vmax)) + 1.0);
+// Header of an index serialized by Model::SerializeIndex(), which is followed
+// by the units of the double-array.
+struct IndexHeader {
+  char magic[4];
+  uint32 version;
+  uint32 pieces_size;
+  uint32 trie_results_size;
+  uint32 units_size;
+};
+
+constexpr char kIndexMagic[4] = {'S', 'P', 'T', 'I'};
+constexpr uint32 kIndexVersion = 1;
+
+// Returns exp(x) with a relative error of about 1e-7. Unlike std::exp, it is
+// branch-free and inlined, so loops over contiguous arrays are vectorized
+// (NEON/SSE) by the compiler. Based on the Cephes expf approximation.
+inline float VectorizableExp(float x) {
+  x = std::min(std::max(x, -87.3f), 88.3f);
+  // exp(x) = 2^n * exp(r) with r = x - n * log(2), |r| <= log(2) / 2.
+  const float n = std::floor(x * 1.44269504088896341f + 0.5f);
+  const float r = x - n * 0.693359375f + n * 2.12194440e-4f;
+  float y = 1.9875691500e-4f;
+  y = y * r + 1.3981999507e-3f;
+  y = y * r + 8.3334519073e-3f;
+  y = y * r + 4.1665795894e-2f;
+  y = y * r + 1.6666665459e-1f;
+  y = y * r + 5.0000001201e-1f;
+  y = y * r * r + r + 1.0f;
+  // Builds 2^n from the exponent bits.
+  const int32 bits = (static_cast<int32>(n) + 127) << 23;
+  float pow2n;
+  memcpy(&pow2n, &bits, sizeof(pow2n));
+  return y * pow2n;
+}
+
+// Returns log(\sum_i exp(values[i])). |values| must not be empty.
+// The sum of exponentials is accumulated in |Accum| over independent lanes
+// so that the loop is vectorized.
+template <typename Accum>
+float LogSumExp(const float *values, size_t size) {
+  float vmax = values[0];
+  for (size_t i = 1; i < size; ++i) vmax = std::max(vmax, values[i]);
+
+  constexpr size_t kLanes = 8;
+  Accum lanes[kLanes] = {};
+  size_t i = 0;
+  for (; i + kLanes <= size; i += kLanes) {
+    for (size_t k = 0; k < kLanes; ++k) {
+      lanes[k] += VectorizableExp(values[i + k] - vmax);
+    }
   }
+  Accum sum = 0;
+  for (; i < size; ++i) sum += VectorizableExp(values[i] - vmax);
+  for (size_t k = 0; k < kLanes; ++k) sum += lanes[k];
+
+  return vmax + static_cast<float>(std::log(sum));
 }
 
 // Returns a sample from a standard Gumbel distribution.
@@ -69,17 +109,58 @@ inline float Gumbel() {
 
   return noise;
 }
+
+// Lends out a lattice owned by the calling thread, so that the inference-time
+// encoders reuse its node arena and adjacency buffers across calls. A private
+// lattice is used when the thread's lattice is already lent out or when
+// thread-local storage is disabled.
+class LatticeWorkspace {
+ public:
+  LatticeWorkspace() {
+#ifndef SPM_NO_THREADLOCAL
+    thread_local static Lattice shared_lattice;
+    thread_local static bool shared_lattice_in_use = false;
+    if (!shared_lattice_in_use) {
+      shared_lattice_in_use = true;
+      in_use_ = &shared_lattice_in_use;
+      lattice_ = &shared_lattice;
+      return;
+    }
+#endif
+    owned_lattice_ = absl::make_unique<Lattice>();
+    lattice_ = owned_lattice_.get();
+  }
+
+  ~LatticeWorkspace() {
+    if (in_use_ != nullptr) *in_use_ = false;
+  }
+
+  LatticeWorkspace(const LatticeWorkspace &) = delete;
+  LatticeWorkspace &operator=(const LatticeWorkspace &) = delete;
+
+  Lattice *get() const { return lattice_; }
+  Lattice *operator->() const { return lattice_; }
+
+ private:
+  Lattice *lattice_ = nullptr;
+  bool *in_use_ = nullptr;
+  std::unique_ptr<Lattice> owned_lattice_;
+};
 }  // namespace
 
 Lattice::Lattice() : node_allocator_(kPreallocateLatticeNodeSize) {}
 Lattice::~Lattice() {}
 
-const std::vector<Lattice::Node *> &Lattice::begin_nodes(int pos) const {
-  return begin_nodes_[pos];
+Lattice::NodeRange Lattice::begin_nodes(int pos) const {
+  BuildAdjacency();
+  Node *const *data = begin_list_.data();
+  return NodeRange(data + begin_offsets_[pos], data + begin_offsets_[pos + 1]);
 }
 
-const std::vector<Lattice::Node *> &Lattice::end_nodes(int pos) const {
-  return end_nodes_[pos];
+Lattice::NodeRange Lattice::end_nodes(int pos) const {
+  BuildAdjacency();
+  Node *const *data = end_list_.data();
+  return NodeRange(data + end_offsets_[pos], data + end_offsets_[pos + 1]);
 }
 
 int Lattice::size() const {
@@ -93,22 +174,27 @@ const char *Lattice::sentence() const { return sentence_.data(); }
 
 const char *Lattice::surface(int pos) const { return surface_[pos]; }
 
-Lattice::Node *Lattice::bos_node() const { return end_nodes_[0][0]; }
+// BOS and EOS are always the first two nodes allocated by SetSentence().
+Lattice::Node *Lattice::bos_node() const { return node_allocator_[0]; }
 
-Lattice::Node *Lattice::eos_node() const { return begin_nodes_[size()][0]; }
+Lattice::Node *Lattice::eos_node() const { return node_allocator_[1]; }
 
 Lattice::Node *Lattice::NewNode() {
   Node *node = node_allocator_.Allocate();
   node->node_id = node_allocator_.size() - 1;
+  adjacency_dirty_.store(true, std::memory_order_relaxed);
   return node;
 }
 
 void Lattice::Clear() {
-  begin_nodes_.clear();
-  end_nodes_.clear();
   sentence_ = absl::string_view("");
   surface_.clear();
   node_allocator_.Free();
+  begin_offsets_.clear();
+  end_offsets_.clear();
+  begin_list_.clear();
+  end_list_.clear();
+  adjacency_dirty_.store(true, std::memory_order_relaxed);
 }
 
 void Lattice::SetSentence(absl::string_view sentence) {
@@ -126,24 +212,14 @@ void Lattice::SetSentence(absl::string_view sentence) {
   surface_.push_back(sentence.data());
 
   const int len = size();
-  begin_nodes_.resize(len + 1);
-  end_nodes_.resize(len + 1);
-
-  constexpr size_t kReservedNodeSize = 16;
-  for (int i = 0; i <= len; ++i) {
-    begin_nodes_[i].reserve(kReservedNodeSize);
-    end_nodes_[i].reserve(kReservedNodeSize);
-  }
 
   Node *bos = NewNode();
   bos->id = -1;
   bos->pos = 0;
-  end_nodes_[0].push_back(bos);
 
   Node *eos = NewNode();
   eos->id = -1;
   eos->pos = len;
-  begin_nodes_[len].push_back(eos);
 }
 
 Lattice::Node *Lattice::Insert(int pos, int length) {
@@ -153,21 +229,57 @@ Lattice::Node *Lattice::Insert(int pos, int length) {
   const int utf8_length =
       static_cast<int>(surface(pos + length) - surface(pos));
   node->piece = absl::string_view(surface(pos), utf8_length);
-  begin_nodes_[pos].push_back(node);
-  end_nodes_[pos + node->length].push_back(node);
 
   return node;
 }
 
+void Lattice::BuildAdjacency() const {
+  // Const readers may share a lattice, so only one of them builds the
+  // adjacency and the others wait for it.
+  if (!adjacency_dirty_.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(adjacency_mutex_);
+  if (!adjacency_dirty_.load(std::memory_order_relaxed)) return;
+
+  // Counting sort by position. BOS only ends at 0 and EOS only begins at
+  // size(), so they are excluded from the begin and end lists respectively.
+  const int len = size();
+  const size_t num_nodes = node_allocator_.size();
+  begin_offsets_.assign(len + 3, 0);
+  end_offsets_.assign(len + 3, 0);
+  begin_list_.resize(num_nodes > 0 ? num_nodes - 1 : 0);
+  end_list_.resize(num_nodes > 0 ? num_nodes - 1 : 0);
+
+  for (size_t i = 0; i < num_nodes; ++i) {
+    const Node *node = node_allocator_[i];
+    if (i != 0) ++begin_offsets_[node->pos + 2];
+    if (i != 1) ++end_offsets_[node->pos + node->length + 2];
+  }
+  for (int pos = 2; pos < len + 3; ++pos) {
+    begin_offsets_[pos] += begin_offsets_[pos - 1];
+    end_offsets_[pos] += end_offsets_[pos - 1];
+  }
+
+  // After filling, offsets[pos + 1] is advanced to the end of |pos|, which
+  // is the beginning of |pos + 1|.
+  for (size_t i = 0; i < num_nodes; ++i) {
+    Node *node = node_allocator_[i];
+    if (i != 0) begin_list_[begin_offsets_[node->pos + 1]++] = node;
+    if (i != 1) end_list_[end_offsets_[node->pos + node->length + 1]++] = node;
+  }
+
+  adjacency_dirty_.store(false, std::memory_order_release);
+}
+
 Lattice::LatticePathWithScore Lattice::Viterbi() {
   const int len = size();
 
   for (int pos = 0; pos <= len; ++pos) {
-    for (Node *rnode : begin_nodes_[pos]) {
+    const NodeRange lnodes = end_nodes(pos);
+    for (Node *rnode : begin_nodes(pos)) {
       rnode->prev = nullptr;
       float best_score = 0.0;
       Node *best_node = nullptr;
-      for (Node *lnode : end_nodes_[pos]) {
+      for (Node *lnode : lnodes) {
         const float score = lnode->backtrace_score + rnode->score;
         if (best_node == nullptr || score > best_score) {
           best_node = lnode;
@@ -185,8 +297,8 @@ Lattice::LatticePathWithScore Lattice::Viterbi() {
 
   // backtrace
   std::vector<Node *> results;
-  float score = begin_nodes(len)[0]->backtrace_score;
-  for (Node *node = begin_nodes_[len][0]->prev; node->prev != nullptr;
+  float score = eos_node()->backtrace_score;
+  for (Node *node = eos_node()->prev; node->prev != nullptr;
        node = node->prev) {
     results.push_back(node);
   }
@@ -198,41 +310,65 @@ Lattice::LatticePathWithScore Lattice::Viterbi() {
   return retval;
 }
 
-std::vector<float> Lattice::ForwardAlgorithm(float inv_theta) const {
+template <typename Accum>
+std::vector<float> Lattice::ForwardAlgorithmImpl(float inv_theta) const {
   const int len = size();
   std::vector<float> alpha(node_allocator_.size(), 0.0);
+  std::vector<float> scores;
 
+  // All nodes starting at |pos| share the same predecessors, so their alpha
+  // is a single log-sum-exp over the nodes ending at |pos|.
   for (int pos = 0; pos <= len; ++pos) {
-    for (Node *rnode : begin_nodes_[pos]) {
-      for (Node *lnode : end_nodes_[pos]) {
-        alpha[rnode->node_id] =
-            LogSumExp(alpha[rnode->node_id],
-                      inv_theta * lnode->score + alpha[lnode->node_id],
-                      lnode == end_nodes_[pos][0]);
-      }
+    const NodeRange rnodes = begin_nodes(pos);
+    const NodeRange lnodes = end_nodes(pos);
+    if (rnodes.empty() || lnodes.empty()) continue;
+
+    scores.resize(lnodes.size());
+    for (size_t i = 0; i < lnodes.size(); ++i) {
+      scores[i] = inv_theta * lnodes[i]->score + alpha[lnodes[i]->node_id];
     }
+    const float value = LogSumExp<Accum>(scores.data(), scores.size());
+    for (const Node *rnode : rnodes) alpha[rnode->node_id] = value;
   }
 
   return alpha;
 }
 
-std::vector<float> Lattice::BackwardAlgorithm(float inv_theta) const {
+template <typename Accum>
+std::vector<float> Lattice::BackwardAlgorithmImpl(float inv_theta) const {
   const int len = size();
   std::vector<float> beta(node_allocator_.size(), 0.0);
+  std::vector<float> scores;
 
+  // All nodes ending at |pos| share the same successors.
   for (int pos = len; pos >= 0; --pos) {
-    for (Node *lnode : end_nodes_[pos]) {
-      for (Node *rnode : begin_nodes_[pos]) {
-        beta[lnode->node_id] =
-            LogSumExp(beta[lnode->node_id], rnode->score + beta[rnode->node_id],
-                      rnode == begin_nodes_[pos][0]);
-      }
+    const NodeRange lnodes = end_nodes(pos);
+    const NodeRange rnodes = begin_nodes(pos);
+    if (lnodes.empty() || rnodes.empty()) continue;
+
+    scores.resize(rnodes.size());
+    for (size_t i = 0; i < rnodes.size(); ++i) {
+      scores[i] = rnodes[i]->score + beta[rnodes[i]->node_id];
     }
+    const float value = LogSumExp<Accum>(scores.data(), scores.size());
+    for (const Node *lnode : lnodes) beta[lnode->node_id] = value;
   }
 
   return beta;
 }
 
+std::vector<float> Lattice::ForwardAlgorithm(float inv_theta) const {
+  return accumulation_type_ == kFloatAccumulation
+             ? ForwardAlgorithmImpl<float>(inv_theta)
+             : ForwardAlgorithmImpl<double>(inv_theta);
+}
+
+std::vector<float> Lattice::BackwardAlgorithm(float inv_theta) const {
+  return accumulation_type_ == kFloatAccumulation
+             ? BackwardAlgorithmImpl<float>(inv_theta)
+             : BackwardAlgorithmImpl<double>(inv_theta);
+}
+
 float Lattice::PopulateMarginal(float freq,
                                 std::vector<float> *expected) const {
   if (expected == nullptr) return 0.0;
@@ -245,17 +381,23 @@ float Lattice::PopulateMarginal(float freq,
   const auto alpha = ForwardAlgorithm(1.0);
   const auto beta = BackwardAlgorithm(1.0);
 
-  const float Z = alpha[begin_nodes_[len][0]->node_id];
-  for (int pos = 0; pos < len; ++pos) {
-    for (Node *node : begin_nodes_[pos]) {
-      if (node->id >= 0) {
-        // the index of |expected| is a Node::id, which is a vocabulary id.
-        (*expected)[node->id] +=
-            freq *
-            std::exp(static_cast<double>(alpha[node->node_id] + node->score +
-                                         beta[node->node_id] - Z));
-      }
-    }
+  const float Z = alpha[eos_node()->node_id];
+
+  // The nodes starting at 0..len-1 are contiguous in the begin list, which
+  // allows computing all marginals in one vectorized pass.
+  const NodeRange nodes(begin_nodes(0).begin(), begin_nodes(len).begin());
+  std::vector<float> marginals(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const Node *node = nodes[i];
+    marginals[i] =
+        alpha[node->node_id] + node->score + beta[node->node_id] - Z;
+  }
+  for (size_t i = 0; i < marginals.size(); ++i) {
+    marginals[i] = freq * VectorizableExp(marginals[i]);
+  }
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    // the index of |expected| is a Node::id, which is a vocabulary id.
+    if (nodes[i]->id >= 0) (*expected)[nodes[i]->id] += marginals[i];
   }
 
   return freq * Z;
@@ -274,8 +416,9 @@ float Lattice::CalculateEntropy(float inv_theta) const {
 
   // Now populate the forward entropies
   for (int pos = 0; pos <= len; ++pos) {
-    for (Node *rnode : begin_nodes_[pos]) {
-      for (Node *lnode : end_nodes_[pos]) {
+    const NodeRange lnodes = end_nodes(pos);
+    for (Node *rnode : begin_nodes(pos)) {
+      for (Node *lnode : lnodes) {
         // Contribution each lnode makes = p(lnode) * (H(lnode) + log p(lnode))
 
         // We have to normalise p(lnode) by the marginal contribution it makes
@@ -288,7 +431,7 @@ float Lattice::CalculateEntropy(float inv_theta) const {
     }
   }
 
-  return -H[begin_nodes_[len][0]->node_id];
+  return -H[eos_node()->node_id];
 }
 
 namespace {
@@ -367,21 +510,25 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
   // As left-to-right Viterbi search can tell the *exact* value of h(x),
   // we can obtain the exact n-best results with A*.
 
-  class HypothesisComparator {
-   public:
-    const bool operator()(Hypothesis *h1, Hypothesis *h2) {
-      return (h1->fx < h2->fx);
-    }
+  const auto hypothesis_less = [](const Hypothesis *h1, const Hypothesis *h2) {
+    return h1->fx < h2->fx;
   };
 
-  using Agenda = std::priority_queue<Hypothesis *, std::vector<Hypothesis *>,
-                                     HypothesisComparator>;
+  // The agenda is a binary max-heap over fx. It is kept as a plain vector so
+  // that it can be pruned in place when it grows too big.
   constexpr size_t kPreallocatedHypothesisSize = 512;
   model::FreeList<Hypothesis> hypothesis_allocator(kPreallocatedHypothesisSize);
+  model::FreeList<Hypothesis> spare_allocator(kPreallocatedHypothesisSize);
+  absl::flat_hash_map<const Hypothesis *, Hypothesis *> clone_map;
 
-  Agenda agenda;
+  std::vector<Hypothesis *> agenda;
   std::vector<Lattice::LatticePathWithScore> results;
 
+  auto push_agenda = [&](Hypothesis *hyp) {
+    agenda.push_back(hyp);
+    std::push_heap(agenda.begin(), agenda.end(), hypothesis_less);
+  };
+
   auto *eos = hypothesis_allocator.Allocate();
   eos->node = eos_node();
   eos->next = nullptr;
@@ -399,13 +546,19 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
     Viterbi();
     eos->fx = eos->node->backtrace_score;
   }
-  agenda.push(eos);
+  push_agenda(eos);
+
+  // Scratch buffers for the stochastic search, reused across expansions.
+  std::vector<float> probs;
+  std::vector<float> perturbed_probs;
+  std::vector<double> adjusted_probs;
 
   int shrink_count = 0;  // Number of times agenda has shrunk. For logging only.
   bool printed_memory_warning = false;  // For logging only.
   while (!agenda.empty()) {
-    auto *top = agenda.top();
-    agenda.pop();
+    std::pop_heap(agenda.begin(), agenda.end(), hypothesis_less);
+    auto *top = agenda.back();
+    agenda.pop_back();
     auto *node = top->node;
 
     // Reaches to BOS
@@ -421,16 +574,17 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
       continue;
     }
 
-    const int end_nodes_size = end_nodes(node->pos).size();
-    std::vector<float> probs(end_nodes_size, 0.0);
-    std::vector<float> perturbed_probs(end_nodes_size, 0.0);
-    std::vector<double> adjusted_probs(end_nodes_size, 0.0);
+    const NodeRange lnodes = end_nodes(node->pos);
+    const int end_nodes_size = lnodes.size();
     const float Z = alpha[node->node_id];
     if (sample) {
+      probs.assign(end_nodes_size, 0.0);
+      perturbed_probs.assign(end_nodes_size, 0.0);
+      adjusted_probs.assign(end_nodes_size, 0.0);
       float max_score = -1e8;
       // Calculate the marginal and perturbed scores for stochastic search
-      for (int i = 0; i < end_nodes(node->pos).size(); i++) {
-        Node *lnode = end_nodes(node->pos)[i];
+      for (int i = 0; i < end_nodes_size; i++) {
+        Node *lnode = lnodes[i];
         // Calculate backwards transition score
         probs[i] =
             top->gx + alpha[lnode->node_id] + (inv_theta * lnode->score) - Z;
@@ -440,7 +594,7 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
         }
       }
       // Now constrain the sampled continuations to match the score of parent
-      for (int i = 0; i < adjusted_probs.size(); i++) {
+      for (int i = 0; i < end_nodes_size; i++) {
         // Use numerically stable version of truncated Gumbel:
         // https://arxiv.org/pdf/1903.06059.pdf appendix B.3
         const float v = top->fx - perturbed_probs[i] +
@@ -451,8 +605,8 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
     }
 
     // Expands new node ending at node->pos
-    for (int i = 0; i < end_nodes(node->pos).size(); i++) {
-      Node *lnode = end_nodes(node->pos)[i];
+    for (int i = 0; i < end_nodes_size; i++) {
+      Node *lnode = lnodes[i];
       auto *hyp = hypothesis_allocator.Allocate();
       hyp->node = lnode;
       if (sample) {
@@ -464,7 +618,7 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
             lnode->backtrace_score + top->gx;  // backtrace_score is h(node).
       }
       hyp->next = top;
-      agenda.push(hyp);
+      push_agenda(hyp);
     }
 
     static constexpr int kOneBillion = 1000000000;  // 10^9.
@@ -477,32 +631,35 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
     }
 
     // When the input is too long or contains duplicated phrases,
-    // `agenda` will get extremely big. Here we avoid this case by
+    // `agenda` will get extremely big. Here we bound the memory by
     // dynamically shrinking the agenda.
-    constexpr int kMaxAgendaSize = 10000;
-    constexpr int kMinAgendaSize = 512;
+    constexpr size_t kMaxAgendaSize = 10000;
+    constexpr size_t kMinAgendaSize = 512;
     if (agenda.size() >= kMaxAgendaSize) {
       // Keeps the top `kMinAgendaSize` hypothesis.
-      Agenda new_agenda;
-      // Keeps the top hypothesis and the ones on their "next" paths.
-      model::FreeList<Hypothesis> new_allocator(kPreallocatedHypothesisSize);
-      // Map between old Hypothesis* and new Hypothesis*.
-      absl::flat_hash_map<const Hypothesis *, Hypothesis *> clone_map;
-
-      const int size = std::min<int>(kMinAgendaSize, nbest_size * 10);
+      const size_t size = std::min<size_t>(kMinAgendaSize, nbest_size * 10);
       shrink_count++;
       LOG(WARNING) << "Too big agenda size " << agenda.size()
                    << ". Shrinking (round " << shrink_count << ") down to "
                    << size << ".";
-      for (int i = 0; i < size; ++i) {
-        const Hypothesis *top_hyp = agenda.top();
-        Hypothesis *cloned_hyp =
-            CloneHypAndDependents(top_hyp, &clone_map, &new_allocator);
-        new_agenda.push(cloned_hyp);
-        agenda.pop();
+      // Pops the best `size` hypotheses to the back of the heap and drops the
+      // rest in front of them.
+      auto heap_end = agenda.end();
+      for (size_t i = 0; i < size; ++i, --heap_end) {
+        std::pop_heap(agenda.begin(), heap_end, hypothesis_less);
       }
-      agenda = std::move(new_agenda);
-      hypothesis_allocator.swap(new_allocator);
+      agenda.erase(agenda.begin(), heap_end);
+
+      // Moves the kept hypotheses and the ones on their "next" paths into
+      // the spare allocator, then recycles the old allocator for the next
+      // round. This bounds the memory held by dropped hypotheses.
+      clone_map.clear();
+      spare_allocator.Free();
+      for (auto &hyp : agenda) {
+        hyp = CloneHypAndDependents(hyp, &clone_map, &spare_allocator);
+      }
+      std::make_heap(agenda.begin(), agenda.end(), hypothesis_less);
+      hypothesis_allocator.swap(spare_allocator);
     }
   }
 
@@ -526,12 +683,12 @@ std::vector<Lattice::Node *> Lattice::Sample(float inv_theta) {
   Node *node = eos_node();
   while (true) {
     probs.clear();
-    for (const Node *lnode : end_nodes_[node->pos]) {
+    for (const Node *lnode : end_nodes(node->pos)) {
       probs.push_back(std::exp(static_cast<double>(
           alpha[lnode->node_id] + inv_theta * lnode->score - Z)));
     }
     std::discrete_distribution<int> dist(probs.begin(), probs.end());
-    node = end_nodes_[node->pos][dist(*mt)];
+    node = end_nodes(node->pos)[dist(*mt)];
     if (node == bos_node()) break;
 
     Z = alpha[node->node_id];
@@ -650,7 +807,62 @@ void Model::BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces) {
     status_ = util::InternalError("no entry is found in the trie.");
 }
 
-Model::Model(const ModelProto &model_proto) {
+bool Model::LoadTrie(absl::string_view precompiled_index) {
+  IndexHeader header;
+  if (precompiled_index.size() < sizeof(header)) return false;
+  memcpy(&header, precompiled_index.data(), sizeof(header));
+
+  auto trie = absl::make_unique<Darts::DoubleArray>();
+  const char *units = precompiled_index.data() + sizeof(header);
+  if (memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+      header.version != kIndexVersion ||
+      header.pieces_size != model_proto_->pieces_size() ||
+      header.trie_results_size == 0 ||
+      precompiled_index.size() !=
+          sizeof(header) + static_cast<size_t>(header.units_size) *
+                               trie->unit_size() ||
+      reinterpret_cast<uintptr_t>(units) % trie->unit_size() != 0) {
+    return false;
+  }
+
+  trie->set_array(units, header.units_size);
+
+  // Every piece has to resolve to its own id, otherwise the index was
+  // serialized for another model.
+  for (const auto &it : pieces_) {
+    int id = -1;
+    trie->exactMatchSearch(it.first.data(), id, it.first.size());
+    if (id != it.second) return false;
+  }
+
+  trie_ = std::move(trie);
+  trie_results_size_ = header.trie_results_size;
+
+  pieces_.clear();
+
+  return true;
+}
+
+util::Status Model::SerializeIndex(std::string *output) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(output);
+  CHECK_OR_RETURN(trie_ && trie_->size() > 0) << "The Trie is not built.";
+
+  IndexHeader header;
+  memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+  header.version = kIndexVersion;
+  header.pieces_size = model_proto_->pieces_size();
+  header.trie_results_size = trie_results_size_;
+  header.units_size = trie_->size();
+
+  output->resize(sizeof(header) + trie_->total_size());
+  memcpy(&(*output)[0], &header, sizeof(header));
+  memcpy(&(*output)[sizeof(header)], trie_->array(), trie_->total_size());
+
+  return util::OkStatus();
+}
+
+void Model::InitializeModel(const ModelProto &model_proto) {
   model_proto_ = &model_proto;
 
   InitializePieces();
@@ -663,6 +875,10 @@ Model::Model(const ModelProto &model_proto) {
       max_score_ = std::max(max_score_, sp.score());
     }
   }
+}
+
+Model::Model(const ModelProto &model_proto) {
+  InitializeModel(model_proto);
 
   std::vector<std::pair<absl::string_view, int>> pieces;
   for (const auto &it : pieces_) pieces.emplace_back(it.first, it.second);
@@ -670,6 +886,18 @@ Model::Model(const ModelProto &model_proto) {
   BuildTrie(&pieces);
 }
 
+Model::Model(const ModelProto &model_proto,
+             absl::string_view precompiled_index) {
+  InitializeModel(model_proto);
+
+  if (!status().ok()) return;
+
+  if (!LoadTrie(precompiled_index)) {
+    status_ = util::InvalidArgumentError(
+        "The precompiled index does not match the model.");
+  }
+}
+
 Model::~Model() {}
 
 EncodeResult Model::Encode(absl::string_view normalized) const {
@@ -681,12 +909,12 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
     return {};
   }
 
-  Lattice lattice;
-  lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  LatticeWorkspace lattice;
+  lattice->SetSentence(normalized);
+  PopulateNodes(lattice.get());
 
   EncodeResult results;
-  for (const auto *node : lattice.Viterbi().first) {
+  for (const auto *node : lattice->Viterbi().first) {
     results.emplace_back(node->piece, node->id);
   }
 
@@ -705,12 +933,12 @@ NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
     return {std::pair<EncodeResult, float>(Encode(normalized), 0.0)};
   }
 
-  Lattice lattice;
-  lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  LatticeWorkspace lattice;
+  lattice->SetSentence(normalized);
+  PopulateNodes(lattice.get());
 
   NBestEncodeResult nbest_results;
-  for (const auto &nbest : lattice.NBest(nbest_size, false, 0.0)) {
+  for (const auto &nbest : lattice->NBest(nbest_size, false, 0.0)) {
     EncodeResult results;
     for (const auto *node : nbest.first) {
       results.emplace_back(node->piece, node->id);
@@ -727,12 +955,12 @@ EncodeResult Model::SampleEncode(absl::string_view normalized,
     return {};
   }
 
-  Lattice lattice;
-  lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  LatticeWorkspace lattice;
+  lattice->SetSentence(normalized);
+  PopulateNodes(lattice.get());
 
   EncodeResult results;
-  for (const auto *node : lattice.Sample(inv_theta)) {
+  for (const auto *node : lattice->Sample(inv_theta)) {
     results.emplace_back(node->piece, node->id);
   }
 
@@ -747,12 +975,12 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
     return {};
   }
   NBestEncodeResult results;
-  Lattice lattice;
-  lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  LatticeWorkspace lattice;
+  lattice->SetSentence(normalized);
+  PopulateNodes(lattice.get());
 
-  const std::vector<float> alpha = lattice.ForwardAlgorithm(inv_theta);
-  const float marginal = alpha[lattice.eos_node()->node_id];
+  const std::vector<float> alpha = lattice->ForwardAlgorithm(inv_theta);
+  const float marginal = alpha[lattice->eos_node()->node_id];
 
   if (include_best) {
     if (!wor) {
@@ -760,7 +988,7 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
       return {};
     }
     EncodeResult result;
-    const auto best_path = lattice.Viterbi();
+    const auto best_path = lattice->Viterbi();
     for (const auto *node : best_path.first) {
       result.emplace_back(node->piece, node->id);
     }
@@ -771,7 +999,7 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
 
   if (wor) {
     // Draw k+1 samples as we need perturbed score of k+1th element
-    auto nbest_samples = lattice.NBest(samples + 1, true, inv_theta);
+    auto nbest_samples = lattice->NBest(samples + 1, true, inv_theta);
 
     if (include_best) {
       std::vector<std::vector<Lattice::Node *>> nbest_paths(
@@ -780,7 +1008,7 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
         nbest_paths[i] = nbest_samples[i].first;
       }
       // Remove the best result from the samples if necessary
-      const auto best_path = lattice.Viterbi();
+      const auto best_path = lattice->Viterbi();
 
       const int index_of_best =
           (std::find(nbest_paths.begin(), nbest_paths.end(), best_path.first) -
@@ -828,13 +1056,9 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
     }
   } else {
     while (results.size() < samples) {
-      Lattice lattice;
-      lattice.SetSentence(normalized);
-      PopulateNodes(&lattice);
-
       float score = 0.0;
       EncodeResult result;
-      const std::vector<Lattice::Node *> sample = lattice.Sample(inv_theta);
+      const std::vector<Lattice::Node *> sample = lattice->Sample(inv_theta);
       for (const auto *node : sample) {
         result.emplace_back(node->piece, node->id);
         score += (inv_theta * node->score);
@@ -848,11 +1072,11 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
 
 float Model::CalculateEntropy(absl::string_view normalized,
                               float inv_theta) const {
-  Lattice lattice;
-  lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  LatticeWorkspace lattice;
+  lattice->SetSentence(normalized);
+  PopulateNodes(lattice.get());
 
-  return lattice.CalculateEntropy(inv_theta);
+  return lattice->CalculateEntropy(inv_theta);
 }
 
 bool Model::VerifyOutputsEquivalent(absl::string_view expected,
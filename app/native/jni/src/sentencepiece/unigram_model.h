@@ -15,7 +15,9 @@
 #ifndef UNIGRAM_MODEL_H_
 #define UNIGRAM_MODEL_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -54,11 +56,31 @@ class Lattice {
   // Returns eos node.
   Node *eos_node() const;
 
+  // Read-only view of the nodes starting or ending at a position.
+  // Invalidated by Insert(), SetSentence() and Clear().
+  class NodeRange {
+   public:
+    NodeRange(Node *const *begin, Node *const *end)
+        : begin_(begin), end_(end) {}
+
+    Node *const *begin() const { return begin_; }
+    Node *const *end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    Node *operator[](size_t index) const { return begin_[index]; }
+    Node *front() const { return *begin_; }
+    Node *back() const { return *(end_ - 1); }
+
+   private:
+    Node *const *begin_;
+    Node *const *end_;
+  };
+
   // Returns nodes starting at |pos|.
-  const std::vector<Node *> &begin_nodes(int pos) const;
+  NodeRange begin_nodes(int pos) const;
 
   // Returns nodes ending at |pos|.
-  const std::vector<Node *> &end_nodes(int pos) const;
+  NodeRange end_nodes(int pos) const;
 
   // Returns Unicode character length.
   int size() const;
@@ -72,7 +94,8 @@ class Lattice {
   // Returns immutable sentence. The same as surface(0)
   const char *sentence() const;
 
-  // Clears the lattice.
+  // Clears the lattice. The allocated memory is kept, so a lattice can be
+  // reused as a workspace for many sentences.
   void Clear();
 
   // Sets new sentence.
@@ -87,6 +110,17 @@ class Lattice {
   // Returns Viterbi path. All nodes must be populated in advance.
   LatticePathWithScore Viterbi();
 
+  // Numeric type used to sum up exponentials in the forwards/backwards
+  // algorithm. Float accumulation is faster, double is more precise on
+  // lattices with many paths.
+  enum AccumulationType { kFloatAccumulation, kDoubleAccumulation };
+
+  void SetAccumulationType(AccumulationType accumulation_type) {
+    accumulation_type_ = accumulation_type;
+  }
+
+  AccumulationType GetAccumulationType() const { return accumulation_type_; }
+
   // Runs forwards/backwards algorithm, returns vector with normalised
   // transition probs.
   std::vector<float> ForwardAlgorithm(float theta) const;
@@ -117,16 +151,44 @@ class Lattice {
   // Lattice class has the ownership of the returned value.
   Node *NewNode();
 
+  template <typename Accum>
+  std::vector<float> ForwardAlgorithmImpl(float theta) const;
+  template <typename Accum>
+  std::vector<float> BackwardAlgorithmImpl(float theta) const;
+
+  // Rebuilds the begin/end adjacency arrays if nodes were inserted since
+  // the last call. Safe to call from concurrent const readers.
+  void BuildAdjacency() const;
+
   absl::string_view sentence_;
   std::vector<const char *> surface_;
-  std::vector<std::vector<Node *>> begin_nodes_;
-  std::vector<std::vector<Node *>> end_nodes_;
+
+  // Nodes are stored in insertion order; node_id is the index of a node.
   model::FreeList<Node> node_allocator_;
+
+  // Adjacency in compressed sparse row format. The nodes starting at |pos|
+  // are begin_list_[begin_offsets_[pos], begin_offsets_[pos + 1]), and
+  // likewise for the nodes ending at |pos|. Nodes keep their insertion order.
+  mutable std::atomic<bool> adjacency_dirty_{true};
+  mutable std::mutex adjacency_mutex_;
+  mutable std::vector<int32> begin_offsets_;
+  mutable std::vector<int32> end_offsets_;
+  mutable std::vector<Node *> begin_list_;
+  mutable std::vector<Node *> end_list_;
+
+  AccumulationType accumulation_type_ = kDoubleAccumulation;
 };
 
 class Model : public ModelInterface {
  public:
   explicit Model(const ModelProto &model_proto);
+
+  // Instantiates the model with the Trie loaded from |precompiled_index|, as
+  // serialized by SerializeIndex() for the same |model_proto|. status() is
+  // not OK when the index does not match the model.
+  // |precompiled_index| is not copied and must outlive the model.
+  Model(const ModelProto &model_proto, absl::string_view precompiled_index);
+
   Model() {}
   ~Model() override;
 
@@ -173,6 +235,9 @@ class Model : public ModelInterface {
   bool VerifyOutputsEquivalent(absl::string_view expected,
                                absl::string_view actual) const override;
 
+  // Serializes the Trie index.
+  util::Status SerializeIndex(std::string *output) const override;
+
   enum EncoderVersion {
     kOptimized,  // The optimized encoder.
     kOriginal    // The original encoder.
@@ -189,6 +254,13 @@ class Model : public ModelInterface {
   // Builds a Trie index.
   void BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces);
 
+  // Loads a Trie index serialized by SerializeIndex(). Returns false when
+  // |precompiled_index| was not serialized for the loaded pieces.
+  bool LoadTrie(absl::string_view precompiled_index);
+
+  // Initializes the pieces and the score range from |model_proto|.
+  void InitializeModel(const ModelProto &model_proto);
+
   // The optimized Viterbi encode.
   // Main differences from the original function:
   // 1. Memorizes the best path at each postion so far,
@@ -14,8 +14,11 @@
 
 #include "unigram_model.h"
 
+#include <chrono>
 #include <cmath>
+#include <functional>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -237,6 +240,61 @@ TEST(LatticeTest, NBestTest) {
   EXPECT_EQ(nbests1.size(), 1);
 }
 
+TEST(LatticeTest, NBestLargeAgendaTest) {
+  Lattice lattice;
+  lattice.SetSentence(std::string(100, 'a'));
+
+  // Every segmentation of the same length has the same score, so the
+  // agenda grows big enough to be shrunk several times.
+  for (int pos = 0; pos < lattice.size(); ++pos) {
+    for (int length = 1; length <= 8 && pos + length <= lattice.size();
+         ++length) {
+      InsertWithScore(&lattice, pos, length, -1.0);
+    }
+  }
+
+  constexpr int kNBestSize = 1000;
+  const auto nbests = lattice.NBest(kNBestSize, false, 0.0);
+  EXPECT_EQ(kNBestSize, nbests.size());
+
+  std::set<std::vector<Lattice::Node *>> paths;
+  for (int i = 0; i < nbests.size(); ++i) {
+    if (i > 0) EXPECT_LE(nbests[i].second, nbests[i - 1].second);
+    paths.insert(nbests[i].first);
+  }
+  EXPECT_EQ(kNBestSize, paths.size());
+}
+
+TEST(LatticeTest, ReuseTest) {
+  Lattice lattice;
+  lattice.SetSentence("ABCDE");
+  for (int pos = 0; pos < 5; ++pos) InsertWithScore(&lattice, pos, 1, 0.0);
+  InsertWithScore(&lattice, 0, 5, 1.0);
+  EXPECT_EQ("ABCDE", GetTokenized(lattice.Viterbi().first));
+
+  // The second sentence is shorter and must not see nodes of the first one.
+  lattice.SetSentence("AB");
+  InsertWithScore(&lattice, 0, 1, 0.0);  // A
+  InsertWithScore(&lattice, 1, 1, 0.0);  // B
+  InsertWithScore(&lattice, 0, 2, 1.0);  // AB
+
+  EXPECT_EQ(2, lattice.begin_nodes(0).size());
+  EXPECT_EQ(1, lattice.begin_nodes(1).size());
+  EXPECT_EQ(1, lattice.begin_nodes(2).size());  // EOS
+  EXPECT_EQ(1, lattice.end_nodes(0).size());    // BOS
+  EXPECT_EQ(1, lattice.end_nodes(1).size());
+  EXPECT_EQ(2, lattice.end_nodes(2).size());
+  EXPECT_EQ(1, lattice.eos_node()->node_id);
+
+  EXPECT_EQ("AB", GetTokenized(lattice.Viterbi().first));
+  EXPECT_EQ(2, lattice.NBest(10, false, 0.0).size());
+
+  // Nodes inserted after a query are visible to the next query.
+  InsertWithScore(&lattice, 1, 1, 5.0);  // B
+  EXPECT_EQ(2, lattice.begin_nodes(1).size());
+  EXPECT_EQ("A B", GetTokenized(lattice.Viterbi().first));
+}
+
 TEST(LatticeTest, NBestSampleTest) {
   Lattice lattice;
   lattice.SetSentence("ABC");
@@ -377,20 +435,165 @@ TEST(LatticeTest, ForwardAlgorithmTest) {
         } else if (i == 2) {
           float Z = std::log(std::exp(inv_theta * (0.0 + 0.0)) +
                              std::exp(inv_theta * 0.2));
-          EXPECT_EQ(alpha[node->node_id], Z);
+          EXPECT_NEAR(alpha[node->node_id], Z, 1e-5);
         } else if (i == 3) {
           float Z =
               std::log(std::exp(inv_theta * (0.0 + 0.0 + 0.1)) +  // A + B + C
                        std::exp(inv_theta * (0.2 + 0.1)) +        // AB + C
                        std::exp(inv_theta * (0.0 + 0.5)) +        // A + BC
                        std::exp(inv_theta * 1.0));                // ABC
-          EXPECT_EQ(Z, alpha[node->node_id]);
+          EXPECT_NEAR(Z, alpha[node->node_id], 1e-5);
         }
       }
     }
   }
 }
 
+namespace {
+
+// Scalar reference of the forwards/backwards algorithm, pairwise log-sum-exp
+// over every edge, used to check the batched implementation.
+float ReferenceLogSumExp(float x, float y, bool init_mode) {
+  if (init_mode) return y;
+  const float vmin = std::min(x, y);
+  const float vmax = std::max(x, y);
+  constexpr float kMinusLogEpsilon = 50;
+  if (vmax > vmin + kMinusLogEpsilon) return vmax;
+  return vmax + std::log(std::exp(static_cast<double>(vmin - vmax)) + 1.0);
+}
+
+std::vector<float> ReferenceForwardAlgorithm(const Lattice &lattice,
+                                             float inv_theta, int num_nodes) {
+  std::vector<float> alpha(num_nodes, 0.0);
+  for (int pos = 0; pos <= lattice.size(); ++pos) {
+    for (Lattice::Node *rnode : lattice.begin_nodes(pos)) {
+      for (Lattice::Node *lnode : lattice.end_nodes(pos)) {
+        alpha[rnode->node_id] = ReferenceLogSumExp(
+            alpha[rnode->node_id],
+            inv_theta * lnode->score + alpha[lnode->node_id],
+            lnode == lattice.end_nodes(pos)[0]);
+      }
+    }
+  }
+  return alpha;
+}
+
+std::vector<float> ReferenceBackwardAlgorithm(const Lattice &lattice,
+                                              float inv_theta, int num_nodes) {
+  std::vector<float> beta(num_nodes, 0.0);
+  for (int pos = lattice.size(); pos >= 0; --pos) {
+    for (Lattice::Node *lnode : lattice.end_nodes(pos)) {
+      for (Lattice::Node *rnode : lattice.begin_nodes(pos)) {
+        beta[lnode->node_id] = ReferenceLogSumExp(
+            beta[lnode->node_id], rnode->score + beta[rnode->node_id],
+            rnode == lattice.begin_nodes(pos)[0]);
+      }
+    }
+  }
+  return beta;
+}
+
+float ReferencePopulateMarginal(const Lattice &lattice, float freq,
+                                int num_nodes, std::vector<float> *expected) {
+  const auto alpha = ReferenceForwardAlgorithm(lattice, 1.0, num_nodes);
+  const auto beta = ReferenceBackwardAlgorithm(lattice, 1.0, num_nodes);
+  const float Z = alpha[lattice.eos_node()->node_id];
+  for (int pos = 0; pos < lattice.size(); ++pos) {
+    for (Lattice::Node *node : lattice.begin_nodes(pos)) {
+      if (node->id >= 0) {
+        (*expected)[node->id] +=
+            freq * std::exp(static_cast<double>(alpha[node->node_id] +
+                                                node->score +
+                                                beta[node->node_id] - Z));
+      }
+    }
+  }
+  return freq * Z;
+}
+
+// Builds a dense lattice over |length| characters with pieces up to
+// |max_piece| characters and pseudo-random scores. Returns the node count.
+int BuildDenseLattice(Lattice *lattice, int length, int max_piece) {
+  lattice->SetSentence(std::string(length, 'a'));
+  int id = 0;
+  for (int pos = 0; pos < length; ++pos) {
+    for (int len = 1; len <= max_piece && pos + len <= length; ++len) {
+      const float score = -1.0 - ((pos * 31 + len * 17) % 13) * 0.37;
+      InsertWithScoreAndId(lattice, pos, len, score, id++);
+    }
+  }
+  return id;
+}
+
+}  // namespace
+
+TEST(LatticeTest, ForwardBackwardMatchesReferenceTest) {
+  Lattice lattice;
+  const int num_ids = BuildDenseLattice(&lattice, 64, 12);
+  const int num_nodes = num_ids + 2;  // BOS, EOS
+
+  for (const auto type :
+       {Lattice::kFloatAccumulation, Lattice::kDoubleAccumulation}) {
+    lattice.SetAccumulationType(type);
+    EXPECT_EQ(type, lattice.GetAccumulationType());
+    for (const float inv_theta : {0.0f, 0.3f, 1.0f}) {
+      const auto alpha = lattice.ForwardAlgorithm(inv_theta);
+      const auto beta = lattice.BackwardAlgorithm(inv_theta);
+      const auto ref_alpha =
+          ReferenceForwardAlgorithm(lattice, inv_theta, num_nodes);
+      const auto ref_beta =
+          ReferenceBackwardAlgorithm(lattice, inv_theta, num_nodes);
+      ASSERT_EQ(ref_alpha.size(), alpha.size());
+      ASSERT_EQ(ref_beta.size(), beta.size());
+      for (int i = 0; i < num_nodes; ++i) {
+        const float tolerance = 1e-5 * std::max(1.0f, std::abs(ref_alpha[i]));
+        EXPECT_NEAR(ref_alpha[i], alpha[i], tolerance);
+        EXPECT_NEAR(ref_beta[i], beta[i],
+                    1e-5 * std::max(1.0f, std::abs(ref_beta[i])));
+      }
+    }
+
+    std::vector<float> expected(num_ids, 0.0);
+    std::vector<float> ref_expected(num_ids, 0.0);
+    const float logZ = lattice.PopulateMarginal(2.0, &expected);
+    const float ref_logZ =
+        ReferencePopulateMarginal(lattice, 2.0, num_nodes, &ref_expected);
+    EXPECT_NEAR(ref_logZ, logZ, 1e-4 * std::abs(ref_logZ));
+    for (int i = 0; i < num_ids; ++i) {
+      EXPECT_NEAR(ref_expected[i], expected[i], 1e-4);
+    }
+  }
+}
+
+// Not a correctness test: reports E-step throughput of the batched
+// forwards/backwards pass against the scalar reference.
+TEST(LatticeTest, PopulateMarginalBenchmarkTest) {
+  constexpr int kSentences = 200;
+  Lattice lattice;
+  const int num_ids = BuildDenseLattice(&lattice, 128, 16);
+  const int num_nodes = num_ids + 2;
+  std::vector<float> expected(num_ids, 0.0);
+
+  auto run = [&](const char *name, const std::function<void()> &estep) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSentences; ++i) estep();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    LOG(INFO) << name << ": " << kSentences / elapsed.count()
+              << " sentences/sec";
+  };
+
+  run("reference", [&]() {
+    ReferencePopulateMarginal(lattice, 1.0, num_nodes, &expected);
+  });
+  lattice.SetAccumulationType(Lattice::kDoubleAccumulation);
+  run("double accumulation",
+      [&]() { lattice.PopulateMarginal(1.0, &expected); });
+  lattice.SetAccumulationType(Lattice::kFloatAccumulation);
+  run("float accumulation",
+      [&]() { lattice.PopulateMarginal(1.0, &expected); });
+}
+
 TEST(LatticeTest, PopulateMarginalTest) {
   Lattice lattice;
   lattice.SetSentence("ABC");
@@ -516,6 +719,53 @@ TEST(UnigramModelTest, SetUnigramModelTest) {
             model.model_proto().SerializeAsString());
 }
 
+TEST(UnigramModelTest, PrecompiledIndexTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+
+  AddPiece(&model_proto, "a", 0.1);   // 3
+  AddPiece(&model_proto, "b", 0.2);   // 4
+  AddPiece(&model_proto, "ab", 0.5);  // 5
+  AddPiece(&model_proto, "abc", 1.0);  // 6
+  AddPiece(&model_proto, "c", 0.3);   // 7
+
+  const Model model(model_proto);
+  std::string index;
+  EXPECT_TRUE(model.SerializeIndex(&index).ok());
+
+  const Model precompiled(model_proto, index);
+  EXPECT_TRUE(precompiled.status().ok());
+
+  for (const auto &piece : {"<unk>", "<s>", "</s>", "a", "b", "ab", "abc", "c",
+                            "x", "bc", ""}) {
+    EXPECT_EQ(model.PieceToId(piece), precompiled.PieceToId(piece));
+  }
+
+  EXPECT_EQ(model.Encode("abcabab"), precompiled.Encode("abcabab"));
+
+  std::string reserialized;
+  EXPECT_TRUE(precompiled.SerializeIndex(&reserialized).ok());
+  EXPECT_EQ(index, reserialized);
+
+  // An index of another model, or a broken one, is rejected.
+  ModelProto other_proto = model_proto;
+  AddPiece(&other_proto, "x", 0.4);  // 8
+
+  const Model other(other_proto, index);
+  EXPECT_FALSE(other.status().ok());
+
+  ModelProto renamed_proto = model_proto;
+  renamed_proto.mutable_pieces(3)->set_piece("e");
+
+  const Model renamed(renamed_proto, index);
+  EXPECT_FALSE(renamed.status().ok());
+
+  const Model truncated(model_proto, absl::string_view(index).substr(0, 10));
+  EXPECT_FALSE(truncated.status().ok());
+
+  const Model empty(model_proto, "");
+  EXPECT_FALSE(empty.status().ok());
+}
+
 TEST(UnigramModelTest, SampleEncodeAndScoreTest) {
   // Test whether inclusion probabilities are correct
   ModelProto model_proto = MakeBaseModelProto();
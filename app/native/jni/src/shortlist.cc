@@ -0,0 +1,371 @@
+//
+// Created by Ricardo Snoek on 16/12/2024.
+//
+
+#include <jni.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A compiled shortlist starts with this header, followed by the offsets of the target ids of every
+// source id (one more than there are source ids) and the target ids, most probable first.
+struct ShortlistHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sourceSize;
+    uint32_t targetSize;
+    uint32_t best;
+    uint32_t entries;
+    uint64_t sourceHash;
+};
+
+struct ShortlistIndex {
+    void *data;
+    size_t length;
+    const ShortlistHeader *header;
+    const uint32_t *offsets;
+    const uint32_t *targets;
+};
+
+constexpr char kShortlistMagic[4] = {'V', 'S', 'L', 'T'};
+constexpr uint32_t kShortlistVersion = 1;
+
+static void throwIOException(JNIEnv *env, const std::string &message) {
+    env->ThrowNew(env->FindClass("java/io/IOException"), message.c_str());
+}
+
+static uint64_t hashFile(const char *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Maps the file at [path] read only, returns nullptr and sets errno when it cannot be mapped.
+ */
+static char *mapFile(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        int error = st.st_size == 0 ? EINVAL : errno;
+        close(fd);
+        errno = error;
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) return nullptr;
+
+    *size = st.st_size;
+    return static_cast<char *>(data);
+}
+
+/**
+ * Maps the words of a vocabulary file of null terminated words, each followed by an int, onto the
+ * id of their first occurrence. Returns the number of words.
+ */
+static size_t readVocabulary(const char *data, size_t size,
+                             std::unordered_map<std::string_view, uint32_t> *ids) {
+    const char *ptr = data;
+    const char *end = data + size;
+    uint32_t id = 0;
+    while (ptr < end) {
+        size_t length = strnlen(ptr, end - ptr);
+        ids->emplace(std::string_view(ptr, length), id++);
+        ptr += length + 1 + sizeof(int);
+    }
+    return id;
+}
+
+/**
+ * Reads a lexical table of "target source probability" lines, like the lex.s2t tables Marian
+ * shortlists are made of, into the [best] most probable target ids of every source id. Lines
+ * with tokens that are not in the vocabularies are skipped.
+ */
+static std::vector<std::vector<uint32_t>> readTable(
+        const char *data, size_t size, size_t sourceSize, size_t best,
+        const std::unordered_map<std::string_view, uint32_t> &sourceIds,
+        const std::unordered_map<std::string_view, uint32_t> &targetIds) {
+    std::vector<std::vector<std::pair<float, uint32_t>>> entries(sourceSize);
+
+    const char *ptr = data;
+    const char *end = data + size;
+    while (ptr < end) {
+        const char *lineEnd = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+        if (lineEnd == nullptr) lineEnd = end;
+
+        std::string_view line(ptr, lineEnd - ptr);
+        ptr = lineEnd + 1;
+
+        size_t first = line.find(' ');
+        size_t second = first == std::string_view::npos ? first : line.find(' ', first + 1);
+        if (second == std::string_view::npos) continue;
+
+        auto target = targetIds.find(line.substr(0, first));
+        auto source = sourceIds.find(line.substr(first + 1, second - first - 1));
+        if (target == targetIds.end() || source == sourceIds.end()) continue;
+
+        std::string probability(line.substr(second + 1));
+        entries[source->second].emplace_back(strtof(probability.c_str(), nullptr), target->second);
+    }
+
+    std::vector<std::vector<uint32_t>> table(sourceSize);
+    for (size_t id = 0; id < sourceSize; ++id) {
+        auto &candidates = entries[id];
+        std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+            return a.first > b.first || (!(a.first < b.first) && a.second < b.second);
+        });
+
+        for (size_t i = 0; i < std::min(candidates.size(), best); ++i) {
+            table[id].push_back(candidates[i].second);
+        }
+    }
+
+    return table;
+}
+
+/**
+ * Whether the offsets of every source id ascend within the targets, and every target is an id of
+ * the target vocabulary, so a corrupt shortlist is never read out of bounds.
+ */
+static bool validSections(const ShortlistHeader *header, const uint32_t *offsets,
+                          const uint32_t *targets) {
+    if (offsets[0] != 0 || offsets[header->sourceSize] != header->entries) return false;
+
+    for (uint32_t id = 0; id < header->sourceSize; ++id) {
+        if (offsets[id] > offsets[id + 1]) return false;
+    }
+
+    for (uint32_t j = 0; j < header->entries; ++j) {
+        if (targets[j] >= header->targetSize) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Maps the compiled shortlist at [path], returns nullptr when it cannot be mapped or is not a
+ * complete and consistent shortlist of this version.
+ */
+static ShortlistIndex *openIndex(const char *path) {
+    size_t length = 0;
+    char *data = mapFile(path, &length);
+    if (data == nullptr) return nullptr;
+
+    auto *header = reinterpret_cast<const ShortlistHeader *>(data);
+    bool valid = length >= sizeof(ShortlistHeader) &&
+                 memcmp(header->magic, kShortlistMagic, sizeof(kShortlistMagic)) == 0 &&
+                 header->version == kShortlistVersion &&
+                 length == sizeof(ShortlistHeader) +
+                           (static_cast<size_t>(header->sourceSize) + 1 + header->entries) *
+                           sizeof(uint32_t);
+
+    auto *offsets = reinterpret_cast<const uint32_t *>(data + sizeof(ShortlistHeader));
+    if (valid) {
+        valid = validSections(header, offsets, offsets + header->sourceSize + 1);
+    }
+
+    if (!valid) {
+        munmap(data, length);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    auto *index = new ShortlistIndex();
+    index->data = data;
+    index->length = length;
+    index->header = header;
+    index->offsets = offsets;
+    index->targets = offsets + header->sourceSize + 1;
+    return index;
+}
+
+static void closeIndex(ShortlistIndex *index) {
+    munmap(index->data, index->length);
+    delete index;
+}
+
+static bool writeIndex(const char *path, const std::vector<std::vector<uint32_t>> &table,
+                       uint32_t targetSize, uint32_t best, uint64_t sourceHash) {
+    ShortlistHeader header{};
+    memcpy(header.magic, kShortlistMagic, sizeof(kShortlistMagic));
+    header.version = kShortlistVersion;
+    header.sourceSize = static_cast<uint32_t>(table.size());
+    header.targetSize = targetSize;
+    header.best = best;
+    header.sourceHash = sourceHash;
+
+    std::vector<uint32_t> offsets(table.size() + 1);
+    std::vector<uint32_t> targets;
+    for (size_t id = 0; id < table.size(); ++id) {
+        offsets[id] = static_cast<uint32_t>(targets.size());
+        targets.insert(targets.end(), table[id].begin(), table[id].end());
+    }
+    offsets[table.size()] = static_cast<uint32_t>(targets.size());
+    header.entries = static_cast<uint32_t>(targets.size());
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) return false;
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), file) == offsets.size() &&
+                   fwrite(targets.data(), sizeof(uint32_t), targets.size(), file) == targets.size();
+
+    return fclose(file) == 0 && written;
+}
+
+/**
+ * Checks that the shortlist lists exactly the target ids of [table] for every source id.
+ */
+static bool validateIndex(const ShortlistIndex *index,
+                          const std::vector<std::vector<uint32_t>> &table) {
+    if (index->header->sourceSize != table.size()) return false;
+
+    for (size_t id = 0; id < table.size(); ++id) {
+        const uint32_t *begin = index->targets + index->offsets[id];
+        const uint32_t *end = index->targets + index->offsets[id + 1];
+        if (!std::equal(begin, end, table[id].begin(), table[id].end())) return false;
+    }
+
+    return true;
+}
+
+static std::string toString(JNIEnv *env, jstring string) {
+    const char *chars = env->GetStringUTFChars(string, nullptr);
+    std::string result(chars);
+    env->ReleaseStringUTFChars(string, chars);
+    return result;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_Shortlist_compile(JNIEnv *env, jobject,
+                                                             jstring lexicalTablePath,
+                                                             jstring sourceVocabularyPath,
+                                                             jstring targetVocabularyPath,
+                                                             jstring indexPath,
+                                                             jint best) {
+    std::string paths[] = {
+            toString(env, lexicalTablePath),
+            toString(env, sourceVocabularyPath),
+            toString(env, targetVocabularyPath),
+    };
+    std::string destination = toString(env, indexPath);
+
+    char *data[3] = {nullptr, nullptr, nullptr};
+    size_t sizes[3] = {0, 0, 0};
+    for (int i = 0; i < 3; ++i) {
+        data[i] = mapFile(paths[i].c_str(), &sizes[i]);
+        if (data[i] == nullptr) {
+            throwIOException(env, "Failed to open " + paths[i] + ": " + strerror(errno));
+            for (int j = 0; j < i; ++j) munmap(data[j], sizes[j]);
+            return;
+        }
+    }
+
+    std::unordered_map<std::string_view, uint32_t> sourceIds;
+    std::unordered_map<std::string_view, uint32_t> targetIds;
+    size_t sourceSize = readVocabulary(data[1], sizes[1], &sourceIds);
+    size_t targetSize = readVocabulary(data[2], sizes[2], &targetIds);
+
+    std::vector<std::vector<uint32_t>> table = readTable(
+            data[0], sizes[0], sourceSize, std::max(best, 1), sourceIds, targetIds);
+    std::string temporary = destination + ".tmp";
+
+    bool written = writeIndex(temporary.c_str(), table, targetSize, std::max(best, 1),
+                              hashFile(data[0], sizes[0]));
+    ShortlistIndex *index = written ? openIndex(temporary.c_str()) : nullptr;
+    bool valid = index != nullptr && validateIndex(index, table);
+
+    if (index != nullptr) closeIndex(index);
+    for (int i = 0; i < 3; ++i) munmap(data[i], sizes[i]);
+
+    if (!written || !valid || rename(temporary.c_str(), destination.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throwIOException(env, "Failed to compile " + paths[0] + " into " + destination);
+    }
+}
+
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_inference_ShortlistIndex_open(JNIEnv *env, jobject,
+                                                               jstring filePath) {
+    std::string path = toString(env, filePath);
+    ShortlistIndex *index = openIndex(path.c_str());
+    if (index == nullptr) {
+        throwIOException(env, "Failed to open " + path + ": " + strerror(errno));
+    }
+
+    return (jlong) index;
+}
+
+JNIEXPORT jintArray JNICALL
+Java_app_versta_translate_bridge_inference_ShortlistIndex_candidates(JNIEnv *env, jobject,
+                                                                     jlong handle,
+                                                                     jlongArray inputIds,
+                                                                     jlongArray specialIds,
+                                                                     jint first) {
+    auto *index = (ShortlistIndex *) handle;
+    uint32_t targetSize = index->header->targetSize;
+
+    // Marks the candidates, so the result comes out sorted without sorting it.
+    std::vector<uint8_t> selected(targetSize, 0);
+    for (uint32_t id = 0; id < std::min<uint32_t>(std::max(first, 0), targetSize); ++id) {
+        selected[id] = 1;
+    }
+
+    jsize specialCount = env->GetArrayLength(specialIds);
+    jlong *specials = env->GetLongArrayElements(specialIds, nullptr);
+    for (jsize i = 0; i < specialCount; ++i) {
+        if (specials[i] >= 0 && specials[i] < targetSize) selected[specials[i]] = 1;
+    }
+    env->ReleaseLongArrayElements(specialIds, specials, JNI_ABORT);
+
+    jsize inputCount = env->GetArrayLength(inputIds);
+    jlong *inputs = env->GetLongArrayElements(inputIds, nullptr);
+    for (jsize i = 0; i < inputCount; ++i) {
+        if (inputs[i] < 0 || inputs[i] >= index->header->sourceSize) continue;
+
+        for (uint32_t j = index->offsets[inputs[i]]; j < index->offsets[inputs[i] + 1]; ++j) {
+            selected[index->targets[j]] = 1;
+        }
+    }
+    env->ReleaseLongArrayElements(inputIds, inputs, JNI_ABORT);
+
+    std::vector<jint> candidates;
+    for (uint32_t id = 0; id < targetSize; ++id) {
+        if (selected[id]) candidates.push_back((jint) id);
+    }
+
+    jintArray result = env->NewIntArray((jsize) candidates.size());
+    env->SetIntArrayRegion(result, 0, (jsize) candidates.size(), candidates.data());
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_inference_ShortlistIndex_close(JNIEnv *env, jobject,
+                                                                jlong handle) {
+    closeIndex((ShortlistIndex *) handle);
+}
+#ifdef __cplusplus
+}
+#endif
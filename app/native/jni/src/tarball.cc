@@ -0,0 +1,658 @@
+//
+// Created by Ricardo Snoek on 16/12/2024.
+//
+
+#include <jni.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Compressed data is read, and inflated data is written, in chunks of this size.
+constexpr size_t kBufferSize = 1024 * 1024;
+constexpr size_t kBlockSize = 512;
+
+// Progress is reported at most once per this many inflated bytes, and at every entry.
+constexpr uint64_t kProgressInterval = 4 * 1024 * 1024;
+
+class Sha256 {
+public:
+    Sha256() {
+        reset();
+    }
+
+    void reset() {
+        state[0] = 0x6a09e667;
+        state[1] = 0xbb67ae85;
+        state[2] = 0x3c6ef372;
+        state[3] = 0xa54ff53a;
+        state[4] = 0x510e527f;
+        state[5] = 0x9b05688c;
+        state[6] = 0x1f83d9ab;
+        state[7] = 0x5be0cd19;
+        length = 0;
+        pending = 0;
+    }
+
+    void update(const uint8_t *data, size_t size) {
+        length += size;
+
+        if (pending > 0) {
+            size_t count = std::min(size, sizeof(block) - pending);
+            std::memcpy(block + pending, data, count);
+            pending += count;
+            data += count;
+            size -= count;
+
+            if (pending < sizeof(block)) {
+                return;
+            }
+            transform(block);
+            pending = 0;
+        }
+
+        for (; size >= sizeof(block); data += sizeof(block), size -= sizeof(block)) {
+            transform(data);
+        }
+
+        std::memcpy(block, data, size);
+        pending = size;
+    }
+
+    std::string hex() {
+        uint64_t bits = length * 8;
+
+        uint8_t padding[sizeof(block) * 2] = {0x80};
+        size_t paddingSize = (pending < 56 ? 56 : 120) - pending;
+
+        uint8_t lengthBytes[8];
+        for (int i = 0; i < 8; ++i) {
+            lengthBytes[i] = (uint8_t) (bits >> (56 - 8 * i));
+        }
+
+        update(padding, paddingSize);
+        update(lengthBytes, sizeof(lengthBytes));
+
+        char result[65];
+        for (int i = 0; i < 8; ++i) {
+            snprintf(result + i * 8, 9, "%08x", state[i]);
+        }
+
+        return {result, 64};
+    }
+
+private:
+    static uint32_t rotate(uint32_t value, int bits) {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    void transform(const uint8_t *data) {
+        static constexpr uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+                0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+                0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+                0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+                0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+                0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+                0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+                0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+                0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t) data[i * 4] << 24 | (uint32_t) data[i * 4 + 1] << 16 |
+                   (uint32_t) data[i * 4 + 2] << 8 | (uint32_t) data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; ++i) {
+            uint32_t s1 = rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + k[i] + w[i];
+            uint32_t s0 = rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    uint32_t state[8]{};
+    uint8_t block[64]{};
+    uint64_t length = 0;
+    size_t pending = 0;
+};
+
+struct TarballListener {
+    std::function<void(const std::string &path, uint64_t extracted, uint64_t total)> onProgress;
+    std::function<void(const std::string &path, const std::string &sha256)> onFileExtracted;
+};
+
+// Extracts a tar stream as it is inflated, without seeking. Regular files are written with a
+// single preallocation and large writes, and hashed while they are written.
+class TarballExtractor {
+public:
+    TarballExtractor(std::string outputDirectory, TarballListener listener)
+            : outputDirectory(std::move(outputDirectory)), listener(std::move(listener)) {}
+
+    ~TarballExtractor() {
+        if (fileDescriptor >= 0) {
+            close(fileDescriptor);
+        }
+    }
+
+    // Extracts the gzip compressed tarball read from fd. Throws std::runtime_error on failure.
+    void extract(int fd) {
+        total = uncompressedSize(fd);
+
+        z_stream stream{};
+        if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("Failed to initialize the decompressor");
+        }
+        std::unique_ptr<z_stream, int (*)(z_stream *)> streamGuard(&stream, inflateEnd);
+
+        std::unique_ptr<uint8_t[]> input(new uint8_t[kBufferSize]);
+        std::unique_ptr<uint8_t[]> output(new uint8_t[kBufferSize]);
+
+        int status = Z_OK;
+        while (!finished) {
+            if (stream.avail_in == 0) {
+                ssize_t count = readFully(fd, input.get(), kBufferSize);
+                if (count == 0) {
+                    break;
+                }
+
+                stream.next_in = input.get();
+                stream.avail_in = (uInt) count;
+            }
+
+            // Archives can be made of several concatenated gzip members.
+            if (status == Z_STREAM_END) {
+                if (inflateReset(&stream) != Z_OK) {
+                    throw std::runtime_error("Failed to reset the decompressor");
+                }
+            }
+
+            stream.next_out = output.get();
+            stream.avail_out = kBufferSize;
+
+            status = inflate(&stream, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END) {
+                throw std::runtime_error(std::string("Corrupt archive: ") +
+                                         (stream.msg != nullptr ? stream.msg : "inflate failed"));
+            }
+
+            consume(output.get(), kBufferSize - stream.avail_out);
+        }
+
+        if (!finished && (status != Z_STREAM_END || state != State::Header || headerSize != 0)) {
+            throw std::runtime_error("Archive is truncated");
+        }
+
+        reportProgress(true);
+    }
+
+private:
+    enum class State {
+        Header,
+        Data,
+        Padding,
+        LongName,
+        PaxHeader,
+    };
+
+    // The gzip trailer holds the uncompressed size modulo 2^32, which is exact for any model
+    // package that fits on a phone. Returns 0 when the input cannot be read at an offset.
+    static uint64_t uncompressedSize(int fd) {
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 18) {
+            return 0;
+        }
+
+        uint8_t trailer[4];
+        if (pread(fd, trailer, sizeof(trailer), st.st_size - 4) != sizeof(trailer)) {
+            return 0;
+        }
+
+        return (uint64_t) trailer[0] | (uint64_t) trailer[1] << 8 |
+               (uint64_t) trailer[2] << 16 | (uint64_t) trailer[3] << 24;
+    }
+
+    static ssize_t readFully(int fd, uint8_t *buffer, size_t size) {
+        size_t offset = 0;
+        while (offset < size) {
+            ssize_t count = read(fd, buffer + offset, size - offset);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                throw std::runtime_error(std::string("Failed to read archive: ") +
+                                         strerror(errno));
+            }
+            if (count == 0) {
+                break;
+            }
+            offset += count;
+        }
+        return (ssize_t) offset;
+    }
+
+    void consume(const uint8_t *data, size_t size) {
+        extracted += size;
+
+        while (size > 0 && !finished) {
+            switch (state) {
+                case State::Header: {
+                    size_t count = std::min(size, kBlockSize - headerSize);
+                    std::memcpy(header + headerSize, data, count);
+                    headerSize += count;
+                    data += count;
+                    size -= count;
+
+                    if (headerSize == kBlockSize) {
+                        headerSize = 0;
+                        parseHeader();
+                    }
+                    break;
+                }
+                case State::Data:
+                case State::LongName:
+                case State::PaxHeader: {
+                    size_t count = (size_t) std::min<uint64_t>(size, remaining);
+                    if (state == State::Data) {
+                        writeFile(data, count);
+                    } else {
+                        extension.append((const char *) data, count);
+                    }
+                    data += count;
+                    size -= count;
+                    remaining -= count;
+
+                    if (remaining == 0) {
+                        finishEntry();
+                    }
+                    break;
+                }
+                case State::Padding: {
+                    size_t count = (size_t) std::min<uint64_t>(size, remaining);
+                    data += count;
+                    size -= count;
+                    remaining -= count;
+
+                    if (remaining == 0) {
+                        state = State::Header;
+                    }
+                    break;
+                }
+            }
+        }
+
+        reportProgress(false);
+    }
+
+    void parseHeader() {
+        bool empty = true;
+        for (unsigned char byte: header) {
+            if (byte != 0) {
+                empty = false;
+                break;
+            }
+        }
+
+        // The archive ends with two empty blocks, one is enough to stop.
+        if (empty) {
+            finished = true;
+            return;
+        }
+
+        uint64_t size = parseNumber(header + 124, 12);
+        char type = (char) header[156];
+
+        entryPadding = (kBlockSize - size % kBlockSize) % kBlockSize;
+        remaining = size;
+
+        // GNU long names and pax headers describe the entry that follows them.
+        if (type == 'L' || type == 'x' || type == 'g') {
+            state = type == 'L' ? State::LongName : State::PaxHeader;
+            extensionType = type;
+            extension.clear();
+
+            if (size == 0) {
+                finishEntry();
+            }
+            return;
+        }
+
+        std::string name;
+        if (!pendingName.empty()) {
+            name = pendingName;
+            pendingName.clear();
+        } else {
+            name = field(header, 100);
+            if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != 0) {
+                name = field(header + 345, 155) + "/" + name;
+            }
+        }
+
+        switch (type) {
+            case '5':
+                makeDirectories(name);
+                skip(size);
+                break;
+            case '0':
+            case '\0':
+            case '7':
+                openFile(name, size);
+                break;
+            default:
+                // Links and devices are not part of model packages.
+                skip(size);
+                break;
+        }
+    }
+
+    void finishEntry() {
+        if (state == State::Data) {
+            closeFile();
+        } else if (state == State::LongName) {
+            pendingName = extension.c_str();
+        } else if (state == State::PaxHeader && extensionType == 'x') {
+            std::string path = paxPath(extension);
+            if (!path.empty()) {
+                pendingName = path;
+            }
+        }
+
+        remaining = entryPadding;
+        state = remaining > 0 ? State::Padding : State::Header;
+    }
+
+    void skip(uint64_t size) {
+        remaining = size + entryPadding;
+        state = remaining > 0 ? State::Padding : State::Header;
+    }
+
+    void openFile(const std::string &name, uint64_t size) {
+        currentName = name;
+        std::string path = resolve(name);
+
+        size_t separator = name.rfind('/');
+        if (separator != std::string::npos) {
+            makeDirectories(name.substr(0, separator));
+        }
+
+        fileDescriptor = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fileDescriptor < 0) {
+            throw std::runtime_error("Failed to create " + name + ": " + strerror(errno));
+        }
+
+        // Reserves the whole file up front, so it is laid out in one piece and a full disk is
+        // noticed before anything is written.
+        if (size > 0) {
+            int result = posix_fallocate(fileDescriptor, 0, (off_t) size);
+            if (result == ENOSPC) {
+                throw std::runtime_error("Not enough space to extract " + name);
+            }
+        }
+
+        sha256.reset();
+        reportProgress(true);
+
+        if (size == 0) {
+            closeFile();
+            state = State::Header;
+            return;
+        }
+
+        state = State::Data;
+    }
+
+    void writeFile(const uint8_t *data, size_t size) {
+        sha256.update(data, size);
+
+        while (size > 0) {
+            ssize_t count = write(fileDescriptor, data, size);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                throw std::runtime_error("Failed to write " + currentName + ": " +
+                                         strerror(errno));
+            }
+            data += count;
+            size -= count;
+        }
+    }
+
+    void closeFile() {
+        if (fileDescriptor < 0) {
+            return;
+        }
+
+        close(fileDescriptor);
+        fileDescriptor = -1;
+
+        if (listener.onFileExtracted) {
+            listener.onFileExtracted(currentName, sha256.hex());
+        }
+    }
+
+    void reportProgress(bool force) {
+        if (!listener.onProgress) {
+            return;
+        }
+        if (!force && extracted - reported < kProgressInterval) {
+            return;
+        }
+
+        reported = extracted;
+        listener.onProgress(currentName, extracted, std::max(total, extracted));
+    }
+
+    // Rejects absolute paths and parent references, so entries cannot escape the output
+    // directory.
+    std::string resolve(const std::string &name) const {
+        if (name.empty() || name[0] == '/') {
+            throw std::runtime_error("Invalid entry name " + name);
+        }
+
+        size_t start = 0;
+        while (start <= name.size()) {
+            size_t end = name.find('/', start);
+            if (end == std::string::npos) end = name.size();
+
+            if (name.compare(start, end - start, "..") == 0) {
+                throw std::runtime_error("Invalid entry name " + name);
+            }
+            start = end + 1;
+        }
+
+        return outputDirectory + "/" + name;
+    }
+
+    // Creates the directories of an entry name, the output directory itself has to exist.
+    void makeDirectories(const std::string &name) const {
+        resolve(name);
+
+        for (size_t i = 1; i <= name.size(); ++i) {
+            if (i != name.size() && name[i] != '/') {
+                continue;
+            }
+
+            std::string directory = outputDirectory + "/" + name.substr(0, i);
+            if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+                throw std::runtime_error("Failed to create " + directory + ": " +
+                                         strerror(errno));
+            }
+        }
+    }
+
+    static std::string field(const uint8_t *data, size_t size) {
+        size_t length = 0;
+        while (length < size && data[length] != 0) {
+            length++;
+        }
+        return {(const char *) data, length};
+    }
+
+    // Octal, or base-256 for sizes of 8GiB and up.
+    static uint64_t parseNumber(const uint8_t *data, size_t size) {
+        uint64_t value = 0;
+
+        if (data[0] & 0x80) {
+            for (size_t i = 1; i < size; ++i) {
+                value = value << 8 | data[i];
+            }
+            return value;
+        }
+
+        for (size_t i = 0; i < size; ++i) {
+            if (data[i] >= '0' && data[i] <= '7') {
+                value = value * 8 + (data[i] - '0');
+            } else if (data[i] != ' ' || value != 0) {
+                break;
+            }
+        }
+        return value;
+    }
+
+    // Records are formatted as "<length> <key>=<value>\n".
+    static std::string paxPath(const std::string &records) {
+        size_t offset = 0;
+        while (offset < records.size()) {
+            size_t space = records.find(' ', offset);
+            if (space == std::string::npos) break;
+
+            size_t length = std::strtoul(records.c_str() + offset, nullptr, 10);
+            if (length == 0 || offset + length > records.size()) break;
+
+            std::string record = records.substr(space + 1, offset + length - space - 2);
+            if (record.rfind("path=", 0) == 0) {
+                return record.substr(5);
+            }
+
+            offset += length;
+        }
+        return {};
+    }
+
+    std::string outputDirectory;
+    TarballListener listener;
+
+    State state = State::Header;
+    bool finished = false;
+
+    uint8_t header[kBlockSize]{};
+    size_t headerSize = 0;
+    uint64_t remaining = 0;
+    uint64_t entryPadding = 0;
+
+    char extensionType = 0;
+    std::string extension;
+    std::string pendingName;
+
+    std::string currentName;
+    int fileDescriptor = -1;
+    Sha256 sha256;
+
+    uint64_t extracted = 0;
+    uint64_t reported = 0;
+    uint64_t total = 0;
+};
+
+static void throwIOException(JNIEnv *env, const std::string &message) {
+    env->ThrowNew(env->FindClass("java/io/IOException"), message.c_str());
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_archive_Tarball_extract(
+        JNIEnv *env,
+        jobject,
+        jint fd,
+        jstring outputDirectory,
+        jobject listener
+) {
+    const char *nativeOutputDirectory = env->GetStringUTFChars(outputDirectory, nullptr);
+    std::string directory(nativeOutputDirectory);
+    env->ReleaseStringUTFChars(outputDirectory, nativeOutputDirectory);
+
+    jclass listenerClass = env->GetObjectClass(listener);
+    jmethodID onProgress = env->GetMethodID(listenerClass, "onProgress",
+                                            "(Ljava/lang/String;JJ)V");
+    jmethodID onFileExtracted = env->GetMethodID(listenerClass, "onFileExtracted",
+                                                 "(Ljava/lang/String;Ljava/lang/String;)V");
+
+    // Stops at the first exception thrown by the listener.
+    auto checkException = [env]() {
+        if (env->ExceptionCheck()) {
+            throw std::runtime_error("");
+        }
+    };
+
+    TarballListener callbacks;
+    callbacks.onProgress = [&](const std::string &path, uint64_t extracted, uint64_t total) {
+        jstring jPath = env->NewStringUTF(path.c_str());
+        env->CallVoidMethod(listener, onProgress, jPath, (jlong) extracted, (jlong) total);
+        env->DeleteLocalRef(jPath);
+        checkException();
+    };
+    callbacks.onFileExtracted = [&](const std::string &path, const std::string &sha256) {
+        jstring jPath = env->NewStringUTF(path.c_str());
+        jstring jSha256 = env->NewStringUTF(sha256.c_str());
+        env->CallVoidMethod(listener, onFileExtracted, jPath, jSha256);
+        env->DeleteLocalRef(jPath);
+        env->DeleteLocalRef(jSha256);
+        checkException();
+    };
+
+    try {
+        TarballExtractor extractor(directory, callbacks);
+        extractor.extract(fd);
+    } catch (const std::exception &e) {
+        if (!env->ExceptionCheck()) {
+            throwIOException(env, e.what());
+        }
+    }
+}
+#ifdef __cplusplus
+}
+#endif
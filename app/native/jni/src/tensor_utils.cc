@@ -3,6 +3,9 @@
 //
 
 #include <jni.h>
+#include <cstring>
+
+#include "OrtJniUtil.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +18,124 @@ extern "C" JNIEXPORT void JNICALL Java_app_versta_translate_bridge_inference_Ten
     auto *alloc = (uint8_t *) env->GetLongField(buffer, env->GetFieldID(env->FindClass("java/nio/Buffer"), "address", "J"));
     delete[] alloc;
 }
+
+JNIEXPORT jobject JNICALL Java_app_versta_translate_bridge_inference_TensorUtils_repeatBuffer(
+        JNIEnv *env,
+        jobject,
+        jlong apiHandle,
+        jlong tensorHandle,
+        jint count
+) {
+    const auto *api = (const OrtApi *) apiHandle;
+    auto *ortValue = (OrtValue *) tensorHandle;
+
+    JavaTensorTypeShape typeShape;
+    OrtErrorCode code = getTensorTypeShape(env, &typeShape, api, ortValue);
+    if (code != ORT_OK) {
+        return nullptr;
+    }
+
+    uint8_t *data = nullptr;
+    code = checkOrtStatus(env, api, api->GetTensorMutableData(ortValue, (void **) &data));
+    if (code != ORT_OK) {
+        return nullptr;
+    }
+
+    size_t sizeBytes = typeShape.elementCount * onnxTypeSize(typeShape.onnxTypeEnum);
+
+    // Freed by closeBuffer, like the buffers of the beam search.
+    auto *repeated = new uint8_t[sizeBytes * count];
+    for (jint i = 0; i < count; ++i) {
+        std::memcpy(repeated + i * sizeBytes, data, sizeBytes);
+    }
+
+    return env->NewDirectByteBuffer(repeated, (jlong) (sizeBytes * count));
+}
+
+JNIEXPORT jobject JNICALL Java_app_versta_translate_bridge_inference_TensorUtils_sliceBuffer(
+        JNIEnv *env,
+        jobject,
+        jlong apiHandle,
+        jlong tensorHandle,
+        jint row,
+        jint length,
+        jint count
+) {
+    const auto *api = (const OrtApi *) apiHandle;
+    auto *ortValue = (OrtValue *) tensorHandle;
+
+    OrtTensorTypeAndShapeInfo *info = nullptr;
+    OrtErrorCode code = checkOrtStatus(env, api, api->GetTensorTypeAndShape(ortValue, &info));
+    if (code != ORT_OK) {
+        return nullptr;
+    }
+
+    size_t dimensions = 0;
+    int64_t shape[3] = {0, 0, 0};
+    ONNXTensorElementDataType type = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+    code = checkOrtStatus(env, api, api->GetDimensionsCount(info, &dimensions));
+    if (code == ORT_OK && dimensions == 3) {
+        code = checkOrtStatus(env, api, api->GetDimensions(info, shape, 3));
+    }
+    if (code == ORT_OK) {
+        code = checkOrtStatus(env, api, api->GetTensorElementType(info, &type));
+    }
+    api->ReleaseTensorTypeAndShapeInfo(info);
+
+    // Shape: [batch, sequence_length, hidden_size]
+    if (code != ORT_OK || dimensions != 3 || row < 0 || row >= shape[0] || length <= 0 ||
+        length > shape[1] || count <= 0) {
+        return nullptr;
+    }
+
+    uint8_t *data = nullptr;
+    code = checkOrtStatus(env, api, api->GetTensorMutableData(ortValue, (void **) &data));
+    if (code != ORT_OK) {
+        return nullptr;
+    }
+
+    size_t positionBytes = shape[2] * onnxTypeSize(type);
+    size_t sizeBytes = length * positionBytes;
+    const uint8_t *source = data + row * shape[1] * positionBytes;
+
+    // Freed by closeBuffer, like the repeated buffers.
+    auto *sliced = new uint8_t[sizeBytes * count];
+    for (jint i = 0; i < count; ++i) {
+        std::memcpy(sliced + i * sizeBytes, source, sizeBytes);
+    }
+
+    return env->NewDirectByteBuffer(sliced, (jlong) (sizeBytes * count));
+}
+
+JNIEXPORT jboolean JNICALL Java_app_versta_translate_bridge_inference_TensorUtils_registerSharedAllocator(
+        JNIEnv *env,
+        jobject,
+        jlong apiHandle,
+        jlong environmentHandle
+) {
+    const auto *api = (const OrtApi *) apiHandle;
+    auto *ortEnv = (OrtEnv *) environmentHandle;
+
+    OrtMemoryInfo *memoryInfo = nullptr;
+    OrtErrorCode code = checkOrtStatus(env, api, api->CreateCpuMemoryInfo(OrtArenaAllocator,
+                                                                        OrtMemTypeDefault,
+                                                                        &memoryInfo));
+    if (code != ORT_OK) {
+        return JNI_FALSE;
+    }
+
+    // Fails when an allocator is already registered with the environment, which is fine as
+    // sessions will share that one instead.
+    OrtStatus *status = api->CreateAndRegisterAllocator(ortEnv, memoryInfo, nullptr);
+    api->ReleaseMemoryInfo(memoryInfo);
+
+    if (status != nullptr) {
+        api->ReleaseStatus(status);
+        return JNI_FALSE;
+    }
+
+    return JNI_TRUE;
+}
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,705 @@
+//
+// Created by Ricardo Snoek on 16/12/2024.
+//
+
+#include <jni.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The memory file starts with this header, followed by the records written so far up to `end`.
+// The file is grown ahead of the records and mapped completely, records are appended by copying
+// them into the mapping.
+struct MemoryHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t end;
+};
+
+// Every record is followed by its key and value, padded to a multiple of eight bytes. Later
+// records replace earlier ones with the same key, a record with kTombstone as value size removes
+// the entry.
+struct RecordHeader {
+    uint64_t hash;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+struct Slot {
+    uint64_t hash;
+    // Offset of the record in the file, zero marks an empty slot as no record starts there.
+    uint64_t offset;
+    // Reference bit of the CLOCK eviction, set when the entry is read or written.
+    bool referenced;
+};
+
+/**
+ * Translation memory backed by an append-only log of records. The index over the log is kept in
+ * memory, as open addressing hash table of the record hashes, and rebuilt from the log when the
+ * memory is opened.
+ */
+struct TranslationMemory {
+    std::mutex mutex;
+    std::string path;
+    int fd;
+    char *data;
+    size_t capacity;
+
+    size_t maxEntries;
+    size_t maxBytes;
+
+    std::vector<Slot> slots;
+    size_t entries;
+    // Size of the records of all entries, everything else in the log is garbage.
+    size_t liveBytes;
+    size_t hand;
+};
+
+constexpr char kMemoryMagic[4] = {'V', 'T', 'M', 'F'};
+constexpr uint32_t kMemoryVersion = 1;
+constexpr uint32_t kTombstone = UINT32_MAX;
+
+// Files are grown by at least this many bytes, and only compacted once they hold at least this
+// much garbage.
+constexpr size_t kGrowthSize = 64 * 1024;
+constexpr size_t kCompactionSize = 64 * 1024;
+
+// Separates the language pair from the source text in a key.
+constexpr char kKeySeparator = '\x1f';
+
+static void throwIOException(JNIEnv *env, const std::string &message) {
+    env->ThrowNew(env->FindClass("java/io/IOException"), message.c_str());
+}
+
+static inline uint64_t mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint64_t hashBytes(const char *data, size_t size, uint64_t seed) {
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ULL;
+
+    uint64_t hash = seed ^ (size * prime);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ mix(word)) * prime;
+        hash = (hash << 31) | (hash >> 33);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash = (hash ^ mix(tail)) * prime;
+
+    return mix(hash);
+}
+
+static uint32_t checksum(const char *data, size_t size) {
+    return static_cast<uint32_t>(hashBytes(data, size, 0x5bd1e995ULL));
+}
+
+static inline size_t recordSize(uint32_t keySize, uint32_t valueSize) {
+    size_t size = sizeof(RecordHeader) + keySize + (valueSize == kTombstone ? 0 : valueSize);
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static inline MemoryHeader *header(TranslationMemory *memory) {
+    return reinterpret_cast<MemoryHeader *>(memory->data);
+}
+
+static inline const RecordHeader *record(TranslationMemory *memory, uint64_t offset) {
+    return reinterpret_cast<const RecordHeader *>(memory->data + offset);
+}
+
+static inline std::string_view recordKey(TranslationMemory *memory, uint64_t offset) {
+    return {memory->data + offset + sizeof(RecordHeader), record(memory, offset)->keySize};
+}
+
+static inline std::string_view recordValue(TranslationMemory *memory, uint64_t offset) {
+    const RecordHeader *entry = record(memory, offset);
+    return {memory->data + offset + sizeof(RecordHeader) + entry->keySize, entry->valueSize};
+}
+
+static std::string makeKey(std::string_view languages, std::string_view source) {
+    std::string key;
+    key.reserve(languages.size() + 1 + source.size());
+    key.append(languages).push_back(kKeySeparator);
+    key.append(source);
+    return key;
+}
+
+/**
+ * Maps [capacity] bytes of the file, growing the file when it is smaller.
+ */
+static bool mapMemory(TranslationMemory *memory, size_t capacity) {
+    struct stat st{};
+    if (fstat(memory->fd, &st) != 0) return false;
+    if (static_cast<size_t>(st.st_size) < capacity && ftruncate(memory->fd, capacity) != 0) {
+        return false;
+    }
+
+    void *data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, memory->fd, 0);
+    if (data == MAP_FAILED) return false;
+
+    if (memory->data != nullptr) munmap(memory->data, memory->capacity);
+    memory->data = static_cast<char *>(data);
+    memory->capacity = capacity;
+    return true;
+}
+
+/**
+ * Returns the slot holding [key], or the empty slot it would be inserted in.
+ */
+static size_t findSlot(TranslationMemory *memory, uint64_t hash, std::string_view key) {
+    size_t mask = memory->slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot &slot = memory->slots[i];
+        if (slot.offset == 0) return i;
+        if (slot.hash == hash && recordKey(memory, slot.offset) == key) return i;
+    }
+}
+
+static void rehash(TranslationMemory *memory, size_t size) {
+    std::vector<Slot> slots(size);
+    std::swap(slots, memory->slots);
+
+    size_t mask = size - 1;
+    for (const Slot &slot: slots) {
+        if (slot.offset == 0) continue;
+
+        size_t i = slot.hash & mask;
+        while (memory->slots[i].offset != 0) i = (i + 1) & mask;
+        memory->slots[i] = slot;
+    }
+    memory->hand = 0;
+}
+
+/**
+ * Empties slot [i], shifting back the slots probed past it so that lookups need no tombstones.
+ */
+static void eraseSlot(TranslationMemory *memory, size_t i) {
+    size_t mask = memory->slots.size() - 1;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        const Slot &slot = memory->slots[j];
+        if (slot.offset == 0) break;
+
+        // Moves the slot unless its home lies cyclically in (i, j].
+        size_t home = slot.hash & mask;
+        bool between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!between) {
+            memory->slots[i] = slot;
+            i = j;
+        }
+    }
+    memory->slots[i] = Slot{};
+}
+
+/**
+ * Appends a record to the log, returns its offset or zero when the file cannot be grown.
+ */
+static uint64_t appendRecord(TranslationMemory *memory, uint64_t hash, std::string_view key,
+                             std::string_view value, bool tombstone) {
+    uint32_t valueSize = tombstone ? kTombstone : static_cast<uint32_t>(value.size());
+    size_t size = recordSize(key.size(), valueSize);
+    uint64_t offset = header(memory)->end;
+
+    if (offset + size > memory->capacity) {
+        size_t capacity = std::max(memory->capacity * 2, offset + size + kGrowthSize);
+        if (!mapMemory(memory, capacity)) return 0;
+    }
+
+    std::string payload;
+    payload.reserve(key.size() + value.size());
+    payload.append(key).append(tombstone ? std::string_view() : value);
+
+    RecordHeader entry{};
+    entry.hash = hash;
+    entry.keySize = key.size();
+    entry.valueSize = valueSize;
+    entry.checksum = checksum(payload.data(), payload.size());
+
+    char *destination = memory->data + offset;
+    memcpy(destination, &entry, sizeof(entry));
+    memcpy(destination + sizeof(entry), payload.data(), payload.size());
+    memset(destination + sizeof(entry) + payload.size(), 0,
+           size - sizeof(entry) - payload.size());
+
+    header(memory)->end = offset + size;
+    return offset;
+}
+
+/**
+ * Removes the entry in slot [i], logging a tombstone for it when [log] is set. Returns false and
+ * keeps the entry when the tombstone cannot be appended.
+ */
+static bool eraseEntry(TranslationMemory *memory, size_t i, bool log) {
+    Slot slot = memory->slots[i];
+    const RecordHeader *entry = record(memory, slot.offset);
+    size_t size = recordSize(entry->keySize, entry->valueSize);
+
+    // Without a tombstone, the entry would come back when the log is replayed. The key is copied,
+    // as appending may remap the log.
+    if (log) {
+        std::string key(recordKey(memory, slot.offset));
+        if (appendRecord(memory, slot.hash, key, {}, true) == 0) return false;
+    }
+
+    memory->liveBytes -= size;
+    memory->entries--;
+    eraseSlot(memory, i);
+    return true;
+}
+
+/**
+ * Evicts one entry that was not referenced since the hand last passed it. Returns false when its
+ * tombstone cannot be appended.
+ */
+static bool evict(TranslationMemory *memory) {
+    size_t mask = memory->slots.size() - 1;
+    while (true) {
+        size_t i = memory->hand;
+        Slot &slot = memory->slots[i];
+
+        if (slot.offset != 0 && !slot.referenced) {
+            // The slot is refilled by the shift, so the hand stays in place.
+            return eraseEntry(memory, i, true);
+        }
+
+        slot.referenced = false;
+        memory->hand = (i + 1) & mask;
+    }
+}
+
+/**
+ * Inserts or replaces the entry for the record at [offset].
+ */
+static void indexRecord(TranslationMemory *memory, uint64_t offset, bool referenced) {
+    const RecordHeader *entry = record(memory, offset);
+    size_t i = findSlot(memory, entry->hash, recordKey(memory, offset));
+
+    if (memory->slots[i].offset != 0) {
+        const RecordHeader *previous = record(memory, memory->slots[i].offset);
+        memory->liveBytes -= recordSize(previous->keySize, previous->valueSize);
+        memory->entries--;
+    } else if ((memory->entries + 1) * 2 > memory->slots.size()) {
+        rehash(memory, memory->slots.size() * 2);
+        i = findSlot(memory, entry->hash, recordKey(memory, offset));
+    }
+
+    memory->slots[i] = Slot{entry->hash, offset, referenced};
+    memory->liveBytes += recordSize(entry->keySize, entry->valueSize);
+    memory->entries++;
+}
+
+static void resetMemory(TranslationMemory *memory) {
+    MemoryHeader *start = header(memory);
+    memcpy(start->magic, kMemoryMagic, sizeof(kMemoryMagic));
+    start->version = kMemoryVersion;
+    start->end = sizeof(MemoryHeader);
+
+    memory->slots.assign(16, Slot{});
+    memory->entries = 0;
+    memory->liveBytes = 0;
+    memory->hand = 0;
+}
+
+/**
+ * Rebuilds the index from the log. The log is cut at the first record that is incomplete or does
+ * not match its checksum, as it was only partially written.
+ */
+static void replay(TranslationMemory *memory) {
+    uint64_t end = std::min<uint64_t>(header(memory)->end, memory->capacity);
+    uint64_t offset = sizeof(MemoryHeader);
+
+    memory->slots.assign(16, Slot{});
+    memory->entries = 0;
+    memory->liveBytes = 0;
+    memory->hand = 0;
+
+    while (offset + sizeof(RecordHeader) <= end) {
+        const RecordHeader *entry = record(memory, offset);
+        size_t size = recordSize(entry->keySize, entry->valueSize);
+        if (entry->keySize > end || size > end - offset) break;
+
+        size_t payloadSize = entry->keySize +
+                             (entry->valueSize == kTombstone ? 0 : entry->valueSize);
+        const char *payload = memory->data + offset + sizeof(RecordHeader);
+        if (checksum(payload, payloadSize) != entry->checksum ||
+            hashBytes(payload, entry->keySize, 0) != entry->hash) {
+            break;
+        }
+
+        if (entry->valueSize == kTombstone) {
+            size_t i = findSlot(memory, entry->hash, recordKey(memory, offset));
+            if (memory->slots[i].offset != 0) eraseEntry(memory, i, false);
+        } else {
+            indexRecord(memory, offset, false);
+        }
+
+        offset += size;
+    }
+
+    header(memory)->end = offset;
+}
+
+/**
+ * Rewrites the log with only the records of the current entries, in the order they were written.
+ */
+static bool compact(TranslationMemory *memory) {
+    std::vector<size_t> live;
+    live.reserve(memory->entries);
+    for (size_t i = 0; i < memory->slots.size(); ++i) {
+        if (memory->slots[i].offset != 0) live.push_back(i);
+    }
+    std::sort(live.begin(), live.end(), [memory](size_t a, size_t b) {
+        return memory->slots[a].offset < memory->slots[b].offset;
+    });
+
+    std::string temporary = memory->path + ".tmp";
+    int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+
+    size_t capacity = sizeof(MemoryHeader) + memory->liveBytes + kGrowthSize;
+    char *data = nullptr;
+    if (ftruncate(fd, capacity) == 0) {
+        void *mapped = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED) data = static_cast<char *>(mapped);
+    }
+
+    if (data == nullptr) {
+        close(fd);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    auto *start = reinterpret_cast<MemoryHeader *>(data);
+    memcpy(start->magic, kMemoryMagic, sizeof(kMemoryMagic));
+    start->version = kMemoryVersion;
+
+    std::vector<uint64_t> offsets(live.size());
+    uint64_t offset = sizeof(MemoryHeader);
+    for (size_t k = 0; k < live.size(); ++k) {
+        const RecordHeader *entry = record(memory, memory->slots[live[k]].offset);
+        size_t size = recordSize(entry->keySize, entry->valueSize);
+
+        memcpy(data + offset, entry, size);
+        offsets[k] = offset;
+        offset += size;
+    }
+    start->end = offset;
+
+    if (rename(temporary.c_str(), memory->path.c_str()) != 0) {
+        munmap(data, capacity);
+        close(fd);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    // Slots keep their position, as the hashes do not change, only their offsets are updated.
+    for (size_t k = 0; k < live.size(); ++k) {
+        memory->slots[live[k]].offset = offsets[k];
+    }
+
+    munmap(memory->data, memory->capacity);
+    close(memory->fd);
+    memory->fd = fd;
+    memory->data = data;
+    memory->capacity = capacity;
+    return true;
+}
+
+static void compactIfWasteful(TranslationMemory *memory) {
+    size_t garbage = header(memory)->end - sizeof(MemoryHeader) - memory->liveBytes;
+    if (garbage >= kCompactionSize && garbage > memory->liveBytes) {
+        compact(memory);
+    }
+}
+
+/**
+ * Evicts entries until [bytes] more fit. Returns false when an eviction cannot be logged.
+ */
+static bool enforceBounds(TranslationMemory *memory, size_t bytes) {
+    while (memory->entries > 0 &&
+           (memory->entries + (bytes > 0 ? 1 : 0) > memory->maxEntries ||
+            memory->liveBytes + bytes > memory->maxBytes)) {
+        if (!evict(memory)) return false;
+    }
+    return true;
+}
+
+static bool hasPrefix(std::string_view key, const std::string &prefix) {
+    return key.size() >= prefix.size() && key.compare(0, prefix.size(), prefix) == 0;
+}
+
+
+static void closeMemory(TranslationMemory *memory) {
+    if (memory->data != nullptr) munmap(memory->data, memory->capacity);
+    if (memory->fd >= 0) close(memory->fd);
+    delete memory;
+}
+
+/**
+ * Opens the memory at [path], creating it when it does not exist or was written by another
+ * version. Returns nullptr and sets errno when it cannot be opened.
+ */
+static TranslationMemory *openMemory(const std::string &path, size_t maxEntries, size_t maxBytes) {
+    auto *memory = new TranslationMemory();
+    memory->path = path;
+    memory->maxEntries = std::max<size_t>(maxEntries, 1);
+    memory->maxBytes = std::max<size_t>(maxBytes, 1);
+    memory->data = nullptr;
+    memory->capacity = 0;
+
+    memory->fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    struct stat st{};
+    if (memory->fd < 0 || fstat(memory->fd, &st) != 0 ||
+        !mapMemory(memory, std::max<size_t>(st.st_size, kGrowthSize))) {
+        int error = errno;
+        closeMemory(memory);
+        errno = error;
+        return nullptr;
+    }
+
+    const MemoryHeader *start = header(memory);
+    if (memcmp(start->magic, kMemoryMagic, sizeof(kMemoryMagic)) != 0 ||
+        start->version != kMemoryVersion) {
+        resetMemory(memory);
+    } else {
+        replay(memory);
+    }
+
+    enforceBounds(memory, 0);
+    compactIfWasteful(memory);
+
+    return memory;
+}
+
+static bool findEntry(TranslationMemory *memory, const std::string &key, std::string *value) {
+    uint64_t hash = hashBytes(key.data(), key.size(), 0);
+
+    std::lock_guard<std::mutex> lock(memory->mutex);
+    Slot &slot = memory->slots[findSlot(memory, hash, key)];
+    if (slot.offset == 0) return false;
+
+    slot.referenced = true;
+    *value = recordValue(memory, slot.offset);
+    return true;
+}
+
+/**
+ * Stores [value] under [key], evicting entries until it fits. Returns false when the file cannot
+ * be grown.
+ */
+static bool putEntry(TranslationMemory *memory, const std::string &key, const std::string &value) {
+    uint64_t hash = hashBytes(key.data(), key.size(), 0);
+
+    size_t size = recordSize(key.size(), value.size());
+    if (size > memory->maxBytes) return true;
+
+    std::lock_guard<std::mutex> lock(memory->mutex);
+
+    size_t i = findSlot(memory, hash, key);
+    if (memory->slots[i].offset != 0) {
+        if (recordValue(memory, memory->slots[i].offset) == value) {
+            memory->slots[i].referenced = true;
+            return true;
+        }
+
+        eraseEntry(memory, i, false);
+    }
+
+    if (!enforceBounds(memory, size)) return false;
+
+    uint64_t offset = appendRecord(memory, hash, key, value, false);
+    if (offset == 0) return false;
+
+    indexRecord(memory, offset, true);
+    compactIfWasteful(memory);
+    return true;
+}
+
+/**
+ * Removes the entries of the language pair [prefix] is made of, or all entries when it is null.
+ */
+static void clearEntries(TranslationMemory *memory, const std::string *prefix) {
+    std::lock_guard<std::mutex> lock(memory->mutex);
+
+    if (prefix == nullptr) {
+        resetMemory(memory);
+        return;
+    }
+
+    for (size_t i = 0; i < memory->slots.size();) {
+        const Slot &slot = memory->slots[i];
+        if (slot.offset != 0 && hasPrefix(recordKey(memory, slot.offset), *prefix)) {
+            // The shift may move another matching slot into this one, so it is checked again.
+            if (!eraseEntry(memory, i, true)) break;
+            continue;
+        }
+        ++i;
+    }
+
+    compactIfWasteful(memory);
+}
+
+static size_t countEntries(TranslationMemory *memory, const std::string *prefix) {
+    std::lock_guard<std::mutex> lock(memory->mutex);
+
+    if (prefix == nullptr) {
+        return memory->entries;
+    }
+
+    size_t count = 0;
+    for (const Slot &slot: memory->slots) {
+        if (slot.offset != 0 && hasPrefix(recordKey(memory, slot.offset), *prefix)) ++count;
+    }
+    return count;
+}
+
+static std::string toString(JNIEnv *env, jstring string) {
+    const char *chars = env->GetStringUTFChars(string, nullptr);
+    std::string result(chars, env->GetStringUTFLength(string));
+    env->ReleaseStringUTFChars(string, chars);
+    return result;
+}
+
+/**
+ * Memory behind [handle], or nullptr with an IllegalStateException pending when it is closed.
+ */
+static TranslationMemory *findMemory(JNIEnv *env, jlong handle) {
+    if (handle == 0) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"),
+                      "TranslationMemory is closed");
+        return nullptr;
+    }
+
+    return (TranslationMemory *) handle;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_open(JNIEnv *env, jobject,
+                                                              jstring filePath, jint maxEntries,
+                                                              jlong maxBytes) {
+    std::string path = toString(env, filePath);
+
+    TranslationMemory *memory = openMemory(path, std::max(maxEntries, 0),
+                                           std::max<jlong>(maxBytes, 0));
+    if (memory == nullptr) {
+        throwIOException(env, "Failed to open " + path + ": " + strerror(errno));
+        return 0;
+    }
+
+    return (jlong) memory;
+}
+
+JNIEXPORT jstring JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_get(JNIEnv *env, jobject, jlong handle,
+                                                             jstring languages, jstring source) {
+    auto *memory = findMemory(env, handle);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    std::string value;
+    if (!findEntry(memory, makeKey(toString(env, languages), toString(env, source)), &value)) {
+        return nullptr;
+    }
+
+    return env->NewStringUTF(value.c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_put(JNIEnv *env, jobject, jlong handle,
+                                                             jstring languages, jstring source,
+                                                             jstring translation) {
+    auto *memory = findMemory(env, handle);
+    if (memory == nullptr) {
+        return;
+    }
+
+    std::string key = makeKey(toString(env, languages), toString(env, source));
+    if (!putEntry(memory, key, toString(env, translation))) {
+        throwIOException(env, "Failed to grow " + memory->path + ": " + strerror(errno));
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_clear(JNIEnv *env, jobject, jlong handle,
+                                                               jstring languages) {
+    auto *memory = findMemory(env, handle);
+    if (memory == nullptr) {
+        return;
+    }
+
+    if (languages == nullptr) {
+        clearEntries(memory, nullptr);
+        return;
+    }
+
+    std::string prefix = makeKey(toString(env, languages), {});
+    clearEntries(memory, &prefix);
+}
+
+JNIEXPORT jint JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_size(JNIEnv *env, jobject, jlong handle,
+                                                              jstring languages) {
+    auto *memory = findMemory(env, handle);
+    if (memory == nullptr) {
+        return 0;
+    }
+
+    if (languages == nullptr) {
+        return (jint) countEntries(memory, nullptr);
+    }
+
+    std::string prefix = makeKey(toString(env, languages), {});
+    return (jint) countEntries(memory, &prefix);
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_compact(JNIEnv *env, jobject,
+                                                                 jlong handle) {
+    auto *memory = findMemory(env, handle);
+    if (memory == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(memory->mutex);
+
+    if (!compact(memory)) {
+        throwIOException(env, "Failed to compact " + memory->path + ": " + strerror(errno));
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_cache_TranslationMemory_close(JNIEnv *env, jobject,
+                                                               jlong handle) {
+    if (handle == 0) {
+        return;
+    }
+
+    closeMemory((TranslationMemory *) handle);
+}
+#ifdef __cplusplus
+}
+#endif
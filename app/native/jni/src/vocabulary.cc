@@ -3,11 +3,234 @@
 //
 
 #include <jni.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+// A compiled vocabulary starts with this header, followed by the offsets of the tokens (one more
+// than there are tokens), the hash table mapping tokens onto ids, and the null terminated tokens.
+struct VocabularyIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;
+    uint32_t buckets;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+};
+
+struct VocabularyIndex {
+    void *data;
+    size_t length;
+    const VocabularyIndexHeader *header;
+    const uint32_t *offsets;
+    // Open addressing hash table of token ids plus one, zero marks an empty bucket.
+    const uint32_t *table;
+    const char *tokens;
+};
+
+constexpr char kVocabularyIndexMagic[4] = {'V', 'V', 'I', 'X'};
+constexpr uint32_t kVocabularyIndexVersion = 1;
+
+static void throwIOException(JNIEnv *env, const std::string &message) {
+    env->ThrowNew(env->FindClass("java/io/IOException"), message.c_str());
+}
+
+static uint32_t hashToken(const char *token, size_t length) {
+    uint32_t hash = 0x811c9dc5u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(token[i])) * 0x01000193u;
+    }
+    return hash;
+}
+
+static uint64_t hashFile(const char *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Maps the file at [path] read only, returns nullptr and sets errno when it cannot be mapped.
+ */
+static char *mapFile(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        int error = st.st_size == 0 ? EINVAL : errno;
+        close(fd);
+        errno = error;
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) return nullptr;
+
+    *size = st.st_size;
+    return static_cast<char *>(data);
+}
+
+/**
+ * Splits a vocabulary file of null terminated words, each followed by an int, into its words.
+ */
+static std::vector<std::string_view> readWords(const char *data, size_t size) {
+    std::vector<std::string_view> words;
+    const char *ptr = data;
+    const char *end = data + size;
+    while (ptr < end) {
+        size_t length = strnlen(ptr, end - ptr);
+        words.emplace_back(ptr, length);
+        ptr += length + 1 + sizeof(int);
+    }
+    return words;
+}
+
+static int findToken(const VocabularyIndex *index, const char *token, size_t length) {
+    uint32_t mask = index->header->buckets - 1;
+    for (uint32_t bucket = hashToken(token, length) & mask;; bucket = (bucket + 1) & mask) {
+        uint32_t entry = index->table[bucket];
+        if (entry == 0) return -1;
+
+        uint32_t id = entry - 1;
+        uint32_t begin = index->offsets[id];
+        // Tokens are null terminated, so the stored length is one less than the distance.
+        if (index->offsets[id + 1] - begin - 1 == length &&
+            memcmp(index->tokens + begin, token, length) == 0) {
+            return static_cast<int>(id);
+        }
+    }
+}
+
+/**
+ * Maps the compiled vocabulary at [path], returns nullptr when it cannot be mapped or is not a
+ * complete index of this version.
+ */
+static VocabularyIndex *openIndex(const char *path) {
+    size_t length = 0;
+    char *data = mapFile(path, &length);
+    if (data == nullptr) return nullptr;
+
+    auto *header = reinterpret_cast<const VocabularyIndexHeader *>(data);
+    size_t tablesSize = 0;
+    bool valid = length >= sizeof(VocabularyIndexHeader) &&
+                 memcmp(header->magic, kVocabularyIndexMagic, sizeof(kVocabularyIndexMagic)) == 0 &&
+                 header->version == kVocabularyIndexVersion &&
+                 header->buckets > header->size &&
+                 (header->buckets & (header->buckets - 1)) == 0;
+
+    if (valid) {
+        tablesSize = (static_cast<size_t>(header->size) + 1 + header->buckets) * sizeof(uint32_t);
+        valid = length >= sizeof(VocabularyIndexHeader) + tablesSize;
+    }
+
+    auto *offsets = reinterpret_cast<const uint32_t *>(data + sizeof(VocabularyIndexHeader));
+    if (valid) {
+        size_t tokensSize = length - sizeof(VocabularyIndexHeader) - tablesSize;
+        valid = offsets[header->size] == tokensSize;
+    }
+
+    if (!valid) {
+        munmap(data, length);
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    auto *index = new VocabularyIndex();
+    index->data = data;
+    index->length = length;
+    index->header = header;
+    index->offsets = offsets;
+    index->table = offsets + header->size + 1;
+    index->tokens = reinterpret_cast<const char *>(index->table + header->buckets);
+    return index;
+}
+
+static void closeIndex(VocabularyIndex *index) {
+    munmap(index->data, index->length);
+    delete index;
+}
+
+/**
+ * Writes the index of [words] to [path], keeping the first id of duplicated words like a linear
+ * search would.
+ */
+static bool writeIndex(const char *path, const std::vector<std::string_view> &words,
+                       uint64_t sourceSize, uint64_t sourceHash) {
+    VocabularyIndexHeader header{};
+    memcpy(header.magic, kVocabularyIndexMagic, sizeof(kVocabularyIndexMagic));
+    header.version = kVocabularyIndexVersion;
+    header.size = static_cast<uint32_t>(words.size());
+    header.sourceSize = sourceSize;
+    header.sourceHash = sourceHash;
+
+    // Keeps the load factor at or below one half.
+    header.buckets = 2;
+    while (header.buckets < words.size() * 2) header.buckets <<= 1;
+
+    std::vector<uint32_t> offsets(words.size() + 1);
+    uint32_t offset = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        offsets[i] = offset;
+        offset += words[i].size() + 1;
+    }
+    offsets[words.size()] = offset;
+
+    std::vector<uint32_t> table(header.buckets);
+    uint32_t mask = header.buckets - 1;
+    for (uint32_t id = 0; id < words.size(); ++id) {
+        uint32_t bucket = hashToken(words[id].data(), words[id].size()) & mask;
+        for (; table[bucket] != 0; bucket = (bucket + 1) & mask) {
+            if (words[table[bucket] - 1] == words[id]) break;
+        }
+        if (table[bucket] == 0) table[bucket] = id + 1;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) return false;
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), file) == offsets.size() &&
+                   fwrite(table.data(), sizeof(uint32_t), table.size(), file) == table.size();
+    for (size_t i = 0; written && i < words.size(); ++i) {
+        written = fwrite(words[i].data(), 1, words[i].size(), file) == words[i].size() &&
+                  fputc('\0', file) != EOF;
+    }
+
+    return fclose(file) == 0 && written;
+}
+
+/**
+ * Checks that every word resolves to the id of its first occurrence and back to itself.
+ */
+static bool validateIndex(const VocabularyIndex *index, const std::vector<std::string_view> &words) {
+    if (index->header->size != words.size()) return false;
+
+    for (uint32_t id = 0; id < words.size(); ++id) {
+        const char *token = index->tokens + index->offsets[id];
+        if (std::string_view(token) != words[id]) return false;
+
+        int found = findToken(index, words[id].data(), words[id].size());
+        if (found < 0 || words[found] != words[id] || static_cast<uint32_t>(found) > id) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +271,89 @@ Java_app_versta_translate_bridge_tokenize_Vocabulary_load(JNIEnv *env, jobject,
 
     return arrayList;
 }
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_tokenize_Vocabulary_compile(JNIEnv *env, jobject,
+                                                             jstring filePath,
+                                                             jstring indexPath) {
+    const char *nativeFilePath = env->GetStringUTFChars(filePath, nullptr);
+    std::string source(nativeFilePath);
+    env->ReleaseStringUTFChars(filePath, nativeFilePath);
+
+    const char *nativeIndexPath = env->GetStringUTFChars(indexPath, nullptr);
+    std::string destination(nativeIndexPath);
+    env->ReleaseStringUTFChars(indexPath, nativeIndexPath);
+
+    size_t size = 0;
+    char *data = mapFile(source.c_str(), &size);
+    if (data == nullptr) {
+        throwIOException(env, "Failed to open " + source + ": " + strerror(errno));
+        return;
+    }
+
+    std::vector<std::string_view> words = readWords(data, size);
+    std::string temporary = destination + ".tmp";
+
+    bool written = writeIndex(temporary.c_str(), words, size, hashFile(data, size));
+    VocabularyIndex *index = written ? openIndex(temporary.c_str()) : nullptr;
+    bool valid = index != nullptr && validateIndex(index, words);
+
+    if (index != nullptr) closeIndex(index);
+    munmap(data, size);
+
+    if (!written || !valid || rename(temporary.c_str(), destination.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throwIOException(env, "Failed to compile " + source + " into " + destination);
+    }
+}
+
+JNIEXPORT jlong JNICALL
+Java_app_versta_translate_bridge_tokenize_VocabularyIndex_open(JNIEnv *env, jobject,
+                                                               jstring filePath) {
+    const char *nativeFilePath = env->GetStringUTFChars(filePath, nullptr);
+    VocabularyIndex *index = openIndex(nativeFilePath);
+    if (index == nullptr) {
+        throwIOException(env, std::string("Failed to open ") + nativeFilePath + ": " +
+                              strerror(errno));
+    }
+    env->ReleaseStringUTFChars(filePath, nativeFilePath);
+
+    return (jlong) index;
+}
+
+JNIEXPORT jint JNICALL
+Java_app_versta_translate_bridge_tokenize_VocabularyIndex_size(JNIEnv *env, jobject,
+                                                               jlong handle) {
+    auto *index = (VocabularyIndex *) handle;
+    return (jint) index->header->size;
+}
+
+JNIEXPORT jstring JNICALL
+Java_app_versta_translate_bridge_tokenize_VocabularyIndex_get(JNIEnv *env, jobject,
+                                                              jlong handle, jint id) {
+    auto *index = (VocabularyIndex *) handle;
+    return env->NewStringUTF(index->tokens + index->offsets[id]);
+}
+
+JNIEXPORT jint JNICALL
+Java_app_versta_translate_bridge_tokenize_VocabularyIndex_indexOf(JNIEnv *env, jobject,
+                                                                  jlong handle, jstring token) {
+    auto *index = (VocabularyIndex *) handle;
+
+    jsize len = env->GetStringUTFLength(token);
+
+    const char *str = env->GetStringUTFChars(token, nullptr);
+    int id = findToken(index, str, len);
+    env->ReleaseStringUTFChars(token, str);
+
+    return id;
+}
+
+JNIEXPORT void JNICALL
+Java_app_versta_translate_bridge_tokenize_VocabularyIndex_close(JNIEnv *env, jobject,
+                                                                jlong handle) {
+    closeIndex((VocabularyIndex *) handle);
+}
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,50 @@
+package app.versta.translate.utils
+
+import android.util.Log
+import app.versta.translate.bridge.inference.BatchPlanner
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertTrue
+import org.junit.Test
+import kotlin.random.Random
+
+class BatchPlannerTest {
+
+    /**
+     * Plans the sequences of a document with a few long sentences. Every sequence has to be in
+     * exactly one batch, and the batches have to waste less padding than padding every sequence
+     * to the longest one.
+     */
+    @Test
+    fun bucketsReducePaddingWaste() {
+        val random = Random(0)
+        val lengths = IntArray(SEQUENCES) {
+            if (it % 10 == 0) random.nextInt(100, 200) else random.nextInt(4, 40)
+        }
+
+        val batches = BatchPlanner(maxBatchSize = MAX_BATCH_SIZE).plan(lengths)
+        batches.forEach { Log.i(TAG, it.toString()) }
+
+        val indices = batches.flatMap { it.indices.toList() }
+        assertEquals(lengths.indices.toList(), indices.sorted())
+
+        for (batch in batches) {
+            assertTrue(batch.indices.size <= MAX_BATCH_SIZE)
+            assertEquals(batch.lengths.max(), batch.length)
+            batch.indices.forEachIndexed { i, index -> assertEquals(lengths[index], batch.lengths[i]) }
+        }
+
+        val padded = batches.sumOf { it.paddedTokens }
+        val unbatched = lengths.size * lengths.max()
+        Log.i(TAG, "Padded tokens: $padded, padded to the longest: $unbatched")
+
+        val waste = 1f - lengths.sum().toFloat() / padded
+        assertTrue(waste < 1f - lengths.sum().toFloat() / unbatched)
+    }
+
+    companion object {
+        private val TAG: String = BatchPlannerTest::class.java.simpleName
+
+        private const val SEQUENCES = 64
+        private const val MAX_BATCH_SIZE = 8
+    }
+}
@@ -0,0 +1,218 @@
+package app.versta.translate.utils
+
+import ai.onnxruntime.OnnxTensor
+import ai.onnxruntime.OrtEnvironment
+import android.util.Log
+import app.versta.translate.bridge.inference.BeamSearch
+import app.versta.translate.bridge.inference.DecodingStrategy
+import org.junit.Assert.assertArrayEquals
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertTrue
+import org.junit.Test
+import java.nio.FloatBuffer
+import kotlin.concurrent.thread
+import kotlin.random.Random
+import kotlin.system.measureNanoTime
+
+class BeamSearchBenchmarkTest {
+
+    /**
+     * Measures a search step over the logits of a Marian sized vocabulary with 1 to 4 threads,
+     * and checks every thread count picks the same beams.
+     */
+    @Test
+    fun benchmarkThreadScaling() {
+        val environment = OrtEnvironment.getEnvironment()
+        val random = Random(0)
+
+        val tensors = (0 until STEPS).map {
+            val logits = FloatArray(BEAMS * VOCAB_SIZE) { random.nextFloat() * 10f }
+            OnnxTensor.createTensor(
+                environment,
+                FloatBuffer.wrap(logits),
+                longArrayOf(BEAMS.toLong(), 1, VOCAB_SIZE.toLong())
+            )
+        }
+
+        var expected: LongArray? = null
+
+        for (threads in 1..4) {
+            BeamSearch(BEAMS, MIN_P, REPETITION_PENALTY, PAD_ID, EOS_ID, threads).use { beamSearch ->
+                // The first step also starts the worker threads.
+                beamSearch.search(tensors.first())
+
+                val elapsed = tensors.drop(1).map { tensor ->
+                    measureNanoTime { beamSearch.search(tensor) } / 1000
+                }
+
+                Log.i(TAG, "$threads threads: ${elapsed.average()} µs per step (min ${elapsed.min()} µs)")
+
+                val best = beamSearch.best()
+                expected?.let { assertArrayEquals(it, best) }
+                expected = best
+            }
+        }
+
+        tensors.forEach { it.close() }
+    }
+
+    /**
+     * Runs every strategy over the same logits. Greedy has to pick what a beam of one picks, and
+     * sampling has to pick the same tokens for the same seed.
+     */
+    @Test
+    fun benchmarkStrategies() {
+        val environment = OrtEnvironment.getEnvironment()
+        val random = Random(0)
+
+        val tensors = (0 until STEPS).map {
+            val logits = FloatArray(VOCAB_SIZE) { random.nextFloat() * 10f }
+            OnnxTensor.createTensor(
+                environment,
+                FloatBuffer.wrap(logits),
+                longArrayOf(1, 1, VOCAB_SIZE.toLong())
+            )
+        }
+
+        fun decode(strategy: DecodingStrategy): LongArray {
+            BeamSearch(1, MIN_P, REPETITION_PENALTY, PAD_ID, EOS_ID, strategy = strategy).use { beamSearch ->
+                val elapsed = tensors.map { tensor ->
+                    measureNanoTime { beamSearch.search(tensor) } / 1000
+                }
+
+                Log.i(TAG, "$strategy: ${elapsed.average()} µs per step (min ${elapsed.min()} µs)")
+
+                return beamSearch.best()
+            }
+        }
+
+        assertArrayEquals(decode(DecodingStrategy.Beam), decode(DecodingStrategy.Greedy))
+        assertArrayEquals(decode(DecodingStrategy.TopK(8, 42)), decode(DecodingStrategy.TopK(8, 42)))
+        assertArrayEquals(decode(DecodingStrategy.TopP(0.9f, 42)), decode(DecodingStrategy.TopP(0.9f, 42)))
+
+        tensors.forEach { it.close() }
+    }
+
+    /**
+     * Searches logits that favor the same few tokens at every step, which loops without n-gram
+     * blocking. No n-gram of the blocked size may occur twice in the result.
+     */
+    @Test
+    fun blocksRepeatedNgrams() {
+        val environment = OrtEnvironment.getEnvironment()
+        val logits = FloatArray(BEAMS * VOCAB_SIZE) {
+            when (it % VOCAB_SIZE) {
+                1 -> 10f
+                2 -> 9f
+                3 -> 8f
+                else -> 0f
+            }
+        }
+
+        for (strategy in listOf(DecodingStrategy.Beam, DecodingStrategy.Greedy)) {
+            val beams = if (strategy == DecodingStrategy.Beam) BEAMS else 1
+
+            BeamSearch(
+                beams, MIN_P, 0f, PAD_ID, EOS_ID, strategy = strategy, noRepeatNgramSize = NGRAM_SIZE
+            ).use { beamSearch ->
+                repeat(STEPS) {
+                    // The search masks the logits in place, so every step gets a fresh tensor.
+                    OnnxTensor.createTensor(
+                        environment,
+                        FloatBuffer.wrap(logits.copyOf(beams * VOCAB_SIZE)),
+                        longArrayOf(beams.toLong(), 1, VOCAB_SIZE.toLong())
+                    ).use { beamSearch.search(it) }
+                }
+
+                val ngrams = beamSearch.best().toList().windowed(NGRAM_SIZE)
+                assertEquals("$strategy repeats an n-gram", ngrams.size, ngrams.toSet().size)
+            }
+        }
+    }
+
+    /**
+     * Searches logits that never favor the end of the sequence. The search has to complete once
+     * the sequence reaches the budget of the source, and never take more steps than the cap.
+     */
+    @Test
+    fun boundsLengthBySource() {
+        val environment = OrtEnvironment.getEnvironment()
+        val logits = FloatArray(VOCAB_SIZE) { if (it == 1) 10f else 0f }
+
+        for ((sourceLength, expected) in listOf(2 to MIN_BUDGET, 40 to 60, 400 to STEPS)) {
+            BeamSearch(
+                1, MIN_P, 0f, PAD_ID, EOS_ID,
+                strategy = DecodingStrategy.Greedy,
+                sourceLength = sourceLength,
+                maxLengthRatio = MAX_LENGTH_RATIO,
+                maxSequenceLength = STEPS
+            ).use { beamSearch ->
+                assertEquals(expected, beamSearch.maxLength)
+
+                var steps = 0
+                while (!beamSearch.complete()) {
+                    OnnxTensor.createTensor(
+                        environment,
+                        FloatBuffer.wrap(logits),
+                        longArrayOf(1, 1, VOCAB_SIZE.toLong())
+                    ).use { beamSearch.search(it) }
+                    steps++
+                }
+
+                assertEquals(expected, steps)
+                assertEquals(expected + 1, beamSearch.best().size)
+            }
+        }
+    }
+
+    /**
+     * Searches past the deadline and cancels another search. Both have to stop before their next
+     * step and report their sequences as truncated, unlike a search that completes on its own.
+     */
+    @Test
+    fun stopsAtDeadlineAndCancellation() {
+        BeamSearch(1, MIN_P, 0f, PAD_ID, EOS_ID, timeoutMillis = TIMEOUT_MILLIS).use { beamSearch ->
+            assertFalse(beamSearch.complete())
+            Thread.sleep(2 * TIMEOUT_MILLIS)
+
+            assertTrue(beamSearch.complete())
+            assertTrue(beamSearch.truncated())
+        }
+
+        BeamSearch(1, MIN_P, 0f, PAD_ID, EOS_ID).use { beamSearch ->
+            thread { beamSearch.cancel() }.join()
+
+            assertTrue(beamSearch.complete())
+            assertTrue(beamSearch.truncated())
+        }
+
+        BeamSearch(1, MIN_P, 0f, PAD_ID, EOS_ID, maxSequenceLength = 1).use { beamSearch ->
+            OnnxTensor.createTensor(
+                OrtEnvironment.getEnvironment(),
+                FloatBuffer.wrap(FloatArray(VOCAB_SIZE) { if (it == 1) 10f else 0f }),
+                longArrayOf(1, 1, VOCAB_SIZE.toLong())
+            ).use { beamSearch.search(it) }
+
+            assertTrue(beamSearch.complete())
+            assertFalse(beamSearch.truncated())
+        }
+    }
+
+    companion object {
+        private val TAG: String = BeamSearchBenchmarkTest::class.java.simpleName
+
+        private const val BEAMS = 4
+        private const val VOCAB_SIZE = 58101
+        private const val STEPS = 64
+        private const val NGRAM_SIZE = 2
+        private const val MAX_LENGTH_RATIO = 1.5f
+        private const val MIN_BUDGET = 16
+        private const val TIMEOUT_MILLIS = 20L
+
+        private const val MIN_P = 1e-5f
+        private const val REPETITION_PENALTY = 1f
+        private const val PAD_ID = 58100L
+        private const val EOS_ID = 0L
+    }
+}
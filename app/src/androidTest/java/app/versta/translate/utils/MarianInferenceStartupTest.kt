@@ -0,0 +1,57 @@
+package app.versta.translate.utils
+
+import android.util.Log
+import androidx.test.platform.app.InstrumentationRegistry
+import app.versta.translate.adapter.outbound.MarianInference
+import app.versta.translate.core.entity.LanguageModelInferenceFiles
+import org.junit.Assert.assertTrue
+import org.junit.Test
+import java.io.File
+import kotlin.system.measureTimeMillis
+
+class MarianInferenceStartupTest {
+
+    /**
+     * Compares the load time of a model without saved optimized graphs (cold) against loads from
+     * the optimized graphs saved by the first load (warm).
+     */
+    @Test
+    fun benchmarkColdAndWarmLoad() {
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        val path = context.filesDir.toPath()
+        val files = LanguageModelInferenceFiles(
+            encoder = path.resolve(ENCODER_FILE_NAME),
+            decoder = path.resolve(DECODER_FILE_NAME),
+        )
+
+        val optimizedModelDirectory = File(context.cacheDir, "optimized_models_benchmark")
+        optimizedModelDirectory.deleteRecursively()
+
+        val inference = MarianInference(optimizedModelDirectory = optimizedModelDirectory)
+
+        val cold = measureTimeMillis { inference.load(files, THREADS) }
+        inference.close()
+
+        assertTrue(optimizedModelDirectory.listFiles()?.size == 2)
+
+        val warm = (0 until WARM_RUNS).map {
+            val elapsed = measureTimeMillis { inference.load(files, THREADS) }
+            inference.close()
+            elapsed
+        }
+
+        Log.i(TAG, "Cold load: $cold ms, warm load: ${warm.average()} ms (min ${warm.min()} ms)")
+
+        optimizedModelDirectory.deleteRecursively()
+    }
+
+    companion object {
+        private val TAG: String = MarianInferenceStartupTest::class.java.simpleName
+
+        private const val ENCODER_FILE_NAME: String = "opus-mt-ja-nl-encoder.onnx"
+        private const val DECODER_FILE_NAME: String = "opus-mt-ja-nl-decoder.onnx"
+
+        private const val THREADS = 4
+        private const val WARM_RUNS = 3
+    }
+}
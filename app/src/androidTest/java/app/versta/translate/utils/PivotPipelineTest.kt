@@ -0,0 +1,161 @@
+package app.versta.translate.utils
+
+import android.util.Log
+import androidx.test.platform.app.InstrumentationRegistry
+import app.versta.translate.adapter.outbound.MarianInference
+import app.versta.translate.adapter.outbound.MarianTokenizer
+import app.versta.translate.adapter.outbound.PivotPipeline
+import app.versta.translate.adapter.outbound.TranslationInference
+import app.versta.translate.bridge.inference.DecodingStrategy
+import app.versta.translate.bridge.inference.JobPriority
+import app.versta.translate.core.entity.Language
+import app.versta.translate.core.entity.LanguageModelFiles
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.runBlocking
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertTrue
+import org.junit.Test
+import java.util.Collections
+import kotlin.system.measureTimeMillis
+
+class PivotPipelineTest {
+
+    /**
+     * Records when every call of [run] started and finished.
+     */
+    private class RecordingInference(
+        private val inference: TranslationInference
+    ) : TranslationInference by inference {
+        val runs: MutableList<LongRange> = Collections.synchronizedList(mutableListOf())
+
+        override fun run(
+            inputIds: LongArray,
+            attentionMask: LongArray,
+            eosId: Long,
+            padId: Long,
+            minP: Float,
+            repetitionPenalty: Float,
+            beamSize: Int,
+            maxSequenceLength: Int,
+            strategy: DecodingStrategy,
+            noRepeatNgramSize: Int,
+            priority: JobPriority,
+            timeoutMillis: Long
+        ): LongArray {
+            val start = System.nanoTime()
+            try {
+                return inference.run(
+                    inputIds, attentionMask, eosId, padId, minP, repetitionPenalty, beamSize,
+                    maxSequenceLength, strategy, noRepeatNgramSize, priority, timeoutMillis
+                )
+            } finally {
+                runs.add(start..System.nanoTime())
+            }
+        }
+    }
+
+    /**
+     * Translates a document through English, once with a run of the first and a run of the second
+     * model after each other for every sentence, and once with the pipeline. Both have to give the
+     * same sentences in the same order, and the pipeline has to run the models at the same time.
+     */
+    @Test
+    fun pipelineOverlapsStages() {
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        val firstFiles = LanguageModelFiles.load(context.filesDir.toPath().resolve(FIRST_MODEL_DIRECTORY))
+        val secondFiles = LanguageModelFiles.load(context.filesDir.toPath().resolve(SECOND_MODEL_DIRECTORY))
+
+        fun stage(files: LanguageModelFiles) = PivotPipeline.Stage(
+            tokenizer = MarianTokenizer(separatedVocabularies = files.tokenizer.targetVocabulary != null),
+            inference = RecordingInference(MarianInference())
+        )
+
+        val first = stage(firstFiles)
+        val second = stage(secondFiles)
+
+        val options = PivotPipeline.Options(
+            minP = MIN_P,
+            repetitionPenalty = REPETITION_PENALTY,
+            beamSize = BEAM_SIZE,
+            maxSequenceLength = MAX_SEQUENCE_LENGTH
+        )
+
+        fun run(stage: PivotPipeline.Stage, text: String): String {
+            val (inputIds, attentionMask) = stage.tokenizer.encode(text)
+            val tokens = stage.inference.run(
+                inputIds = inputIds,
+                attentionMask = attentionMask,
+                eosId = stage.tokenizer.eosId,
+                padId = stage.tokenizer.padId,
+                minP = options.minP,
+                repetitionPenalty = options.repetitionPenalty,
+                beamSize = options.beamSize,
+                maxSequenceLength = options.maxSequenceLength
+            )
+
+            return stage.tokenizer.decode(tokens)
+        }
+
+        PivotPipeline(first, second).use { pipeline ->
+            pipeline.load(
+                firstFiles, secondFiles,
+                Language.fromIsoCode("ja"), Language.fromIsoCode("nl"),
+                THREADS
+            )
+
+            // Warms up both models, so neither measurement pays for the first runs.
+            run(second, run(first, SENTENCES.first()))
+
+            val sequential: List<String>
+            val sequentialTime = measureTimeMillis {
+                sequential = SENTENCES.map { run(second, run(first, it)) }
+            }
+
+            val firstRuns = first.inference as RecordingInference
+            val secondRuns = second.inference as RecordingInference
+            firstRuns.runs.clear()
+            secondRuns.runs.clear()
+
+            val pipelined: List<PivotPipeline.Sentence>
+            val pipelinedTime = measureTimeMillis {
+                pipelined = runBlocking { pipeline.translate(SENTENCES, options).toList() }
+            }
+
+            Log.i(TAG, "Sequential: $sequentialTime ms, pipelined: $pipelinedTime ms")
+
+            assertEquals(SENTENCES.indices.toList(), pipelined.map { it.index })
+            assertEquals(sequential, pipelined.map { it.text })
+
+            val overlaps = firstRuns.runs.count { a ->
+                secondRuns.runs.any { b -> a.first < b.last && b.first < a.last }
+            }
+            assertTrue("No run of the first model overlaps the second model", overlaps > 0)
+            assertTrue(
+                "Pipelined $pipelinedTime ms is not faster than sequential $sequentialTime ms",
+                pipelinedTime < sequentialTime
+            )
+        }
+    }
+
+    companion object {
+        private val TAG: String = PivotPipelineTest::class.java.simpleName
+
+        private const val FIRST_MODEL_DIRECTORY: String = "opus-mt-ja-en"
+        private const val SECOND_MODEL_DIRECTORY: String = "opus-mt-en-nl"
+
+        private const val THREADS = 2
+        private const val BEAM_SIZE = 2
+        private const val MAX_SEQUENCE_LENGTH = 256
+        private const val MIN_P = 0.0001f
+        private const val REPETITION_PENALTY = 0.1f
+
+        private val SENTENCES = listOf(
+            "今日はとても良い天気です。",
+            "駅までの道を教えていただけますか？",
+            "この本は昨年の夏に出版されました。",
+            "会議は午後三時に始まります。",
+            "私たちは来週京都へ旅行する予定です。",
+            "彼女は毎朝コーヒーを飲みます。",
+        )
+    }
+}
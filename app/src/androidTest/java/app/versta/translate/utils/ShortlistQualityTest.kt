@@ -0,0 +1,102 @@
+package app.versta.translate.utils
+
+import android.util.Log
+import androidx.test.platform.app.InstrumentationRegistry
+import app.versta.translate.adapter.outbound.MarianInference
+import app.versta.translate.adapter.outbound.MarianTokenizer
+import app.versta.translate.bridge.inference.Shortlist
+import app.versta.translate.core.entity.Language
+import app.versta.translate.core.entity.LanguageModelFiles
+import app.versta.translate.core.entity.LanguagePair
+import org.junit.Assert.assertTrue
+import org.junit.Test
+import java.io.File
+import kotlin.io.path.pathString
+import kotlin.system.measureTimeMillis
+
+class ShortlistQualityTest {
+
+    /**
+     * Translates a held-out set of sentences, which the lexical table was not built from, with
+     * and without the shortlist. Most translations have to be identical, the rest may only differ
+     * where the full vocabulary search picked a token the table does not list.
+     */
+    @Test
+    fun shortlistMatchesFullVocabularyOnHeldOutSet() {
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        val path = context.filesDir.toPath().resolve(MODEL_DIRECTORY)
+        val files = LanguageModelFiles.load(path)
+        val lexicalTable = requireNotNull(files.inference.lexicalTable) {
+            "$MODEL_DIRECTORY has no lexical table"
+        }
+        val sentences = path.resolve(HELD_OUT_FILE_NAME).toFile().readLines().filter { it.isNotBlank() }
+
+        val shortlist = File(context.cacheDir, "shortlist_quality.index")
+        Shortlist.compile(
+            lexicalTable.pathString,
+            files.tokenizer.sourceVocabulary.pathString,
+            (files.tokenizer.targetVocabulary ?: files.tokenizer.sourceVocabulary).pathString,
+            shortlist.path,
+            Shortlist.DEFAULT_BEST
+        )
+
+        val tokenizer = MarianTokenizer(separatedVocabularies = files.tokenizer.targetVocabulary != null)
+        tokenizer.load(files.tokenizer, LanguagePair(Language.fromIsoCode("ja"), Language.fromIsoCode("nl")))
+
+        val inference = MarianInference()
+
+        fun translate(sentence: String): String {
+            val (inputIds, attentionMask) = tokenizer.encode(sentence)
+            val tokens = inference.run(
+                inputIds = inputIds,
+                attentionMask = attentionMask,
+                eosId = tokenizer.eosId,
+                padId = tokenizer.padId,
+                minP = MIN_P,
+                repetitionPenalty = REPETITION_PENALTY,
+                beamSize = BEAM_SIZE,
+                maxSequenceLength = MAX_SEQUENCE_LENGTH
+            )
+            return tokenizer.decode(tokens)
+        }
+
+        inference.load(files.inference.copy(shortlist = null), THREADS)
+        val full: List<String>
+        val fullTime = measureTimeMillis { full = sentences.map { translate(it) } }
+
+        inference.load(files.inference.copy(shortlist = shortlist.toPath()), THREADS)
+        val shortlisted: List<String>
+        val shortlistTime = measureTimeMillis { shortlisted = sentences.map { translate(it) } }
+
+        inference.close()
+        shortlist.delete()
+
+        val identical = full.zip(shortlisted).count { (a, b) -> a == b }
+        val agreement = identical.toFloat() / sentences.size
+
+        full.zip(shortlisted).filter { (a, b) -> a != b }.forEach { (a, b) ->
+            Log.i(TAG, "Full: $a\nShortlist: $b")
+        }
+        Log.i(
+            TAG,
+            "Identical: $identical/${sentences.size}, full: $fullTime ms, shortlist: $shortlistTime ms"
+        )
+
+        assertTrue("Only ${agreement * 100}% of the translations match", agreement >= MIN_AGREEMENT)
+    }
+
+    companion object {
+        private val TAG: String = ShortlistQualityTest::class.java.simpleName
+
+        private const val MODEL_DIRECTORY: String = "opus-mt-ja-nl"
+        private const val HELD_OUT_FILE_NAME: String = "held_out.ja.txt"
+
+        private const val THREADS = 4
+        private const val BEAM_SIZE = 4
+        private const val MAX_SEQUENCE_LENGTH = 256
+        private const val MIN_P = 0.0001f
+        private const val REPETITION_PENALTY = 0.1f
+
+        private const val MIN_AGREEMENT = 0.95f
+    }
+}
@@ -0,0 +1,85 @@
+package app.versta.translate.utils
+
+import android.util.Log
+import androidx.test.platform.app.InstrumentationRegistry
+import app.versta.translate.adapter.outbound.MarianInference
+import app.versta.translate.adapter.outbound.MarianTokenizer
+import app.versta.translate.bridge.inference.DecodingStrategy
+import app.versta.translate.core.entity.Language
+import app.versta.translate.core.entity.LanguageModelFiles
+import app.versta.translate.core.entity.LanguagePair
+import org.junit.Assert.assertArrayEquals
+import org.junit.Test
+import kotlin.system.measureTimeMillis
+
+class SpeculativeDecodingTest {
+
+    /**
+     * Decodes copy heavy sentences greedily with and without drafts from the source, which have to
+     * give the same tokens.
+     */
+    @Test
+    fun speculativeMatchesGreedy() {
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        val files = LanguageModelFiles.load(context.filesDir.toPath().resolve(MODEL_DIRECTORY))
+
+        val tokenizer = MarianTokenizer(separatedVocabularies = files.tokenizer.targetVocabulary != null)
+        tokenizer.load(files.tokenizer, LanguagePair(Language.fromIsoCode("ja"), Language.fromIsoCode("nl")))
+
+        val inference = MarianInference()
+        inference.load(files.inference, THREADS)
+
+        fun run(sentence: String, strategy: DecodingStrategy): LongArray {
+            val (inputIds, attentionMask) = tokenizer.encode(sentence)
+            return inference.run(
+                inputIds = inputIds,
+                attentionMask = attentionMask,
+                eosId = tokenizer.eosId,
+                padId = tokenizer.padId,
+                minP = MIN_P,
+                repetitionPenalty = REPETITION_PENALTY,
+                beamSize = 1,
+                maxSequenceLength = MAX_SEQUENCE_LENGTH,
+                strategy = strategy
+            )
+        }
+
+        var greedyTime = 0L
+        var speculativeTime = 0L
+
+        for (sentence in SENTENCES) {
+            val greedy: LongArray
+            greedyTime += measureTimeMillis { greedy = run(sentence, DecodingStrategy.Greedy) }
+
+            val speculative: LongArray
+            speculativeTime += measureTimeMillis {
+                speculative = run(sentence, DecodingStrategy.Speculative())
+            }
+
+            assertArrayEquals(sentence, greedy, speculative)
+        }
+
+        inference.close()
+
+        Log.i(TAG, "Greedy: $greedyTime ms, speculative: $speculativeTime ms")
+    }
+
+    companion object {
+        private val TAG: String = SpeculativeDecodingTest::class.java.simpleName
+
+        private const val MODEL_DIRECTORY: String = "opus-mt-ja-nl"
+
+        private const val THREADS = 4
+        private const val MAX_SEQUENCE_LENGTH = 256
+        private const val MIN_P = 0.0001f
+        private const val REPETITION_PENALTY = 0.1f
+
+        private val SENTENCES = listOf(
+            "注文番号は ABC-12345-XYZ です。",
+            "詳しくは https://example.com/docs/getting-started を参照してください。",
+            "2024年12月16日 14:30 に Ricardo Snoek さんと会います。",
+            "関数 fetchUserProfile(userId) は null を返します。",
+            "電話番号は +31 20 123 4567 です。",
+        )
+    }
+}
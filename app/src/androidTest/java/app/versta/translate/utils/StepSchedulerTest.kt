@@ -0,0 +1,235 @@
+package app.versta.translate.utils
+
+import android.util.Log
+import app.versta.translate.bridge.inference.JobPriority
+import app.versta.translate.bridge.inference.StepScheduler
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.runBlocking
+import kotlinx.coroutines.runInterruptible
+import kotlinx.coroutines.withTimeout
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertNull
+import org.junit.Assert.assertTrue
+import org.junit.Assert.fail
+import org.junit.Test
+import java.util.Collections
+import java.util.concurrent.CountDownLatch
+import kotlin.concurrent.thread
+
+class StepSchedulerTest {
+
+    /**
+     * Admits an interactive job while a background job is decoding. The step the interactive job
+     * waits for has to run before the next step of the background job, which then finishes its
+     * steps.
+     */
+    @Test
+    fun interactiveJobPreemptsBackgroundJob() {
+        val scheduler = StepScheduler()
+        val order = Collections.synchronizedList(mutableListOf<String>())
+        val halfway = CountDownLatch(1)
+        val resume = CountDownLatch(1)
+
+        val background = thread {
+            scheduler.admit(JobPriority.Background).use { job ->
+                repeat(STEPS) { step ->
+                    job.step {
+                        order.add("background")
+                        if (step == STEPS / 2) {
+                            halfway.countDown()
+                            resume.await()
+                        }
+                        Thread.sleep(STEP_MILLIS)
+                    }
+                }
+            }
+        }
+
+        halfway.await()
+        val interactive = thread {
+            scheduler.admit(JobPriority.Interactive).use { job ->
+                repeat(STEPS) {
+                    job.step {
+                        order.add("interactive")
+                        Thread.sleep(STEP_MILLIS)
+                    }
+                }
+            }
+        }
+
+        awaitWaitingJobs(scheduler, 1)
+        resume.countDown()
+        interactive.join()
+        background.join()
+
+        // The background job takes no step between its halfway step and the first step of the
+        // interactive job.
+        assertEquals(order.toString(), "interactive", order[STEPS / 2 + 1])
+        assertEquals(2 * STEPS, order.size)
+
+        val statistics = scheduler.statistics()
+        Log.i(TAG, statistics.toString())
+
+        assertEquals(0, statistics.queueDepth.values.sum())
+        assertEquals(0, statistics.waitingJobs)
+        assertEquals(2L, statistics.completedJobs)
+        assertTrue(statistics.preemptions >= 1L)
+    }
+
+    /**
+     * Keeps an interactive job open without taking steps, like a flow waiting for a slow
+     * collector. A background job has to step without waiting for it.
+     */
+    @Test
+    fun idleJobDoesNotBlockOtherJobs() {
+        val scheduler = StepScheduler()
+        val interactive = scheduler.admit(JobPriority.Interactive)
+        assertEquals(1, interactive.step { 1 })
+
+        var result: Int? = null
+        val background = thread {
+            scheduler.admit(JobPriority.Background).use { job ->
+                result = job.step { 2 }
+            }
+        }
+
+        background.join(TIMEOUT_MILLIS)
+        assertEquals(2, result)
+
+        interactive.close()
+    }
+
+    /**
+     * Cancels a background job while it waits for the step of an interactive job. Its step has to
+     * return without running instead of waiting for the interactive step to finish.
+     */
+    @Test
+    fun cancelledJobStopsWaiting() {
+        val scheduler = StepScheduler()
+        val interactive = scheduler.admit(JobPriority.Interactive)
+        val background = scheduler.admit(JobPriority.Background)
+        val started = CountDownLatch(1)
+        val resume = CountDownLatch(1)
+
+        val running = thread {
+            interactive.step {
+                started.countDown()
+                resume.await()
+            }
+        }
+        started.await()
+
+        var result: Int? = 0
+        val waiting = thread { result = background.step { 1 } }
+
+        awaitWaitingJobs(scheduler, 1)
+        scheduler.cancelAll()
+        waiting.join()
+
+        assertNull(result)
+        assertTrue(background.cancelled)
+
+        resume.countDown()
+        running.join()
+        interactive.close()
+        background.close()
+    }
+
+    /**
+     * Cancels a coroutine waiting for a step behind a step that does not finish yet. The
+     * coroutine has to stop waiting, and the job must not take the turn of the running step.
+     */
+    @Test
+    fun cancelledCoroutineStopsWaiting() {
+        val scheduler = StepScheduler()
+        val interactive = scheduler.admit(JobPriority.Interactive)
+        val background = scheduler.admit(JobPriority.Background)
+        val started = CountDownLatch(1)
+        val resume = CountDownLatch(1)
+
+        val running = thread {
+            interactive.step {
+                started.countDown()
+                resume.await()
+            }
+        }
+        started.await()
+
+        runBlocking {
+            val waiting = launch(Dispatchers.Default) {
+                background.awaitStep { fail("Cancelled step ran") }
+            }
+
+            awaitWaitingJobs(scheduler, 1)
+            withTimeout(TIMEOUT_MILLIS) { waiting.cancelAndJoin() }
+        }
+
+        assertEquals(0, scheduler.statistics().waitingJobs)
+        assertFalse(background.cancelled)
+
+        resume.countDown()
+        running.join()
+
+        assertEquals(3, background.step { 3 })
+        interactive.close()
+        background.close()
+    }
+
+    /**
+     * Runs a job without other jobs in [runInterruptible], which therefore never waits for its
+     * turn. Cancelling the coroutine has to stop the job before its next step.
+     */
+    @Test
+    fun cancelledInterruptibleJobStopsStepping() {
+        val scheduler = StepScheduler()
+        val started = CountDownLatch(1)
+        var steps = 0
+
+        runBlocking {
+            val running = launch(Dispatchers.Default) {
+                runInterruptible {
+                    scheduler.admit(JobPriority.Background).use { job ->
+                        while (true) {
+                            job.step {
+                                steps++
+                                started.countDown()
+                                Thread.sleep(STEP_MILLIS)
+                            }
+                        }
+                    }
+                }
+            }
+
+            started.await()
+            withTimeout(TIMEOUT_MILLIS) { running.cancelAndJoin() }
+        }
+
+        val stopped = steps
+        Thread.sleep(STEP_MILLIS * 4)
+
+        assertEquals(stopped, steps)
+        assertEquals(0, scheduler.statistics().queueDepth.values.sum())
+    }
+
+    /**
+     * Waits until [count] jobs wait for a step.
+     */
+    private fun awaitWaitingJobs(scheduler: StepScheduler, count: Int) {
+        val deadline = System.currentTimeMillis() + TIMEOUT_MILLIS
+        while (scheduler.statistics().waitingJobs != count) {
+            assertTrue("Timed out waiting for $count jobs", System.currentTimeMillis() < deadline)
+            Thread.sleep(1)
+        }
+    }
+
+    companion object {
+        private val TAG: String = StepSchedulerTest::class.java.simpleName
+
+        private const val STEPS = 8
+        private const val STEP_MILLIS = 5L
+        private const val TIMEOUT_MILLIS = 5_000L
+    }
+}
@@ -0,0 +1,46 @@
+package app.versta.translate.utils
+
+import app.versta.translate.core.entity.TextSegment
+import org.junit.Assert.assertEquals
+import org.junit.Test
+
+class TextSegmentTest {
+    @Test
+    fun splitsSentencesAndLines() {
+        val segments = TextSegment.split("Hello   world. How are you?\n\nFine!")
+
+        assertEquals(
+            listOf(
+                TextSegment("Hello world.", " "),
+                TextSegment("How are you?", "\n\n"),
+                TextSegment("Fine!", "")
+            ),
+            segments
+        )
+    }
+
+    @Test
+    fun splitsSentencesWithoutWhitespace() {
+        val segments = TextSegment.split("日本語です。はい")
+
+        assertEquals(listOf("日本語です。", "はい"), segments.map { it.source })
+    }
+
+    @Test
+    fun editOnlyChangesItsSentence() {
+        val before = TextSegment.split("One sentence. Two sentences. Three sentences.")
+        val after = TextSegment.split("One sentence. Two edited sentences. Three sentences.")
+
+        assertEquals(listOf(1), before.indices.filter { before[it] != after[it] })
+    }
+
+    @Test
+    fun joinsWithSeparators() {
+        val segments = TextSegment.split("Hallo.\nHoe gaat het? Goed.")
+
+        assertEquals(
+            "Hello.\nHow are you? Fine.",
+            TextSegment.join(segments, listOf("Hello.", "How are you?", "Fine."))
+        )
+    }
+}
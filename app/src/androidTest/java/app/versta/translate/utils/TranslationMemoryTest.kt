@@ -0,0 +1,94 @@
+package app.versta.translate.utils
+
+import androidx.test.platform.app.InstrumentationRegistry
+import app.versta.translate.bridge.cache.TranslationMemory
+import org.junit.After
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertNull
+import org.junit.Assert.assertTrue
+import org.junit.Before
+import org.junit.Test
+import java.io.File
+
+class TranslationMemoryTest {
+    private lateinit var file: File
+
+    @Before
+    fun setUp() {
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        file = File(context.cacheDir, "translation_memory_test")
+        file.delete()
+    }
+
+    @After
+    fun tearDown() {
+        file.delete()
+    }
+
+    @Test
+    fun persistsAcrossReopen() {
+        TranslationMemory(file.path, MAX_ENTRIES, MAX_BYTES).use { memory ->
+            memory.put("en-nl", "Hello", "Hallo")
+            memory.put("nl-en", "Hallo", "Hello")
+            memory.put("en-nl", "Hello", "Hoi")
+        }
+
+        TranslationMemory(file.path, MAX_ENTRIES, MAX_BYTES).use { memory ->
+            assertEquals("Hoi", memory.get("en-nl", "Hello"))
+            assertEquals("Hello", memory.get("nl-en", "Hallo"))
+            assertNull(memory.get("en-de", "Hello"))
+            assertEquals(2, memory.size())
+        }
+    }
+
+    @Test
+    fun evictsToMaxEntries() {
+        TranslationMemory(file.path, 2, MAX_BYTES).use { memory ->
+            memory.put("en-nl", "one", "een")
+            memory.put("en-nl", "two", "twee")
+            memory.put("en-nl", "three", "drie")
+
+            assertEquals(2, memory.size())
+            assertEquals("drie", memory.get("en-nl", "three"))
+        }
+
+        TranslationMemory(file.path, 2, MAX_BYTES).use { memory ->
+            assertEquals(2, memory.size())
+        }
+    }
+
+    @Test
+    fun clearsLanguagePair() {
+        TranslationMemory(file.path, MAX_ENTRIES, MAX_BYTES).use { memory ->
+            memory.put("en-nl", "Hello", "Hallo")
+            memory.put("nl-en", "Hallo", "Hello")
+            memory.clear("en-nl")
+
+            assertEquals(0, memory.size("en-nl"))
+            assertEquals(1, memory.size("nl-en"))
+        }
+
+        TranslationMemory(file.path, MAX_ENTRIES, MAX_BYTES).use { memory ->
+            assertNull(memory.get("en-nl", "Hello"))
+            assertEquals(1, memory.size())
+        }
+    }
+
+    @Test
+    fun compactsOverwrittenEntries() {
+        TranslationMemory(file.path, MAX_ENTRIES, MAX_BYTES).use { memory ->
+            repeat(10_000) { memory.put("en-nl", "counter", it.toString()) }
+            val before = file.length()
+
+            memory.compact()
+
+            assertTrue(file.length() <= before)
+            assertEquals("9999", memory.get("en-nl", "counter"))
+        }
+    }
+
+    companion object {
+        private const val MAX_ENTRIES = 1024
+        private const val MAX_BYTES = 1024L * 1024
+    }
+}
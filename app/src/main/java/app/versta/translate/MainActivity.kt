@@ -47,7 +47,8 @@ open class MainActivity : ComponentActivity() {
             viewModelFactory {
                 LanguageImportViewModel(
                     modelExtractor = MainApplication.module.extractor,
-                    languageRepository = MainApplication.module.languageRepository
+                    languageRepository = MainApplication.module.languageRepository,
+                    modelCompiler = MainApplication.module.compiler
                 )
             }
         }
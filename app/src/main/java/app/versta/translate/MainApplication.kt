@@ -12,11 +12,15 @@ import app.versta.translate.adapter.outbound.LanguageRepository
 import app.versta.translate.adapter.outbound.LicenseDataStoreRepository
 import app.versta.translate.adapter.outbound.LicenseRepository
 import app.versta.translate.adapter.outbound.MarianInference
+import app.versta.translate.adapter.outbound.MarianModelCompiler
 import app.versta.translate.adapter.outbound.MarianTokenizer
+import app.versta.translate.adapter.outbound.ModelCompiler
+import app.versta.translate.adapter.outbound.PivotPipeline
 import app.versta.translate.adapter.outbound.TranslationInference
 import app.versta.translate.adapter.outbound.TranslationPreferenceDataStoreRepository
 import app.versta.translate.adapter.outbound.TranslationPreferenceRepository
 import app.versta.translate.adapter.outbound.TranslationTokenizer
+import app.versta.translate.bridge.inference.SessionPool
 import app.versta.translate.core.model.LoggingViewModel
 import app.versta.translate.core.model.TextTranslationViewModel
 import app.versta.translate.core.model.TranslationViewModel
@@ -24,6 +28,7 @@ import app.versta.translate.database.DatabaseContainer
 import app.versta.translate.utils.FileLoggingTree
 import timber.log.Timber
 import timber.log.Timber.Forest.plant
+import java.io.File
 
 
 val Context.dataStore by preferencesDataStore(name = "preferences")
@@ -39,8 +44,10 @@ interface ApplicationModuleInterface {
     val loggingViewModel: LoggingViewModel
 
     val extractor: CompressedFileExtractor
+    val compiler: ModelCompiler
     val tokenizer: TranslationTokenizer
     val model: TranslationInference
+    val pivot: PivotPipeline
 }
 
 class ApplicationModule(context: Context) : ApplicationModuleInterface {
@@ -72,7 +79,9 @@ class ApplicationModule(context: Context) : ApplicationModuleInterface {
             model = MainApplication.module.model,
             languageRepository = MainApplication.module.languageRepository,
             languagePreferenceRepository = MainApplication.module.languagePreferenceRepository,
-            translationPreferenceRepository = MainApplication.module.translatorPreferenceRepository
+            translationPreferenceRepository = MainApplication.module.translatorPreferenceRepository,
+            translationMemoryFile = File(context.filesDir, "translation_memory"),
+            pivot = MainApplication.module.pivot
         )
     }
 
@@ -87,12 +96,36 @@ class ApplicationModule(context: Context) : ApplicationModuleInterface {
         TarballExtractor(context)
     }
 
+    override val compiler: ModelCompiler by lazy {
+        MarianModelCompiler(inference = MarianInference())
+    }
+
     override val tokenizer: TranslationTokenizer by lazy {
         MarianTokenizer()
     }
 
     override val model: TranslationInference by lazy {
-        MarianInference()
+        MarianInference(
+            optimizedModelDirectory = File(context.cacheDir, "optimized_models")
+        )
+    }
+
+    /**
+     * Translates the language pairs without a model of their own through English. Its models are
+     * only loaded once such a pair is selected, and both stages keep them in one pool.
+     */
+    override val pivot: PivotPipeline by lazy {
+        val sessionPool = SessionPool<MarianInference.ModelSessions>(MarianInference.DEFAULT_MEMORY_BUDGET)
+
+        fun stage() = PivotPipeline.Stage(
+            tokenizer = MarianTokenizer(),
+            inference = MarianInference(
+                optimizedModelDirectory = File(context.cacheDir, "optimized_models"),
+                sessionPool = sessionPool
+            )
+        )
+
+        PivotPipeline(first = stage(), second = stage())
     }
 }
 
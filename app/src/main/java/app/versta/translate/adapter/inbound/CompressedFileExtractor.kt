@@ -7,8 +7,8 @@ interface ExtractionProgressListener {
     /**
      * Callback for progress updates during extraction.
      * @param file The file currently being extracted.
-     * @param extracted The number of files that have been extracted so far.
-     * @param total The total number of files in the archive.
+     * @param extracted The number of megabytes that have been extracted so far.
+     * @param total The total number of uncompressed megabytes in the archive.
      */
     fun onProgressUpdate(file: File, extracted: Int, total: Int)
 }
@@ -3,11 +3,11 @@ package app.versta.translate.adapter.inbound
 import android.content.Context
 import android.net.Uri
 import android.provider.OpenableColumns
+import app.versta.translate.bridge.archive.Tarball
 import org.apache.commons.compress.archivers.tar.TarArchiveInputStream
 import org.apache.commons.compress.compressors.gzip.GzipCompressorInputStream
 import java.io.File
-import java.io.FileInputStream
-import java.io.FileOutputStream
+import java.io.IOException
 
 class TarballExtractor(private val context: Context) : CompressedFileExtractor {
     /**
@@ -22,19 +22,41 @@ class TarballExtractor(private val context: Context) : CompressedFileExtractor {
         extractToDirectory: Boolean,
         listener: ExtractionProgressListener?
     ): File {
-        var file: File? = null
-
-        try {
-            file = copyToInternalStorage(uri)
-            return extractFile(file, outputDir, extractToDirectory, listener)
-        } catch (e: Exception) {
-            throw e
-        } finally {
-            // Clean up the temporary file
-            if (file?.exists() == true) {
-                file.delete()
+        val extractionDir = if (extractToDirectory) {
+            val fileNameWithoutExtension = (getFileName(uri) ?: "tmp.tar.gz").removeSuffix(".tar.gz")
+            File(outputDir, fileNameWithoutExtension)
+        } else outputDir
+
+        if (!extractionDir.exists()) {
+            extractionDir.mkdirs()
+        }
+
+        val checksums = mutableMapOf<String, String>()
+
+        val tarballListener = object : Tarball.Listener {
+            override fun onProgress(path: String, extractedBytes: Long, totalBytes: Long) {
+                listener?.onProgressUpdate(
+                    File(extractionDir, path),
+                    (extractedBytes / BYTES_PER_PROGRESS_UNIT).toInt(),
+                    (totalBytes / BYTES_PER_PROGRESS_UNIT).toInt()
+                )
+            }
+
+            override fun onFileExtracted(path: String, sha256: String) {
+                checksums[path] = sha256
             }
         }
+
+        val descriptor = context.contentResolver.openFileDescriptor(uri, "r")
+            ?: throw IOException("Failed to open $uri")
+
+        descriptor.use {
+            Tarball.extract(it.fd, extractionDir.path, tarballListener)
+        }
+
+        verifyChecksums(extractionDir, checksums)
+
+        return extractionDir
     }
 
     /**
@@ -62,70 +84,30 @@ class TarballExtractor(private val context: Context) : CompressedFileExtractor {
     }
 
     /**
-     * Copies the file from the given Uri to the app's internal storage.
-     * @param uri The Uri of the file to copy.
-     * @return The File object pointing to the copied file in internal storage.
+     * Verifies the extracted files against the checksum files in the archive, which list the
+     * SHA-256 of files relative to their own directory in the format of sha256sum.
+     * @param extractionDir The directory the archive was extracted into.
+     * @param checksums The SHA-256 of every extracted file by its path in the archive.
      */
-    private fun copyToInternalStorage(uri: Uri): File {
-        val fileName = getFileName(uri) ?: "tmp.tar.gz"
-        val destinationFile = File(context.filesDir, fileName)
+    private fun verifyChecksums(extractionDir: File, checksums: Map<String, String>) {
+        val checksumFiles = checksums.keys.filter { File(it).name == CHECKSUM_FILE_NAME }
 
-        context.contentResolver.openInputStream(uri).use { inputStream ->
-            FileOutputStream(destinationFile).use { outputStream ->
-                inputStream?.copyTo(outputStream)
-            }
-        }
+        for (checksumFile in checksumFiles) {
+            val directory = File(checksumFile).parent
 
-        return destinationFile
-    }
+            File(extractionDir, checksumFile).forEachLine { line ->
+                val match = CHECKSUM_LINE_REGEX.matchEntire(line.trim()) ?: return@forEachLine
+                val (expected, name) = match.destructured
 
-    /**
-     * Extracts the contents of a .tar.gz file into a specified directory.
-     * @param file The File object pointing to the .tar.gz file.
-     * @param outputDir The directory where the contents should be extracted.
-     */
-    private fun extractFile(
-        file: File,
-        outputDir: File,
-        extractToDirectory: Boolean,
-        listener: ExtractionProgressListener?
-    ): File {
-        val total = if (listener != null) getTotalEntries(file) else 0
-        val extractionDir = if (extractToDirectory) {
-            val fileNameWithoutExtension = file.name.removeSuffix(".tar.gz")
-            File(outputDir, fileNameWithoutExtension)
-        } else outputDir
+                val path = if (directory != null) "$directory/$name" else name
+                val actual = checksums[path]
+                    ?: throw IOException("File $path is missing from the archive")
 
-        if (!extractionDir.exists()) {
-            extractionDir.mkdirs()
-        }
-
-        TarArchiveInputStream(GzipCompressorInputStream(FileInputStream(file))).use { input ->
-            var entry = input.nextEntry
-            var extracted = 0
-
-            while (entry != null) {
-                val path = File(extractionDir, entry.name)
-
-                if (entry.isDirectory) {
-                    path.mkdirs()
-                } else {
-                    path.parentFile?.mkdirs()
-                    FileOutputStream(path).use { outputStream ->
-                        input.copyTo(outputStream)
-                    }
+                if (!actual.equals(expected, ignoreCase = true)) {
+                    throw IOException("Checksum mismatch for $path")
                 }
-
-                if (listener != null) {
-                    extracted++
-                    listener.onProgressUpdate(path, extracted, total)
-                }
-
-                entry = input.nextEntry
             }
         }
-
-        return extractionDir
     }
 
     /**
@@ -156,24 +138,15 @@ class TarballExtractor(private val context: Context) : CompressedFileExtractor {
         return result
     }
 
-    /**
-     * Helper method to retrieve the total number of entries in a .tar.gz file.
-     * @param file The File object pointing to the .tar.gz file.
-     * @return The total number of entries in the .tar.gz file.
-     */
-    private fun getTotalEntries(file: File): Int {
-        var totalEntries = 0
-
-        TarArchiveInputStream(GzipCompressorInputStream(FileInputStream(file))).use { input ->
-            while (input.nextEntry != null) {
-                totalEntries++
-            }
-        }
-
-        return totalEntries
-    }
-
     companion object {
         private val TAG: String = TarballExtractor::class.java.simpleName
+
+        /**
+         * Progress is reported in megabytes of uncompressed data.
+         */
+        private const val BYTES_PER_PROGRESS_UNIT = 1024L * 1024L
+
+        private const val CHECKSUM_FILE_NAME = "SHA256SUMS"
+        private val CHECKSUM_LINE_REGEX = Regex("([0-9a-fA-F]{64}) [ *](.+)")
     }
 }
\ No newline at end of file
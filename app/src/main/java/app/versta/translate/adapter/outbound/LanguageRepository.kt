@@ -8,6 +8,7 @@ import app.versta.translate.core.entity.LanguagePair
 import app.versta.translate.core.entity.LanguagePairWithModelFiles
 import app.versta.translate.core.entity.ModelMetadata
 import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.combine
 
 interface LanguageRepository {
     /**
@@ -35,6 +36,44 @@ interface LanguageRepository {
      */
     fun getLanguageModel(languagePair: LanguagePair): LanguageModelFiles?
 
+    /**
+     * Gets the target languages for a given source language, including the languages that are
+     * reached by translating through [pivot] when no model covers the pair directly.
+     */
+    fun getTargetLanguagesBySource(sourceLanguage: Language, pivot: Language): Flow<List<Language>> {
+        val targets = getTargetLanguagesBySource(sourceLanguage)
+        if (sourceLanguage == pivot) {
+            return targets
+        }
+
+        return targets.combine(getTargetLanguagesBySource(pivot)) { direct, pivotTargets ->
+            if (pivot !in direct) {
+                return@combine direct
+            }
+
+            (direct + pivotTargets.filter { it != sourceLanguage }).distinct()
+        }
+    }
+
+    /**
+     * Gets the language model files that translate a given language pair through [pivot], the
+     * model from the source into the pivot language and from the pivot into the target language,
+     * or null when either of them is not available.
+     */
+    fun getPivotLanguageModels(
+        languagePair: LanguagePair,
+        pivot: Language
+    ): Pair<LanguageModelFiles, LanguageModelFiles>? {
+        if (languagePair.source == pivot || languagePair.target == pivot) {
+            return null
+        }
+
+        val first = getLanguageModel(LanguagePair(languagePair.source, pivot)) ?: return null
+        val second = getLanguageModel(LanguagePair(pivot, languagePair.target)) ?: return null
+
+        return Pair(first, second)
+    }
+
     /**
      * Inserts a [LanguageMetadata] into the repository, ignoring if it already exists.
      * @param bundleMetadata The metadata of the bundle containing the language model.
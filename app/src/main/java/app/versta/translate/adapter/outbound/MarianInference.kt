@@ -1,10 +1,21 @@
 package app.versta.translate.adapter.outbound
 
+import ai.onnxruntime.OnnxJavaType
 import ai.onnxruntime.OrtEnvironment
 import ai.onnxruntime.OrtLoggingLevel
 import ai.onnxruntime.OrtSession
+import ai.onnxruntime.TensorInfo
 import ai.onnxruntime.extensions.OrtxPackage
+import app.versta.translate.bridge.inference.BatchPlanner
 import app.versta.translate.bridge.inference.BeamSearch
+import app.versta.translate.bridge.inference.DecoderBinding
+import app.versta.translate.bridge.inference.DecodingStrategy
+import app.versta.translate.bridge.inference.JobPriority
+import app.versta.translate.bridge.inference.MappedSession
+import app.versta.translate.bridge.inference.SessionPool
+import app.versta.translate.bridge.inference.ShortlistIndex
+import app.versta.translate.bridge.inference.StepScheduler
+import app.versta.translate.bridge.inference.TensorUtils
 import app.versta.translate.core.entity.LanguageModelInferenceFiles
 import app.versta.translate.core.entity.DecoderInput
 import app.versta.translate.core.entity.DecoderOutput
@@ -12,15 +23,32 @@ import app.versta.translate.core.entity.EncoderAttentionMasks
 import app.versta.translate.core.entity.EncoderHiddenStates
 import app.versta.translate.core.entity.EncoderInput
 import app.versta.translate.core.entity.EncoderOutput
+import app.versta.translate.utils.TensorUtils as OrtTensorUtils
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.emitAll
 import kotlinx.coroutines.flow.flow
 import kotlinx.coroutines.flow.flowOn
 import timber.log.Timber
 import java.io.File
+import java.nio.file.Path
+import java.util.UUID
+import kotlin.io.path.fileSize
 import kotlin.io.path.pathString
 
-class MarianInference : TranslationInference {
+/**
+ * @param optimizedModelDirectory Directory to save the optimized graphs of loaded models in, which
+ * makes later loads of the same model skip graph optimization. Disabled when null.
+ * @param memoryBudget Number of bytes the loaded models may keep resident, so switching back to a
+ * recently used language pair does not have to load its models again.
+ * @param sessionPool Pool shared with other instances, so their models stay resident under one
+ * budget instead of [memoryBudget] each. A shared pool is left open when this instance is closed.
+ */
+class MarianInference(
+    private val optimizedModelDirectory: File? = null,
+    memoryBudget: Long = DEFAULT_MEMORY_BUDGET,
+    sessionPool: SessionPool<ModelSessions>? = null
+) : TranslationInference {
 
     private val ortEnvironment =
         OrtEnvironment.getEnvironment(OrtLoggingLevel.ORT_LOGGING_LEVEL_FATAL,
@@ -29,29 +57,87 @@ class MarianInference : TranslationInference {
                 setGlobalSpinControl(false)
             })
 
-    private var encoderSession: OrtSession? = null
-    private var decoderSession: OrtSession? = null
+    /**
+     * @param shortlist Shortlist of the model, the search covers the full vocabulary without one.
+     * It is closed with the sessions, once no translation holds a lease on them.
+     * @param threads Number of threads of the sessions, which the beam search uses as well.
+     * @param maxLengthRatio Target tokens per source token of the model, which bounds the length of
+     * a translation.
+     */
+    class ModelSessions internal constructor(
+        val encoder: MappedSession,
+        val decoder: MappedSession,
+        val shortlist: ShortlistIndex?,
+        val threads: Int,
+        val maxLengthRatio: Float
+    ) : AutoCloseable {
+        /**
+         * Type the decoder declares for its past key/values.
+         */
+        val cacheType: OnnxJavaType = decoder.session.inputInfo.entries
+            .firstOrNull { it.key.startsWith("past_key_values") }
+            ?.let { (it.value.info as? TensorInfo)?.type }
+            ?: OnnxJavaType.FLOAT
+
+        override fun close() {
+            encoder.close()
+            decoder.close()
+            shortlist?.close()
+        }
+    }
+
+    private val ownsSessionPool = sessionPool == null
+    private val sessionPool = sessionPool ?: SessionPool(memoryBudget)
+
+    /**
+     * Lease on the sessions of the loaded model. Every translation takes its own lease, so it keeps
+     * decoding with the same sessions when another model is loaded in the meantime.
+     */
+    private var sessions: SessionPool<ModelSessions>.Lease? = null
+    private var sessionsKey: String? = null
+    private val sessionsLock = Any()
+
+    /**
+     * Runs the encoder and decoder steps of concurrent translations one at a time, by priority.
+     */
+    private val scheduler = StepScheduler()
+
+    /**
+     * Groups the sequences of [runBatch] by length, so every batch is encoded at its own length.
+     */
+    private val batchPlanner = BatchPlanner()
+
+    /**
+     * Batches encoded by [runBatch], the most recent last.
+     */
+    private val recentBatches = ArrayDeque<BatchPlanner.Batch>()
+
+    init {
+        TensorUtils.registerSharedAllocator(
+            apiHandle = OrtTensorUtils.getOrtApiHandle(),
+            environmentHandle = OrtTensorUtils.getNativeHandle(ortEnvironment)
+        )
+    }
 
-    private var runInference = false
+    /**
+     * Searches of the running translations, which [cancel] stops.
+     */
+    private val activeSearches = mutableSetOf<BeamSearch>()
 
     private fun encode(
-        inputIds: LongArray, attentionMask: LongArray
+        sessions: ModelSessions, inputIds: LongArray, attentionMask: LongArray, beamSize: Int
     ): EncoderHiddenStates {
-        if (encoderSession == null) {
-            throw IllegalStateException("Encoder session is not loaded")
-        }
-
         val encoderInput = EncoderInput(
             ortEnvironment = ortEnvironment,
             inputIds = inputIds,
             attentionMask = attentionMask
         )
 
-        val encoderOutput = EncoderOutput()
+        val encoderOutput = EncoderOutput(ortEnvironment)
 
         try {
             val inputs = encoderInput.get()
-            val output = encoderOutput.parse(encoderSession!!.run(inputs))
+            val output = encoderOutput.parse(sessions.encoder.session.run(inputs), beamSize)
 
             return output ?: throw IllegalStateException("Encoder output is null")
         } catch (e: Exception) {
@@ -63,7 +149,119 @@ class MarianInference : TranslationInference {
         }
     }
 
+    /**
+     * Encodes the sequences of [batch] at the length of its longest sequence, and returns the
+     * hidden states of every sequence at its own length, in the order of the batch.
+     */
+    private fun encodeBatch(
+        sessions: ModelSessions,
+        batch: BatchPlanner.Batch,
+        inputIds: List<LongArray>,
+        padId: Long,
+        beamSize: Int
+    ): List<EncoderHiddenStates> {
+        val sequences = batch.indices.map { inputIds[it] }
+        val encoderInput = EncoderInput(
+            ortEnvironment = ortEnvironment,
+            inputIds = Array(sequences.size) { row ->
+                LongArray(batch.length) { i -> sequences[row].getOrElse(i) { padId } }
+            },
+            attentionMask = Array(sequences.size) { row ->
+                LongArray(batch.length) { i -> if (i < sequences[row].size) 1 else 0 }
+            }
+        )
+
+        val encoderOutput = EncoderOutput(ortEnvironment)
+
+        try {
+            val inputs = encoderInput.get()
+            val output = encoderOutput.parseRows(sessions.encoder.session.run(inputs), batch.lengths, beamSize)
+
+            synchronized(recentBatches) {
+                recentBatches.addLast(batch)
+                if (recentBatches.size > RECENT_BATCHES) {
+                    recentBatches.removeFirst()
+                }
+            }
+            Timber.tag(TAG).d("Encoded $batch")
+
+            return output ?: throw IllegalStateException("Encoder output is null")
+        } catch (e: Exception) {
+            Timber.e(e)
+            throw e
+        } finally {
+            encoderInput.destroy()
+            encoderOutput.destroy()
+        }
+    }
+
+    /**
+     * Runs one decoder step and searches its logits. Without a binding the outputs are allocated
+     * by the session, and the present key/values are copied into the cache for the next step.
+     * With a [draft], the step runs for the last token and the draft at once and keeps the key/
+     * values of the tokens the search accepted.
+     *
+     * @return The number of tokens the step added to the sequence.
+     */
+    private fun decodeStep(
+        session: OrtSession,
+        beamSearch: BeamSearch,
+        decoderInput: DecoderInput,
+        decoderOutput: DecoderOutput,
+        decoderBinding: DecoderBinding?,
+        draft: LongArray
+    ): Int {
+        if (decoderBinding != null && draft.isNotEmpty()) {
+            val logits = decoderBinding.run(beamSearch.lastTokens().first() + draft)
+            val steps = beamSearch.verify(logits, draft, decoderBinding.vocabularySize)
+            decoderBinding.accept(steps)
+            decoderBinding.reorder(beamSearch.topBeamIds())
+            return steps
+        }
+
+        if (decoderBinding != null) {
+            val logits = decoderBinding.run(beamSearch.lastTokens())
+            beamSearch.search(logits, decoderBinding.vocabularySize)
+            decoderBinding.reorder(beamSearch.topBeamIds())
+            return 1
+        }
+
+        val inputs = decoderInput.get(
+            inputIds = beamSearch.lastTokens(),
+            cache = decoderOutput.cache
+        )
+
+        val outputs = session.run(inputs)
+        decoderInput.close()
+
+        decoderOutput.search(outputs)
+        decoderOutput.cache(outputs)
+
+        outputs.close()
+        return 1
+    }
+
+    /**
+     * Drafts the tokens the next step verifies, none unless decoding speculatively through a
+     * binding. The draft never takes the sequence past [remaining] more tokens.
+     */
+    private fun draft(
+        beamSearch: BeamSearch,
+        sourceIds: LongArray,
+        strategy: DecodingStrategy,
+        decoderBinding: DecoderBinding?,
+        remaining: Int
+    ): LongArray {
+        if (strategy !is DecodingStrategy.Speculative || decoderBinding == null || remaining <= 1) {
+            return NO_DRAFT
+        }
+
+        return beamSearch.draft(sourceIds, minOf(strategy.draftLength, remaining - 1))
+    }
+
     private fun decode(
+        sessions: ModelSessions,
+        sourceIds: LongArray,
         encoderHiddenStates: EncoderHiddenStates,
         attentionMask: EncoderAttentionMasks,
         eosId: Long,
@@ -72,72 +270,85 @@ class MarianInference : TranslationInference {
         repetitionPenalty: Float,
         beamsSize: Int,
         maxSequenceLength: Int,
-        completeOnRepeat: Boolean
+        noRepeatNgramSize: Int,
+        strategy: DecodingStrategy,
+        candidates: IntArray?,
+        timeoutMillis: Long,
+        job: StepScheduler.Job
     ): LongArray {
-        if (decoderSession == null) {
-            throw IllegalStateException("Decoder session is not loaded")
-        }
-
         val beamSearch = BeamSearch(
             beamSize = beamsSize,
             minP = minP,
             repetitionPenalty = repetitionPenalty,
             padId = padId,
-            eosId = eosId
+            eosId = eosId,
+            threads = sessions.threads,
+            strategy = strategy,
+            noRepeatNgramSize = noRepeatNgramSize,
+            sourceLength = sourceIds.size,
+            maxLengthRatio = sessions.maxLengthRatio,
+            maxSequenceLength = maxSequenceLength,
+            timeoutMillis = timeoutMillis
         )
+        candidates?.let { beamSearch.restrict(it) }
+        track(beamSearch)
 
         val decoderInput = DecoderInput(
             ortEnvironment = ortEnvironment,
-            encoderHiddenStates = Array(beamsSize) { encoderHiddenStates },
-            encoderAttentionMask = Array(beamsSize) { attentionMask }
+            encoderHiddenStates = encoderHiddenStates,
+            encoderAttentionMask = attentionMask,
+            beamSize = beamsSize
         )
 
         val decoderOutput = DecoderOutput(
             ortEnvironment = ortEnvironment,
-            beamSearch = beamSearch
+            beamSearch = beamSearch,
+            cacheType = sessions.cacheType,
+            maxSequenceLength = beamSearch.maxLength
+        )
+
+        val decoderBinding = DecoderBinding.create(
+            session = sessions.decoder.session,
+            encoderHiddenStates = decoderInput.encoderHiddenStates,
+            encoderAttentionMask = decoderInput.encoderAttentionMask,
+            beamSize = beamsSize,
+            maxSequenceLength = beamSearch.maxLength,
+            maxTokens = maxTokens(strategy)
         )
 
         var step = 0
 
         try {
-            while (runInference && step < maxSequenceLength) {
-                step++
-
-                if (beamSearch.complete(completeOnRepeat)) {
-                    break;
-                }
-
-                val inputs = decoderInput.get(
-                    inputIds = beamSearch.lastTokens(),
-                    cache = decoderOutput.cache
-                )
-
-                val outputs = decoderSession!!.run(inputs)
-                decoderInput.close()
-
-                decoderOutput.search(outputs)
-                decoderOutput.cache(outputs)
-
-                outputs.close()
-            }
-
-            val result = beamSearch.best().plus(eosId)
-
-            if (completeOnRepeat) {
-                return distinct(result)
+            while (step < beamSearch.maxLength && !beamSearch.complete()) {
+                step += job.step {
+                    val remaining = beamSearch.maxLength - step
+                    val draft = draft(beamSearch, sourceIds, strategy, decoderBinding, remaining)
+                    decodeStep(
+                        sessions.decoder.session,
+                        beamSearch,
+                        decoderInput,
+                        decoderOutput,
+                        decoderBinding,
+                        draft
+                    )
+                } ?: break
             }
 
-            return result
+            return result(beamSearch, job, eosId)
         } catch (e: Exception) {
             Timber.e(e)
             throw e
         } finally {
+            decoderBinding?.close()
             decoderInput.destroy()
             decoderOutput.destroy()
+            release(beamSearch)
         }
     }
 
     private fun decodeAsFlow(
+        sessions: ModelSessions,
+        sourceIds: LongArray,
         encoderHiddenStates: EncoderHiddenStates,
         attentionMask: EncoderAttentionMasks,
         eosId: Long,
@@ -146,12 +357,12 @@ class MarianInference : TranslationInference {
         repetitionPenalty: Float,
         beamsSize: Int,
         maxSequenceLength: Int,
-        completeOnRepeat: Boolean
+        noRepeatNgramSize: Int,
+        strategy: DecodingStrategy,
+        candidates: IntArray?,
+        timeoutMillis: Long,
+        job: StepScheduler.Job
     ): Flow<LongArray> {
-        if (decoderSession == null) {
-            throw IllegalStateException("Decoder session is not loaded")
-        }
-
         return flow {
             val beamSearch = BeamSearch(
                 beamSize = beamsSize,
@@ -159,59 +370,69 @@ class MarianInference : TranslationInference {
                 repetitionPenalty = repetitionPenalty,
                 padId = padId,
                 eosId = eosId,
+                threads = sessions.threads,
+                strategy = strategy,
+                noRepeatNgramSize = noRepeatNgramSize,
+                sourceLength = sourceIds.size,
+                maxLengthRatio = sessions.maxLengthRatio,
+                maxSequenceLength = maxSequenceLength,
+                timeoutMillis = timeoutMillis
             )
+            candidates?.let { beamSearch.restrict(it) }
+            track(beamSearch)
 
             val decoderInput = DecoderInput(
                 ortEnvironment = ortEnvironment,
-                encoderHiddenStates = Array(beamsSize) { encoderHiddenStates },
-                encoderAttentionMask = Array(beamsSize) { attentionMask }
+                encoderHiddenStates = encoderHiddenStates,
+                encoderAttentionMask = attentionMask,
+                beamSize = beamsSize
             )
 
             val decoderOutput = DecoderOutput(
                 ortEnvironment = ortEnvironment,
-                beamSearch = beamSearch
+                beamSearch = beamSearch,
+                cacheType = sessions.cacheType,
+                maxSequenceLength = beamSearch.maxLength
+            )
+
+            val decoderBinding = DecoderBinding.create(
+                session = sessions.decoder.session,
+                encoderHiddenStates = decoderInput.encoderHiddenStates,
+                encoderAttentionMask = decoderInput.encoderAttentionMask,
+                beamSize = beamsSize,
+                maxSequenceLength = beamSearch.maxLength,
+                maxTokens = maxTokens(strategy)
             )
 
             var step = 0
 
             try {
-                while (runInference && step < maxSequenceLength) {
-                    step++
-
-                    if (beamSearch.complete(completeOnRepeat)) {
-                        val result = beamSearch.best().plus(eosId)
-
-                        if (completeOnRepeat) {
-                            emit(distinct(result))
-                            break
-                        }
-
-                        emit(result)
-                        break
-                    }
-
-                    val inputs = decoderInput.get(
-                        inputIds = beamSearch.lastTokens(),
-                        cache = decoderOutput.cache
-                    )
-
-                    val outputs = decoderSession!!.run(inputs)
-                    decoderInput.close()
-
-                    decoderOutput.search(outputs)
-                    decoderOutput.cache(outputs)
-
-                    outputs.close()
+                while (step < beamSearch.maxLength && !beamSearch.complete()) {
+                    step += job.awaitStep {
+                        val remaining = beamSearch.maxLength - step
+                        val draft = draft(beamSearch, sourceIds, strategy, decoderBinding, remaining)
+                        decodeStep(
+                            sessions.decoder.session,
+                            beamSearch,
+                            decoderInput,
+                            decoderOutput,
+                            decoderBinding,
+                            draft
+                        )
+                    } ?: break
 
                     emit(beamSearch.best())
                 }
+
+                emit(result(beamSearch, job, eosId))
             } catch (e: Exception) {
                 Timber.e(e)
                 throw e
             } finally {
+                decoderBinding?.close()
                 decoderInput.destroy()
                 decoderOutput.destroy()
-
+                release(beamSearch)
             }
         }.flowOn(Dispatchers.Default)
     }
@@ -225,31 +446,123 @@ class MarianInference : TranslationInference {
         repetitionPenalty: Float,
         beamSize: Int,
         maxSequenceLength: Int,
+        strategy: DecodingStrategy,
+        noRepeatNgramSize: Int,
+        priority: JobPriority,
+        timeoutMillis: Long,
     ): LongArray {
-        runInference = true
-
-        // This is a workaround for the issue with various models that are overfitting on the
-        // training data, and start repeating when translating single words. This is a temporary
-        // solution until we can start retraining the models.
-        val completeOnRepeat = inputIds.size <= 2
+        val search = strategy.resolve(beamSize)
+        val beams = if (search == DecodingStrategy.Beam) beamSize else 1
+
+        // Various models overfit on their training data and start repeating when translating
+        // single words, so no token may repeat in the translation of a very short input.
+        val ngramSize = if (inputIds.size <= 2) 1 else noRepeatNgramSize
+
+        val startedAt = System.nanoTime()
+
+        leaseSessions().use { lease ->
+            scheduler.admit(priority).use { job ->
+                val encoderHiddenStates = job.step {
+                    encode(
+                        sessions = lease.value,
+                        inputIds = inputIds,
+                        attentionMask = attentionMask,
+                        beamSize = beams
+                    )
+                } ?: return longArrayOf(padId)
+
+                val tokens = decode(
+                    sessions = lease.value,
+                    sourceIds = inputIds,
+                    encoderHiddenStates = encoderHiddenStates,
+                    attentionMask = attentionMask,
+                    eosId = eosId,
+                    padId = padId,
+                    minP = minP,
+                    repetitionPenalty = repetitionPenalty,
+                    beamsSize = beams,
+                    maxSequenceLength = maxSequenceLength,
+                    noRepeatNgramSize = ngramSize,
+                    strategy = search,
+                    candidates = candidates(lease.value, inputIds, eosId, padId),
+                    timeoutMillis = remaining(timeoutMillis, startedAt),
+                    job = job
+                )
+                return tokens
+            }
+        }
+    }
 
-        val encoderHiddenStates = encode(
-            inputIds = inputIds,
-            attentionMask = attentionMask
-        )
+    override fun runBatch(
+        inputIds: List<LongArray>,
+        eosId: Long,
+        padId: Long,
+        minP: Float,
+        repetitionPenalty: Float,
+        beamSize: Int,
+        maxSequenceLength: Int,
+        strategy: DecodingStrategy,
+        noRepeatNgramSize: Int,
+        priority: JobPriority,
+        timeoutMillis: Long,
+    ): List<LongArray> {
+        val search = strategy.resolve(beamSize)
+        val beams = if (search == DecodingStrategy.Beam) beamSize else 1
+
+        val results = MutableList(inputIds.size) { longArrayOf(padId) }
+        val batches = batchPlanner.plan(IntArray(inputIds.size) { inputIds[it].size })
+
+        val startedAt = System.nanoTime()
+
+        leaseSessions().use { lease ->
+            scheduler.admit(priority).use { job ->
+                for (batch in batches) {
+                    val encoderHiddenStates = job.step {
+                        encodeBatch(lease.value, batch, inputIds, padId, beams)
+                    } ?: break
+
+                    // Decoding closes the hidden states of a sequence, the ones it did not reach are
+                    // closed here when the batch is cancelled or a sequence fails to decode.
+                    var decoded = 0
+                    try {
+                        for ((row, hiddenStates) in encoderHiddenStates.withIndex()) {
+                            if (job.cancelled) {
+                                break
+                            }
+
+                            decoded = row + 1
+                            val sourceIds = inputIds[batch.indices[row]]
+
+                            results[batch.indices[row]] = decode(
+                                sessions = lease.value,
+                                sourceIds = sourceIds,
+                                encoderHiddenStates = hiddenStates,
+                                attentionMask = LongArray(sourceIds.size) { 1 },
+                                eosId = eosId,
+                                padId = padId,
+                                minP = minP,
+                                repetitionPenalty = repetitionPenalty,
+                                beamsSize = beams,
+                                maxSequenceLength = maxSequenceLength,
+                                // Like run, no token may repeat in the translation of a very short input.
+                                noRepeatNgramSize = if (sourceIds.size <= 2) 1 else noRepeatNgramSize,
+                                strategy = search,
+                                candidates = candidates(lease.value, sourceIds, eosId, padId),
+                                timeoutMillis = remaining(timeoutMillis, startedAt),
+                                job = job
+                            )
+                        }
+                    } finally {
+                        for (hiddenStates in encoderHiddenStates.drop(decoded)) {
+                            OrtTensorUtils.closeTensorBuffer(hiddenStates)
+                            OrtTensorUtils.closeTensor(hiddenStates)
+                        }
+                    }
+                }
+            }
+        }
 
-        val tokens = decode(
-            encoderHiddenStates = encoderHiddenStates,
-            attentionMask = attentionMask,
-            eosId = eosId,
-            padId = padId,
-            minP = minP,
-            repetitionPenalty = repetitionPenalty,
-            beamsSize = beamSize,
-            maxSequenceLength = maxSequenceLength,
-            completeOnRepeat = completeOnRepeat
-        )
-        return tokens
+        return results
     }
 
     override fun runAsFlow(
@@ -261,74 +574,307 @@ class MarianInference : TranslationInference {
         repetitionPenalty: Float,
         beamSize: Int,
         maxSequenceLength: Int,
+        strategy: DecodingStrategy,
+        noRepeatNgramSize: Int,
+        priority: JobPriority,
+        timeoutMillis: Long,
     ): Flow<LongArray> {
-        runInference = true
+        val search = strategy.resolve(beamSize)
+        val beams = if (search == DecodingStrategy.Beam) beamSize else 1
 
-        // This is a workaround for the issue with various models that are overfitting on the
-        // training data, and start repeating when translating single words. This is a temporary
-        // solution until we can start retraining the models.
-        val completeOnRepeat = inputIds.size <= 4
+        // Various models overfit on their training data and start repeating when translating
+        // single words, so no token may repeat in the translation of a very short input.
+        val ngramSize = if (inputIds.size <= 4) 1 else noRepeatNgramSize
 
-        val encoderHiddenStates = encode(
-            inputIds = inputIds,
-            attentionMask = attentionMask
-        )
+        // The sessions are leased and the job is admitted once the flow is collected, and both are
+        // closed when it completes or the collector is cancelled.
+        return flow {
+            val startedAt = System.nanoTime()
+
+            leaseSessions().use { lease ->
+                scheduler.admit(priority).use { job ->
+                    val encoderHiddenStates = job.awaitStep {
+                        encode(
+                            sessions = lease.value,
+                            inputIds = inputIds,
+                            attentionMask = attentionMask,
+                            beamSize = beams
+                        )
+                    } ?: return@flow
+
+                    emitAll(
+                        decodeAsFlow(
+                            sessions = lease.value,
+                            sourceIds = inputIds,
+                            encoderHiddenStates = encoderHiddenStates,
+                            attentionMask = attentionMask,
+                            eosId = eosId,
+                            padId = padId,
+                            minP = minP,
+                            repetitionPenalty = repetitionPenalty,
+                            beamsSize = beams,
+                            maxSequenceLength = maxSequenceLength,
+                            noRepeatNgramSize = ngramSize,
+                            strategy = search,
+                            candidates = candidates(lease.value, inputIds, eosId, padId),
+                            timeoutMillis = remaining(timeoutMillis, startedAt),
+                            job = job
+                        )
+                    )
+                }
+            }
+        }.flowOn(Dispatchers.Default)
+    }
 
-        return decodeAsFlow(
-            encoderHiddenStates = encoderHiddenStates,
-            attentionMask = attentionMask,
-            eosId = eosId,
-            padId = padId,
-            minP = minP,
-            repetitionPenalty = repetitionPenalty,
-            beamsSize = beamSize,
-            maxSequenceLength = maxSequenceLength,
-            completeOnRepeat = completeOnRepeat
-        )
+    /**
+     * Leases the sessions of the loaded model for a translation, which has to close the lease once
+     * it takes no more steps.
+     */
+    private fun leaseSessions(): SessionPool<ModelSessions>.Lease {
+        synchronized(sessionsLock) {
+            return sessions?.retain() ?: throw IllegalStateException("Model is not loaded")
+        }
     }
 
-    private fun distinct(tokens: LongArray): LongArray {
-        val deduplicated = mutableListOf<Long>()
-        var lastToken = -1L
+    /**
+     * Target tokens of the shortlist worth searching for [inputIds], or null to search all of them.
+     */
+    private fun candidates(
+        sessions: ModelSessions, inputIds: LongArray, eosId: Long, padId: Long
+    ): IntArray? {
+        return sessions.shortlist?.candidates(inputIds, longArrayOf(eosId, padId))
+            ?.takeIf { it.isNotEmpty() }
+    }
 
-        for (token in tokens) {
-            if (token != lastToken) {
-                deduplicated.add(token)
-                lastToken = token
-            }
+    private fun maxTokens(strategy: DecodingStrategy): Int {
+        return if (strategy is DecodingStrategy.Speculative) strategy.draftLength + 1 else 1
+    }
+
+    /**
+     * Best sequence of a search that takes no more steps, which only ends with [eosId] when it was
+     * not cancelled or stopped at its deadline.
+     */
+    private fun result(beamSearch: BeamSearch, job: StepScheduler.Job, eosId: Long): LongArray {
+        if (job.cancelled || beamSearch.truncated()) {
+            Timber.tag(TAG).d("Translation truncated, cancelled: ${job.cancelled}")
+            return beamSearch.best()
         }
 
-        return deduplicated.toLongArray()
+        return beamSearch.best().plus(eosId)
     }
 
-    override fun cancel() {
-        runInference = false
+    /**
+     * Time left of [timeoutMillis] since [startedAt], at least a millisecond so an expired deadline
+     * still stops the search. Zero when there is no timeout.
+     */
+    private fun remaining(timeoutMillis: Long, startedAt: Long): Long {
+        if (timeoutMillis <= 0) return 0
+
+        val elapsedMillis = (System.nanoTime() - startedAt) / 1_000_000
+        return maxOf(timeoutMillis - elapsedMillis, 1)
     }
 
-    override fun load(files: LanguageModelInferenceFiles, threads: Int) {
-        close()
+    private fun track(beamSearch: BeamSearch) {
+        synchronized(activeSearches) {
+            activeSearches.add(beamSearch)
+        }
+    }
+
+    // Removed before it is closed, so cancel never reaches a closed search.
+    private fun release(beamSearch: BeamSearch) {
+        synchronized(activeSearches) {
+            activeSearches.remove(beamSearch)
+        }
+        beamSearch.close()
+    }
+
+    /**
+     * Stops every running translation before its next step, and the queued ones before their
+     * first. Their results are the best sequences so far, without an end of sequence token.
+     */
+    override fun cancel() {
+        synchronized(activeSearches) {
+            activeSearches.forEach { it.cancel() }
+        }
+        scheduler.cancelAll()
+    }
 
-        val encoderFile = File(files.encoder.pathString).readBytes()
-        val decoderFile = File(files.decoder.pathString).readBytes()
-        val options = OrtSession.SessionOptions().apply {
+    private fun sessionOptions(threads: Int): OrtSession.SessionOptions {
+        return OrtSession.SessionOptions().apply {
             setCPUArenaAllocator(true)
             setMemoryPatternOptimization(true)
             setIntraOpNumThreads(1)
             addXnnpack(mapOf("intra_op_num_threads" to threads.toString()))
             addConfigEntry("kOrtSessionOptionsConfigAllowIntraOpSpinning", "0")
+            addConfigEntry("session.use_env_allocators", "1")
             registerCustomOpLibrary(OrtxPackage.getLibraryPath())
         }
+    }
+
+    /**
+     * Replaces the lease on the loaded sessions, which stay open for the translations that still
+     * hold a lease on them.
+     *
+     * @return The pool key of the replaced sessions.
+     */
+    private fun replaceSessions(lease: SessionPool<ModelSessions>.Lease?, key: String?): String? {
+        synchronized(sessionsLock) {
+            val replacedKey = sessionsKey
+
+            sessions?.close()
+            sessions = lease
+            sessionsKey = key
+
+            return replacedKey
+        }
+    }
+
+    /**
+     * Removes the sessions of the loaded model from the pool, they are closed once the running
+     * translations no longer hold a lease on them.
+     */
+    override fun unload() {
+        replaceSessions(null, null)?.let { sessionPool.remove(it) }
+    }
+
+    override fun load(files: LanguageModelInferenceFiles, threads: Int) {
+        replaceSessions(null, null)
+
+        val maxLengthRatio = files.maxLengthRatio ?: DEFAULT_MAX_LENGTH_RATIO
+
+        val key = "${files.encoder.pathString}:${files.decoder.pathString}:" +
+            "${files.shortlist?.pathString}:$threads:$maxLengthRatio"
+        val bytes = files.encoder.fileSize() + files.decoder.fileSize()
+
+        // Graphs optimized when the model was imported take precedence over the cache, which
+        // holds a directory per model package as the graphs of every package share their names.
+        val optimizedModels = files.optimizedModelDirectory?.toFile()
+            ?: optimizedModelDirectory?.let { File(it, cacheDirectoryName(files)) }
+
+        val lease = sessionPool.acquire(key, bytes) {
+            // Every session gets its own options, as the optimized model path differs per model.
+            val encoder = MappedSession(
+                ortEnvironment,
+                files.encoder.pathString,
+                { sessionOptions(threads) },
+                optimizedModels
+            )
+            val decoder = try {
+                MappedSession(
+                    ortEnvironment,
+                    files.decoder.pathString,
+                    { sessionOptions(threads) },
+                    optimizedModels
+                )
+            } catch (e: Exception) {
+                encoder.close()
+                throw e
+            }
+
+            val shortlist = files.shortlist?.let {
+                try {
+                    ShortlistIndex(it.pathString)
+                } catch (e: Exception) {
+                    Timber.tag(TAG).w(e, "Failed to open shortlist, searching the full vocabulary")
+                    null
+                }
+            }
+
+            ModelSessions(encoder, decoder, shortlist, threads, maxLengthRatio)
+        }
+        replaceSessions(lease, key)
+
+        Timber.tag(TAG).d("Session pool: ${sessionPool.statistics()}")
+    }
+
+    /**
+     * Name of the directory of the optimized graphs of [files] in [optimizedModelDirectory], keyed
+     * by the path of the model package.
+     */
+    private fun cacheDirectoryName(files: LanguageModelInferenceFiles): String {
+        val packagePath = files.encoder.toAbsolutePath().parent.pathString
+        return UUID.nameUUIDFromBytes(packagePath.toByteArray()).toString()
+    }
+
+    /**
+     * Optimizes the graphs of the encoder and decoder into [directory] ahead of their first load,
+     * which is then passed as [LanguageModelInferenceFiles.optimizedModelDirectory]. Every graph
+     * is loaded back and checked to have the inputs and outputs of its source model.
+     *
+     * @return The optimized encoder and decoder files.
+     */
+    fun optimize(files: LanguageModelInferenceFiles, directory: File): Pair<File, File> {
+        return Pair(optimize(files.encoder, directory), optimize(files.decoder, directory))
+    }
+
+    private fun optimize(model: Path, directory: File): File {
+        val (optimizedFile, signature) =
+            MappedSession(ortEnvironment, model.pathString, { sessionOptions(1) }, directory).use {
+                Pair(it.optimizedFile, signature(it.session))
+            }
+
+        MappedSession(ortEnvironment, model.pathString, { sessionOptions(1) }, directory).use {
+            if (optimizedFile == null || !it.optimized || signature(it.session) != signature) {
+                optimizedFile?.delete()
+                throw IllegalStateException("Optimized graph of ${model.fileName} does not match its source")
+            }
+        }
 
-        encoderSession = ortEnvironment.createSession(encoderFile, options)
-        decoderSession = ortEnvironment.createSession(decoderFile, options)
+        return optimizedFile
+    }
+
+    private fun signature(session: OrtSession): String {
+        return (session.inputInfo.values + session.outputInfo.values).joinToString("\n")
+    }
+
+    /**
+     * Last batches encoded by [runBatch] with their padding waste, the most recent last.
+     */
+    fun batchStatistics(): List<BatchPlanner.Batch> {
+        synchronized(recentBatches) {
+            return recentBatches.toList()
+        }
+    }
+
+    /**
+     * Queue depth by priority and the latency of the last translations.
+     */
+    fun schedulerStatistics(): StepScheduler.Statistics {
+        return scheduler.statistics()
+    }
+
+    /**
+     * Hit, miss and residency statistics of the loaded models.
+     */
+    fun statistics(): SessionPool.Statistics {
+        return sessionPool.statistics()
     }
 
     override fun close() {
-        encoderSession?.close()
-        decoderSession?.close()
+        if (ownsSessionPool) {
+            replaceSessions(null, null)
+            sessionPool.close()
+        } else {
+            unload()
+        }
     }
 
     companion object {
         private val TAG: String = MarianInference::class.java.simpleName
+
+        private const val RECENT_BATCHES = 32
+
+        /**
+         * Fits about two language pairs of the usual quantized models.
+         */
+        const val DEFAULT_MEMORY_BUDGET: Long = 512L * 1024 * 1024
+
+        /**
+         * Target tokens per source token for models without their own ratio, which even wordy
+         * target languages stay well below.
+         */
+        const val DEFAULT_MAX_LENGTH_RATIO: Float = 3f
+
+        private val NO_DRAFT = LongArray(0)
     }
 }
@@ -0,0 +1,184 @@
+package app.versta.translate.adapter.outbound
+
+import app.versta.translate.bridge.inference.Shortlist
+import app.versta.translate.bridge.tokenize.SentencePiece
+import app.versta.translate.bridge.tokenize.Vocabulary
+import app.versta.translate.bridge.tokenize.VocabularyIndex
+import app.versta.translate.core.entity.CompiledArtifact
+import app.versta.translate.core.entity.CompiledArtifactType
+import app.versta.translate.core.entity.CompiledModelManifest
+import app.versta.translate.core.entity.LanguageModelFiles
+import timber.log.Timber
+import java.nio.file.Path
+import kotlin.io.path.pathString
+
+/**
+ * Compiles the vocabularies into binary indices, serializes the SentencePiece piece indices,
+ * compiles the lexical table into a shortlist, and optimizes the encoder and decoder graphs with the session options [inference] loads them with.
+ */
+class MarianModelCompiler(
+    private val inference: MarianInference
+) : ModelCompiler {
+    override fun compile(files: LanguageModelFiles): CompiledModelManifest {
+        val root = files.path
+        val directory = root.resolve(CompiledModelManifest.DIRECTORY).toFile()
+
+        directory.deleteRecursively()
+        if (!directory.mkdirs()) {
+            throw IllegalStateException("Failed to create ${directory.absolutePath}")
+        }
+
+        val artifacts = mutableListOf<CompiledArtifact>()
+        val tokenizer = files.tokenizer
+
+        compile(root, CompiledArtifactType.SourceVocabulary) {
+            compileVocabulary(root, tokenizer.sourceVocabulary)
+        }?.let { artifacts.add(it) }
+
+        tokenizer.targetVocabulary?.let { targetVocabulary ->
+            compile(root, CompiledArtifactType.TargetVocabulary) {
+                compileVocabulary(root, targetVocabulary)
+            }?.let { artifacts.add(it) }
+        }
+
+        compile(root, CompiledArtifactType.SourceTokenizer) {
+            compileSentencePiece(root, tokenizer.source, tokenizer.sourceVocabulary)
+        }?.let { artifacts.add(it) }
+
+        compile(root, CompiledArtifactType.TargetTokenizer) {
+            compileSentencePiece(
+                root,
+                tokenizer.target,
+                tokenizer.targetVocabulary ?: tokenizer.sourceVocabulary
+            )
+        }?.let { artifacts.add(it) }
+
+        files.inference.lexicalTable?.let { lexicalTable ->
+            compile(root, CompiledArtifactType.Shortlist) {
+                compileShortlist(
+                    root,
+                    lexicalTable,
+                    tokenizer.sourceVocabulary,
+                    tokenizer.targetVocabulary ?: tokenizer.sourceVocabulary
+                )
+            }?.let { artifacts.add(it) }
+        }
+
+        try {
+            val (encoder, decoder) = inference.optimize(files.inference, directory)
+
+            artifacts.add(
+                CompiledArtifact.create(
+                    root, CompiledArtifactType.Encoder, encoder.toPath(), files.inference.encoder
+                )
+            )
+            artifacts.add(
+                CompiledArtifact.create(
+                    root, CompiledArtifactType.Decoder, decoder.toPath(), files.inference.decoder
+                )
+            )
+        } catch (e: Exception) {
+            Timber.tag(TAG).w(e, "Failed to optimize the models in $root")
+        }
+
+        val manifest = CompiledModelManifest(artifacts = artifacts)
+        manifest.save(root)
+
+        Timber.tag(TAG).d("Compiled ${artifacts.map { it.type }} for $root")
+
+        return manifest
+    }
+
+    /**
+     * Runs [compile], which returns the artifact and its source, and lists the artifact unless it
+     * fails.
+     */
+    private fun compile(
+        root: Path,
+        type: CompiledArtifactType,
+        compile: () -> Pair<Path, Path>
+    ): CompiledArtifact? {
+        return try {
+            val (path, source) = compile()
+            CompiledArtifact.create(root, type, path, source)
+        } catch (e: Exception) {
+            Timber.tag(TAG).w(e, "Failed to compile $type")
+            null
+        }
+    }
+
+    private fun compileVocabulary(root: Path, source: Path): Pair<Path, Path> {
+        val index = artifactPath(root, source)
+        Vocabulary.compile(source.pathString, index.pathString)
+
+        // The index has to read back exactly as the vocabulary it replaces.
+        val vocabulary = Vocabulary.load(source.pathString)
+        val ids = HashMap<String, Int>(vocabulary.size * 2)
+        vocabulary.forEachIndexed { id, token -> ids.putIfAbsent(token, id) }
+
+        VocabularyIndex(index.pathString).use { compiled ->
+            if (compiled != vocabulary || ids.any { (token, id) -> compiled.indexOf(token) != id }) {
+                throw IllegalStateException("Vocabulary index does not match $source")
+            }
+        }
+
+        return Pair(index, source)
+    }
+
+    private fun compileSentencePiece(root: Path, source: Path, vocabulary: Path): Pair<Path, Path> {
+        val index = artifactPath(root, source)
+        val model = source.toFile().readBytes()
+        val tokens = Vocabulary.load(vocabulary.pathString)
+
+        SentencePiece().use { built ->
+            built.loadFromSerializedProto(model)
+            built.serializeIndex(index.pathString)
+
+            SentencePiece().use { compiled ->
+                compiled.loadFromSerializedProto(model, index.pathString)
+
+                // Encodes text made of vocabulary tokens, so most pieces are looked up once.
+                val text = tokens.joinToString(" ").replace(SENTENCE_PIECE_UNDERLINE, " ")
+                val matches = tokens.all { built.pieceToId(it) == compiled.pieceToId(it) } &&
+                        text.chunked(VALIDATION_CHUNK_LENGTH).all {
+                            built.encodeAsPieces(it) == compiled.encodeAsPieces(it)
+                        }
+
+                if (!matches) {
+                    throw IllegalStateException("SentencePiece index does not match $source")
+                }
+            }
+        }
+
+        return Pair(index, source)
+    }
+
+    private fun compileShortlist(
+        root: Path,
+        source: Path,
+        sourceVocabulary: Path,
+        targetVocabulary: Path
+    ): Pair<Path, Path> {
+        val index = artifactPath(root, source)
+        Shortlist.compile(
+            source.pathString,
+            sourceVocabulary.pathString,
+            targetVocabulary.pathString,
+            index.pathString,
+            Shortlist.DEFAULT_BEST
+        )
+
+        return Pair(index, source)
+    }
+
+    private fun artifactPath(root: Path, source: Path): Path {
+        return root.resolve(CompiledModelManifest.DIRECTORY).resolve("${source.fileName}.index")
+    }
+
+    companion object {
+        private val TAG: String = MarianModelCompiler::class.java.simpleName
+
+        private const val SENTENCE_PIECE_UNDERLINE = "▁"
+        private const val VALIDATION_CHUNK_LENGTH = 4096
+    }
+}
@@ -4,9 +4,12 @@ import app.versta.translate.core.entity.LanguageModelTokenizerFiles
 import app.versta.translate.core.entity.LanguagePair
 import app.versta.translate.bridge.tokenize.SentencePiece
 import app.versta.translate.bridge.tokenize.Vocabulary
+import app.versta.translate.bridge.tokenize.VocabularyIndex
 import kotlinx.serialization.json.Json
 import kotlinx.serialization.json.JsonObject
+import timber.log.Timber
 import java.io.File
+import java.nio.file.Path
 import kotlin.io.path.absolutePathString
 import kotlin.io.path.pathString
 
@@ -18,6 +21,8 @@ class MarianTokenizer(
     private val separatedVocabularies: Boolean = false
 ): TranslationTokenizer {
     companion object {
+        private val TAG: String = MarianTokenizer::class.java.simpleName
+
         private const val SENTENCE_PIECE_UNDERLINE = "▁"
         private val languageCodeRegex = Regex(">>.+<<")
     }
@@ -30,6 +35,16 @@ class MarianTokenizer(
     private var sourceVocabulary: List<String> = emptyList()
     private var targetVocabulary: List<String> = emptyList()
 
+    /**
+     * Compiled vocabularies backing the loaded vocabularies, closed when another model is loaded.
+     */
+    private val vocabularyIndices = mutableListOf<VocabularyIndex>()
+
+    /**
+     * SentencePiece ids of the target vocabulary, or -1 for tokens unknown to the decoder model.
+     */
+    private var targetPieceIds: IntArray = IntArray(0)
+
     private var sourceLanguage: String = ""
     private var targetLanguage: String = ""
 
@@ -98,6 +113,13 @@ class MarianTokenizer(
 
     override fun decode(ids: LongArray, filterSpecialTokens: Boolean): String {
         try {
+            if (filterSpecialTokens) {
+                val pieceIds = convertIdsToPieceIds(ids)
+                if (pieceIds != null) {
+                    return decoder.decode(pieceIds).trim()
+                }
+            }
+
             var tokens = ids.map { convertIdToToken(it) }
 
             if (filterSpecialTokens) {
@@ -146,7 +168,10 @@ class MarianTokenizer(
 
         normalizer = MosesPunctuationNormalizer(lang = sourceLanguage)
 
-        sourceVocabulary = Vocabulary.load(files.sourceVocabulary.pathString)
+        vocabularyIndices.forEach { it.close() }
+        vocabularyIndices.clear()
+
+        sourceVocabulary = openVocabulary(files.sourceVocabulary, files.sourceVocabularyIndex)
         if (!validateVocabulary(sourceVocabulary, eosToken, padToken, unknownToken)) {
             throw IllegalArgumentException("Vocabulary does not contain the provided tokens")
         }
@@ -156,7 +181,7 @@ class MarianTokenizer(
                 throw IllegalArgumentException("Target vocabulary file path must be provided when using separated vocabularies")
             }
 
-            targetVocabulary = Vocabulary.load(files.targetVocabulary.pathString)
+            targetVocabulary = openVocabulary(files.targetVocabulary, files.targetVocabularyIndex)
             if (!validateVocabulary(targetVocabulary, eosToken, padToken, unknownToken)) {
                 throw IllegalArgumentException("Target vocabulary does not contain the provided tokens")
             }
@@ -166,10 +191,17 @@ class MarianTokenizer(
         }
 
         val encoderModel = loadSentencePieceModel(files.source.absolutePathString())
-        encoder.loadFromSerializedProto(encoderModel)
+        loadSentencePiece(encoder, encoderModel, files.sourceIndex)
 
         val decoderModel = loadSentencePieceModel(files.target.pathString)
-        decoder.loadFromSerializedProto(decoderModel)
+        loadSentencePiece(decoder, decoderModel, files.targetIndex)
+
+        val decoderUnknownId = decoder.pieceToId(unknownToken)
+        targetPieceIds = IntArray(targetVocabulary.size) { i ->
+            val token = targetVocabulary[i]
+            val id = decoder.pieceToId(token)
+            if (id == decoderUnknownId && token != unknownToken) -1 else id
+        }
     }
 
     private fun padBatchSequences(
@@ -205,6 +237,32 @@ class MarianTokenizer(
         return id
     }
 
+    /**
+     * Maps vocabulary ids to SentencePiece ids of the decoder model, dropping special tokens.
+     * Returns null if any token is unknown to the decoder model, in which case the tokens have to
+     * be joined manually.
+     */
+    private fun convertIdsToPieceIds(ids: LongArray): IntArray? {
+        val pieceIds = IntArray(ids.size)
+        var size = 0
+
+        for (id in ids) {
+            val token = convertIdToToken(id)
+            if (token in specialTokens) {
+                continue
+            }
+
+            val pieceId = targetPieceIds.getOrElse(id.toInt()) { -1 }
+            if (pieceId < 0) {
+                return null
+            }
+
+            pieceIds[size++] = pieceId
+        }
+
+        return if (size == pieceIds.size) pieceIds else pieceIds.copyOf(size)
+    }
+
     private fun convertIdToToken(id: Long): String {
         if (id < 0L || id >= vocabSize) {
             return unknownToken
@@ -220,6 +278,39 @@ class MarianTokenizer(
         return vocab
     }
 
+    /**
+     * Opens the compiled [index] of the vocabulary if there is one, falling back to reading the
+     * vocabulary [file] when it cannot be opened.
+     */
+    private fun openVocabulary(file: Path, index: Path?): List<String> {
+        if (index != null) {
+            try {
+                return VocabularyIndex(index.pathString).also { vocabularyIndices.add(it) }
+            } catch (e: Exception) {
+                Timber.tag(TAG).w(e, "Failed to open vocabulary index, loading $file")
+            }
+        }
+
+        return Vocabulary.load(file.pathString)
+    }
+
+    /**
+     * Loads [model] with its compiled [index] if there is one, falling back to building the index
+     * when it does not match the model.
+     */
+    private fun loadSentencePiece(processor: SentencePiece, model: ByteArray, index: Path?) {
+        if (index != null) {
+            try {
+                processor.loadFromSerializedProto(model, index.pathString)
+                return
+            } catch (e: Exception) {
+                Timber.tag(TAG).w(e, "Failed to load SentencePiece index $index")
+            }
+        }
+
+        processor.loadFromSerializedProto(model)
+    }
+
     private fun loadSentencePieceModel(filePath: String): ByteArray {
         return File(filePath).readBytes()
     }
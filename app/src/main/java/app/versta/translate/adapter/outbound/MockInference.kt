@@ -1,5 +1,7 @@
 package app.versta.translate.adapter.outbound
 
+import app.versta.translate.bridge.inference.DecodingStrategy
+import app.versta.translate.bridge.inference.JobPriority
 import app.versta.translate.core.entity.LanguageModelInferenceFiles
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.flowOf
@@ -14,6 +16,10 @@ class MockInference: TranslationInference {
         repetitionPenalty: Float,
         beamSize: Int,
         maxSequenceLength: Int,
+        strategy: DecodingStrategy,
+        noRepeatNgramSize: Int,
+        priority: JobPriority,
+        timeoutMillis: Long,
     ): LongArray {
         return LongArray(0)
     }
@@ -27,10 +33,30 @@ class MockInference: TranslationInference {
         repetitionPenalty: Float,
         beamSize: Int,
         maxSequenceLength: Int,
+        strategy: DecodingStrategy,
+        noRepeatNgramSize: Int,
+        priority: JobPriority,
+        timeoutMillis: Long,
     ): Flow<LongArray> {
         return flowOf(LongArray(0))
     }
 
+    override fun runBatch(
+        inputIds: List<LongArray>,
+        eosId: Long,
+        padId: Long,
+        minP: Float,
+        repetitionPenalty: Float,
+        beamSize: Int,
+        maxSequenceLength: Int,
+        strategy: DecodingStrategy,
+        noRepeatNgramSize: Int,
+        priority: JobPriority,
+        timeoutMillis: Long,
+    ): List<LongArray> {
+        return inputIds.map { LongArray(0) }
+    }
+
     override fun cancel() {
         return
     }
@@ -39,6 +65,10 @@ class MockInference: TranslationInference {
         return
     }
 
+    override fun unload() {
+        return
+    }
+
     override fun close() {
         return
     }
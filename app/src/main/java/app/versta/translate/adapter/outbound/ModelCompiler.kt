@@ -0,0 +1,14 @@
+package app.versta.translate.adapter.outbound
+
+import app.versta.translate.core.entity.CompiledModelManifest
+import app.versta.translate.core.entity.LanguageModelFiles
+
+interface ModelCompiler {
+    /**
+     * Compiles the files of an imported language model into artifacts that load without parsing
+     * or optimizing, and writes the manifest listing them into the model directory. Artifacts that
+     * fail to compile or validate are left out, their sources are loaded instead.
+     * @param files The files of the language model to compile.
+     */
+    fun compile(files: LanguageModelFiles): CompiledModelManifest
+}
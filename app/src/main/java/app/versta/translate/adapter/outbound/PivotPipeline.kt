@@ -0,0 +1,160 @@
+package app.versta.translate.adapter.outbound
+
+import app.versta.translate.bridge.inference.DecodingStrategy
+import app.versta.translate.bridge.inference.JobPriority
+import app.versta.translate.core.entity.Language
+import app.versta.translate.core.entity.LanguageModelFiles
+import app.versta.translate.core.entity.LanguagePair
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.channelFlow
+import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.launch
+
+/**
+ * Translates between languages that no model covers directly by chaining two models through a
+ * pivot language, usually English. Both models stay loaded, and the sentences the first model
+ * finished are passed on to the second while the first one decodes the next, so a document takes
+ * about as long as the slower of the two models instead of both.
+ */
+class PivotPipeline(
+    private val first: Stage,
+    private val second: Stage
+) : AutoCloseable {
+    /**
+     * Tokenizer and model of one of the two translations.
+     */
+    class Stage(
+        val tokenizer: TranslationTokenizer,
+        val inference: TranslationInference
+    )
+
+    data class Options(
+        val minP: Float,
+        val repetitionPenalty: Float,
+        val beamSize: Int,
+        val maxSequenceLength: Int,
+        val strategy: DecodingStrategy = DecodingStrategy.Beam,
+        val noRepeatNgramSize: Int = 0,
+        val priority: JobPriority = JobPriority.Interactive
+    )
+
+    /**
+     * Translation of the sentence at [index] of the input.
+     */
+    data class Sentence(val index: Int, val text: String)
+
+    /**
+     * Size of the larger vocabulary of both models, which the minimum probability of a token is
+     * relative to.
+     */
+    val vocabSize: Long
+        get() = maxOf(first.tokenizer.vocabSize, second.tokenizer.vocabSize)
+
+    /**
+     * Loads [firstFiles] to translate from [source] into [pivot] and [secondFiles] to translate
+     * from [pivot] into [target].
+     */
+    fun load(
+        firstFiles: LanguageModelFiles,
+        secondFiles: LanguageModelFiles,
+        source: Language,
+        target: Language,
+        threads: Int,
+        pivot: Language = Language.fromIsoCode(DEFAULT_PIVOT_LANGUAGE)
+    ) {
+        first.tokenizer.load(firstFiles.tokenizer, LanguagePair(source, pivot))
+        first.inference.load(firstFiles.inference, threads)
+
+        second.tokenizer.load(secondFiles.tokenizer, LanguagePair(pivot, target))
+        second.inference.load(secondFiles.inference, threads)
+    }
+
+    /**
+     * Translates every sentence of [sentences], emitting them in input order as they are
+     * finished. The second model starts on a sentence as soon as the first model finished it, at
+     * most [PIVOT_BUFFER] finished sentences wait for the second model. The flow ends early when
+     * a sentence was truncated by [cancel].
+     */
+    fun translate(sentences: List<String>, options: Options): Flow<Sentence> = channelFlow {
+        val pivots = Channel<Sentence>(PIVOT_BUFFER)
+
+        launch(Dispatchers.Default) {
+            try {
+                for ((index, sentence) in sentences.withIndex()) {
+                    val pivot = translate(first, sentence, options) ?: break
+                    pivots.send(Sentence(index, pivot))
+                }
+            } finally {
+                pivots.close()
+            }
+        }
+
+        for (pivot in pivots) {
+            val translation = translate(second, pivot.text, options) ?: break
+            send(Sentence(pivot.index, translation))
+        }
+
+        // Stops the first model when the second one was truncated.
+        pivots.cancel()
+    }.flowOn(Dispatchers.Default)
+
+    /**
+     * @return The translation of [text], or null when it was truncated.
+     */
+    private fun translate(stage: Stage, text: String, options: Options): String? {
+        if (text.isBlank()) {
+            return text
+        }
+
+        val (inputIds, attentionMask) = stage.tokenizer.encode(text)
+        val tokens = stage.inference.run(
+            inputIds = inputIds,
+            attentionMask = attentionMask,
+            eosId = stage.tokenizer.eosId,
+            padId = stage.tokenizer.padId,
+            minP = options.minP,
+            repetitionPenalty = options.repetitionPenalty,
+            beamSize = options.beamSize,
+            maxSequenceLength = options.maxSequenceLength,
+            strategy = options.strategy,
+            noRepeatNgramSize = options.noRepeatNgramSize,
+            priority = options.priority
+        )
+
+        if (tokens.lastOrNull() != stage.tokenizer.eosId) {
+            return null
+        }
+
+        return stage.tokenizer.decode(tokens)
+    }
+
+    /**
+     * Releases the models of both stages, for when a language pair is translated directly again.
+     */
+    fun unload() {
+        first.inference.unload()
+        second.inference.unload()
+    }
+
+    fun cancel() {
+        first.inference.cancel()
+        second.inference.cancel()
+    }
+
+    override fun close() {
+        first.inference.close()
+        second.inference.close()
+    }
+
+    companion object {
+        const val DEFAULT_PIVOT_LANGUAGE = "en"
+
+        /**
+         * Sentences of the pivot language that may wait for the second model, which bounds how far
+         * the first model runs ahead.
+         */
+        private const val PIVOT_BUFFER = 4
+    }
+}
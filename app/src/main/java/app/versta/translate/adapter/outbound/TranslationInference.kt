@@ -1,9 +1,17 @@
 package app.versta.translate.adapter.outbound
 
+import app.versta.translate.bridge.inference.DecodingStrategy
+import app.versta.translate.bridge.inference.JobPriority
 import app.versta.translate.core.entity.LanguageModelInferenceFiles
 import kotlinx.coroutines.flow.Flow
 
 interface TranslationInference {
+    /**
+     * Translates [inputIds] into the tokens of the target language, which end with [eosId] once
+     * the model finished the translation. Without it, the translation was truncated by [cancel]
+     * or by [timeoutMillis], the time it may take from the call when more than zero, and holds
+     * the best tokens so far.
+     */
     fun run(
         inputIds: LongArray,
         attentionMask: LongArray,
@@ -13,8 +21,16 @@ interface TranslationInference {
         repetitionPenalty: Float,
         beamSize: Int,
         maxSequenceLength: Int,
+        strategy: DecodingStrategy = DecodingStrategy.Beam,
+        noRepeatNgramSize: Int = 0,
+        priority: JobPriority = JobPriority.Interactive,
+        timeoutMillis: Long = 0,
     ): LongArray
 
+    /**
+     * Like [run], but emits the best tokens after every decoding step. The last emission is the
+     * result of [run], [timeoutMillis] is measured from the start of the collection.
+     */
     fun runAsFlow(
         inputIds: LongArray,
         attentionMask: LongArray,
@@ -24,11 +40,36 @@ interface TranslationInference {
         repetitionPenalty: Float,
         beamSize: Int,
         maxSequenceLength: Int,
+        strategy: DecodingStrategy = DecodingStrategy.Beam,
+        noRepeatNgramSize: Int = 0,
+        priority: JobPriority = JobPriority.Interactive,
+        timeoutMillis: Long = 0,
     ): Flow<LongArray>
 
+    /**
+     * Translates every sequence of [inputIds], which are not padded, like [run]. Sequences of
+     * similar lengths are encoded together, and the results are in the order of [inputIds].
+     * [timeoutMillis] bounds the whole batch.
+     */
+    fun runBatch(
+        inputIds: List<LongArray>,
+        eosId: Long,
+        padId: Long,
+        minP: Float,
+        repetitionPenalty: Float,
+        beamSize: Int,
+        maxSequenceLength: Int,
+        strategy: DecodingStrategy = DecodingStrategy.Beam,
+        noRepeatNgramSize: Int = 0,
+        priority: JobPriority = JobPriority.Background,
+        timeoutMillis: Long = 0,
+    ): List<LongArray>
+
     fun cancel()
 
     fun load(files: LanguageModelInferenceFiles, threads: Int)
 
+    fun unload()
+
     fun close()
 }
\ No newline at end of file
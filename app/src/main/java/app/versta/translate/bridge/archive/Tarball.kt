@@ -0,0 +1,36 @@
+package app.versta.translate.bridge.archive
+
+import java.io.IOException
+
+/**
+ * Native extractor for gzip compressed tarballs, which inflates, parses and writes the archive in
+ * a single pass over the file descriptor.
+ */
+object Tarball {
+    interface Listener {
+        /**
+         * Called at every entry and periodically while it is written.
+         * @param path The archive path of the entry being extracted.
+         * @param extractedBytes The number of uncompressed bytes read so far.
+         * @param totalBytes The uncompressed size of the archive, as stored in its gzip trailer.
+         */
+        fun onProgress(path: String, extractedBytes: Long, totalBytes: Long)
+
+        /**
+         * Called when a regular file has been written completely.
+         * @param sha256 The hex encoded SHA-256 of the file contents.
+         */
+        fun onFileExtracted(path: String, sha256: String)
+    }
+
+    init {
+        System.loadLibrary("app_versta_translate_bridge")
+    }
+
+    /**
+     * Extracts the archive read from [fd] into [outputDirectory], which has to exist. Entries that
+     * would be written outside of it are rejected.
+     */
+    @Throws(IOException::class)
+    external fun extract(fd: Int, outputDirectory: String, listener: Listener)
+}
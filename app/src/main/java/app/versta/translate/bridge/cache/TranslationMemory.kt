@@ -0,0 +1,78 @@
+package app.versta.translate.bridge.cache
+
+import timber.log.Timber
+import java.io.IOException
+
+/**
+ * Persistent translation memory, stored as a memory mapped append-only log at [filePath]. Entries
+ * are looked up by a 64-bit hash of the language pair and source text, and the full key is
+ * compared before a translation is returned.
+ *
+ * The least recently used entries are evicted once there are more than [maxEntries] entries or
+ * their records take more than [maxBytes] bytes. The log is compacted when most of it is garbage.
+ */
+class TranslationMemory(filePath: String, maxEntries: Int, maxBytes: Long) : AutoCloseable {
+    private var handle = 0L
+
+    init {
+        handle = open(filePath, maxEntries, maxBytes)
+
+        if (handle == 0L) {
+            throw IOException("Failed to open translation memory $filePath")
+        }
+    }
+
+    fun get(languages: String, source: String): String? {
+        return get(handle, languages, source)
+    }
+
+    @Throws(IOException::class)
+    fun put(languages: String, source: String, translation: String) {
+        put(handle, languages, source, translation)
+    }
+
+    /**
+     * Removes the entries of [languages], or all entries when it is null.
+     */
+    fun clear(languages: String? = null) {
+        clear(handle, languages)
+    }
+
+    fun size(languages: String? = null): Int {
+        return size(handle, languages)
+    }
+
+    /**
+     * Rewrites the log with only the current entries.
+     */
+    @Throws(IOException::class)
+    fun compact() {
+        compact(handle)
+    }
+
+    override fun close() {
+        if (handle == 0L) {
+            Timber.tag(TAG).w("TranslationMemory is already closed")
+            return
+        }
+
+        close(handle)
+        handle = 0L
+    }
+
+    private external fun open(filePath: String, maxEntries: Int, maxBytes: Long): Long
+    private external fun get(handle: Long, languages: String, source: String): String?
+    private external fun put(handle: Long, languages: String, source: String, translation: String)
+    private external fun clear(handle: Long, languages: String?)
+    private external fun size(handle: Long, languages: String?): Int
+    private external fun compact(handle: Long)
+    private external fun close(handle: Long)
+
+    companion object {
+        private val TAG: String = TranslationMemory::class.java.simpleName
+
+        init {
+            System.loadLibrary("app_versta_translate_bridge")
+        }
+    }
+}
@@ -0,0 +1,83 @@
+package app.versta.translate.bridge.inference
+
+/**
+ * Groups sequences of similar lengths into batches, so the encoder runs every batch at the length
+ * of its longest sequence instead of padding short sequences to the longest of all. Sequences are
+ * sorted by length and split into buckets of [bucketWidth] tokens, a bucket is split further into
+ * batches of at most [maxBatchSize] sequences and [maxBatchTokens] padded tokens.
+ */
+class BatchPlanner(
+    private val bucketWidth: Int = DEFAULT_BUCKET_WIDTH,
+    private val maxBatchSize: Int = DEFAULT_MAX_BATCH_SIZE,
+    private val maxBatchTokens: Int = DEFAULT_MAX_BATCH_TOKENS
+) {
+    init {
+        require(bucketWidth > 0) { "Bucket width must be positive" }
+        require(maxBatchSize > 0) { "Maximum batch size must be positive" }
+    }
+
+    /**
+     * Sequences encoded together, padded to [length].
+     *
+     * @param indices Positions of the sequences in the planned input, shortest first.
+     * @param lengths Lengths of the sequences, in the order of [indices].
+     */
+    class Batch(
+        val indices: IntArray,
+        val lengths: IntArray,
+        val length: Int
+    ) {
+        val tokens: Int
+            get() = lengths.sum()
+
+        val paddedTokens: Int
+            get() = indices.size * length
+
+        /**
+         * Share of the padded tokens that is padding, which the encoder computes for nothing.
+         */
+        val paddingWaste: Float
+            get() = if (paddedTokens == 0) 0f else 1f - tokens.toFloat() / paddedTokens
+
+        override fun toString(): String {
+            return "Batch(size=${indices.size}, length=$length, paddingWaste=$paddingWaste)"
+        }
+    }
+
+    /**
+     * Plans the batches of sequences of [lengths], every index occurs in exactly one batch.
+     */
+    fun plan(lengths: IntArray): List<Batch> {
+        val order = lengths.indices.sortedBy { lengths[it] }
+        val batches = mutableListOf<Batch>()
+
+        var start = 0
+        while (start < order.size) {
+            val bucket = bucket(lengths[order[start]])
+
+            var end = start + 1
+            while (end < order.size && end - start < maxBatchSize &&
+                bucket(lengths[order[end]]) == bucket &&
+                (end - start + 1) * lengths[order[end]] <= maxBatchTokens
+            ) {
+                end++
+            }
+
+            val indices = order.subList(start, end).toIntArray()
+            val batchLengths = IntArray(indices.size) { lengths[indices[it]] }
+            batches.add(Batch(indices, batchLengths, batchLengths.last()))
+
+            start = end
+        }
+
+        return batches
+    }
+
+    private fun bucket(length: Int) = (length - 1).coerceAtLeast(0) / bucketWidth
+
+    companion object {
+        const val DEFAULT_BUCKET_WIDTH = 16
+        const val DEFAULT_MAX_BATCH_SIZE = 8
+        const val DEFAULT_MAX_BATCH_TOKENS = 1024
+    }
+}
@@ -6,21 +6,73 @@ import app.versta.translate.utils.TensorUtils
 import timber.log.Timber
 import java.nio.ByteBuffer
 
+/**
+ * @param threads Number of threads a search may use, searches over few logits always run on the
+ * calling thread.
+ * @param strategy How the next tokens are picked, [beamSize] only applies to
+ * [DecodingStrategy.Beam].
+ * @param noRepeatNgramSize Size of the n-grams that may occur only once in a sequence, tokens
+ * that would repeat one are masked before they are picked. Zero allows any repetition.
+ * @param sourceLength Number of tokens of the source, the sequences may have [maxLengthRatio]
+ * tokens for each of them but never more than [maxSequenceLength]. Without a source length or
+ * ratio, only [maxSequenceLength] bounds them. The search is complete once they reach this
+ * [maxLength], and everything it keeps per step is allocated for that many steps up front.
+ * @param timeoutMillis Time the search may take from its construction, after which it is
+ * [complete] and [truncated] before the next step. Zero does not limit it.
+ */
 class BeamSearch(
     beamSize: Int,
     minP: Float,
     repetitionPenalty: Float,
     padId: Long,
-    eosId: Long
+    eosId: Long,
+    threads: Int = 1,
+    strategy: DecodingStrategy = DecodingStrategy.Beam,
+    noRepeatNgramSize: Int = 0,
+    sourceLength: Int = 0,
+    maxLengthRatio: Float = 0f,
+    maxSequenceLength: Int = DEFAULT_MAX_SEQUENCE_LENGTH,
+    timeoutMillis: Long = 0
 ) : AutoCloseable {
     private var handle: Long
 
+    /**
+     * Most tokens a sequence gets before the search is complete.
+     */
+    val maxLength: Int
+
     init {
-        handle = construct(beamSize, minP, repetitionPenalty / 10, padId, eosId)
+        val topK = (strategy as? DecodingStrategy.TopK)?.k ?: 0
+        val topP = (strategy as? DecodingStrategy.TopP)?.p ?: 0f
+        val seed = when (strategy) {
+            is DecodingStrategy.TopK -> strategy.seed
+            is DecodingStrategy.TopP -> strategy.seed
+            else -> DecodingStrategy.DEFAULT_SEED
+        }
+
+        handle = construct(
+            strategy.type,
+            beamSize,
+            minP,
+            repetitionPenalty / 10,
+            padId,
+            eosId,
+            threads,
+            topK,
+            topP,
+            seed,
+            noRepeatNgramSize,
+            sourceLength,
+            maxLengthRatio,
+            maxSequenceLength,
+            timeoutMillis
+        )
 
         if (handle == 0L) {
             throw RuntimeException("Failed to initialize BeamSearch")
         }
+
+        maxLength = maxLength(handle)
     }
 
     fun search(tensor: OnnxTensor) {
@@ -36,21 +88,102 @@ class BeamSearch(
         )
     }
 
+    /**
+     * Searches the logits tensor behind [tensorHandle], laid out as [beams, 1, size].
+     */
+    fun search(tensorHandle: Long, size: Int) {
+        return search(
+            handle = handle,
+            apiHandle = TensorUtils.getOrtApiHandle(),
+            tensorHandle = tensorHandle,
+            size = size
+        )
+    }
+
+    /**
+     * Drafts up to [length] tokens that continue the best sequence by looking up its last tokens
+     * in [sourceIds]. Only greedy searches draft, as only their picks can be verified exactly.
+     */
+    fun draft(sourceIds: LongArray, length: Int): LongArray {
+        return draft(handle, sourceIds, length)
+    }
+
+    /**
+     * Searches the logits of the last token and every [draft] token behind [tensorHandle], laid
+     * out as [1, draft + 1, size], as consecutive steps until a pick differs from the draft.
+     *
+     * @return The number of steps taken, which is one more than the accepted draft tokens unless
+     * the sequence completed.
+     */
+    fun verify(tensorHandle: Long, draft: LongArray, size: Int): Int {
+        return verify(
+            handle = handle,
+            apiHandle = TensorUtils.getOrtApiHandle(),
+            tensorHandle = tensorHandle,
+            draft = draft,
+            size = size
+        )
+    }
+
+    /**
+     * Copies the rows of [tensor] in the order of the top beams into the direct [destination].
+     * With [half], fp32 values are converted to fp16 while they are copied.
+     *
+     * @return The number of bytes written.
+     */
     fun transposeBuffer(
-        tensor: OnnxTensor
-    ): ByteBuffer {
+        tensor: OnnxTensor,
+        destination: ByteBuffer,
+        half: Boolean = false
+    ): Int {
         val ortApiHandle = TensorUtils.getOrtApiHandle()
         val tensorHandle = TensorUtils.getNativeHandle(tensor)
 
-        return transposeBuffer(handle, ortApiHandle, tensorHandle)
+        val size = transposeBuffer(handle, ortApiHandle, tensorHandle, destination, half)
+        if (size < 0) {
+            throw IllegalStateException("Failed to transpose into a buffer of ${destination.capacity()} bytes")
+        }
+
+        return size
+    }
+
+    /**
+     * Restricts the next searches to the [candidates] token ids, like the ones of a shortlist. The
+     * probabilities are normalized over the candidates only.
+     */
+    fun restrict(candidates: IntArray) {
+        restrict(handle, candidates)
     }
 
     fun lastTokens(): Array<LongArray> {
         return lastTokens(handle)
     }
 
-    fun complete(completeOnRepeat: Boolean): Boolean {
-        return complete(handle, completeOnRepeat)
+    /**
+     * Index of the beam every current beam was extended from in the last search.
+     */
+    fun topBeamIds(): IntArray {
+        return topBeamIds(handle)
+    }
+
+    fun complete(): Boolean {
+        return complete(handle)
+    }
+
+    /**
+     * Whether [complete] stopped the search because it was cancelled or ran past its deadline, its
+     * best sequence is then the best one so far instead of a finished one.
+     */
+    fun truncated(): Boolean {
+        return truncated(handle)
+    }
+
+    /**
+     * Completes the search before its next step. Unlike the other functions, it may be called
+     * from any thread, as long as the search is not closed concurrently.
+     */
+    fun cancel() {
+        cancel(handle)
     }
 
     fun best(): LongArray {
@@ -67,7 +200,23 @@ class BeamSearch(
         handle = 0L
     }
 
-    private external fun construct(beamSize: Int, minP: Float, repetitionPenalty: Float, padId: Long, eosId: Long): Long
+    private external fun construct(
+        strategy: Int,
+        beamSize: Int,
+        minP: Float,
+        repetitionPenalty: Float,
+        padId: Long,
+        eosId: Long,
+        threads: Int,
+        topK: Int,
+        topP: Float,
+        seed: Long,
+        noRepeatNgramSize: Int,
+        sourceLength: Int,
+        maxLengthRatio: Float,
+        maxSequenceLength: Int,
+        timeoutMillis: Long
+    ): Long
 
     private external fun search(
         handle: Long,
@@ -75,19 +224,36 @@ class BeamSearch(
         tensorHandle: Long,
         size: Int,
     )
+    private external fun draft(handle: Long, sourceIds: LongArray, length: Int): LongArray
+    private external fun verify(
+        handle: Long,
+        apiHandle: Long,
+        tensorHandle: Long,
+        draft: LongArray,
+        size: Int
+    ): Int
     private external fun transposeBuffer(
         handle: Long,
         apiHandle: Long,
         tensorHandle: Long,
-    ): ByteBuffer
+        destination: ByteBuffer,
+        half: Boolean,
+    ): Int
+    private external fun restrict(handle: Long, candidates: IntArray)
     private external fun lastTokens(handle: Long): Array<LongArray>
-    private external fun complete(handle: Long, completeOnRepeat: Boolean): Boolean
+    private external fun topBeamIds(handle: Long): IntArray
+    private external fun maxLength(handle: Long): Int
+    private external fun complete(handle: Long): Boolean
+    private external fun truncated(handle: Long): Boolean
+    private external fun cancel(handle: Long)
     private external fun best(handle: Long): LongArray
     private external fun close(handle: Long): Boolean
 
     companion object {
         private val TAG: String = BeamSearch::class.java.simpleName
 
+        const val DEFAULT_MAX_SEQUENCE_LENGTH = 512
+
         init {
             System.loadLibrary("app_versta_translate_bridge")
         }
@@ -0,0 +1,135 @@
+package app.versta.translate.bridge.inference
+
+import ai.onnxruntime.OnnxTensorLike
+import ai.onnxruntime.OrtSession
+import app.versta.translate.utils.TensorUtils
+import timber.log.Timber
+
+/**
+ * Runs the decoder through an IoBinding, with the logits and present key/values written into
+ * buffers that are allocated once for [maxSequenceLength] steps and reused every step. The past
+ * key/values are bound to the buffers the previous step wrote into, so they are never copied
+ * unless the beams are reordered.
+ *
+ * The encoder tensors must stay open for as long as the binding is used.
+ */
+class DecoderBinding private constructor(
+    private var handle: Long
+) : AutoCloseable {
+    /**
+     * Size of the last dimension of the logits, as passed to [BeamSearch.search].
+     */
+    val vocabularySize: Int = vocabularySize(handle)
+
+    /**
+     * Runs the next decoder step for the last token of every beam, returns the handle of the
+     * logits tensor. The tensor is overwritten by the next step.
+     */
+    fun run(inputIds: Array<LongArray>): Long {
+        val logits = run(handle, inputIds)
+
+        if (logits == 0L) {
+            throw IllegalStateException("Failed to run decoder step")
+        }
+
+        return logits
+    }
+
+    /**
+     * Runs a decoder step for all of [inputIds] at once, the last token followed by a draft,
+     * returns the handle of the logits tensor laid out as [beams, inputIds.size, vocabularySize].
+     * Call [accept] with the number of tokens that were kept before the next step.
+     */
+    fun run(inputIds: LongArray): Long {
+        val logits = runTokens(handle, inputIds)
+
+        if (logits == 0L) {
+            throw IllegalStateException("Failed to run decoder step")
+        }
+
+        return logits
+    }
+
+    /**
+     * Keeps the key/values of the first [count] tokens of the last step, dropping those of the
+     * rejected draft tokens. Must be called before [reorder].
+     */
+    fun accept(count: Int) {
+        accept(handle, count)
+    }
+
+    /**
+     * Moves the key/values of the beams selected by the last search into place for the next step.
+     */
+    fun reorder(beamIds: IntArray) {
+        reorder(handle, beamIds)
+    }
+
+    override fun close() {
+        if (handle == 0L) {
+            Timber.tag(TAG).w("DecoderBinding is already closed")
+            return
+        }
+
+        close(handle)
+        handle = 0L
+    }
+
+    private external fun run(handle: Long, inputIds: Array<LongArray>): Long
+    private external fun runTokens(handle: Long, inputIds: LongArray): Long
+    private external fun accept(handle: Long, count: Int)
+    private external fun reorder(handle: Long, beamIds: IntArray)
+    private external fun vocabularySize(handle: Long): Int
+    private external fun close(handle: Long)
+
+    companion object {
+        private val TAG: String = DecoderBinding::class.java.simpleName
+
+        init {
+            System.loadLibrary("app_versta_translate_bridge")
+        }
+
+        /**
+         * Returns null when the decoder has no past key/value inputs, or their shapes are not
+         * static, in which case the decoder has to be run without a binding.
+         *
+         * @param maxTokens Most tokens a single step runs for, more than one to verify drafts.
+         */
+        fun create(
+            session: OrtSession,
+            encoderHiddenStates: OnnxTensorLike,
+            encoderAttentionMask: OnnxTensorLike,
+            beamSize: Int,
+            maxSequenceLength: Int,
+            maxTokens: Int = 1
+        ): DecoderBinding? {
+            val handle = construct(
+                apiHandle = TensorUtils.getOrtApiHandle(),
+                sessionHandle = TensorUtils.getNativeHandle(session),
+                encoderHiddenStatesHandle = TensorUtils.getNativeHandle(encoderHiddenStates),
+                encoderAttentionMaskHandle = TensorUtils.getNativeHandle(encoderAttentionMask),
+                beams = beamSize,
+                maxSequenceLength = maxSequenceLength,
+                maxTokens = maxTokens
+            )
+
+            if (handle == 0L) {
+                Timber.tag(TAG).d("Decoder does not support a binding")
+                return null
+            }
+
+            return DecoderBinding(handle)
+        }
+
+        @JvmStatic
+        private external fun construct(
+            apiHandle: Long,
+            sessionHandle: Long,
+            encoderHiddenStatesHandle: Long,
+            encoderAttentionMaskHandle: Long,
+            beams: Int,
+            maxSequenceLength: Int,
+            maxTokens: Int
+        ): Long
+    }
+}
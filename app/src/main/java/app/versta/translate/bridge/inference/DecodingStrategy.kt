@@ -0,0 +1,46 @@
+package app.versta.translate.bridge.inference
+
+/**
+ * How [BeamSearch] picks the next token at every decoding step. Every strategy but [Beam] decodes
+ * a single sequence, so the encoder output and decoder cache only need a single row.
+ */
+sealed class DecodingStrategy(internal val type: Int) {
+    /**
+     * Picks the most likely token, the cheapest strategy.
+     */
+    data object Greedy : DecodingStrategy(0)
+
+    /**
+     * Samples from the [k] most likely tokens. The same [seed] gives the same translation.
+     */
+    data class TopK(val k: Int, val seed: Long = DEFAULT_SEED) : DecodingStrategy(1)
+
+    /**
+     * Samples from the most likely tokens whose probability adds up to [p]. The same [seed] gives
+     * the same translation.
+     */
+    data class TopP(val p: Float, val seed: Long = DEFAULT_SEED) : DecodingStrategy(2)
+
+    /**
+     * Decodes the same translation as [Greedy], but drafts up to [draftLength] tokens copied from
+     * the source, like numbers and names, and verifies them with a single decoder step.
+     */
+    data class Speculative(val draftLength: Int = DEFAULT_DRAFT_LENGTH) : DecodingStrategy(0)
+
+    /**
+     * Keeps the best sequences of the beam size, the default.
+     */
+    data object Beam : DecodingStrategy(3)
+
+    /**
+     * Returns the strategy to decode with for [beamSize], a beam of one is decoded greedily.
+     */
+    fun resolve(beamSize: Int): DecodingStrategy {
+        return if (this == Beam && beamSize <= 1) Greedy else this
+    }
+
+    companion object {
+        const val DEFAULT_SEED = 0L
+        const val DEFAULT_DRAFT_LENGTH = 8
+    }
+}
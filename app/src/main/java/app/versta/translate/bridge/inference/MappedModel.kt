@@ -0,0 +1,103 @@
+package app.versta.translate.bridge.inference
+
+import timber.log.Timber
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+
+/**
+ * Read-only memory mapping of a model file. The file is paged in lazily when the mapping is read,
+ * and is never copied onto the Java heap.
+ */
+class MappedModel(private val filePath: String) : AutoCloseable {
+    private var handle = 0L
+
+    /**
+     * File name of the model without extension.
+     */
+    val name: String = File(filePath).nameWithoutExtension
+
+    init {
+        // Throws an IOException when the file cannot be opened or mapped.
+        handle = open(filePath)
+    }
+
+    /**
+     * Direct buffer over the mapping, only valid until the model is closed.
+     */
+    fun buffer(): ByteBuffer {
+        return buffer(handle)
+    }
+
+    /**
+     * Identifies the model contents together with the loaded ONNX Runtime version.
+     */
+    fun fingerprint(): String {
+        return "${contentHash()}-${runtimeVersion()}"
+    }
+
+    /**
+     * Hash of the whole file. It is stored next to the model, usually when the model is optimized
+     * at import, so later loads only read the file size and modification time.
+     */
+    private fun contentHash(): String {
+        val file = File(filePath)
+        val hashFile = File(filePath + HASH_EXTENSION)
+        val stamp = "${file.length()}:${file.lastModified()}"
+
+        // A missing or unreadable hash file is written again.
+        val stored = try {
+            hashFile.readLines()
+        } catch (e: IOException) {
+            emptyList()
+        }
+
+        if (stored.size == 2 && stored[0] == stamp) {
+            return stored[1]
+        }
+
+        val hash = hash(handle)
+
+        try {
+            hashFile.writeText("$stamp\n$hash")
+        } catch (e: IOException) {
+            Timber.tag(TAG).w(e, "Failed to store the hash of $name")
+        }
+
+        return hash
+    }
+
+    /**
+     * Drops the pages that were read so far, they are read from the file again when needed.
+     */
+    fun trim() {
+        trim(handle)
+    }
+
+    override fun close() {
+        if (handle == 0L) {
+            Timber.tag(TAG).w("MappedModel is already closed")
+            return
+        }
+
+        close(handle)
+        handle = 0L
+    }
+
+    private external fun open(filePath: String): Long
+    private external fun buffer(handle: Long): ByteBuffer
+    private external fun hash(handle: Long): String
+    private external fun runtimeVersion(): String
+    private external fun trim(handle: Long)
+    private external fun close(handle: Long)
+
+    companion object {
+        private val TAG: String = MappedModel::class.java.simpleName
+
+        private const val HASH_EXTENSION = ".hash"
+
+        init {
+            System.loadLibrary("app_versta_translate_bridge")
+        }
+    }
+}
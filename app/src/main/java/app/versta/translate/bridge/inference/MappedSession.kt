@@ -0,0 +1,152 @@
+package app.versta.translate.bridge.inference
+
+import ai.onnxruntime.OrtEnvironment
+import ai.onnxruntime.OrtSession
+import timber.log.Timber
+import java.io.File
+
+/**
+ * ONNX session created from a memory mapped model file. The model is paged in lazily while the
+ * session is created, and never copied onto the Java heap. The mapping lives as long as the
+ * session and is released when the session is closed.
+ *
+ * When [optimizedModelDirectory] is given, the graph optimized by the first load is saved there,
+ * keyed by the model fingerprint, and later loads skip graph optimization by loading it instead.
+ * The directory holds the graphs of a single model package, as the graphs of every package share
+ * their names and a graph replaces the ones saved for other contents of the same name.
+ *
+ * @param options Creates the options of every attempt to create the session, which are changed
+ * to load or save the optimized model and closed once the session is created.
+ */
+class MappedSession(
+    environment: OrtEnvironment,
+    filePath: String,
+    options: () -> OrtSession.SessionOptions,
+    optimizedModelDirectory: File? = null
+) : AutoCloseable {
+    private var model: MappedModel
+
+    val session: OrtSession
+
+    /**
+     * Whether the session was created from a previously saved optimized model.
+     */
+    val optimized: Boolean
+
+    /**
+     * File the optimized model is saved to and loaded from, if an optimized model directory is
+     * given. It only exists once a session has been created from the source model successfully.
+     */
+    val optimizedFile: File?
+
+    init {
+        val source = MappedModel(filePath)
+        val optimizedFile = optimizedModelDirectory?.let {
+            File(it, "${source.name}-${source.fingerprint()}$OPTIMIZED_MODEL_EXTENSION")
+        }
+        this.optimizedFile = optimizedFile
+
+        var session: OrtSession? = null
+        var model = source
+
+        if (optimizedFile != null && optimizedFile.exists()) {
+            try {
+                val cached = MappedModel(optimizedFile.path)
+                try {
+                    session = options().use {
+                        it.setOptimizationLevel(OrtSession.SessionOptions.OptLevel.NO_OPT)
+                        environment.createSession(cached.buffer(), it)
+                    }
+                    model = cached
+                    source.close()
+                } catch (e: Exception) {
+                    cached.close()
+                    throw e
+                }
+            } catch (e: Exception) {
+                Timber.tag(TAG).w(e, "Discarding optimized model ${optimizedFile.name}")
+                optimizedFile.delete()
+            }
+        }
+
+        optimized = session != null
+
+        if (session == null) {
+            session = createFromSource(environment, source, options, optimizedFile)
+        }
+
+        this.model = model
+        this.session = session
+        this.model.trim()
+    }
+
+    private fun createFromSource(
+        environment: OrtEnvironment,
+        source: MappedModel,
+        options: () -> OrtSession.SessionOptions,
+        optimizedFile: File?
+    ): OrtSession {
+        if (optimizedFile != null) {
+            val temporaryFile = File(optimizedFile.path + ".tmp")
+
+            val session = try {
+                temporaryFile.parentFile?.mkdirs()
+                options().use {
+                    it.setOptimizedModelFilePath(temporaryFile.path)
+                    environment.createSession(source.buffer(), it)
+                }
+            } catch (e: Exception) {
+                // Saving the optimized model may fail on its own, for example on a full disk, so
+                // the model is loaded once more without saving it.
+                Timber.tag(TAG).w(e, "Failed to optimize ${source.name} into ${optimizedFile.name}")
+                temporaryFile.delete()
+                null
+            }
+
+            if (session != null) {
+                removeStaleOptimizedModels(source.name, optimizedFile)
+
+                if (!temporaryFile.renameTo(optimizedFile)) {
+                    Timber.tag(TAG).w("Failed to save optimized model ${optimizedFile.name}")
+                    temporaryFile.delete()
+                }
+
+                return session
+            }
+        }
+
+        try {
+            return options().use { environment.createSession(source.buffer(), it) }
+        } catch (e: Exception) {
+            source.close()
+            throw e
+        }
+    }
+
+    /**
+     * Removes optimized models saved for other contents or runtime versions of the same model in
+     * the directory of [optimizedFile], which only holds the graphs of the same model package.
+     */
+    private fun removeStaleOptimizedModels(name: String, optimizedFile: File) {
+        val pattern = Regex(
+            "${Regex.escape(name)}-[0-9a-f]{16}-[^-]+${Regex.escape(OPTIMIZED_MODEL_EXTENSION)}"
+        )
+
+        optimizedFile.parentFile?.listFiles()?.forEach {
+            if (it.name != optimizedFile.name && pattern.matches(it.name)) {
+                it.delete()
+            }
+        }
+    }
+
+    override fun close() {
+        session.close()
+        model.close()
+    }
+
+    companion object {
+        private val TAG: String = MappedSession::class.java.simpleName
+
+        private const val OPTIMIZED_MODEL_EXTENSION = ".optimized.onnx"
+    }
+}
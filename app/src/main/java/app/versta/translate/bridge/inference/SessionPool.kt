@@ -0,0 +1,168 @@
+package app.versta.translate.bridge.inference
+
+import timber.log.Timber
+
+/**
+ * Keeps loaded sessions resident under a memory budget, evicting the least recently used entries
+ * when a new entry does not fit. The most recently acquired entry is never evicted, even if it
+ * exceeds the budget on its own. An entry is handed out as a [Lease], and is neither evicted nor
+ * closed while a lease on it is open, so a translation keeps its sessions when another model is
+ * loaded halfway through it.
+ *
+ * @param memoryBudget Maximum number of bytes the resident entries may use.
+ */
+class SessionPool<T : AutoCloseable>(
+    private val memoryBudget: Long
+) : AutoCloseable {
+    data class Statistics(
+        val hits: Long,
+        val misses: Long,
+        val evictions: Long,
+        val residentEntries: Int,
+        val residentBytes: Long,
+        val leasedEntries: Int
+    )
+
+    internal class Entry<T>(val value: T, val bytes: Long) {
+        var leases = 0
+
+        /**
+         * Whether the entry was removed from the pool while leased, it is closed with its last
+         * lease.
+         */
+        var retired = false
+    }
+
+    /**
+     * Use of an entry, which has to be closed once the entry is no longer used.
+     */
+    inner class Lease internal constructor(private val entry: Entry<T>) : AutoCloseable {
+        private var closed = false
+
+        val value: T
+            get() = entry.value
+
+        /**
+         * Takes another lease on the same entry, which stays open after this one is closed.
+         */
+        fun retain(): Lease {
+            synchronized(this@SessionPool) {
+                check(!closed) { "Lease is already closed" }
+                return lease(entry)
+            }
+        }
+
+        override fun close() {
+            synchronized(this@SessionPool) {
+                if (closed) return
+                closed = true
+
+                entry.leases--
+                if (entry.leases == 0 && entry.retired) {
+                    entry.value.close()
+                }
+            }
+        }
+    }
+
+    // Access ordered, so iteration starts at the least recently used entry.
+    private val entries = LinkedHashMap<String, Entry<T>>(16, 0.75f, true)
+
+    private var hits = 0L
+    private var misses = 0L
+    private var evictions = 0L
+    private var residentBytes = 0L
+
+    /**
+     * Leases the entry stored under [key], creating it with [create] when it is not resident.
+     *
+     * @param bytes Estimated memory use of the entry, only used when it has to be created.
+     */
+    @Synchronized
+    fun acquire(key: String, bytes: Long, create: () -> T): Lease {
+        val entry = entries[key]
+        if (entry != null) {
+            hits++
+            return lease(entry)
+        }
+
+        misses++
+        evict(bytes)
+
+        val created = Entry(create(), bytes)
+        entries[key] = created
+        residentBytes += bytes
+
+        return lease(created)
+    }
+
+    /**
+     * Removes the entry stored under [key], if any, and closes it once it is no longer leased.
+     */
+    @Synchronized
+    fun remove(key: String) {
+        val entry = entries.remove(key) ?: return
+        residentBytes -= entry.bytes
+        retire(entry)
+    }
+
+    @Synchronized
+    fun statistics(): Statistics {
+        return Statistics(
+            hits = hits,
+            misses = misses,
+            evictions = evictions,
+            residentEntries = entries.size,
+            residentBytes = residentBytes,
+            leasedEntries = entries.values.count { it.leases > 0 }
+        )
+    }
+
+    private fun lease(entry: Entry<T>): Lease {
+        entry.leases++
+        return Lease(entry)
+    }
+
+    private fun retire(entry: Entry<T>) {
+        if (entry.leases > 0) {
+            entry.retired = true
+        } else {
+            entry.value.close()
+        }
+    }
+
+    /**
+     * Evicts least recently used entries that are not leased until [bytes] more fit in the budget.
+     */
+    private fun evict(bytes: Long) {
+        val iterator = entries.iterator()
+        while (iterator.hasNext() && residentBytes + bytes > memoryBudget) {
+            val (key, entry) = iterator.next()
+            if (entry.leases > 0) {
+                continue
+            }
+
+            iterator.remove()
+
+            residentBytes -= entry.bytes
+            evictions++
+
+            Timber.tag(TAG).d("Evicting $key, freeing ${entry.bytes} bytes")
+            entry.value.close()
+        }
+    }
+
+    /**
+     * Removes every entry, the leased ones are closed with their last lease.
+     */
+    @Synchronized
+    override fun close() {
+        entries.values.forEach { retire(it) }
+        entries.clear()
+        residentBytes = 0L
+    }
+
+    companion object {
+        private val TAG: String = SessionPool::class.java.simpleName
+    }
+}
@@ -0,0 +1,28 @@
+package app.versta.translate.bridge.inference
+
+import java.io.IOException
+
+object Shortlist {
+    init {
+        System.loadLibrary("app_versta_translate_bridge")
+    }
+
+    /**
+     * Number of most probable target tokens kept for every source token.
+     */
+    const val DEFAULT_BEST = 100
+
+    /**
+     * Compiles the lexical table at [lexicalTablePath] into a shortlist that [ShortlistIndex]
+     * maps, keeping the [best] most probable target tokens of every source token. The shortlist is
+     * validated before it replaces [indexPath].
+     */
+    @Throws(IOException::class)
+    external fun compile(
+        lexicalTablePath: String,
+        sourceVocabularyPath: String,
+        targetVocabularyPath: String,
+        indexPath: String,
+        best: Int
+    )
+}
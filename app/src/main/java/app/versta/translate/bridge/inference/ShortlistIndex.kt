@@ -0,0 +1,61 @@
+package app.versta.translate.bridge.inference
+
+import timber.log.Timber
+import java.io.IOException
+
+/**
+ * Shortlist compiled by [Shortlist.compile]. The shortlist is memory mapped, so opening it does
+ * not read the table.
+ */
+class ShortlistIndex(filePath: String) : AutoCloseable {
+    private var handle = 0L
+
+    init {
+        handle = open(filePath)
+
+        if (handle == 0L) {
+            throw IOException("Failed to open shortlist $filePath")
+        }
+    }
+
+    /**
+     * Returns the sorted target ids worth searching when translating [inputIds]: the target
+     * tokens listed for any of the source tokens, the [first] target ids and [specialIds].
+     */
+    fun candidates(inputIds: LongArray, specialIds: LongArray, first: Int = DEFAULT_FIRST): IntArray {
+        return candidates(handle, inputIds, specialIds, first)
+    }
+
+    override fun close() {
+        if (handle == 0L) {
+            Timber.tag(TAG).w("ShortlistIndex is already closed")
+            return
+        }
+
+        close(handle)
+        handle = 0L
+    }
+
+    private external fun open(filePath: String): Long
+    private external fun candidates(
+        handle: Long,
+        inputIds: LongArray,
+        specialIds: LongArray,
+        first: Int
+    ): IntArray
+    private external fun close(handle: Long)
+
+    companion object {
+        private val TAG: String = ShortlistIndex::class.java.simpleName
+
+        /**
+         * Number of leading target ids always searched, which hold the special and most frequent
+         * tokens of Marian vocabularies.
+         */
+        const val DEFAULT_FIRST = 100
+
+        init {
+            System.loadLibrary("app_versta_translate_bridge")
+        }
+    }
+}
@@ -0,0 +1,278 @@
+package app.versta.translate.bridge.inference
+
+import kotlinx.coroutines.runInterruptible
+import java.util.TreeSet
+import java.util.concurrent.locks.ReentrantLock
+import kotlin.concurrent.withLock
+import kotlin.coroutines.cancellation.CancellationException
+
+/**
+ * Priority of a translation job, an earlier entry preempts the later ones.
+ */
+enum class JobPriority {
+    /**
+     * Translations the user is waiting for, like the input of a text box.
+     */
+    Interactive,
+
+    /**
+     * Translations nobody is waiting for yet, like the sentences of a document.
+     */
+    Background
+}
+
+/**
+ * Interleaves translation jobs at the granularity of decoder steps. The sessions are only used
+ * from within [Job.step], which runs one step at a time: of the jobs waiting for a step, the one
+ * with the highest priority, and the earliest job among equal priorities. An interactive job that
+ * is admitted while a background job decodes therefore preempts it at its next step. A job that
+ * is busy between its steps, like a flow waiting for its collector, holds up no other job. A
+ * cancelled job takes no more steps, even when it is waiting for one.
+ *
+ * Waiting for a step blocks the calling thread, so only a few jobs should be admitted at once.
+ * [Job.awaitStep] stops waiting when the calling coroutine is cancelled, and [Job.step] throws an
+ * [InterruptedException] before its next step once the calling thread is interrupted, so a job
+ * run in [runInterruptible] ends at its next step when its coroutine is cancelled.
+ */
+class StepScheduler {
+    /**
+     * Latency of a job, from its admission until it was closed or until now.
+     *
+     * @param queuedMillis Time from the admission to the start of the first step.
+     * @param preemptedMillis Time the job waited for other jobs after its first step.
+     */
+    data class JobStatistics(
+        val priority: JobPriority,
+        val steps: Int,
+        val preemptions: Int,
+        val queuedMillis: Long,
+        val preemptedMillis: Long,
+        val totalMillis: Long
+    )
+
+    /**
+     * @param queueDepth Number of admitted jobs that are not closed yet, by priority.
+     * @param waitingJobs Number of jobs waiting for a step.
+     * @param recentJobs Latency of the last closed jobs, the most recent last.
+     */
+    data class Statistics(
+        val queueDepth: Map<JobPriority, Int>,
+        val waitingJobs: Int,
+        val completedJobs: Long,
+        val preemptions: Long,
+        val recentJobs: List<JobStatistics>
+    )
+
+    inner class Job internal constructor(
+        val priority: JobPriority,
+        internal val sequence: Long
+    ) : AutoCloseable {
+        private val admittedAt = System.nanoTime()
+        private var startedAt = 0L
+        private var closedAt = 0L
+        private var preemptedNanos = 0L
+        private var steps = 0
+        private var preemptions = 0
+        private var closed = false
+
+        /**
+         * Whether the job was cancelled, its steps no longer run.
+         */
+        var cancelled = false
+            get() = lock.withLock { field }
+            private set
+
+        // Whether the job took the turn to step, which is given back once its step finished.
+        private var holdsTurn = false
+
+        /**
+         * Runs [block] as the next step of the job, once no waiting job before it wants to run.
+         *
+         * @return The result of [block], or null when the job was cancelled before it ran.
+         * @throws InterruptedException When the calling thread was interrupted before [block] ran.
+         */
+        fun <T> step(block: () -> T): T? {
+            if (!takeTurn()) {
+                return null
+            }
+
+            try {
+                return block()
+            } finally {
+                giveTurn()
+            }
+        }
+
+        /**
+         * Like [step], but stops waiting with a [CancellationException] when the calling
+         * coroutine is cancelled, instead of keeping its thread parked.
+         */
+        suspend fun <T> awaitStep(block: () -> T): T? {
+            try {
+                if (!runInterruptible { takeTurn() }) {
+                    return null
+                }
+            } catch (e: CancellationException) {
+                // The turn may have been taken right before the wait was interrupted.
+                giveTurn()
+                throw e
+            }
+
+            try {
+                return block()
+            } finally {
+                giveTurn()
+            }
+        }
+
+        private fun takeTurn(): Boolean {
+            // Without other jobs the turn is taken without waiting, which would miss an interrupt.
+            if (Thread.interrupted()) {
+                throw InterruptedException()
+            }
+
+            lock.withLock {
+                check(!closed) { "Job is already closed" }
+
+                val waitStart = System.nanoTime()
+                var preempted = false
+
+                waiting.add(this)
+                try {
+                    while (!cancelled && (running || waiting.first() !== this)) {
+                        // Only the steps of a job with a higher priority count as a preemption.
+                        preempted = preempted || waiting.first().priority < priority
+                        changed.await()
+                    }
+                } finally {
+                    waiting.remove(this)
+                    changed.signalAll()
+                }
+
+                if (cancelled) {
+                    return false
+                }
+
+                if (steps == 0) {
+                    startedAt = System.nanoTime()
+                } else {
+                    preemptedNanos += System.nanoTime() - waitStart
+                }
+
+                if (preempted && steps > 0) {
+                    preemptions++
+                    this@StepScheduler.preemptions++
+                }
+
+                running = true
+                holdsTurn = true
+                return true
+            }
+        }
+
+        private fun giveTurn() {
+            lock.withLock {
+                if (!holdsTurn) return
+                holdsTurn = false
+
+                steps++
+                running = false
+                changed.signalAll()
+            }
+        }
+
+        /**
+         * Cancels the job, a step that already runs is finished first.
+         */
+        fun cancel() {
+            lock.withLock {
+                cancelled = true
+                changed.signalAll()
+            }
+        }
+
+        fun statistics(): JobStatistics {
+            lock.withLock {
+                val now = if (closed) closedAt else System.nanoTime()
+                return JobStatistics(
+                    priority = priority,
+                    steps = steps,
+                    preemptions = preemptions,
+                    queuedMillis = ((if (steps > 0) startedAt else now) - admittedAt) / 1_000_000,
+                    preemptedMillis = preemptedNanos / 1_000_000,
+                    totalMillis = (now - admittedAt) / 1_000_000
+                )
+            }
+        }
+
+        override fun close() {
+            lock.withLock {
+                if (closed) return
+                closed = true
+                closedAt = System.nanoTime()
+
+                jobs.remove(this)
+                completedJobs++
+
+                recentJobs.addLast(statistics())
+                if (recentJobs.size > RECENT_JOBS) {
+                    recentJobs.removeFirst()
+                }
+
+                changed.signalAll()
+            }
+        }
+    }
+
+    private val lock = ReentrantLock()
+    private val changed = lock.newCondition()
+
+    // Ordered by the order their steps run in.
+    private val order = compareBy<Job>({ it.priority }, { it.sequence })
+    private val jobs = TreeSet(order)
+    private val waiting = TreeSet(order)
+    private var running = false
+
+    private var sequence = 0L
+    private var completedJobs = 0L
+    private var preemptions = 0L
+    private val recentJobs = ArrayDeque<JobStatistics>()
+
+    /**
+     * Admits a job, which has to be closed once it takes no more steps.
+     */
+    fun admit(priority: JobPriority): Job {
+        lock.withLock {
+            val job = Job(priority, sequence++)
+            jobs.add(job)
+            return job
+        }
+    }
+
+    /**
+     * Cancels every job that is admitted and not closed yet.
+     */
+    fun cancelAll() {
+        lock.withLock {
+            jobs.forEach { it.cancel() }
+        }
+    }
+
+    fun statistics(): Statistics {
+        lock.withLock {
+            return Statistics(
+                queueDepth = JobPriority.entries.associateWith { priority ->
+                    jobs.count { it.priority == priority }
+                },
+                waitingJobs = waiting.size,
+                completedJobs = completedJobs,
+                preemptions = preemptions,
+                recentJobs = recentJobs.toList()
+            )
+        }
+    }
+
+    companion object {
+        private const val RECENT_JOBS = 32
+    }
+}
@@ -1,6 +1,7 @@
 package app.versta.translate.bridge.inference
 
 import java.nio.Buffer
+import java.nio.ByteBuffer
 
 object TensorUtils {
     init {
@@ -8,4 +9,23 @@ object TensorUtils {
     }
 
     external fun closeBuffer(buffer: Buffer)
+
+    /**
+     * Copies the data of a tensor [count] times into a native buffer, which has to be freed with
+     * [closeBuffer].
+     */
+    external fun repeatBuffer(apiHandle: Long, tensorHandle: Long, count: Int): ByteBuffer
+
+    /**
+     * Copies the first [length] positions of the sequence at [row] of a [batch, sequence, hidden]
+     * tensor [count] times into a native buffer, which has to be freed with [closeBuffer]. Returns
+     * null when the row or length are out of the bounds of the tensor.
+     */
+    external fun sliceBuffer(apiHandle: Long, tensorHandle: Long, row: Int, length: Int, count: Int): ByteBuffer?
+
+    /**
+     * Registers a CPU arena allocator with the ORT environment, which sessions created with
+     * `session.use_env_allocators` share. Returns false when one is already registered.
+     */
+    external fun registerSharedAllocator(apiHandle: Long, environmentHandle: Long): Boolean
 }
\ No newline at end of file
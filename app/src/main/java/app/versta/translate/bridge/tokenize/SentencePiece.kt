@@ -32,16 +32,53 @@ class SentencePiece : AutoCloseable {
         loadFromSerializedProto(handle, serialized)
     }
 
+    /**
+     * Loads the model like [loadFromSerializedProto], with its piece index read from [indexPath]
+     * as written by [serializeIndex] instead of built.
+     *
+     * @throws RuntimeException If the index does not match the model.
+     */
+    fun loadFromSerializedProto(serialized: ByteArray, indexPath: String) {
+        loadFromSerializedProtoWithIndex(handle, serialized, indexPath)
+    }
+
+    /**
+     * Writes the piece index of the loaded model to [indexPath].
+     */
+    fun serializeIndex(indexPath: String) {
+        serializeIndex(handle, indexPath)
+    }
+
     fun encodeAsPieces(input: String): List<String> {
         val pieces = encodeAsPieces(handle, input)
         return pieces.toList()
     }
 
+    fun pieceToId(piece: String): Int {
+        return pieceToId(handle, piece)
+    }
+
+    /**
+     * Detokenizes the given SentencePiece ids directly into a string, without building the
+     * intermediate pieces.
+     */
+    fun decode(ids: IntArray): String {
+        return decode(handle, ids)
+    }
+
     private external fun constructor(): Long
     private external fun close(handle: Long)
     private external fun load(handle: Long, filename: String)
     private external fun loadFromSerializedProto(handle: Long, serialized: ByteArray)
+    private external fun loadFromSerializedProtoWithIndex(
+        handle: Long,
+        serialized: ByteArray,
+        indexPath: String
+    )
+    private external fun serializeIndex(handle: Long, indexPath: String)
     private external fun encodeAsPieces(handle: Long, input: String): Array<String>
+    private external fun pieceToId(handle: Long, piece: String): Int
+    private external fun decode(handle: Long, ids: IntArray): String
 
     companion object {
         private val TAG: String = SentencePiece::class.java.simpleName
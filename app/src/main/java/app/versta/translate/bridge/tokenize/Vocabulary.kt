@@ -1,9 +1,19 @@
 package app.versta.translate.bridge.tokenize
 
+import java.io.IOException
+
 object Vocabulary {
     init {
         System.loadLibrary("app_versta_translate_bridge")
     }
 
     external fun load(filePath: String): List<String>
-}
\ No newline at end of file
+
+    /**
+     * Compiles the vocabulary at [filePath] into an index that [VocabularyIndex] maps without
+     * building the token list. The index is validated against the vocabulary before it replaces
+     * [indexPath].
+     */
+    @Throws(IOException::class)
+    external fun compile(filePath: String, indexPath: String)
+}
@@ -0,0 +1,62 @@
+package app.versta.translate.bridge.tokenize
+
+import timber.log.Timber
+import java.io.IOException
+
+/**
+ * Vocabulary compiled by [Vocabulary.compile]. The index is memory mapped, tokens are only decoded
+ * when they are accessed and [indexOf] is a hash table lookup instead of a linear search.
+ */
+class VocabularyIndex(filePath: String) : AbstractList<String>(), AutoCloseable {
+    private var handle = 0L
+
+    init {
+        handle = open(filePath)
+
+        if (handle == 0L) {
+            throw IOException("Failed to open vocabulary index $filePath")
+        }
+    }
+
+    override val size: Int = size(handle)
+
+    override fun get(index: Int): String {
+        if (index < 0 || index >= size) {
+            throw IndexOutOfBoundsException("Index $index is out of bounds for size $size")
+        }
+
+        return get(handle, index)
+    }
+
+    override fun indexOf(element: String): Int {
+        return indexOf(handle, element)
+    }
+
+    override fun contains(element: String): Boolean {
+        return indexOf(element) >= 0
+    }
+
+    override fun close() {
+        if (handle == 0L) {
+            Timber.tag(TAG).w("VocabularyIndex is already closed")
+            return
+        }
+
+        close(handle)
+        handle = 0L
+    }
+
+    private external fun open(filePath: String): Long
+    private external fun size(handle: Long): Int
+    private external fun get(handle: Long, id: Int): String
+    private external fun indexOf(handle: Long, token: String): Int
+    private external fun close(handle: Long)
+
+    companion object {
+        private val TAG: String = VocabularyIndex::class.java.simpleName
+
+        init {
+            System.loadLibrary("app_versta_translate_bridge")
+        }
+    }
+}
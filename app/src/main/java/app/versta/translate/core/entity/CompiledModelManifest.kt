@@ -0,0 +1,139 @@
+package app.versta.translate.core.entity
+
+import kotlinx.serialization.SerialName
+import kotlinx.serialization.Serializable
+import kotlinx.serialization.json.Json
+import timber.log.Timber
+import java.io.File
+import java.nio.file.Path
+import kotlin.io.path.exists
+
+enum class CompiledArtifactType {
+    SourceVocabulary,
+    TargetVocabulary,
+    SourceTokenizer,
+    TargetTokenizer,
+    Encoder,
+    Decoder,
+    Shortlist
+}
+
+/**
+ * Artifact compiled from one of the files of a language model. Both paths are relative to the
+ * directory of the language model.
+ */
+@Serializable
+data class CompiledArtifact(
+    val type: CompiledArtifactType,
+    val path: String,
+    val source: String,
+    @SerialName("source_size")
+    val sourceSize: Long,
+    @SerialName("source_modified")
+    val sourceModified: Long
+) {
+    /**
+     * Whether the artifact exists and its source has not changed since it was compiled.
+     */
+    fun isValid(root: Path): Boolean {
+        val sourceFile = root.resolve(source).toFile()
+
+        return root.resolve(path).exists() &&
+                sourceFile.length() == sourceSize &&
+                sourceFile.lastModified() == sourceModified
+    }
+
+    companion object {
+        fun create(root: Path, type: CompiledArtifactType, path: Path, source: Path): CompiledArtifact {
+            val sourceFile = source.toFile()
+
+            return CompiledArtifact(
+                type = type,
+                path = root.relativize(path).toString(),
+                source = root.relativize(source).toString(),
+                sourceSize = sourceFile.length(),
+                sourceModified = sourceFile.lastModified()
+            )
+        }
+    }
+}
+
+/**
+ * Lists the artifacts compiled for a language model at import, which are used instead of their
+ * sources while they are valid.
+ */
+@Serializable
+data class CompiledModelManifest(
+    val version: Int = VERSION,
+    val artifacts: List<CompiledArtifact>
+) {
+    /**
+     * Returns the path of the artifact of the given [type], or null if it was not compiled or is
+     * no longer valid.
+     */
+    fun resolve(root: Path, type: CompiledArtifactType): Path? {
+        val artifact = artifacts.find { it.type == type } ?: return null
+
+        if (!artifact.isValid(root)) {
+            Timber.tag(TAG).w("Ignoring outdated compiled artifact ${artifact.path}")
+            return null
+        }
+
+        return root.resolve(artifact.path)
+    }
+
+    fun save(root: Path) {
+        val file = File(root.resolve(DIRECTORY).toFile(), FILE_NAME)
+        val temporaryFile = File(file.path + ".tmp")
+
+        temporaryFile.writeText(serializer.encodeToString(serializer(), this))
+        if (!temporaryFile.renameTo(file)) {
+            temporaryFile.delete()
+            throw IllegalStateException("Failed to save compiled model manifest: ${file.absolutePath}")
+        }
+    }
+
+    companion object {
+        private val TAG: String = CompiledModelManifest::class.java.simpleName
+
+        private val serializer = Json { ignoreUnknownKeys = true }
+
+        /**
+         * Version of the compiled artifacts, raised whenever their format changes so that older
+         * artifacts are ignored.
+         */
+        const val VERSION = 1
+
+        /**
+         * Directory in the language model directory the artifacts and manifest are written to.
+         */
+        const val DIRECTORY = "compiled"
+
+        private const val FILE_NAME = "manifest.json"
+
+        /**
+         * Reads the manifest of the language model at [root], returns null if there is none or
+         * it was written for another version.
+         */
+        fun load(root: Path): CompiledModelManifest? {
+            val file = File(root.resolve(DIRECTORY).toFile(), FILE_NAME)
+            if (!file.exists()) {
+                return null
+            }
+
+            val manifest = try {
+                serializer.decodeFromString<CompiledModelManifest>(file.readText())
+            } catch (e: Exception) {
+                Timber.tag(TAG).w(e, "Failed to read compiled model manifest")
+                return null
+            }
+
+            if (manifest.version != VERSION) {
+                Timber.tag(TAG).d("Ignoring compiled model manifest of version ${manifest.version}")
+                return null
+            }
+
+            return manifest
+        }
+    }
+}
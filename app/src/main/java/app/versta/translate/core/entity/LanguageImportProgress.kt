@@ -9,6 +9,8 @@ sealed class LanguageImportProgress {
     data class InProgress(val current: String, val extracted: Int, val total: Int) :
         LanguageImportProgress()
 
+    data class Compiling(val current: String) : LanguageImportProgress()
+
     data class Completed(val metadata: ModelMetadata) : LanguageImportProgress()
     data class Error(val exception: Exception) : LanguageImportProgress()
 }
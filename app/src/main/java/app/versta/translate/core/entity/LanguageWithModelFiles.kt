@@ -37,6 +37,7 @@ data class LanguageModelFiles(
             }
 
             val metadata = serializer.decodeFromString<LanguageMetadata>(metadataFile.readText())
+            val manifest = CompiledModelManifest.load(path)
             val files = LanguageModelFiles(
                 path = path,
                 baseModel = metadata.baseModel,
@@ -47,11 +48,21 @@ data class LanguageModelFiles(
                     sourceVocabulary = path.resolve(metadata.files.tokenizer.sourceVocabulary),
                     targetVocabulary = metadata.files.tokenizer.targetVocabulary?.let { path.resolve(it) },
                     source = path.resolve(metadata.files.tokenizer.source),
-                    target = path.resolve(metadata.files.tokenizer.target)
+                    target = path.resolve(metadata.files.tokenizer.target),
+                    sourceVocabularyIndex = manifest?.resolve(path, CompiledArtifactType.SourceVocabulary),
+                    targetVocabularyIndex = manifest?.resolve(path, CompiledArtifactType.TargetVocabulary),
+                    sourceIndex = manifest?.resolve(path, CompiledArtifactType.SourceTokenizer),
+                    targetIndex = manifest?.resolve(path, CompiledArtifactType.TargetTokenizer)
                 ),
                 inference = LanguageModelInferenceFiles(
                     encoder = path.resolve(metadata.files.inference.encoder),
-                    decoder = path.resolve(metadata.files.inference.decoder)
+                    decoder = path.resolve(metadata.files.inference.decoder),
+                    optimizedModelDirectory = manifest?.resolve(path, CompiledArtifactType.Encoder)
+                        ?.let { manifest.resolve(path, CompiledArtifactType.Decoder) }
+                        ?.let { path.resolve(CompiledModelManifest.DIRECTORY) },
+                    lexicalTable = metadata.files.inference.lexicalTable?.let { path.resolve(it) },
+                    shortlist = manifest?.resolve(path, CompiledArtifactType.Shortlist),
+                    maxLengthRatio = metadata.files.inference.maxLengthRatio
                 )
             )
 
@@ -70,7 +81,14 @@ data class LanguageModelTokenizerFiles(
     val sourceVocabulary: Path,
     val targetVocabulary: Path? = null,
     val source: Path,
-    val target: Path
+    val target: Path,
+    /**
+     * Vocabularies and SentencePiece indices compiled at import, see [CompiledModelManifest].
+     */
+    val sourceVocabularyIndex: Path? = null,
+    val targetVocabularyIndex: Path? = null,
+    val sourceIndex: Path? = null,
+    val targetIndex: Path? = null
 ) {
     fun isValid() = config.exists() &&
             sourceVocabulary.exists() &&
@@ -82,8 +100,24 @@ data class LanguageModelTokenizerFiles(
 @Serializable
 data class LanguageModelInferenceFiles(
     val encoder: Path,
-    val decoder: Path
+    val decoder: Path,
+    /**
+     * Directory holding the graphs of the encoder and decoder optimized at import.
+     */
+    val optimizedModelDirectory: Path? = null,
+    val lexicalTable: Path? = null,
+    /**
+     * Shortlist compiled from [lexicalTable] at import, decoding searches the full vocabulary
+     * without it.
+     */
+    val shortlist: Path? = null,
+    /**
+     * Most target tokens a translation may have per source token, decoding falls back to a
+     * ratio that fits most language pairs without one.
+     */
+    val maxLengthRatio: Float? = null
 ) {
     fun isValid() = encoder.exists() &&
-            decoder.exists()
+            decoder.exists() &&
+            lexicalTable?.exists() ?: true
 }
@@ -1,21 +1,36 @@
 package app.versta.translate.core.entity
 
+import ai.onnxruntime.OnnxJavaType
 import ai.onnxruntime.OnnxTensor
 import ai.onnxruntime.OnnxTensorLike
 import ai.onnxruntime.OrtEnvironment
 import ai.onnxruntime.OrtSession
 import app.versta.translate.bridge.inference.BeamSearch
 import app.versta.translate.utils.TensorUtils
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.nio.LongBuffer
 
+/**
+ * @param encoderHiddenStates Hidden states already repeated for every beam, closed with the input.
+ */
 class DecoderInput(
     private val ortEnvironment: OrtEnvironment,
-    encoderHiddenStates: Array<EncoderHiddenStates>,
-    encoderAttentionMask: Array<EncoderAttentionMasks>,
+    encoderHiddenStates: EncoderHiddenStates,
+    encoderAttentionMask: EncoderAttentionMasks,
+    beamSize: Int,
 ) {
-    private val _encoderHiddenStatesTensor =
-        OnnxTensor.createTensor(ortEnvironment, encoderHiddenStates)
-    private val _encoderAttentionMaskTensor =
-        OnnxTensor.createTensor(ortEnvironment, encoderAttentionMask)
+    private val _encoderHiddenStatesTensor = encoderHiddenStates
+    private val _encoderAttentionMaskTensor = OnnxTensor.createTensor(
+        ortEnvironment,
+        repeatRows(encoderAttentionMask, beamSize),
+        longArrayOf(beamSize.toLong(), encoderAttentionMask.size.toLong())
+    )
+
+    val encoderHiddenStates: OnnxTensorLike
+        get() = _encoderHiddenStatesTensor
+    val encoderAttentionMask: OnnxTensorLike
+        get() = _encoderAttentionMaskTensor
 
     private var _inputIdsTensor: OnnxTensorLike? = null
     private var _useCacheTensor: OnnxTensorLike? = null
@@ -48,17 +63,43 @@ class DecoderInput(
         TensorUtils.closeTensor(_inputIdsTensor)
         TensorUtils.closeTensor(_useCacheTensor)
 
+        TensorUtils.closeTensorBuffer(_encoderHiddenStatesTensor)
         TensorUtils.closeTensor(_encoderHiddenStatesTensor)
         TensorUtils.closeTensor(_encoderAttentionMaskTensor)
     }
+
+    /**
+     * Fills a direct buffer, which the tensor uses as is instead of copying a nested array.
+     */
+    private fun repeatRows(values: LongArray, count: Int): LongBuffer {
+        val buffer = ByteBuffer.allocateDirect(values.size * count * Long.SIZE_BYTES)
+            .order(ByteOrder.nativeOrder())
+            .asLongBuffer()
+
+        for (i in 0 until count) {
+            buffer.put(values)
+        }
+        buffer.rewind()
+
+        return buffer
+    }
 }
 
+/**
+ * @param cacheType Type of the past key/value inputs of the decoder. When it is fp16 while the
+ * present outputs are fp32, the cache is converted while it is reordered, halving its memory.
+ * @param maxSequenceLength Most steps the decoder runs for. The cache of every layer is reordered
+ * into a buffer allocated for that many steps at the first step, and reused by the later ones.
+ */
 class DecoderOutput(
     private val ortEnvironment: OrtEnvironment,
-    private val beamSearch: BeamSearch
+    private val beamSearch: BeamSearch,
+    private val cacheType: OnnxJavaType = OnnxJavaType.FLOAT,
+    private val maxSequenceLength: Int = BeamSearch.DEFAULT_MAX_SEQUENCE_LENGTH
 ) {
     private val _cacheRegex = "present.\\d".toRegex()
     private val _cache = mutableMapOf<String, OnnxTensorLike>()
+    private val _buffers = mutableMapOf<String, ByteBuffer>()
     val cache: Map<String, OnnxTensorLike>
         get() = _cache
 
@@ -89,17 +130,41 @@ class DecoderOutput(
                 continue
             }
 
-            val buffer = beamSearch.transposeBuffer(tensor)
+            val half = cacheType == OnnxJavaType.FLOAT16
+            val type = if (half) OnnxJavaType.FLOAT16 else tensor.info.type
+            val buffer = buffer(key, shape, type.size)
 
-            TensorUtils.closeTensorBuffer(_cache[key])
+            // The buffer backs the cache of the previous step, which is only read by that step.
             TensorUtils.closeTensor(_cache[key])
 
-            _cache[key] = OnnxTensor.createTensor(ortEnvironment, buffer.asFloatBuffer(), shape)
+            val size = beamSearch.transposeBuffer(tensor, buffer, half)
+            buffer.clear()
+            buffer.limit(size)
+
+            _cache[key] = OnnxTensor.createTensor(ortEnvironment, buffer, shape, type)
         }
     }
 
+    /**
+     * Buffer of the cache of [key]. The sequence axis of the cache grows by one every step, so
+     * the buffer is allocated for [maxSequenceLength] of them and only replaced when it is still
+     * too small.
+     */
+    private fun buffer(key: String, shape: LongArray, elementSize: Int): ByteBuffer {
+        val size = shape.fold(elementSize.toLong(), Long::times)
+        _buffers[key]?.takeIf { it.capacity() >= size }?.let { return it }
+
+        val length = shape.getOrElse(2) { 1L }.coerceAtLeast(1L)
+        val capacity = size / length * maxOf(length, maxSequenceLength.toLong())
+
+        return ByteBuffer.allocateDirect(capacity.toInt())
+            .order(ByteOrder.nativeOrder())
+            .also { _buffers[key] = it }
+    }
+
     fun destroy() {
-        TensorUtils.closeTensorBuffer(_cache)
         TensorUtils.closeTensor(_cache)
+        _cache.clear()
+        _buffers.clear()
     }
 }
\ No newline at end of file
@@ -4,18 +4,29 @@ import ai.onnxruntime.OnnxTensor
 import ai.onnxruntime.OnnxTensorLike
 import ai.onnxruntime.OrtEnvironment
 import ai.onnxruntime.OrtSession
-import app.versta.translate.utils.TensorUtils
+import app.versta.translate.bridge.inference.TensorUtils
+import app.versta.translate.utils.TensorUtils as OrtTensorUtils
+import java.nio.ByteOrder
 
-// Shape: [sequence_length, hidden_size]
-internal typealias EncoderHiddenStates = Array<FloatArray>
+// Shape: [beam_size, sequence_length, hidden_size], backed by a native buffer.
+internal typealias EncoderHiddenStates = OnnxTensor
 
 // Shape: [sequence_length]
 internal typealias EncoderAttentionMasks = LongArray
 
-class EncoderInput(ortEnvironment: OrtEnvironment, inputIds: LongArray, attentionMask: LongArray) {
-    private val _inputIdsTensor = OnnxTensor.createTensor(ortEnvironment, arrayOf(inputIds))
-    private val _attentionMaskTensor =
-        OnnxTensor.createTensor(ortEnvironment, arrayOf(attentionMask))
+/**
+ * @param inputIds Sequences of the batch, all of the same length.
+ */
+class EncoderInput(
+    ortEnvironment: OrtEnvironment,
+    inputIds: Array<LongArray>,
+    attentionMask: Array<LongArray>
+) {
+    constructor(ortEnvironment: OrtEnvironment, inputIds: LongArray, attentionMask: LongArray) :
+            this(ortEnvironment, arrayOf(inputIds), arrayOf(attentionMask))
+
+    private val _inputIdsTensor = OnnxTensor.createTensor(ortEnvironment, inputIds)
+    private val _attentionMaskTensor = OnnxTensor.createTensor(ortEnvironment, attentionMask)
 
     fun get(): Map<String, OnnxTensorLike> {
         return mapOf(
@@ -25,27 +36,89 @@ class EncoderInput(ortEnvironment: OrtEnvironment, inputIds: LongArray, attentio
     }
 
     fun destroy() {
-        TensorUtils.closeTensor(_inputIdsTensor)
-        TensorUtils.closeTensor(_attentionMaskTensor)
+        OrtTensorUtils.closeTensor(_inputIdsTensor)
+        OrtTensorUtils.closeTensor(_attentionMaskTensor)
     }
 }
 
-class EncoderOutput {
+class EncoderOutput(private val ortEnvironment: OrtEnvironment) {
     private var _output: OrtSession.Result? = null
 
-    @Suppress("UNCHECKED_CAST")
-    fun parse(output: OrtSession.Result): EncoderHiddenStates? {
+    /**
+     * Repeats the hidden states of the single encoded sequence for every beam. The rows are copied
+     * in native memory, so the hidden states are never read onto the Java heap.
+     */
+    fun parse(output: OrtSession.Result, beamSize: Int): EncoderHiddenStates? {
         _output = output
 
-        val outputLastHiddenStates = output.get("last_hidden_state") ?: return null
+        val outputLastHiddenStates = output.get("last_hidden_state").orElse(null) ?: return null
+        if (outputLastHiddenStates !is OnnxTensor) {
+            return null
+        }
+
+        // Shape: [1, sequence_length, hidden_size]
+        val shape = outputLastHiddenStates.info.shape
+        val buffer = TensorUtils.repeatBuffer(
+            apiHandle = OrtTensorUtils.getOrtApiHandle(),
+            tensorHandle = OrtTensorUtils.getNativeHandle(outputLastHiddenStates),
+            count = beamSize
+        )
+
+        return OnnxTensor.createTensor(
+            ortEnvironment,
+            buffer.order(ByteOrder.nativeOrder()).asFloatBuffer(),
+            longArrayOf(beamSize.toLong(), shape[1], shape[2])
+        )
+    }
+
+    /**
+     * Splits the hidden states of a batch into those of every sequence, cut to its length in
+     * [lengths] and repeated for every beam, like [parse] does for a single sequence. Returns null
+     * when the output does not hold a sequence of every length.
+     */
+    fun parseRows(output: OrtSession.Result, lengths: IntArray, beamSize: Int): List<EncoderHiddenStates>? {
+        _output = output
+
+        val outputLastHiddenStates = output.get("last_hidden_state").orElse(null) ?: return null
+        if (outputLastHiddenStates !is OnnxTensor) {
+            return null
+        }
 
         // Shape: [batch_size, sequence_length, hidden_size]
-        val lastHiddenStates = outputLastHiddenStates.get().value as Array<EncoderHiddenStates>
+        val shape = outputLastHiddenStates.info.shape
+        val rows = mutableListOf<EncoderHiddenStates>()
+
+        for ((row, length) in lengths.withIndex()) {
+            val buffer = TensorUtils.sliceBuffer(
+                apiHandle = OrtTensorUtils.getOrtApiHandle(),
+                tensorHandle = OrtTensorUtils.getNativeHandle(outputLastHiddenStates),
+                row = row,
+                length = length,
+                count = beamSize
+            )
 
-        return lastHiddenStates.first()
+            if (buffer == null) {
+                rows.forEach {
+                    OrtTensorUtils.closeTensorBuffer(it)
+                    OrtTensorUtils.closeTensor(it)
+                }
+                return null
+            }
+
+            rows.add(
+                OnnxTensor.createTensor(
+                    ortEnvironment,
+                    buffer.order(ByteOrder.nativeOrder()).asFloatBuffer(),
+                    longArrayOf(beamSize.toLong(), length.toLong(), shape[2])
+                )
+            )
+        }
+
+        return rows
     }
 
     fun destroy() {
-        TensorUtils.closeTensor(_output)
+        OrtTensorUtils.closeTensor(_output)
+        _output = null
     }
-}
\ No newline at end of file
+}
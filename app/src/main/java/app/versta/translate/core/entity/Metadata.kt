@@ -118,9 +118,20 @@ data class LanguageModelTokenizerFilesMetadata(
 @Serializable
 data class LanguageModelInferenceFilesMetadata(
     val encoder: String,
-    val decoder: String
+    val decoder: String,
+    /**
+     * Lexical table of "target source probability" lines the shortlist is compiled from.
+     */
+    @SerialName("lexical_table")
+    val lexicalTable: String? = null,
+    /**
+     * Most target tokens a translation may have per source token.
+     */
+    @SerialName("max_length_ratio")
+    val maxLengthRatio: Float? = null
 ) {
     fun isValid(path: Path) = path.resolve(encoder).exists() &&
-            path.resolve(decoder).exists()
+            path.resolve(decoder).exists() &&
+            lexicalTable?.let { path.resolve(it).exists() } ?: true
 }
 
@@ -0,0 +1,64 @@
+package app.versta.translate.core.entity
+
+/**
+ * Sentence of an input text. Sentences are translated and cached on their own, so an edit only
+ * retranslates the sentences it touches.
+ * @param source The sentence, with its whitespace collapsed.
+ * @param separator The whitespace that followed the sentence in the input, used to join the
+ * translations.
+ */
+data class TextSegment(val source: String, val separator: String) {
+    companion object {
+        private val sentenceBoundary = "(?<=[.!?])\\s+|(?<=[。！？])\\s*|\\s*\\n\\s*".toRegex()
+        private val whitespace = "\\s+".toRegex()
+
+        /**
+         * Splits [text] into its sentences and line breaks, dropping empty segments.
+         */
+        fun split(text: String): List<TextSegment> {
+            val segments = mutableListOf<TextSegment>()
+            var start = 0
+
+            fun add(end: Int, separator: String) {
+                val source = text.substring(start, end).trim().replace(whitespace, " ")
+
+                if (source.isNotEmpty()) {
+                    segments.add(TextSegment(source, separator))
+                } else if (segments.isNotEmpty()) {
+                    val last = segments.removeAt(segments.lastIndex)
+                    segments.add(last.copy(separator = last.separator + separator))
+                }
+            }
+
+            for (boundary in sentenceBoundary.findAll(text)) {
+                add(boundary.range.first, boundary.value)
+                start = boundary.range.last + 1
+            }
+
+            add(text.length, "")
+
+            return segments
+        }
+
+        /**
+         * Joins the [translations] of the [segments] with the separators of the input.
+         */
+        fun join(segments: List<TextSegment>, translations: List<String>): String {
+            return buildString {
+                segments.forEachIndexed { i, segment ->
+                    append(translations[i])
+
+                    if (i == segments.lastIndex) {
+                        return@forEachIndexed
+                    }
+
+                    if (segment.separator.contains('\n')) {
+                        append(segment.separator.filter { it == '\n' })
+                    } else {
+                        append(' ')
+                    }
+                }
+            }
+        }
+    }
+}
@@ -1,39 +1,102 @@
 package app.versta.translate.core.entity
 
-class TranslationMemoryCache(private val maxSize: Int) {
-    private val languagePairCaches = mutableMapOf<String, LinkedHashMap<Int, String>>()
+import app.versta.translate.bridge.cache.TranslationMemory
+import timber.log.Timber
+import java.io.File
+import java.text.Normalizer
+
+/**
+ * Caches translations by language pair and source text. When a [file] is given the translations
+ * are kept in a [TranslationMemory], so they survive restarts, otherwise they are only kept in
+ * memory. Keys are compared in full, so different sources never share a translation.
+ *
+ * A closed cache is empty and ignores writes, as translations that were running when it was
+ * replaced may still use it.
+ */
+class TranslationMemoryCache(private val maxSize: Int, file: File? = null) : AutoCloseable {
+    private val memory: TranslationMemory? = file?.let {
+        try {
+            TranslationMemory(it.absolutePath, maxSize, MAX_BYTES)
+        } catch (e: Exception) {
+            Timber.tag(TAG).w(e, "Failed to open translation memory, falling back to memory")
+            null
+        }
+    }
+
+    private val languagePairCaches = mutableMapOf<String, LinkedHashMap<String, String>>()
+
+    private var closed = false
 
     private fun getCacheKeyForLanguagePair(languages: LanguagePair): String {
         return "${languages.source.isoCode}-${languages.target.isoCode}"
     }
 
-    private fun getCacheForLanguagePair(languages: LanguagePair): LinkedHashMap<Int, String> {
+    private fun getCacheForLanguagePair(languages: LanguagePair): LinkedHashMap<String, String> {
         val languagePairKey = getCacheKeyForLanguagePair(languages)
         return languagePairCaches.getOrPut(languagePairKey) {
-            object : LinkedHashMap<Int, String>(maxSize, 0.75f, true) {
-                override fun removeEldestEntry(eldest: MutableMap.MutableEntry<Int, String>?): Boolean {
+            object : LinkedHashMap<String, String>(16, 0.75f, true) {
+                override fun removeEldestEntry(eldest: MutableMap.MutableEntry<String, String>?): Boolean {
                     return size > maxSize
                 }
             }
         }
     }
 
+    /**
+     * Normalizes the source text so that canonically equivalent inputs share an entry.
+     */
+    private fun normalize(key: String): String {
+        return Normalizer.normalize(key.trim(), Normalizer.Form.NFC)
+    }
+
+    @Synchronized
     fun get(key: String, languages: LanguagePair): String? {
+        if (closed) {
+            return null
+        }
+
+        if (memory != null) {
+            return memory.get(getCacheKeyForLanguagePair(languages), normalize(key))
+        }
+
         val cache = getCacheForLanguagePair(languages)
-        return cache[key.hashCode()]
+        return cache[normalize(key)]
     }
 
+    @Synchronized
     fun put(key: String, value: String, languages: LanguagePair) {
+        if (closed) {
+            return
+        }
+
+        if (memory != null) {
+            try {
+                memory.put(getCacheKeyForLanguagePair(languages), normalize(key), value)
+            } catch (e: Exception) {
+                Timber.tag(TAG).w(e, "Failed to write to translation memory")
+            }
+            return
+        }
+
         val cache = getCacheForLanguagePair(languages)
-        cache[key.hashCode()] = value
+        cache[normalize(key)] = value
     }
 
     fun put(keys: List<String>, values: List<String>, languages: LanguagePair) {
-        val cache = getCacheForLanguagePair(languages)
-        keys.zip(values).forEach { (k, v) -> cache[k.hashCode()] = v }
+        keys.zip(values).forEach { (k, v) -> put(k, v, languages) }
     }
 
+    @Synchronized
     fun clear(languages: LanguagePair? = null) {
+        if (closed) {
+            return
+        }
+
+        if (memory != null) {
+            memory.clear(languages?.let { getCacheKeyForLanguagePair(it) })
+            return
+        }
+
         if (languages != null) {
             val languagePairKey = getCacheKeyForLanguagePair(languages)
             languagePairCaches.remove(languagePairKey)
@@ -43,7 +106,16 @@ class TranslationMemoryCache(private val maxSize: Int) {
         languagePairCaches.clear()
     }
 
+    @Synchronized
     fun size(languages: LanguagePair? = null): Int {
+        if (closed) {
+            return 0
+        }
+
+        if (memory != null) {
+            return memory.size(languages?.let { getCacheKeyForLanguagePair(it) })
+        }
+
         if (languages != null) {
             val languagePairKey = getCacheKeyForLanguagePair(languages)
             return languagePairCaches[languagePairKey]?.size ?: 0
@@ -52,12 +124,24 @@ class TranslationMemoryCache(private val maxSize: Int) {
         return languagePairCaches.values.sumOf { it.size }
     }
 
-    fun keys(languages: LanguagePair? = null): Set<Int> {
-        if (languages != null) {
-            val languagePairKey = getCacheKeyForLanguagePair(languages)
-            return languagePairCaches[languagePairKey]?.keys ?: emptySet()
+    @Synchronized
+    override fun close() {
+        if (closed) {
+            return
         }
 
-        return languagePairCaches.values.flatMap { it.keys }.toSet()
+        closed = true
+        memory?.close()
+        languagePairCaches.clear()
+    }
+
+    companion object {
+        private val TAG: String = TranslationMemoryCache::class.java.simpleName
+
+        /**
+         * Bound on the size of the records in the translation memory, on top of the number of
+         * entries, as the cache size can be unlimited.
+         */
+        const val MAX_BYTES = 32L * 1024 * 1024
     }
 }
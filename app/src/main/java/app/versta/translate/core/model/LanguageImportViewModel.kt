@@ -6,10 +6,12 @@ import androidx.lifecycle.viewModelScope
 import app.versta.translate.adapter.inbound.CompressedFileExtractor
 import app.versta.translate.adapter.inbound.ExtractionProgressListener
 import app.versta.translate.adapter.outbound.LanguageRepository
+import app.versta.translate.adapter.outbound.ModelCompiler
 import app.versta.translate.core.entity.BundleMetadata
 import app.versta.translate.core.entity.LanguageAnalysisProgress
 import app.versta.translate.core.entity.LanguageImportProgress
 import app.versta.translate.core.entity.LanguageMetadata
+import app.versta.translate.core.entity.LanguageModelFiles
 import app.versta.translate.core.entity.ModelMetadata
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.MutableStateFlow
@@ -24,6 +26,7 @@ import java.io.File
 class LanguageImportViewModel(
     private val modelExtractor: CompressedFileExtractor,
     private val languageRepository: LanguageRepository,
+    private val modelCompiler: ModelCompiler? = null,
 ) : ViewModel() {
     private val _serializer = Json { ignoreUnknownKeys = true }
 
@@ -69,6 +72,7 @@ class LanguageImportViewModel(
                 )
 
                 val metadata = readMetadata(output)
+                compile(metadata)
 
                 languageRepository.upsertLanguageModels(metadata)
                 _importProgressState.value = LanguageImportProgress.Completed(metadata)
@@ -102,6 +106,28 @@ class LanguageImportViewModel(
         }
     }
 
+    /**
+     * Compiles the artifacts of every language model in the bundle. Failing to compile does not
+     * fail the import, as the models still load from their source files.
+     */
+    private fun compile(metadata: ModelMetadata) {
+        val compiler = modelCompiler ?: return
+
+        metadata.languageMetadata.forEach {
+            val root = it.root ?: return@forEach
+
+            _importProgressState.value = LanguageImportProgress.Compiling(
+                current = "${it.sourceLanguage}-${it.targetLanguage}"
+            )
+
+            try {
+                compiler.compile(LanguageModelFiles.load(root))
+            } catch (e: Exception) {
+                Timber.tag(TAG).w(e, "Failed to compile language model $root")
+            }
+        }
+    }
+
     /**
      * Reads the metadata file from the extracted model.
      */
@@ -4,6 +4,7 @@ import androidx.lifecycle.ViewModel
 import androidx.lifecycle.viewModelScope
 import app.versta.translate.adapter.outbound.LanguagePreferenceRepository
 import app.versta.translate.adapter.outbound.LanguageRepository
+import app.versta.translate.adapter.outbound.PivotPipeline
 import app.versta.translate.core.entity.Language
 import kotlinx.coroutines.ExperimentalCoroutinesApi
 import kotlinx.coroutines.Job
@@ -40,11 +41,14 @@ class LanguageViewModel(
     val availableLanguages = languageRepository.getLanguages().distinctUntilChanged()
     val availableLanguagePairs = languageRepository.getLanguagePairs().distinctUntilChanged()
 
+    // Targets without a direct model are offered when the pivot pipeline can reach them.
+    private val pivotLanguage = Language.fromIsoCode(PivotPipeline.DEFAULT_PIVOT_LANGUAGE)
+
     val sourceLanguages = languageRepository.getSourceLanguages().distinctUntilChanged()
     val targetLanguages = sourceLanguage
         .flatMapLatest {
             if (it != null) {
-                languageRepository.getTargetLanguagesBySource(it)
+                languageRepository.getTargetLanguagesBySource(it, pivotLanguage)
             } else {
                 flowOf(emptyList())
             }
@@ -74,7 +78,7 @@ class LanguageViewModel(
 
             // If the current target language is not available for the new source language, clear the
             // current target language.
-            languageRepository.getTargetLanguagesBySource(language).collectLatest { languages ->
+            languageRepository.getTargetLanguagesBySource(language, pivotLanguage).collectLatest { languages ->
                 if (languages.none { it == targetLanguage.first() }) {
                     clearTargetLanguage()
                 }
@@ -5,12 +5,17 @@ import androidx.lifecycle.ViewModel
 import androidx.lifecycle.viewModelScope
 import app.versta.translate.adapter.outbound.LanguagePreferenceRepository
 import app.versta.translate.adapter.outbound.LanguageRepository
+import app.versta.translate.adapter.outbound.PivotPipeline
 import app.versta.translate.adapter.outbound.TranslationInference
 import app.versta.translate.adapter.outbound.TranslationPreferenceRepository
 import app.versta.translate.adapter.outbound.TranslationTokenizer
+import app.versta.translate.bridge.inference.JobPriority
+import app.versta.translate.core.entity.Language
 import app.versta.translate.core.entity.LanguageModelFiles
 import app.versta.translate.core.entity.LanguagePair
+import app.versta.translate.core.entity.TextSegment
 import app.versta.translate.core.entity.TranslationMemoryCache
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.ExperimentalCoroutinesApi
 import kotlinx.coroutines.FlowPreview
@@ -19,21 +24,42 @@ import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
-import kotlinx.coroutines.flow.catch
+import kotlinx.coroutines.flow.combine
 import kotlinx.coroutines.flow.conflate
 import kotlinx.coroutines.flow.debounce
 import kotlinx.coroutines.flow.distinctUntilChanged
 import kotlinx.coroutines.flow.filterNotNull
 import kotlinx.coroutines.flow.first
-import kotlinx.coroutines.flow.flow
 import kotlinx.coroutines.flow.flowOf
+import kotlinx.coroutines.flow.last
 import kotlinx.coroutines.flow.map
 import kotlinx.coroutines.flow.mapLatest
 import kotlinx.coroutines.flow.sample
+import kotlinx.coroutines.flow.transformWhile
 import kotlinx.coroutines.launch
+import kotlinx.coroutines.runInterruptible
 import kotlinx.coroutines.sync.Mutex
 import kotlinx.coroutines.sync.withLock
+import kotlinx.coroutines.withContext
 import timber.log.Timber
+import java.io.File
+
+/**
+ * Translation of a segment so far, which is final once [completed].
+ */
+data class SegmentProgress(val text: String, val completed: Boolean)
+
+private class SegmentTranslation(val progress: MutableStateFlow<SegmentProgress>, val job: Job?)
+
+/**
+ * Models that translate the selected language pair, either a single model or two models chained
+ * through a pivot language.
+ */
+private sealed class ModelSelection {
+    data class Direct(val files: LanguageModelFiles) : ModelSelection()
+
+    data class Pivot(val first: LanguageModelFiles, val second: LanguageModelFiles) : ModelSelection()
+}
 
 // TODO: Move to generic entity class
 sealed class LoadingProgress {
@@ -51,6 +77,8 @@ class TranslationViewModel(
     private val languageRepository: LanguageRepository,
     private val languagePreferenceRepository: LanguagePreferenceRepository,
     private val translationPreferenceRepository: TranslationPreferenceRepository,
+    private val translationMemoryFile: File? = null,
+    private val pivot: PivotPipeline? = null,
 ) : ViewModel() {
     val cacheSize = translationPreferenceRepository.getCacheSize().distinctUntilChanged()
     val cacheEnabled = translationPreferenceRepository.getCacheEnabled().distinctUntilChanged()
@@ -65,11 +93,27 @@ class TranslationViewModel(
     private lateinit var _cache: TranslationMemoryCache
     private val _queue = Mutex()
 
+    /**
+     * Segments of the last input by language pair and source, kept until they are no longer part
+     * of the input so that unchanged sentences are not translated again.
+     */
+    private val _segments = mutableMapOf<String, SegmentTranslation>()
+
     val languages = languagePreferenceRepository.getLanguagePair().distinctUntilChanged()
     private val _languageModels = languages.filterNotNull().map { data ->
-        languageRepository.getLanguageModel(data)
+        languageRepository.getLanguageModel(data)?.let { ModelSelection.Direct(it) }
+            ?: pivot?.let {
+                languageRepository.getPivotLanguageModels(data, pivotLanguage)
+                    ?.let { (first, second) -> ModelSelection.Pivot(first, second) }
+            }
     }
 
+    /**
+     * Whether the loaded language pair is translated through [pivot] instead of [model].
+     */
+    @Volatile
+    private var _pivotLoaded = false
+
     private val _loadingProgress = MutableStateFlow<LoadingProgress>(LoadingProgress.Idle)
     val loadingProgress: StateFlow<LoadingProgress> = _loadingProgress.asStateFlow()
 
@@ -160,107 +204,292 @@ class TranslationViewModel(
     }
 
     /**
-     * Translates the input text to the target language, returning the result as a flow. If the
-     * translation is already in the cache, it will be returned immediately.
+     * Translates the input text to the target language, returning the result as a flow. The input
+     * is split into sentences, which are translated on their own. Sentences that are in the cache
+     * or were part of the previous input are returned immediately, the others are translated in
+     * order while sentences that are no longer part of the input are cancelled.
      */
     @OptIn(FlowPreview::class)
-    suspend fun translateAsFlow(input: String, languages: LanguagePair): Flow<String> {
-        val sanitized = sanitize(input)
+    fun translateAsFlow(input: String, languages: LanguagePair): Flow<String> {
+        val segments = TextSegment.split(sanitize(input))
+        if (segments.isEmpty()) {
+            return flowOf("")
+        }
 
-        var cache = _cache.get(sanitized, languages)
-        if (cache != null) {
-            return flowOf(cache)
+        val progress = scheduleSegments(segments, languages)
+
+        return combine(progress) { it.toList() }
+            .transformWhile { states ->
+                emit(TextSegment.join(segments, states.map { it.text }))
+                !states.all { it.completed }
+            }
+            .debounce(1000L / 120)
+            .conflate()
+    }
+
+    /**
+     * Translates the input text to the target language. Sentences that are already in the cache
+     * will be returned immediately.
+     */
+    suspend fun translate(input: String, languages: LanguagePair): String {
+        try {
+            return translateAsFlow(input, languages).last()
+        } catch (e: Exception) {
+            setTranslationError(e)
+            Timber.tag(TAG).e(e)
+
+            return ""
         }
+    }
 
-        _queue.withLock {
-            // Check to see if the translation is already in the cache, if so return it.
-            cache = _cache.get(sanitized, languages)
+    private fun getSegmentKey(source: String, languages: LanguagePair): String {
+        return "${languages.source.isoCode}-${languages.target.isoCode}:$source"
+    }
+
+    /**
+     * Returns the progress of every segment, starting the translation of segments that are neither
+     * cached nor already scheduled, and cancels the segments of the previous input that are no
+     * longer part of it.
+     */
+    private fun scheduleSegments(
+        segments: List<TextSegment>,
+        languages: LanguagePair
+    ): List<StateFlow<SegmentProgress>> {
+        synchronized(_segments) {
+            val keys = segments.map { getSegmentKey(it.source, languages) }.toSet()
+
+            // Segments that are translated as a group share a job, which keeps running as long as
+            // one of them is still part of the input.
+            val kept = _segments.filterKeys { it in keys }.values.mapNotNull { it.job }.toSet()
+
+            _segments.entries.removeAll { (key, segment) ->
+                if (key !in keys) {
+                    segment.job?.takeIf { it !in kept }?.cancel()
+                    return@removeAll true
+                }
 
-            if (cache != null) {
-                return flowOf(cache!!)
+                false
             }
 
-            val (inputIds, attentionMask) = tokenizer.encode(sanitized)
-            val minP = minProbability.first() * 100 / tokenizer.vocabSize
+            val pending = mutableListOf<String>()
+            for (source in segments.map { it.source }.distinct()) {
+                val key = getSegmentKey(source, languages)
+                if (key in _segments) {
+                    continue
+                }
 
-            _translationInProgress.value = true
-            return model.runAsFlow(
-                inputIds = inputIds,
-                attentionMask = attentionMask,
-                eosId = tokenizer.eosId,
-                padId = tokenizer.padId,
-                minP = minP,
-                repetitionPenalty = repetitionPenalty.first(),
-                beamSize = beamSize.first(),
-                maxSequenceLength = maxSequenceLength.first(),
-            )
-                .debounce(1000L / 120)
-                .conflate()
-                .catch { e ->
-                    setTranslationError(e)
-                    Timber.tag(TAG).e(e)
+                val cache = _cache.get(source, languages)
+                if (cache != null) {
+                    _segments[key] =
+                        SegmentTranslation(MutableStateFlow(SegmentProgress(cache, true)), null)
+                } else {
+                    pending.add(source)
                 }
-                .map { tokenIds ->
-                    val outputText = tokenizer.decode(tokenIds)
+            }
+
+            // A single new segment streams its progress, while several new segments, like a pasted
+            // document, are batched.
+            when {
+                _pivotLoaded -> startPivotSegments(pending, languages)
+                pending.size > 1 -> startBatchSegments(pending, languages)
+                else -> pending.forEach { startSegment(it, languages) }
+            }
+
+            val progress = segments.map {
+                _segments.getValue(getSegmentKey(it.source, languages)).progress
+            }
+
+            updateTranslationInProgress()
+
+            return progress
+        }
+    }
 
-                    if (tokenIds.last() == tokenizer.eosId) {
-                        _translationInProgress.value = false
+    private fun startSegment(source: String, languages: LanguagePair) {
+        val progress = MutableStateFlow(SegmentProgress("", false))
 
-                        if (cacheEnabled.first()) {
-                            _cache.put(sanitized, outputText, languages)
+        // Launched on the main thread, so segments queue up for the model in input order.
+        val job = viewModelScope.launch {
+            try {
+                _queue.withLock {
+                    withContext(Dispatchers.Default) {
+                        translateSegment(source, languages) { text ->
+                            progress.value = SegmentProgress(text, false)
                         }
                     }
-
-                    outputText
                 }
+            } catch (e: CancellationException) {
+                throw e
+            } catch (e: Exception) {
+                setTranslationError(e)
+                Timber.tag(TAG).e(e)
+
+                // Drop the segment, so that it is translated again on the next input.
+                synchronized(_segments) {
+                    _segments.remove(getSegmentKey(source, languages))
+                }
+            } finally {
+                progress.value = progress.value.copy(completed = true)
+                updateTranslationInProgress()
+            }
         }
+
+        _segments[getSegmentKey(source, languages)] = SegmentTranslation(progress, job)
     }
 
     /**
-     * Translates the input text to the target language. If the translation is already in the cache,
-     * it will be returned immediately.
+     * Translates the [sources] through the pivot pipeline as one job, so that the second model
+     * works on a sentence while the first model translates the next.
      */
-    suspend fun translate(input: String, languages: LanguagePair): String {
-        try {
-            val sanitized = sanitize(input)
+    private fun startPivotSegments(sources: List<String>, languages: LanguagePair) {
+        val pipeline = pivot ?: return
+
+        startSegmentGroup(sources, languages) { report ->
+            val options = PivotPipeline.Options(
+                minP = minProbability.first() * 100 / pipeline.vocabSize,
+                repetitionPenalty = repetitionPenalty.first(),
+                beamSize = beamSize.first(),
+                maxSequenceLength = maxSequenceLength.first()
+            )
 
-            var cache = _cache.get(sanitized, languages)
-            if (cache != null) {
-                return cache
+            pipeline.translate(sources, options).collect { sentence ->
+                report(sentence.index, sentence.text, true)
             }
+        }
+    }
 
-            _queue.withLock {
-                // Check to see if the translation is already in the cache, if so return it.
-                cache = _cache.get(sanitized, languages)
+    /**
+     * Translates the [sources] in batches of [BATCH_SEGMENTS] with [TranslationInference.runBatch],
+     * which encodes sentences of similar lengths together. Every batch is reported once it is
+     * finished. The batch runs interruptibly, so cancelling the job stops it at its next step.
+     */
+    private fun startBatchSegments(sources: List<String>, languages: LanguagePair) {
+        startSegmentGroup(sources, languages) { report ->
+            val minP = minProbability.first() * 100 / tokenizer.vocabSize
+            val repetitionPenalty = repetitionPenalty.first()
+            val beamSize = beamSize.first()
+            val maxSequenceLength = maxSequenceLength.first()
+
+            for (offset in sources.indices step BATCH_SEGMENTS) {
+                val batch = sources.subList(offset, minOf(offset + BATCH_SEGMENTS, sources.size))
+                val results = runInterruptible(Dispatchers.Default) {
+                    model.runBatch(
+                        inputIds = batch.map { tokenizer.encode(it).first },
+                        eosId = tokenizer.eosId,
+                        padId = tokenizer.padId,
+                        minP = minP,
+                        repetitionPenalty = repetitionPenalty,
+                        beamSize = beamSize,
+                        maxSequenceLength = maxSequenceLength,
+                        priority = JobPriority.Interactive
+                    )
+                }
 
-                if (cache != null) {
-                    return cache!!
+                results.forEachIndexed { index, tokenIds ->
+                    val completed = tokenIds.lastOrNull() == tokenizer.eosId
+                    report(offset + index, tokenizer.decode(tokenIds), completed)
                 }
+            }
+        }
+    }
+
+    /**
+     * Translates the [sources] as one job, in which [translate] reports every finished segment by
+     * its index, along with whether the model finished the sentence and it may be cached. The
+     * segments [translate] did not report are translated again on the next input.
+     */
+    private fun startSegmentGroup(
+        sources: List<String>,
+        languages: LanguagePair,
+        translate: suspend (report: suspend (Int, String, Boolean) -> Unit) -> Unit
+    ) {
+        if (sources.isEmpty()) {
+            return
+        }
 
+        val progress = sources.map { MutableStateFlow(SegmentProgress("", false)) }
+        val finished = BooleanArray(sources.size)
 
-                val (inputIds, attentionMask) = tokenizer.encode(sanitized)
-                val minP = minProbability.first() * 100 / tokenizer.vocabSize
+        val job = viewModelScope.launch {
+            try {
+                _queue.withLock {
+                    translate { index, text, cacheable ->
+                        progress[index].value = SegmentProgress(text, true)
+                        finished[index] = true
 
-                _translationInProgress.value = true
-                val tokenIds = model.run(
-                    inputIds = inputIds,
-                    attentionMask = attentionMask,
-                    eosId = tokenizer.eosId,
-                    padId = tokenizer.padId,
-                    minP = minP,
-                    repetitionPenalty = repetitionPenalty.first(),
-                    beamSize = beamSize.first(),
-                    maxSequenceLength = maxSequenceLength.first(),
-                )
-                _translationInProgress.value = false
+                        if (cacheable && cacheEnabled.first()) {
+                            _cache.put(sources[index], text, languages)
+                        }
+                    }
+                }
+            } catch (e: CancellationException) {
+                throw e
+            } catch (e: Exception) {
+                setTranslationError(e)
+                Timber.tag(TAG).e(e)
+            } finally {
+                // Drop the unfinished segments, so that they are translated again on the next input.
+                synchronized(_segments) {
+                    sources.indices.filter { !finished[it] }.forEach {
+                        val key = getSegmentKey(sources[it], languages)
+                        if (_segments[key]?.progress === progress[it]) {
+                            _segments.remove(key)
+                        }
+                    }
+                }
 
-                return tokenizer.decode(tokenIds)
+                progress.forEach { it.value = it.value.copy(completed = true) }
+                updateTranslationInProgress()
             }
-        } catch (e: Exception) {
-            setTranslationError(e)
-            Timber.tag(TAG).e(e)
+        }
 
-            return ""
+        sources.forEachIndexed { index, source ->
+            _segments[getSegmentKey(source, languages)] = SegmentTranslation(progress[index], job)
+        }
+    }
+
+    /**
+     * Translates a single segment, reporting the best translation after every decoding step. The
+     * translation is cached once the model finished the sentence.
+     */
+    private suspend fun translateSegment(
+        source: String,
+        languages: LanguagePair,
+        onProgress: (String) -> Unit
+    ) {
+        // Check to see if the translation was cached while waiting, if so return it.
+        val cache = _cache.get(source, languages)
+        if (cache != null) {
+            onProgress(cache)
+            return
+        }
+
+        val (inputIds, attentionMask) = tokenizer.encode(source)
+        val minP = minProbability.first() * 100 / tokenizer.vocabSize
+
+        model.runAsFlow(
+            inputIds = inputIds,
+            attentionMask = attentionMask,
+            eosId = tokenizer.eosId,
+            padId = tokenizer.padId,
+            minP = minP,
+            repetitionPenalty = repetitionPenalty.first(),
+            beamSize = beamSize.first(),
+            maxSequenceLength = maxSequenceLength.first(),
+        ).collect { tokenIds ->
+            val outputText = tokenizer.decode(tokenIds)
+            onProgress(outputText)
+
+            if (tokenIds.last() == tokenizer.eosId && cacheEnabled.first()) {
+                _cache.put(source, outputText, languages)
+            }
+        }
+    }
+
+    private fun updateTranslationInProgress() {
+        synchronized(_segments) {
+            _translationInProgress.value =
+                _segments.values.any { !it.progress.value.completed }
         }
     }
 
@@ -269,6 +498,13 @@ class TranslationViewModel(
      */
     fun cancelTranslation() {
         model.cancel()
+        pivot?.cancel()
+
+        synchronized(_segments) {
+            _segments.values.forEach { it.job?.cancel() }
+            _segments.entries.removeAll { it.value.job != null }
+        }
+
         _translationInProgress.value = false
     }
 
@@ -293,6 +529,10 @@ class TranslationViewModel(
                 _loadingProgress.value = LoadingProgress.InProgress
 
                 try {
+                    // The pivot models are no longer used, so their memory is released.
+                    _pivotLoaded = false
+                    pivot?.unload()
+
                     tokenizer.load(files.tokenizer, languages)
                     model.load(files.inference, threadCount.first())
 
@@ -305,22 +545,66 @@ class TranslationViewModel(
         }
     }
 
+    /**
+     * Loads the models that translate from the source into the pivot language and from the pivot
+     * into the target language, for a pair that no model covers directly.
+     */
+    private fun loadPivot(
+        first: LanguageModelFiles,
+        second: LanguageModelFiles,
+        languages: LanguagePair
+    ) {
+        val pipeline = pivot ?: return
+        cancelTranslation()
+
+        viewModelScope.launch(Dispatchers.IO) {
+            _loadMutex.withLock {
+                _loadingProgress.value = LoadingProgress.InProgress
+
+                try {
+                    pipeline.load(
+                        firstFiles = first,
+                        secondFiles = second,
+                        source = languages.source,
+                        target = languages.target,
+                        threads = threadCount.first(),
+                        pivot = pivotLanguage
+                    )
+                    _pivotLoaded = true
+
+                    _loadingProgress.value = LoadingProgress.Completed
+                } catch (e: Exception) {
+                    Timber.tag(TAG).e(e)
+                    _loadingProgress.value = LoadingProgress.Error(e)
+                }
+            }
+        }
+    }
+
     /**
      * Reloads the model and tokenizer.
      */
     fun reload() {
         viewModelScope.launch {
             cacheSize.conflate().collect { size ->
-                _cache = TranslationMemoryCache(size)
+                // The previous cache is closed first, as both would append to the same file.
+                // Translations that still hold it find a closed cache, which ignores them.
+                if (::_cache.isInitialized) {
+                    _cache.close()
+                }
+
+                _cache = TranslationMemoryCache(size, translationMemoryFile)
             }
         }
 
         viewModelScope.launch {
             _languageModels.conflate().collect {
-                val pair = languages.first()
+                val pair = languages.first() ?: return@collect
 
-                if (it != null && pair != null) {
-                    load(it, pair)
+                when (it) {
+                    is ModelSelection.Direct -> load(it.files, pair)
+                    is ModelSelection.Pivot -> loadPivot(it.first, it.second, pair)
+                    null -> {}
                 }
             }
         }
@@ -330,7 +614,23 @@ class TranslationViewModel(
         reload()
     }
 
+    override fun onCleared() {
+        super.onCleared()
+
+        if (::_cache.isInitialized) {
+            _cache.close()
+        }
+    }
+
     companion object {
         private val TAG: String = TranslationViewModel::class.java.simpleName
+
+        private val pivotLanguage = Language.fromIsoCode(PivotPipeline.DEFAULT_PIVOT_LANGUAGE)
+
+        /**
+         * New segments that are translated in one call of [TranslationInference.runBatch], which
+         * matches the largest batch of the batch planner.
+         */
+        private const val BATCH_SEGMENTS = 8
     }
 }
\ No newline at end of file
@@ -604,7 +604,8 @@ fun ProgressPage(
     val screenHeight = LocalContext.current.resources.displayMetrics.heightPixels
 
     when (importProgress) {
-        is LanguageImportProgress.Idle, LanguageImportProgress.Started, is LanguageImportProgress.InProgress -> {
+        is LanguageImportProgress.Idle, LanguageImportProgress.Started, is LanguageImportProgress.InProgress,
+        is LanguageImportProgress.Compiling -> {
             Box {
                 Row(
                     modifier = Modifier
@@ -642,7 +643,7 @@ fun ProgressPage(
                     ) {
                         item {
                             LinearProgressIndicator(
-                                progress = { progress.extracted / progress.total.toFloat() },
+                                progress = { progress.extracted / progress.total.coerceAtLeast(1).toFloat() },
                                 modifier = Modifier
                                     .fillMaxWidth()
                                     .height(MaterialTheme.spacing.small),
@@ -662,7 +663,7 @@ fun ProgressPage(
                                     modifier = Modifier.weight(1f)
                                 )
                                 Text(
-                                    text = "${progress.extracted}/${progress.total}",
+                                    text = "${progress.extracted}/${progress.total} MB",
                                     color = MaterialTheme.colorScheme.onSurface,
                                     style = MaterialTheme.typography.bodyMediumEmphasized,
                                     modifier = Modifier.padding(start = MaterialTheme.spacing.medium)
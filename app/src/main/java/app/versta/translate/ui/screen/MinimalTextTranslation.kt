@@ -24,7 +24,10 @@ import androidx.compose.material3.Text
 import androidx.compose.runtime.Composable
 import androidx.compose.runtime.LaunchedEffect
 import androidx.compose.runtime.getValue
+import androidx.compose.runtime.mutableStateOf
+import androidx.compose.runtime.remember
 import androidx.compose.runtime.rememberCoroutineScope
+import androidx.compose.runtime.setValue
 import androidx.compose.ui.Modifier
 import androidx.compose.ui.platform.LocalContext
 import androidx.compose.ui.platform.LocalView
@@ -44,6 +47,7 @@ import app.versta.translate.core.model.TranslationViewModel
 import app.versta.translate.ui.component.MinimalLanguageSelector
 import app.versta.translate.ui.theme.FilledIconButtonDefaults
 import app.versta.translate.ui.theme.spacing
+import kotlinx.coroutines.Job
 import kotlinx.coroutines.launch
 
 @Composable
@@ -77,13 +81,17 @@ fun MinimalTextTranslation(
     val languages by translationViewModel.languages.collectAsStateWithLifecycle(null)
 
     val translationScope = rememberCoroutineScope()
+    var translationJob by remember { mutableStateOf<Job?>(null) }
 
     fun translate(input: String) {
         if (input.isEmpty()) {
             return
         }
 
-        translationScope.launch {
+        // Only the translation of the latest input is collected, the view model keeps translating
+        // the sentences it shares with the previous input.
+        translationJob?.cancel()
+        translationJob = translationScope.launch {
             if (languages == null) return@launch
 
             translationViewModel.translateAsFlow(input, languages!!)
@@ -41,6 +41,7 @@ import androidx.compose.runtime.Composable
 import androidx.compose.runtime.LaunchedEffect
 import androidx.compose.runtime.getValue
 import androidx.compose.runtime.mutableIntStateOf
+import androidx.compose.runtime.mutableStateOf
 import androidx.compose.runtime.remember
 import androidx.compose.runtime.rememberCoroutineScope
 import androidx.compose.runtime.setValue
@@ -76,6 +77,7 @@ import app.versta.translate.ui.component.TextField
 import app.versta.translate.ui.component.TextFieldDefaults
 import app.versta.translate.ui.theme.FilledIconButtonDefaults
 import app.versta.translate.ui.theme.spacing
+import kotlinx.coroutines.Job
 import kotlinx.coroutines.launch
 
 @OptIn(ExperimentalMaterial3Api::class)
@@ -132,6 +134,7 @@ fun TextTranslation(
     val translationBottomPadding = with(LocalDensity.current) { bottomBarHeight.toDp() }
 
     val translationScope = rememberCoroutineScope()
+    var translationJob by remember { mutableStateOf<Job?>(null) }
 
     fun translate(input: String) {
         if (input.isEmpty()) {
@@ -143,7 +146,8 @@ fun TextTranslation(
             scaffoldState.bottomSheetState.expand()
         }
 
-        translationScope.launch {
+        translationJob?.cancel()
+        translationJob = translationScope.launch {
             if (languages == null) return@launch
 
             translationViewModel.translateAsFlow(input, languages!!)
@@ -26,6 +26,18 @@ class TensorUtils {
             return field.getLong(tensor)
         }
 
+        fun getNativeHandle(environment: OrtEnvironment): Long {
+            val field = OrtEnvironment::class.java.getDeclaredField("nativeHandle")
+            field.isAccessible = true
+            return field.getLong(environment)
+        }
+
+        fun getNativeHandle(session: OrtSession): Long {
+            val field = OrtSession::class.java.getDeclaredField("sessionHandle")
+            field.isAccessible = true
+            return field.getLong(session)
+        }
+
         fun createIntTensor(
             env: OrtEnvironment,
             data: IntArray